@@ -0,0 +1,123 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "MemoryShadow.h"
+#include "logging.h"
+#include "GlobalState.h"
+#include "../shared/MemoryShadow.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <cstring>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace libtas {
+
+static MemoryShadowMapping* shadow = nullptr;
+static int shadow_fd = -1;
+static pid_t shadow_pid = 0;
+
+void MemoryShadow::init()
+{
+#ifdef __linux__
+    if (shadow)
+        return;
+
+    int fd = syscall(SYS_memfd_create, "memoryshadow", 0);
+    if (fd < 0) {
+        debuglogstdio(LCF_ERROR, "Could not create the memory shadow");
+        return;
+    }
+
+    if (ftruncate(fd, sizeof(MemoryShadowMapping)) != 0) {
+        debuglogstdio(LCF_ERROR, "Could not resize the memory shadow");
+        close(fd);
+        return;
+    }
+
+    void* addr = mmap(nullptr, sizeof(MemoryShadowMapping), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        debuglogstdio(LCF_ERROR, "Could not map the memory shadow");
+        close(fd);
+        return;
+    }
+
+    shadow = static_cast<MemoryShadowMapping*>(addr);
+    shadow_fd = fd;
+    NATIVECALL(shadow_pid = getpid());
+#endif
+}
+
+int MemoryShadow::fd()
+{
+    return shadow_fd;
+}
+
+bool MemoryShadow::isArea(const Area *area)
+{
+    return shadow && (area->addr == static_cast<void*>(shadow)) && (area->size == sizeof(MemoryShadowMapping));
+}
+
+void MemoryShadow::sync()
+{
+#ifdef __linux__
+    if (!shadow)
+        return;
+
+    uint64_t count = shadow->page_count;
+    if (count > MemoryShadowMapping::PAGES_MAX)
+        count = MemoryShadowMapping::PAGES_MAX;
+
+    memset(shadow->page_valid, 0, count);
+
+    /* Pages may have been unmapped by the game, so they are copied using a
+     * single read of our own memory instead of memcpy, which skips the pages
+     * that cannot be read */
+    struct iovec local[MemoryShadowMapping::PAGES_MAX], remote[MemoryShadowMapping::PAGES_MAX];
+    for (uint64_t i = 0; i < count; i++) {
+        local[i].iov_base = shadow->pages[i];
+        local[i].iov_len = 4096;
+        remote[i].iov_base = reinterpret_cast<void*>(static_cast<uintptr_t>(shadow->page_addr[i]));
+        remote[i].iov_len = 4096;
+    }
+
+    uint64_t p = 0;
+    while (p < count) {
+        ssize_t ret = process_vm_readv(shadow_pid, &local[p], count - p, &remote[p], count - p, 0);
+        if (ret < 0) {
+            /* The first page cannot be read */
+            p++;
+            continue;
+        }
+
+        /* The read stops at the first page that cannot be read */
+        uint64_t pages = ret / 4096;
+        for (uint64_t i = 0; i < pages; i++)
+            shadow->page_valid[p+i] = 1;
+        p += pages + 1;
+    }
+
+    shadow->generation++;
+#endif
+}
+
+}
@@ -0,0 +1,43 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MEMORYSHADOW_H
+#define LIBTAS_MEMORYSHADOW_H
+
+#include "checkpoint/MemArea.h"
+
+namespace libtas {
+namespace MemoryShadow {
+
+    /* Create the shadow memfd and map it. The mapping is skipped by
+     * savestates, so it must be created before any savestate is made. */
+    void init();
+
+    /* File descriptor of the shadow, or -1 */
+    int fd();
+
+    /* Is this area the shadow mapping? */
+    bool isArea(const Area *area);
+
+    /* Copy the pages requested by the program into the shadow */
+    void sync();
+}
+}
+
+#endif
@@ -79,27 +79,4 @@ ssize_t Utils::readAll(int fd, void *buf, size_t count)
     return num_read;
 }
 
-/* This function detects if the given page is zero pages or not. There is
- * scope of improving this function using some optimizations.
- *
- * TODO: One can use /proc/self/pagemap to detect if the page is backed by a
- * shared zero page.
- */
-bool Utils::isZeroPage(void *addr)
-{
-    static const size_t page_size = 4096;
-    long long *buf = (long long *)addr;
-    size_t end = page_size / sizeof(*buf);
-    long long res = 0;
-
-    for (size_t i = 0; i + 7 < end; i += 8) {
-        res = buf[i + 0] | buf[i + 1] | buf[i + 2] | buf[i + 3] |
-        buf[i + 4] | buf[i + 5] | buf[i + 6] | buf[i + 7];
-        if (res != 0) {
-            break;
-        }
-    }
-    return res == 0;
-}
-
 }
@@ -30,7 +30,6 @@ namespace Utils
 {
     ssize_t writeAll(int fd, const void *buf, size_t count);
     ssize_t readAll(int fd, void *buf, size_t count);
-    bool isZeroPage(void *addr);
 }
 }
 
@@ -46,6 +46,14 @@
 #include "../renderhud/RenderHUD.h"
 #include "ReservedMemory.h"
 #include "SaveState.h"
+#include "WorkerPool.h"
+#include "PageScan.h"
+#include "PageStore.h"
+#include "StateWriter.h"
+#include "RestorePlan.h"
+#include "StateStats.h"
+#include "LazyRestore.h"
+#include "../MemoryShadow.h"
 #include "../../external/lz4.h"
 #include "../../shared/sockethelpers.h"
 
@@ -56,8 +64,12 @@
 #include "../xlib/xdisplay.h" // x11::gameDisplays
 #endif
 
+#include <sys/wait.h>
+
 #ifdef __linux__
 #include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
 #endif
 
 #define ONE_MB 1024 * 1024
@@ -85,8 +97,80 @@ static void readAllAreas();
 static int reallocateArea(Area *saved_area, Area *current_area);
 static void readAnArea(SaveState &saved_area, int spmfd, SaveState &parent_state, SaveState &base_state);
 
+/* Pages queued for compression by the worker threads */
+struct CompressBatch {
+    /* Maximum number of pages processed by a single worker */
+    static const int WORKER_PAGES = WORKER_BUFFER_SIZE / (sizeof(int) + LZ4_COMPRESSBOUND(4096));
+
+    /* Size of an uncompressed block, and maximum number of blocks processed
+     * by a single worker. The beginning of the worker buffer is used to
+     * gather the block pages. */
+    static const int BLOCK_SIZE = STATEBLOCKPAGES * 4096;
+    static const int WORKER_BLOCKS = (WORKER_BUFFER_SIZE - BLOCK_SIZE) / LZ4_COMPRESSBOUND(BLOCK_SIZE);
+
+    char* addrs[WORKERS_MAX * WORKER_PAGES];
+    char flags[WORKERS_MAX * WORKER_PAGES];
+    int count;
+    int capacity;
+    int workers;
+
+    /* Are we using the worker threads, or compressing on the current thread */
+    bool threaded;
+
+    /* Number of bytes written in each worker buffer */
+    size_t sizes[WORKERS_MAX];
+
+    /* Block compression. The block index of the area is located in the
+     * pagemap file at index_offset, and block_count blocks were already written */
+    bool blocks;
+    int pmfd;
+    off_t index_offset;
+    int block_count;
+    int block_sizes[WORKERS_MAX * WORKER_BLOCKS];
+};
+
+static_assert(CompressBatch::WORKER_BLOCKS * STATEBLOCKPAGES <= CompressBatch::WORKER_PAGES, "Batch cannot hold the pages of all blocks");
+
+/* Ids of pages saved in the page store, waiting to be written */
+struct StoreIds {
+    int64_t ids[512];
+    int count;
+};
+
 static void writeAllAreas(bool base);
 static size_t writeAnArea(int pmfd, int pfd, int spmfd, Area &area, SaveState &parent_state, bool base);
+static size_t storePage(int pfd, char* addr, char* ss_flag, char* compressed_page, CompressBatch* batch, StoreIds* store_ids);
+static void flushStoreIds(int pfd, StoreIds* store_ids);
+static void walkStorePages(SaveState &state, void (*action)(int64_t id));
+static void releaseStoreSlot(const char* slotpagemappath, const char* slotpagespath, int slot_index);
+static void setStoreSlotPath(int slot_index, const char* slotpagemappath);
+static void checkStoreSlots();
+static size_t flushBatch(int pfd, char* ss_pagemaps, CompressBatch* batch);
+static void compressBatch(int worker, void* arg);
+static void fillHeader(StateHeader &sh);
+static int checkThreads(const StateHeader &sh);
+
+/* Savestates kept in forked processes, which hold the memory of the game at
+ * the time of the savestate using copy-on-write. The header and the content
+ * of /proc/self/maps of each snapshot are stored in the pagemap memfd of its
+ * slot. The table is located in our reserved memory, so that it is not
+ * overwritten when loading a state. */
+struct SnapshotTable {
+    /* Slot (plus one) whose memory was identical to the game memory when the
+     * soft-dirty bits were last cleared, or 0 */
+    int reference;
+
+    /* Memory layout of the snapshot being loaded */
+    char maps[ReservedMemory::PSM_SIZE];
+};
+
+static_assert(sizeof(SnapshotTable) <= ReservedMemory::SNAPSHOT_SIZE, "Snapshot table does not fit in reserved memory");
+
+static void writeSnapshot();
+static void readSnapshot();
+static size_t readSnapshotArea(const Area &area, pid_t pid, int spmfd, int cpmfd, int cmemfd, bool dirty_only);
+static void killSnapshot(int slot);
+static bool clearSoftDirty();
 
 void Checkpoint::setSavestatePath(std::string path)
 {
@@ -132,34 +216,154 @@ static void resetParent()
     parent_ss_index = -1;
 }
 
+/* Are savestates kept in forked processes? */
+static bool useSnapshots()
+{
+    return shared_config.savestate_settings & SharedConfig::SS_SNAPSHOT;
+}
+
+static SnapshotTable* getSnapshots()
+{
+    return static_cast<SnapshotTable*>(ReservedMemory::getAddr(ReservedMemory::SNAPSHOT_ADDR));
+}
+
+/* Are stored pages compressed in blocks? */
+static bool useBlocks()
+{
+    return (shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) &&
+        (shared_config.savestate_settings & SharedConfig::SS_BLOCKS) &&
+        !PageStore::enabled();
+}
+
 static int getPagemapFd(int index)
 {
-    if (index < 0) return 0;
-    int* pagemaps = static_cast<int*>(ReservedMemory::getAddr(ReservedMemory::PAGEMAPS_ADDR));
-    return pagemaps[index];
+    SlotData* slot = ReservedMemory::getSlot(index);
+    return slot ? slot->pagemap_fd : 0;
 }
 
 static int getPagesFd(int index)
 {
-    if (index < 0) return 0;
-    int* pages = static_cast<int*>(ReservedMemory::getAddr(ReservedMemory::PAGES_ADDR));
-    return pages[index];
+    SlotData* slot = ReservedMemory::getSlot(index);
+    return slot ? slot->pages_fd : 0;
 }
 
 static void setPagemapFd(int index, int fd)
 {
-    int* pagemaps = static_cast<int*>(ReservedMemory::getAddr(ReservedMemory::PAGEMAPS_ADDR));
-    pagemaps[index] = fd;
+    SlotData* slot = ReservedMemory::getSlot(index);
+    MYASSERT(slot != nullptr)
+    slot->pagemap_fd = fd;
 }
 static void setPagesFd(int index, int fd)
 {
-    int* pages = static_cast<int*>(ReservedMemory::getAddr(ReservedMemory::PAGES_ADDR));
-    pages[index] = fd;
+    SlotData* slot = ReservedMemory::getSlot(index);
+    MYASSERT(slot != nullptr)
+    slot->pages_fd = fd;
+}
+
+void Checkpoint::freeState(int index, std::string path)
+{
+    SlotData* slot = ReservedMemory::getSlot(index);
+    if (!slot)
+        return;
+
+    if (useSnapshots()) {
+        killSnapshot(index);
+    }
+    else {
+        /* Release the references to the page store, using the files of the
+         * freed slot and not the ones of the current slot */
+        checkStoreSlots();
+        std::string slotpagemappath = path + ".pm";
+        std::string slotpagespath = path + ".p";
+        releaseStoreSlot(slotpagemappath.c_str(), slotpagespath.c_str(), index);
+        setStoreSlotPath(index, "");
+
+        /* Remove the savestate files once the pages are released */
+        if (!(shared_config.savestate_settings & SharedConfig::SS_RAM) && !path.empty()) {
+            NATIVECALL(unlink(slotpagemappath.c_str()));
+            NATIVECALL(unlink(slotpagespath.c_str()));
+        }
+    }
+
+    if (slot->pagemap_fd) {
+        NATIVECALL(close(slot->pagemap_fd));
+        slot->pagemap_fd = 0;
+    }
+    if (slot->pages_fd) {
+        NATIVECALL(close(slot->pages_fd));
+        slot->pages_fd = 0;
+    }
+
+    /* The next incremental savestate cannot be based on it */
+    if (index == parent_ss_index)
+        resetParent();
+}
+
+uint64_t Checkpoint::stateSize(int index)
+{
+    SlotData* slot = ReservedMemory::getSlot(index);
+    if (!slot)
+        return 0;
+
+    uint64_t size = 0;
+    struct stat sb;
+    if (slot->pagemap_fd && (fstat(slot->pagemap_fd, &sb) == 0))
+        size += sb.st_size;
+    if (slot->pages_fd && (fstat(slot->pages_fd, &sb) == 0))
+        size += sb.st_size;
+
+#ifdef __linux__
+    /* Pages that are only held by the snapshot process, because the game
+     * modified them afterwards */
+    if (useSnapshots() && slot->pid) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", slot->pid);
+
+        int fd;
+        NATIVECALL(fd = open(path, O_RDONLY));
+        if (fd != -1) {
+            char buf[4096];
+            ssize_t len = Utils::readAll(fd, buf, sizeof(buf) - 1);
+            NATIVECALL(close(fd));
+            if (len > 0) {
+                buf[len] = '\0';
+                const char* const fields[] = {"Private_Clean:", "Private_Dirty:"};
+                for (const char* field : fields) {
+                    const char* line = strstr(buf, field);
+                    if (line)
+                        size += strtoull(line + strlen(field), nullptr, 10) * 1024;
+                }
+            }
+        }
+    }
+#endif
+
+    return size;
+}
+
+bool Checkpoint::clearSoftDirtyForSearch()
+{
+    /* Incremental savestates store the pages modified since their base
+     * savestate, so bits can only be cleared if there is none */
+    if (shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)
+        return false;
+
+    if (getPagemapFd(base_ss_index))
+        return false;
+
+    struct stat sb;
+    if ((basepagemappath[0] != '\0') && (stat(basepagemappath, &sb) == 0))
+        return false;
+
+    /* Memory is not known to be identical to a snapshot anymore */
+    getSnapshots()->reference = 0;
+
+    return clearSoftDirty();
 }
 
 int Checkpoint::checkCheckpoint()
 {
-    if (shared_config.savestate_settings & SharedConfig::SS_RAM)
+    if (shared_config.savestate_settings & (SharedConfig::SS_RAM | SharedConfig::SS_SNAPSHOT))
         return SaveStateManager::ESTATE_OK;
 
     /* TODO: Find another way to check for space, because mapped memory is
@@ -206,6 +410,28 @@ int Checkpoint::checkCheckpoint()
 
 int Checkpoint::checkRestore()
 {
+    /* Check that the snapshot process is still alive */
+    if (useSnapshots()) {
+        SlotData* slot = ReservedMemory::getSlot(ss_index);
+        if (!slot || !slot->pid) {
+            return SaveStateManager::ESTATE_NOSTATE;
+        }
+
+        if (waitpid(slot->pid, nullptr, WNOHANG) != 0) {
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Process %d holding state %d is gone", slot->pid, ss_index);
+            slot->pid = 0;
+            SnapshotTable* snapshots = getSnapshots();
+            if (snapshots->reference == ss_index + 1)
+                snapshots->reference = 0;
+            return SaveStateManager::ESTATE_NOSTATE;
+        }
+
+        StateHeader sh;
+        lseek(slot->pagemap_fd, 0, SEEK_SET);
+        Utils::readAll(slot->pagemap_fd, &sh, sizeof(sh));
+        return checkThreads(sh);
+    }
+
     /* Check that the savestate files exist */
     if (shared_config.savestate_settings & SharedConfig::SS_RAM) {
         if (!getPagemapFd(ss_index)) {
@@ -244,6 +470,11 @@ int Checkpoint::checkRestore()
         NATIVECALL(close(pmfd));
     }
 
+    return checkThreads(sh);
+}
+
+static int checkThreads(const StateHeader &sh)
+{
     /* Check that the thread list is identical */
     int n=0;
     for (ThreadInfo *thread = ThreadManager::getThreadList(); thread != nullptr; thread = thread->next) {
@@ -317,10 +548,17 @@ void Checkpoint::handler(int signum)
 
         TimeHolder old_time, new_time, delta_time;
         NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &old_time));
-        readAllAreas();
+        StateStats::begin(ss_index, true);
+        if (useSnapshots())
+            readSnapshot();
+        else
+            readAllAreas();
+        StateStats::end();
         NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &new_time));
         delta_time = new_time - old_time;
         debuglogstdio(LCF_CHECKPOINT | LCF_INFO, "Loaded state %d in %f seconds", ss_index, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+        if (LazyRestore::enabled())
+            debuglogstdio(LCF_CHECKPOINT | LCF_INFO, "%d pages will be loaded on first access", LazyRestore::pendingCount());
 
         /* Loading state was overwritten, putting the right value again */
         SaveStateManager::setLoading();
@@ -347,6 +585,14 @@ void Checkpoint::handler(int signum)
         /* We must restore the current stack frame from the savestate */
         AltStack::restoreStackFrame();
     }
+    else if (useSnapshots()) {
+        /* We must store the current stack frame in the savestate */
+        AltStack::saveStackFrame();
+
+        StateStats::begin(ss_index, false);
+        writeSnapshot();
+        StateStats::end();
+    }
     else {
         /* Check that base savestate exists, otherwise save it */
         if (shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
@@ -367,7 +613,11 @@ void Checkpoint::handler(int signum)
         /* We must store the current stack frame in the savestate */
         AltStack::saveStackFrame();
 
+        /* Only the savestate is reported, not the base savestate. With forked
+         * savestates, the areas are processed by the child. */
+        StateStats::begin(ss_index, false);
         writeAllAreas(false);
+        StateStats::end();
     }
 }
 
@@ -408,6 +658,26 @@ static bool skipArea(const Area *area)
         return true;
     }
 
+    /* Don't save the page store table */
+    if (PageStore::isArea(area)) {
+        return true;
+    }
+
+    /* Don't save the lazy loading table */
+    if (LazyRestore::isArea(area)) {
+        return true;
+    }
+
+    /* Don't save the memory shadow shared with the program */
+    if (MemoryShadow::isArea(area)) {
+        return true;
+    }
+
+    /* Don't save the socket buffers, they follow the socket state */
+    if (isSocketBuffersArea(area->addr, area->size)) {
+        return true;
+    }
+
     /* Don't save area that cannot be promoted to read/write */
     if ((area->max_prot & (PROT_WRITE|PROT_READ)) != (PROT_WRITE|PROT_READ)) {
         return false;
@@ -444,6 +714,11 @@ static void readAllAreas()
         MYASSERT(crfd != -1);
     }
 
+    /* Pages may be loaded on first access instead */
+    bool lazy = LazyRestore::enabled();
+    if (lazy)
+        LazyRestore::beginLoad(pagemappath, pagespath, getPagemapFd(ss_index), getPagesFd(ss_index));
+
     /* Read the savestate header */
     StateHeader sh;
     saved_state.readHeader(sh);
@@ -500,6 +775,9 @@ static void readAllAreas()
         saved_area = saved_state.nextArea();
     }
 
+    if (lazy)
+        LazyRestore::endLoad();
+
     if (crfd != -1) {
         /* Clear soft-dirty bits */
         Utils::writeAll(crfd, "4\n", 2);
@@ -683,6 +961,9 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
 {
     const Area& saved_area = saved_state.getArea();
 
+    StateStats::beginArea(saved_area);
+    SavestateAreaStats* stats = StateStats::area();
+
     if (saved_area.skip)
         return;
 
@@ -695,6 +976,9 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
         MYASSERT(-1 != lseek(spmfd, static_cast<off_t>(reinterpret_cast<uintptr_t>(saved_area.addr) / (4096/8)), SEEK_SET));
     }
 
+    /* Defer the loading of pages of this area if possible */
+    bool lazy = LazyRestore::enabled() && LazyRestore::beginArea(saved_area);
+
     /* Number of pages in the area */
     int nb_pages = saved_area.size / 4096;
 
@@ -715,16 +999,29 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
         /* We read pagemap flags in chunks to avoid too many read syscalls. */
         if ((spmfd != -1) && (pagemap_i >= 512)) {
             size_t remaining_pages = (nb_pages-page_i)>512?512:(nb_pages-page_i);
+            uint64_t scan_start = StateStats::now();
             Utils::readAll(spmfd, pagemaps, remaining_pages*8);
+            stats->scan_ns += StateStats::now() - scan_start;
             pagemap_i = 0;
         }
 
         char flag = saved_state.getNextPageFlag();
+        StateStats::countFlags(&flag, 1);
 
         /* Gather the flag for the page map */
         uint64_t page = (spmfd != -1)?pagemaps[pagemap_i++]:-1;
         bool soft_dirty = page & (0x1ull << 55);
         bool page_present = page & (0x1ull << 63);
+        if (page_present)
+            stats->pages_present++;
+
+        if (lazy) {
+            off_t offset = 0;
+            int size = 0;
+            saved_state.getPageLocation(offset, size);
+            if (LazyRestore::deferPage(curAddr, flag, offset, size))
+                continue;
+        }
 
         /* It seems that static memory is both zero and unmapped, so we still
          * need to memset the region if it was mapped.
@@ -733,7 +1030,7 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
          * on one stage, advancing to the next stage, loading the state and 
          * advancing to next stage again. */
         if (flag == Area::NO_PAGE) {
-            if (page_present && (!Utils::isZeroPage(static_cast<void*>(curAddr))))
+            if (page_present && (!PageScan::isZeroPage(curAddr)))
                 memset(static_cast<void*>(curAddr), 0, 4096);
         }
         else if (flag == Area::ZERO_PAGE) {
@@ -749,7 +1046,7 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
             else {
                 /* Only memset if the page is not zero, to prevent an actual
                  * allocation if the page was allocated but never used. */
-                if (!Utils::isZeroPage(static_cast<void*>(curAddr))) {
+                if (!PageScan::isZeroPage(curAddr)) {
                     memset(static_cast<void*>(curAddr), 0, 4096);
                 }
             }
@@ -767,7 +1064,7 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
                  * We must read from the base savestate.
                  */
                 base_state.getPageFlag(curAddr);
-                base_state.queuePageLoad(curAddr);
+                base_state.planPageLoad(curAddr);
             }
             else {
                 if (soft_dirty) {
@@ -775,16 +1072,19 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
                      * We must read from the base savestate.
                      */
                     base_state.getPageFlag(curAddr);
-                    base_state.queuePageLoad(curAddr);
+                    base_state.planPageLoad(curAddr);
                 }
             }
         }
         else {
-            saved_state.queuePageLoad(curAddr);
+            saved_state.planPageLoad(curAddr);
         }
     }
-    base_state.finishLoad();
-    saved_state.finishLoad();
+    /* Load the pages of the area */
+    RestorePlan::execute();
+
+    if (lazy)
+        LazyRestore::endArea();
 
     /* Recover permission to the area */
     if (!(saved_area.prot & PROT_WRITE)) {
@@ -795,11 +1095,19 @@ static void readAnArea(SaveState &saved_state, int spmfd, SaveState &parent_stat
 
 static void writeAllAreas(bool base)
 {
+    /* All memory pages must be present before being saved */
+    LazyRestore::finish();
+
     if (shared_config.savestate_settings & SharedConfig::SS_FORK) {
         pid_t pid;
         NATIVECALL(pid = fork());
-        if (pid != 0)
+        if (pid != 0) {
+            /* Register the child, so that we know which state it saved */
+            SlotData* slot = ReservedMemory::getSlot(base?base_ss_index:ss_index);
+            if (slot && (pid > 0))
+                slot->pid = pid;
             return;
+        }
 
         ThreadManager::restoreThreadTids();
     }
@@ -821,9 +1129,29 @@ static void writeAllAreas(bool base)
     char temppagemappath[1024];
     char temppagespath[1024];
 
+    /* When sharing pages, the old state must be kept until the new one is
+     * written, so that identical pages are found in the store and not
+     * released in between. */
+    bool use_temp = ((shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) || PageStore::enabled()) && !base;
+
+    /* Drop the references of slots whose files were removed */
+    checkStoreSlots();
+
+    /* Release the pages of the base savestate that we will overwrite */
+    if (base)
+        releaseStoreSlot(basepagemappath, basepagespath, base_ss_index);
+
+    /* States written in the background are first staged in memory */
+    bool async = StateWriter::enabled() && !base;
+
 #ifdef __linux__
-    if (shared_config.savestate_settings & SharedConfig::SS_RAM) {
-        if (!(shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)) {
+    if (async) {
+        debuglogstdio(LCF_CHECKPOINT, "Staging checkpoint for %s and %s", pagemappath, pagespath);
+        pmfd = syscall(SYS_memfd_create, "pagemapstate", 0);
+        pfd = syscall(SYS_memfd_create, "pagesstate", 0);
+    }
+    else if (shared_config.savestate_settings & SharedConfig::SS_RAM) {
+        if (!use_temp && !base) {
             debuglogstdio(LCF_CHECKPOINT, "Performing checkpoint in slot %d", ss_index);
 
             pmfd = getPagemapFd(ss_index);
@@ -868,7 +1196,7 @@ static void writeAllAreas(bool base)
     else
 #endif
     {
-        if (!(shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)) {
+        if (!use_temp && !base) {
             debuglogstdio(LCF_CHECKPOINT, "Performing checkpoint in %s and %s", pagemappath, pagespath);
 
             NATIVECALL(unlink(pagemappath));
@@ -918,18 +1246,7 @@ static void writeAllAreas(bool base)
 
     /* Saving the savestate header */
     StateHeader sh;
-    int n=0;
-    for (ThreadInfo *thread = ThreadManager::getThreadList(); thread != nullptr; thread = thread->next) {
-        if (thread->state == ThreadInfo::ST_SUSPENDED) {
-            if (n >= STATEMAXTHREADS) {
-                debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "   hit the limit of the number of threads");
-                break;
-            }
-            sh.pthread_ids[n] = thread->pthread_id;
-            sh.tids[n++] = thread->tid;
-        }
-    }
-    sh.thread_count = n;
+    fillHeader(sh);
     Utils::writeAll(pmfd, &sh, sizeof(sh));
     savestate_size += sizeof(sh);
 
@@ -992,14 +1309,21 @@ static void writeAllAreas(bool base)
         NATIVECALL(close(spmfd));
     }
 
-    /* Closing the savestate files */
-    if (!(shared_config.savestate_settings & SharedConfig::SS_RAM)) {
+    if (async) {
+        /* The writer thread closes the memfds when the state is on disk */
+        StateWriter::submit(current_ss_index, pmfd, pfd, pagemappath, pagespath);
+    }
+    else if (!(shared_config.savestate_settings & SharedConfig::SS_RAM)) {
+        /* Closing the savestate files */
         NATIVECALL(close(pmfd));
         NATIVECALL(close(pfd));
     }
 
     /* Rename the savestate files */
-    if ((shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base) {
+    if (use_temp && !async) {
+        /* Release the pages of the savestate that we are replacing */
+        releaseStoreSlot(pagemappath, pagespath, current_ss_index);
+
         if (shared_config.savestate_settings & SharedConfig::SS_RAM) {
             /* Closing the old savestate memfds and replace with the new one */
             if (getPagemapFd(current_ss_index)) {
@@ -1015,9 +1339,16 @@ static void writeAllAreas(bool base)
         }
     }
 
+    if (base)
+        setStoreSlotPath(base_ss_index, basepagemappath);
+    else
+        setStoreSlotPath(current_ss_index, pagemappath);
+
     NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &new_time));
     delta_time = new_time - old_time;
-    debuglogstdio(LCF_INFO, "Saved state %d of size %zu in %f seconds", base?0:ss_index, savestate_size, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+    debuglogstdio(LCF_INFO, "Saved state %d of size %zu in %f seconds with %d workers", base?0:ss_index, savestate_size, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0, WorkerPool::count());
+    if (PageStore::enabled())
+        debuglogstdio(LCF_INFO, "Page store contains %d pages", static_cast<int>(PageStore::pageCount()));
 
     if (shared_config.savestate_settings & SharedConfig::SS_FORK) {
         /* Store that we are the child, so that destructors may act differently */
@@ -1028,6 +1359,23 @@ static void writeAllAreas(bool base)
     }
 }
 
+static void fillHeader(StateHeader &sh)
+{
+    sh.version = useBlocks() ? STATEVERSION_BLOCK : STATEVERSION_PAGE;
+    int n=0;
+    for (ThreadInfo *thread = ThreadManager::getThreadList(); thread != nullptr; thread = thread->next) {
+        if (thread->state == ThreadInfo::ST_SUSPENDED) {
+            if (n >= STATEMAXTHREADS) {
+                debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "   hit the limit of the number of threads");
+                break;
+            }
+            sh.pthread_ids[n] = thread->pthread_id;
+            sh.tids[n++] = thread->tid;
+        }
+    }
+    sh.thread_count = n;
+}
+
 /* Write a memory area into the savestate. Returns the size of the area in bytes */
 static size_t writeAnArea(int pmfd, int pfd, int spmfd, Area &area, SaveState &parent_state, bool base)
 {
@@ -1043,8 +1391,13 @@ static size_t writeAnArea(int pmfd, int pfd, int spmfd, Area &area, SaveState &p
     Utils::writeAll(pmfd, &area, sizeof(area));
     area_size += sizeof(area);
 
-    if (area.skip)
+    StateStats::beginArea(area);
+    SavestateAreaStats* stats = StateStats::area();
+
+    if (area.skip) {
+        stats->bytes = area_size;
         return area_size;
+    }
 
     if (spmfd != -1) {
         /* Seek at the beginning of the area pagemap */
@@ -1054,14 +1407,8 @@ static size_t writeAnArea(int pmfd, int pfd, int spmfd, Area &area, SaveState &p
     /* Number of pages in the area */
     int nb_pages = area.size / 4096;
 
-    /* Index of the current area page */
-    int page_i = 0;
-
-    /* Chunk of pagemap values */
-    uint64_t pagemaps[512];
-
-    /* Current index in the pagemaps array */
-    int pagemap_i = 512;
+    /* Chunk of pagemap values, for one window of pages */
+    uint64_t pagemaps[PageScan::WINDOW_PAGES];
 
     /* Chunk of savestate pagemap values */
     char ss_pagemaps[4096];
@@ -1072,95 +1419,777 @@ static size_t writeAnArea(int pmfd, int pfd, int spmfd, Area &area, SaveState &p
     /* Compressed chunk */
     char compressed_page[LZ4_COMPRESSBOUND(4096)];
 
-    char* endAddr = static_cast<char*>(area.endAddr);
-    for (char* curAddr = static_cast<char*>(area.addr); curAddr < endAddr; curAddr += 4096, page_i++) {
+    /* Compressing pages with worker threads. Forked processes don't have them. */
+    CompressBatch batch;
+    batch.count = 0;
+    batch.workers = 0;
+    batch.threaded = false;
+    if ((shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) &&
+        !(shared_config.savestate_settings & SharedConfig::SS_FORK) &&
+        !PageStore::enabled()) {
+        batch.workers = WorkerPool::count();
+        batch.threaded = (batch.workers > 0);
+    }
+
+    batch.blocks = useBlocks();
+    if (batch.blocks) {
+        /* Blocks are always built using a batch, so we use the buffer of the
+         * first worker if we don't have worker threads */
+        if (batch.workers == 0)
+            batch.workers = 1;
+        batch.capacity = batch.workers * CompressBatch::WORKER_BLOCKS * STATEBLOCKPAGES;
+        batch.pmfd = pmfd;
+        batch.block_count = 0;
+
+        /* Reserve the space of the block index, which is filled when blocks
+         * are written */
+        batch.index_offset = lseek(pmfd, 0, SEEK_CUR);
+        MYASSERT(batch.index_offset != -1)
+        size_t index_size = ((nb_pages + STATEBLOCKPAGES - 1) / STATEBLOCKPAGES) * sizeof(StateBlock);
+        MYASSERT(-1 != lseek(pmfd, index_size, SEEK_CUR))
+        area_size += index_size;
+    }
+    else {
+        batch.capacity = batch.workers * CompressBatch::WORKER_PAGES;
+    }
+    CompressBatch* batch_ptr = batch.workers ? &batch : nullptr;
+
+    /* Stored pages are saved in the page store if enabled */
+    StoreIds store_ids;
+    store_ids.count = 0;
+    StoreIds* store_ids_ptr = PageStore::enabled() ? &store_ids : nullptr;
+
+    bool incremental = (shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base;
+
+    /* Pages of private anonymous memory that are neither present nor swapped
+     * were never written, so they are zero without reading them. */
+    bool unmapped_zero = (spmfd != -1) && (area.flags & Area::AREA_ANON) && (area.flags & Area::AREA_PRIV);
+
+    /* Pages are processed in windows. Each window is first classified using
+     * bitmaps, so that only the pages that must be stored are visited one
+     * by one. Windows start at a multiple of 512 pages from the area start,
+     * so they never cross a chunk of savestate pagemaps. */
+    PageScan::Window window;
+    for (int window_i = 0; window_i < nb_pages; window_i += PageScan::WINDOW_PAGES) {
 
         /* We write a chunk of savestate pagemaps if it is full */
         if (ss_pagemap_i >= 4096) {
+            /* Queued pages must be written before, because they fill the
+             * pagemap flags */
+            if (!batch.blocks)
+                area_size += flushBatch(pfd, ss_pagemaps, batch_ptr);
+            StateStats::countFlags(ss_pagemaps, 4096);
+            uint64_t io_start = StateStats::now();
             Utils::writeAll(pmfd, ss_pagemaps, 4096);
+            stats->io_ns += StateStats::now() - io_start;
             ss_pagemap_i = 0;
             area_size += 4096;
         }
 
-        /* We read pagemap flags in chunks to avoid too many read syscalls. */
-        if ((spmfd != -1) && (pagemap_i >= 512)) {
-            size_t remaining_pages = (nb_pages-page_i)>512?512:(nb_pages-page_i);
-            Utils::readAll(spmfd, pagemaps, remaining_pages*8);
-            pagemap_i = 0;
+        int window_pages = (nb_pages-window_i)>PageScan::WINDOW_PAGES?PageScan::WINDOW_PAGES:(nb_pages-window_i);
+        char* window_addr = static_cast<char*>(area.addr) + static_cast<size_t>(window_i) * 4096;
+        char* window_flags = &ss_pagemaps[ss_pagemap_i];
+
+        /* Gather the pagemap flags of the window */
+        uint64_t scan_start = StateStats::now();
+        if (spmfd != -1)
+            Utils::readAll(spmfd, pagemaps, window_pages*8);
+        PageScan::classify((spmfd != -1)?pagemaps:nullptr, window_pages, window);
+
+        /* Pages that are not present are skipped if the option is set */
+        uint64_t no_page[PageScan::WINDOW_WORDS];
+        for (int w = 0; w < PageScan::WINDOW_WORDS; w++) {
+            uint64_t valid = PageScan::validMask(window_pages, w);
+            no_page[w] = (shared_config.savestate_settings & SharedConfig::SS_PRESENT) ? (valid & ~window.present[w]) : 0;
         }
 
-        /* Gather the flag for the current pagemap. */
-        uint64_t page = (spmfd != -1)?pagemaps[pagemap_i++]:-1;
-        bool page_present = page & (0x1ull << 63);
-        bool soft_dirty = page & (0x1ull << 55);
-
-        /* Check if page is present */
-        if ((shared_config.savestate_settings & SharedConfig::SS_PRESENT) && (!page_present)) {
-            ss_pagemaps[ss_pagemap_i++] = Area::NO_PAGE;
+        /* Check for zero pages (only on anonymous memory) */
+        if (area.flags & Area::AREA_ANON) {
+            uint64_t candidates[PageScan::WINDOW_WORDS];
+            for (int w = 0; w < PageScan::WINDOW_WORDS; w++) {
+                candidates[w] = ~no_page[w];
+                if (unmapped_zero) {
+                    uint64_t mapped = window.present[w] | window.swapped[w];
+                    window.zero[w] = PageScan::validMask(window_pages, w) & ~mapped & ~no_page[w];
+                    candidates[w] &= mapped;
+                }
+            }
+            PageScan::findZeroPages(window_addr, candidates, window);
         }
 
-        /* Check if page is zero (only check on anonymous memory)*/
-        else if ((area.flags & Area::AREA_ANON) && Utils::isZeroPage(static_cast<void*>(curAddr))) {
-            ss_pagemaps[ss_pagemap_i++] = Area::ZERO_PAGE;
-        }
+        for (int w = 0; w < PageScan::WINDOW_WORDS; w++) {
+            uint64_t valid = PageScan::validMask(window_pages, w);
+            if (!valid)
+                break;
 
-        /* Check if page was not modified since last savestate */
-        else if (!soft_dirty && (shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base) {
-            /* Copy the value of the parent savestate if any */
-            if (parent_state) {
-                char parent_flag = parent_state.getPageFlag(curAddr);
-                if ((parent_flag == Area::NONE) || (parent_flag == Area::FULL_PAGE) || (parent_flag == Area::COMPRESSED_PAGE)) {
-                    /* Parent does not have the page or parent stores the memory page,
-                     * saving the full page. */
+            uint64_t bits = no_page[w];
+            while (bits) {
+                window_flags[64*w + PageScan::lowestBit(bits)] = Area::NO_PAGE;
+                bits &= bits - 1;
+            }
 
-                    int compressed_size = 0;
-                    if (shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) {
-                        compressed_size = LZ4_compress_default(curAddr, compressed_page, 4096, LZ4_COMPRESSBOUND(4096));
-                    }
-                    if (compressed_size != 0) {
-                        ss_pagemaps[ss_pagemap_i++] = Area::COMPRESSED_PAGE;
-                        Utils::writeAll(pfd, &compressed_size, sizeof(int));
-                        Utils::writeAll(pfd, compressed_page, compressed_size);
-                        area_size += compressed_size;
+            bits = window.zero[w];
+            while (bits) {
+                window_flags[64*w + PageScan::lowestBit(bits)] = Area::ZERO_PAGE;
+                bits &= bits - 1;
+            }
+
+            uint64_t remaining = valid & ~no_page[w] & ~window.zero[w];
+
+            /* Pages not modified since last savestate */
+            uint64_t clean = incremental ? (remaining & ~window.soft_dirty[w]) : 0;
+            window.dirty[w] = remaining & ~clean;
+
+            while (clean) {
+                int i = PageScan::lowestBit(clean);
+                clean &= clean - 1;
+                char* curAddr = window_addr + (64*w + i) * 4096;
+
+                /* Copy the value of the parent savestate if any */
+                if (parent_state) {
+                    char parent_flag = parent_state.getPageFlag(curAddr);
+                    if ((parent_flag == Area::NONE) || (parent_flag == Area::FULL_PAGE) ||
+                        (parent_flag == Area::COMPRESSED_PAGE) || (parent_flag == Area::BLOCK_PAGE) ||
+                        (parent_flag == Area::STORE_PAGE)) {
+                        /* Parent does not have the page or parent stores the memory page,
+                         * saving the full page. */
+                        window.dirty[w] |= 1ull << i;
                     }
                     else {
-                        ss_pagemaps[ss_pagemap_i++] = Area::FULL_PAGE;
-                        Utils::writeAll(pfd, static_cast<void*>(curAddr), 4096);
-                        area_size += 4096;
+                        window_flags[64*w + i] = parent_flag;
                     }
                 }
                 else {
-                    ss_pagemaps[ss_pagemap_i++] = parent_flag;
+                    window_flags[64*w + i] = Area::BASE_PAGE;
                 }
             }
-            else {
-                ss_pagemaps[ss_pagemap_i++] = Area::BASE_PAGE;
+        }
+
+        for (int w = 0; w < PageScan::WINDOW_WORDS; w++) {
+            stats->pages_present += __builtin_popcountll(window.present[w]);
+            stats->pages_dirty += __builtin_popcountll(window.dirty[w]);
+        }
+        stats->scan_ns += StateStats::now() - scan_start;
+
+        /* Store the dirty pages, in increasing address order */
+        for (int w = 0; w < PageScan::WINDOW_WORDS; w++) {
+            uint64_t bits = window.dirty[w];
+            while (bits) {
+                int i = PageScan::lowestBit(bits);
+                bits &= bits - 1;
+                area_size += storePage(pfd, window_addr + (64*w + i) * 4096, &window_flags[64*w + i], compressed_page, batch_ptr, store_ids_ptr);
+
+                /* Compress the queued pages if the batch is full */
+                if (batch_ptr && (batch.count == batch.capacity)) {
+                    area_size += flushBatch(pfd, ss_pagemaps, batch_ptr);
+                }
+            }
+        }
+
+        ss_pagemap_i += window_pages;
+    }
+
+    /* Writing the last queued pages and savestate pagemap chunk */
+    area_size += flushBatch(pfd, ss_pagemaps, batch_ptr);
+    StateStats::countFlags(ss_pagemaps, ss_pagemap_i);
+    uint64_t io_start = StateStats::now();
+    flushStoreIds(pfd, store_ids_ptr);
+    Utils::writeAll(pmfd, ss_pagemaps, ss_pagemap_i);
+    stats->io_ns += StateStats::now() - io_start;
+    area_size += ss_pagemap_i;
+
+    stats->bytes = area_size;
+    return area_size;
+}
+
+/* Save a memory page, or queue it for compression if a batch is used.
+ * Returns the number of bytes written. */
+static size_t storePage(int pfd, char* addr, char* ss_flag, char* compressed_page, CompressBatch* batch, StoreIds* store_ids)
+{
+    SavestateAreaStats* stats = StateStats::area();
+
+    if (store_ids) {
+        uint64_t store_start = StateStats::now();
+        int64_t id = PageStore::put(addr);
+        stats->compress_ns += StateStats::now() - store_start;
+        if (id >= 0) {
+            if (store_ids->count == 512)
+                flushStoreIds(pfd, store_ids);
+            store_ids->ids[store_ids->count++] = id;
+            *ss_flag = Area::STORE_PAGE;
+            return sizeof(int64_t);
+        }
+
+        /* The store is full, save the page in the savestate */
+        flushStoreIds(pfd, store_ids);
+    }
+
+    if (batch) {
+        /* With blocks, the position of the page is given by the number of
+         * pages stored before. Otherwise the flag will be filled when the
+         * batch is processed. */
+        batch->addrs[batch->count] = addr;
+        batch->flags[batch->count] = 0;
+        batch->count++;
+        *ss_flag = batch->blocks ? Area::BLOCK_PAGE : Area::NONE;
+        return 0;
+    }
+
+    int compressed_size = 0;
+    if (shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) {
+        uint64_t compress_start = StateStats::now();
+        compressed_size = LZ4_compress_default(addr, compressed_page, 4096, LZ4_COMPRESSBOUND(4096));
+        stats->compress_ns += StateStats::now() - compress_start;
+    }
+
+    uint64_t io_start = StateStats::now();
+    if (compressed_size != 0) {
+        *ss_flag = Area::COMPRESSED_PAGE;
+        Utils::writeAll(pfd, &compressed_size, sizeof(int));
+        Utils::writeAll(pfd, compressed_page, compressed_size);
+        stats->io_ns += StateStats::now() - io_start;
+        return compressed_size;
+    }
+
+    *ss_flag = Area::FULL_PAGE;
+    Utils::writeAll(pfd, static_cast<void*>(addr), 4096);
+    stats->io_ns += StateStats::now() - io_start;
+    return 4096;
+}
+
+static void flushStoreIds(int pfd, StoreIds* store_ids)
+{
+    if (!store_ids || (store_ids->count == 0))
+        return;
+
+    Utils::writeAll(pfd, store_ids->ids, store_ids->count * sizeof(int64_t));
+    store_ids->count = 0;
+}
+
+/* Call an action on each reference of a savestate to the page store */
+static void walkStorePages(SaveState &state, void (*action)(int64_t id))
+{
+    if (!PageStore::isInit() || !state)
+        return;
+
+    for (Area area = state.getArea(); area.addr != nullptr; area = state.nextArea()) {
+        if (area.skip)
+            continue;
+
+        for (char* curAddr = static_cast<char*>(area.addr); curAddr < static_cast<char*>(area.endAddr); curAddr += 4096) {
+            if (state.getNextPageFlag() == Area::STORE_PAGE)
+                action(state.getStorePageId());
+        }
+    }
+}
+
+/* Remove the references of a savestate slot to the page store, if the slot
+ * contains a savestate */
+static void releaseStoreSlot(const char* slotpagemappath, const char* slotpagespath, int slot_index)
+{
+    if (!PageStore::isInit())
+        return;
+
+    if (!(shared_config.savestate_settings & SharedConfig::SS_RAM)) {
+        struct stat sb;
+        int ret;
+        NATIVECALL(ret = stat(slotpagemappath, &sb));
+        if (ret != 0)
+            return;
+    }
+
+    SaveState old_state(slotpagemappath, slotpagespath, getPagemapFd(slot_index), getPagesFd(slot_index));
+    walkStorePages(old_state, PageStore::release);
+}
+
+/* Remember the path of a slot holding references to the page store, from
+ * the path of its pagemap file, or forget it with an empty path. Only states
+ * stored on disk are remembered, because their files may be removed
+ * outside of the program. */
+static void setStoreSlotPath(int slot_index, const char* slotpagemappath)
+{
+    if (!PageStore::enabled() || (shared_config.savestate_settings & SharedConfig::SS_RAM))
+        return;
+
+    char path[1024];
+    strncpy(path, slotpagemappath, 1023);
+    path[1023] = '\0';
+
+    size_t len = strlen(path);
+    if ((len >= 3) && (strcmp(path + len - 3, ".pm") == 0))
+        path[len - 3] = '\0';
+
+    PageStore::setSlotPath(slot_index, path);
+}
+
+/* If the files of a slot were removed outside of the program, its references
+ * to the page store cannot be released anymore. In that case, the reference
+ * counts are rebuilt from the pagemaps of the remaining slots. */
+static void checkStoreSlots()
+{
+    if (!PageStore::enabled() || (shared_config.savestate_settings & SharedConfig::SS_RAM))
+        return;
+
+    char slotpagemappath[1024];
+    char slotpagespath[1024];
+    bool missing = false;
+
+    for (int i = 0; i < ReservedMemory::slotCount(); i++) {
+        const char* path = PageStore::slotPath(i);
+        if (path[0] == '\0')
+            continue;
+
+        snprintf(slotpagemappath, 1024, "%s.pm", path);
+        snprintf(slotpagespath, 1024, "%s.p", path);
+
+        struct stat sb;
+        int ret_pm, ret_p;
+        NATIVECALL(ret_pm = stat(slotpagemappath, &sb));
+        NATIVECALL(ret_p = stat(slotpagespath, &sb));
+        if ((ret_pm != 0) || (ret_p != 0)) {
+            debuglogstdio(LCF_CHECKPOINT | LCF_WARNING, "Files of savestate %d were removed", i);
+            PageStore::setSlotPath(i, "");
+            missing = true;
+        }
+    }
+
+    if (!missing)
+        return;
+
+    PageStore::beginRebuild();
+    for (int i = 0; i < ReservedMemory::slotCount(); i++) {
+        const char* path = PageStore::slotPath(i);
+        if (path[0] == '\0')
+            continue;
+
+        snprintf(slotpagemappath, 1024, "%s.pm", path);
+        snprintf(slotpagespath, 1024, "%s.p", path);
+        SaveState state(slotpagemappath, slotpagespath, 0, 0);
+        walkStorePages(state, PageStore::addReference);
+    }
+    PageStore::endRebuild();
+}
+
+/* Compress a contiguous range of the queued pages into the worker buffer,
+ * using the same layout as the pages file. */
+static void compressBatch(int worker, void* arg)
+{
+    CompressBatch* batch = static_cast<CompressBatch*>(arg);
+    char* buffer = WorkerPool::getBuffer(worker);
+    size_t size = 0;
+
+    if (batch->blocks) {
+        int nb_blocks = (batch->count + STATEBLOCKPAGES - 1) / STATEBLOCKPAGES;
+        int first = (nb_blocks * worker) / batch->workers;
+        int last = (nb_blocks * (worker + 1)) / batch->workers;
+
+        char* output = buffer + CompressBatch::BLOCK_SIZE;
+
+        for (int b = first; b < last; b++) {
+            /* Gather the block pages, which may not be contiguous in memory */
+            int first_page = b * STATEBLOCKPAGES;
+            int page_count = batch->count - first_page;
+            if (page_count > STATEBLOCKPAGES)
+                page_count = STATEBLOCKPAGES;
+
+            for (int p = 0; p < page_count; p++) {
+                memcpy(buffer + p * 4096, batch->addrs[first_page + p], 4096);
             }
+
+            int compressed_size = LZ4_compress_default(buffer, output + size, page_count * 4096, LZ4_COMPRESSBOUND(CompressBatch::BLOCK_SIZE));
+            MYASSERT(compressed_size != 0)
+            batch->block_sizes[b] = compressed_size;
+            size += compressed_size;
+        }
+
+        batch->sizes[worker] = size;
+        return;
+    }
+
+    int first = (batch->count * worker) / batch->workers;
+    int last = (batch->count * (worker + 1)) / batch->workers;
+
+    for (int i = first; i < last; i++) {
+        int compressed_size = LZ4_compress_default(batch->addrs[i], buffer + size + sizeof(int), 4096, LZ4_COMPRESSBOUND(4096));
+        if (compressed_size != 0) {
+            memcpy(buffer + size, &compressed_size, sizeof(int));
+            size += sizeof(int) + compressed_size;
+            batch->flags[i] = Area::COMPRESSED_PAGE;
         }
         else {
-            int compressed_size = 0;
-            if (shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) {
-                compressed_size = LZ4_compress_default(curAddr, compressed_page, 4096, LZ4_COMPRESSBOUND(4096));
+            memcpy(buffer + size, batch->addrs[i], 4096);
+            size += 4096;
+            batch->flags[i] = Area::FULL_PAGE;
+        }
+    }
+
+    batch->sizes[worker] = size;
+}
+
+/* Compress all queued pages in parallel, then write them in address order and
+ * fill their pagemap flags or block index. Returns the number of bytes written. */
+static size_t flushBatch(int pfd, char* ss_pagemaps, CompressBatch* batch)
+{
+    if (!batch || (batch->count == 0))
+        return 0;
+
+    SavestateAreaStats* stats = StateStats::area();
+    uint64_t compress_start = StateStats::now();
+    if (batch->threaded)
+        WorkerPool::run(compressBatch, batch);
+    else
+        compressBatch(0, batch);
+    stats->compress_ns += StateStats::now() - compress_start;
+
+    if (batch->blocks) {
+        /* Fill the block index entries of the written blocks */
+        StateBlock entries[WORKERS_MAX * CompressBatch::WORKER_BLOCKS];
+        int nb_blocks = (batch->count + STATEBLOCKPAGES - 1) / STATEBLOCKPAGES;
+        off_t offset = lseek(pfd, 0, SEEK_CUR);
+        MYASSERT(offset != -1)
+
+        for (int b = 0; b < nb_blocks; b++) {
+            entries[b].offset = offset;
+            entries[b].compressed_size = batch->block_sizes[b];
+            entries[b].page_count = batch->count - b * STATEBLOCKPAGES;
+            if (entries[b].page_count > STATEBLOCKPAGES)
+                entries[b].page_count = STATEBLOCKPAGES;
+            offset += batch->block_sizes[b];
+        }
+
+        off_t entries_offset = batch->index_offset + batch->block_count * sizeof(StateBlock);
+        MYASSERT(pwrite(batch->pmfd, entries, nb_blocks * sizeof(StateBlock), entries_offset) == static_cast<ssize_t>(nb_blocks * sizeof(StateBlock)))
+        batch->block_count += nb_blocks;
+    }
+    else {
+        /* Queued pages are the only ones with a NONE flag in the pagemap chunk */
+        int flag_i = 0;
+        for (int i = 0; i < batch->count; i++) {
+            while (ss_pagemaps[flag_i] != Area::NONE)
+                flag_i++;
+            ss_pagemaps[flag_i++] = batch->flags[i];
+        }
+    }
+
+    size_t size = 0;
+    size_t output_offset = batch->blocks ? CompressBatch::BLOCK_SIZE : 0;
+    uint64_t io_start = StateStats::now();
+    for (int w = 0; w < batch->workers; w++) {
+        Utils::writeAll(pfd, WorkerPool::getBuffer(w) + output_offset, batch->sizes[w]);
+        size += batch->sizes[w];
+    }
+    stats->io_ns += StateStats::now() - io_start;
+
+    batch->count = 0;
+    return size;
+}
+
+/* Save the state by forking a process that keeps the current memory */
+static void writeSnapshot()
+{
+#ifdef __linux__
+    SnapshotTable* snapshots = getSnapshots();
+    int slot = ss_index;
+    SlotData* slot_data = ReservedMemory::getSlot(slot);
+
+    TimeHolder old_time, new_time, delta_time;
+    NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &old_time));
+
+    /* Remove the previous savestate of this slot */
+    killSnapshot(slot);
+
+    int pmfd = slot_data->pagemap_fd;
+    if (pmfd) {
+        ftruncate(pmfd, 0);
+        lseek(pmfd, 0, SEEK_SET);
+    }
+    else {
+        pmfd = syscall(SYS_memfd_create, "snapshotstate", 0);
+        MYASSERT(pmfd != -1)
+        slot_data->pagemap_fd = pmfd;
+    }
+
+    StateHeader sh;
+    fillHeader(sh);
+    Utils::writeAll(pmfd, &sh, sizeof(sh));
+
+    /* Store the memory layout, which will be restored before copying pages */
+    int mapsfd;
+    NATIVECALL(mapsfd = open("/proc/self/maps", O_RDONLY));
+    MYASSERT(mapsfd != -1)
+    ssize_t maps_size = Utils::readAll(mapsfd, snapshots->maps, ReservedMemory::PSM_SIZE);
+    MYASSERT(maps_size > 0)
+    MYASSERT(maps_size < ReservedMemory::PSM_SIZE)
+    NATIVECALL(close(mapsfd));
+    Utils::writeAll(pmfd, snapshots->maps, maps_size);
+
+    /* Memory will be identical to the snapshot, so we only need to track
+     * which pages are modified from now on. Pages written before the fork
+     * are also marked, which is harmless. */
+    bool tracked = clearSoftDirty();
+
+    pid_t parent = getpid();
+    pid_t pid;
+    NATIVECALL(pid = fork());
+
+    if (pid == 0) {
+        /* The child only holds the memory, and must not outlive the game */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent)
+            _exit(0);
+
+#ifdef SYS_close_range
+        syscall(SYS_close_range, 0, ~0U, 0);
+#endif
+
+        sigset_t mask;
+        sigfillset(&mask);
+        NATIVECALL(sigprocmask(SIG_SETMASK, &mask, nullptr));
+        while (true)
+            NATIVECALL(sigsuspend(&mask));
+    }
+
+    if (pid < 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not fork to save state %d: errno %d", slot, errno);
+        snapshots->reference = 0;
+        return;
+    }
+
+    /* Without soft-dirty support, loading will compare all pages */
+    slot_data->pid = pid;
+    snapshots->reference = tracked ? (slot + 1) : 0;
+
+    NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &new_time));
+    delta_time = new_time - old_time;
+    debuglogstdio(LCF_INFO, "Saved state %d in process %d in %f seconds", slot, pid, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+#endif
+}
+
+/* Load the state by copying the memory of the forked process. If the game
+ * memory was identical to the snapshot when soft-dirty bits were last
+ * cleared, only the modified pages are copied. */
+static void readSnapshot()
+{
+#ifdef __linux__
+    SnapshotTable* snapshots = getSnapshots();
+
+    /* Static variables are overwritten when loading the state */
+    int slot = ss_index;
+    SlotData* slot_data = ReservedMemory::getSlot(slot);
+    pid_t pid = slot_data->pid;
+    bool dirty_only = (snapshots->reference == slot + 1);
+
+    debuglogstdio(LCF_CHECKPOINT, "Performing restore from process %d", pid);
+
+    char path[64];
+    int spmfd, cpmfd, cmemfd;
+    NATIVECALL(spmfd = open("/proc/self/pagemap", O_RDONLY));
+    MYASSERT(spmfd != -1)
+
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+    NATIVECALL(cpmfd = open(path, O_RDONLY));
+    MYASSERT(cpmfd != -1)
+
+    snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+    NATIVECALL(cmemfd = open(path, O_RDONLY));
+    MYASSERT(cmemfd != -1)
+
+    /* Reallocate areas to match the snapshot layout */
+    lseek(slot_data->pagemap_fd, sizeof(StateHeader), SEEK_SET);
+    ssize_t maps_size = Utils::readAll(slot_data->pagemap_fd, snapshots->maps, ReservedMemory::PSM_SIZE);
+    MYASSERT(maps_size > 0)
+
+    ProcSelfMaps savedLayout(snapshots->maps, maps_size);
+    ProcSelfMaps memMapLayout;
+
+    Area saved_area, current_area;
+    savedLayout.getNextArea(&saved_area);
+    bool not_eof = memMapLayout.getNextArea(&current_area);
+
+    while ((saved_area.addr != nullptr) || not_eof) {
+        int cmp = reallocateArea(&saved_area, &current_area);
+        if (cmp == 0) {
+            savedLayout.getNextArea(&saved_area);
+            not_eof = memMapLayout.getNextArea(&current_area);
+        }
+        if (cmp > 0) {
+            not_eof = memMapLayout.getNextArea(&current_area);
+        }
+        if (cmp < 0) {
+            savedLayout.getNextArea(&saved_area);
+        }
+    }
+
+    /* Copy the pages that differ from the snapshot. Shared areas are
+     * identical in both processes */
+    size_t page_count = 0;
+    savedLayout.reset();
+    while (savedLayout.getNextArea(&saved_area)) {
+        if (skipArea(&saved_area) || (saved_area.flags & Area::AREA_SHARED))
+            continue;
+
+        if (!(saved_area.prot & PROT_WRITE)) {
+            MYASSERT(mprotect(saved_area.addr, saved_area.size, saved_area.prot | PROT_WRITE) == 0)
+        }
+
+        page_count += readSnapshotArea(saved_area, pid, spmfd, cpmfd, cmemfd, dirty_only);
+
+        if (!(saved_area.prot & PROT_WRITE)) {
+            MYASSERT(mprotect(saved_area.addr, saved_area.size, saved_area.prot) == 0)
+        }
+    }
+
+    debuglogstdio(LCF_CHECKPOINT | LCF_INFO, "Copied %zu %s pages from process %d", page_count, dirty_only?"modified":"present", pid);
+
+    /* Memory is now identical to the snapshot */
+    snapshots->reference = clearSoftDirty() ? (slot + 1) : 0;
+
+    NATIVECALL(close(cmemfd));
+    NATIVECALL(close(cpmfd));
+    NATIVECALL(close(spmfd));
+#endif
+}
+
+/* Copy the pages of an area from the snapshot process. Returns the number
+ * of copied pages */
+static size_t readSnapshotArea(const Area &area, pid_t pid, int spmfd, int cpmfd, int cmemfd, bool dirty_only)
+{
+    size_t page_count = 0;
+#ifdef __linux__
+    const uint64_t present_mask = (0x1ull << 63) | (0x1ull << 62); // present or swapped
+    const uint64_t soft_dirty_mask = 0x1ull << 55;
+
+    /* Contiguous pages to copy, at the same address in both processes */
+    struct iovec iovs[512];
+    int iov_count = 0;
+    size_t iov_size = 0;
+
+    auto flushCopies = [&]() {
+        if (iov_count == 0)
+            return;
+
+        ssize_t ret = process_vm_readv(pid, iovs, iov_count, iovs, iov_count, 0);
+        if ((ret < 0) || (static_cast<size_t>(ret) != iov_size)) {
+            /* Fallback to reading the process memory file */
+            for (int i = 0; i < iov_count; i++) {
+                ssize_t r = pread(cmemfd, iovs[i].iov_base, iovs[i].iov_len, reinterpret_cast<off_t>(iovs[i].iov_base));
+                if (r != static_cast<ssize_t>(iovs[i].iov_len))
+                    debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not read %zu bytes at %p from process %d", iovs[i].iov_len, iovs[i].iov_base, pid);
             }
-            if (compressed_size != 0) {
-                ss_pagemaps[ss_pagemap_i++] = Area::COMPRESSED_PAGE;
-                Utils::writeAll(pfd, &compressed_size, sizeof(int));
-                Utils::writeAll(pfd, compressed_page, compressed_size);
-                area_size += compressed_size;
+        }
+
+        iov_count = 0;
+        iov_size = 0;
+    };
+
+    uint64_t self_flags[512];
+    uint64_t child_flags[512];
+
+    char* addr = static_cast<char*>(area.addr);
+    char* end = static_cast<char*>(area.endAddr);
+
+    while (addr < end) {
+        size_t count = (end - addr) / 4096;
+        if (count > 512)
+            count = 512;
+
+        off_t pm_offset = reinterpret_cast<uintptr_t>(addr) / 4096 * sizeof(uint64_t);
+        ssize_t self_ret = pread(spmfd, self_flags, count * sizeof(uint64_t), pm_offset);
+        ssize_t child_ret = pread(cpmfd, child_flags, count * sizeof(uint64_t), pm_offset);
+        if ((self_ret != static_cast<ssize_t>(count * sizeof(uint64_t))) ||
+            (child_ret != static_cast<ssize_t>(count * sizeof(uint64_t)))) {
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not read pagemaps at %p", addr);
+            break;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            char* page = addr + i * 4096;
+            bool self_present = self_flags[i] & present_mask;
+
+            /* Page was not modified since the memory matched the snapshot */
+            if (dirty_only && self_present && !(self_flags[i] & soft_dirty_mask))
+                continue;
+
+            if (child_flags[i] & present_mask) {
+                if ((iov_count > 0) &&
+                    (static_cast<char*>(iovs[iov_count-1].iov_base) + iovs[iov_count-1].iov_len == page)) {
+                    iovs[iov_count-1].iov_len += 4096;
+                }
+                else {
+                    if (iov_count == 512)
+                        flushCopies();
+                    iovs[iov_count].iov_base = page;
+                    iovs[iov_count].iov_len = 4096;
+                    iov_count++;
+                }
+                iov_size += 4096;
+                page_count++;
             }
-            else {
-                ss_pagemaps[ss_pagemap_i++] = Area::FULL_PAGE;
-                Utils::writeAll(pfd, static_cast<void*>(curAddr), 4096);
-                area_size += 4096;
+            else if (self_present) {
+                /* Page is absent from the snapshot, drop our own */
+                madvise(page, 4096, MADV_DONTNEED);
             }
         }
+
+        addr += count * 4096;
     }
 
-    /* Writing the last savestate pagemap chunk */
-    Utils::writeAll(pmfd, ss_pagemaps, ss_pagemap_i);
-    area_size += ss_pagemap_i;
+    flushCopies();
+#endif
+    return page_count;
+}
 
-    return area_size;
+/* Clear the soft-dirty bits of all pages, and check that the kernel does
+ * track the pages that are modified afterwards */
+static bool clearSoftDirty()
+{
+#ifdef __linux__
+    int crfd;
+    NATIVECALL(crfd = open("/proc/self/clear_refs", O_WRONLY));
+    if (crfd == -1)
+        return false;
+
+    bool cleared = (Utils::writeAll(crfd, "4\n", 2) == 2);
+    NATIVECALL(close(crfd));
+    if (!cleared)
+        return false;
+
+    /* Writing to a page must now set its soft-dirty bit */
+    volatile char probe = 0;
+    probe = 1;
+
+    int spmfd;
+    NATIVECALL(spmfd = open("/proc/self/pagemap", O_RDONLY));
+    if (spmfd == -1)
+        return false;
+
+    uint64_t entry = 0;
+    off_t pm_offset = reinterpret_cast<uintptr_t>(&probe) / 4096 * sizeof(uint64_t);
+    ssize_t ret = pread(spmfd, &entry, sizeof(entry), pm_offset);
+    NATIVECALL(close(spmfd));
+
+    return (ret == sizeof(entry)) && (entry & (0x1ull << 55));
+#else
+    return false;
+#endif
+}
+
+/* Terminate the process holding a savestate */
+static void killSnapshot(int slot)
+{
+#ifdef __linux__
+    SlotData* slot_data = ReservedMemory::getSlot(slot);
+    if (!slot_data || !slot_data->pid)
+        return;
+
+    kill(slot_data->pid, SIGKILL);
+    waitpid(slot_data->pid, nullptr, 0);
+    slot_data->pid = 0;
+
+    SnapshotTable* snapshots = getSnapshots();
+    if (snapshots->reference == slot + 1)
+        snapshots->reference = 0;
+#endif
 }
 
 }
@@ -23,6 +23,7 @@
 #define LIBTAS_CHECKPOINT_H
 
 #include <string>
+#include <cstdint>
 
 namespace libtas {
 namespace Checkpoint
@@ -35,6 +36,18 @@ namespace Checkpoint
 
     void setCurrentToParent();
 
+    /* Remove the state of a slot, whose savestate path (without extension)
+     * is given, from RAM, from a process or from the disk */
+    void freeState(int index, std::string path);
+
+    /* Memory used by the state stored in RAM or in a process for a slot */
+    uint64_t stateSize(int index);
+
+    /* Clear the soft-dirty bits of the memory for the ram search. This is
+     * refused if incremental savestates rely on the current bits. Returns if
+     * the bits were cleared. */
+    bool clearSoftDirtyForSearch();
+
     int checkCheckpoint();
     int checkRestore();
     void handler(int signum);
@@ -0,0 +1,739 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "LazyRestore.h"
+#include "PageStore.h"
+#include "StateHeader.h"
+#include "../logging.h"
+#include "../GlobalState.h"
+#include "../../shared/SharedConfig.h"
+#include "../global.h" // shared_config
+#include "../../external/lz4.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <csignal>
+#include <cerrno>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/userfaultfd.h>
+#endif
+
+namespace libtas {
+
+/* Maximum number of deferred pages (16 GB) and of registered areas in a table */
+#define LAZY_MAX_PAGES (1 << 22)
+#define LAZY_MAX_RANGES 4096
+
+/* Smaller areas are always loaded immediately. This keeps the small .bss
+ * areas of libraries resident, because the loading thread may use them. */
+#define LAZY_MIN_AREA_SIZE (256 * 1024)
+
+#define LAZY_STACK_SIZE (256 * 1024)
+
+struct LazyPage {
+    uintptr_t addr;
+    off_t offset; // Location of the page, from SaveState::getPageLocation()
+    int size;
+    char flag; // Area::NONE when the page is not deferred anymore
+};
+
+struct LazyRange {
+    uintptr_t addr;
+    size_t size;
+};
+
+/* Deferred pages of a single savestate, sorted by address */
+struct LazyTable {
+    int pmfd;
+    int pfd;
+    int count;
+    int pending;
+    int range_count;
+    LazyRange ranges[LAZY_MAX_RANGES];
+    LazyPage entries[LAZY_MAX_PAGES];
+};
+
+/* Everything used by the loading thread is located in this mapping, which is
+ * skipped by savestates. The thread must never access a deferred page
+ * itself, so it cannot rely on any other global variable. */
+struct LazyMapping {
+    /* Stack of the loading thread, followed by page-aligned buffers */
+    char stack[LAZY_STACK_SIZE];
+    char page[4096];
+    char block[STATEBLOCKPAGES * 4096];
+    char compressed[LZ4_COMPRESSBOUND(STATEBLOCKPAGES * 4096)];
+
+    int uffd;
+    int storefd;
+    int lock;
+
+    /* Range of deferred pages that we are discarding ourselves, and
+     * whether the loading thread has handled the whole range */
+    uintptr_t discard_start;
+    uintptr_t discard_end;
+    int discard_done;
+
+    /* Block that is decompressed in the block buffer, or -1 */
+    int cached_table;
+    off_t cached_block;
+
+    /* Run of pages to discard in the current area */
+    uintptr_t run_start;
+    uintptr_t run_end;
+
+    int errors;
+
+    /* Table of the last loaded state, the other one holds the pages of the
+     * previous state while loading */
+    int current;
+    LazyTable tables[2];
+};
+
+static LazyMapping* lazy = nullptr;
+static size_t lazy_size = 0;
+
+#ifdef __linux__
+
+static void lock(LazyMapping* l)
+{
+    while (__atomic_exchange_n(&l->lock, 1, __ATOMIC_ACQUIRE)) {}
+}
+
+static void unlock(LazyMapping* l)
+{
+    __atomic_store_n(&l->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* The ioctl function is hooked, so we use the raw syscall */
+static int uffdIoctl(LazyMapping* l, unsigned long request, void* arg)
+{
+    return syscall(SYS_ioctl, l->uffd, request, arg);
+}
+
+static void wakePage(LazyMapping* l, uintptr_t addr)
+{
+    struct uffdio_range range;
+    range.start = addr;
+    range.len = 4096;
+    uffdIoctl(l, UFFDIO_WAKE, &range);
+}
+
+/* Install a zero page at addr. Returns false if the operation must be tried
+ * again because the memory layout is being changed by another thread. */
+static bool zeroPage(LazyMapping* l, uintptr_t addr)
+{
+    struct uffdio_zeropage zero;
+    zero.range.start = addr;
+    zero.range.len = 4096;
+    zero.mode = 0;
+    if (uffdIoctl(l, UFFDIO_ZEROPAGE, &zero) == -1) {
+        if (errno == EAGAIN)
+            return false;
+        if (errno == EEXIST)
+            wakePage(l, addr);
+    }
+    return true;
+}
+
+/* Read a deferred page and install it at dst. If the page cannot be read,
+ * a zero page is installed so that the faulting thread is not blocked.
+ * Returns false if the operation must be tried again. */
+static bool copyPage(LazyMapping* l, int table_i, const LazyPage& page, uintptr_t dst)
+{
+    LazyTable& table = l->tables[table_i];
+    const char* src = nullptr;
+
+    if (page.flag == Area::FULL_PAGE) {
+        if (pread(table.pfd, l->page, 4096, page.offset) == 4096)
+            src = l->page;
+    }
+    else if (page.flag == Area::COMPRESSED_PAGE) {
+        if ((pread(table.pfd, l->compressed, page.size, page.offset) == page.size) &&
+            (LZ4_decompress_safe(l->compressed, l->page, page.size, 4096) == 4096))
+            src = l->page;
+    }
+    else if (page.flag == Area::BLOCK_PAGE) {
+        if ((l->cached_table != table_i) || (l->cached_block != page.offset)) {
+            l->cached_block = -1;
+            StateBlock entry;
+            if ((pread(table.pmfd, &entry, sizeof(StateBlock), page.offset) == sizeof(StateBlock)) &&
+                (pread(table.pfd, l->compressed, entry.compressed_size, entry.offset) == entry.compressed_size) &&
+                (LZ4_decompress_safe(l->compressed, l->block, entry.compressed_size, sizeof(l->block)) == entry.page_count * 4096)) {
+                l->cached_table = table_i;
+                l->cached_block = page.offset;
+            }
+        }
+        if (l->cached_block != -1)
+            src = l->block + page.size * 4096;
+    }
+    else if (page.flag == Area::STORE_PAGE) {
+        if (pread(l->storefd, l->page, 4096, page.offset * 4096) == 4096)
+            src = l->page;
+    }
+
+    if (!src) {
+        l->errors++;
+        return zeroPage(l, dst);
+    }
+
+    struct uffdio_copy copy;
+    copy.dst = dst;
+    copy.src = reinterpret_cast<uintptr_t>(src);
+    copy.len = 4096;
+    copy.mode = 0;
+    if (uffdIoctl(l, UFFDIO_COPY, &copy) == -1) {
+        if (errno == EAGAIN)
+            return false;
+        if (errno == EEXIST)
+            wakePage(l, dst);
+    }
+    return true;
+}
+
+/* Index of the first entry at or after addr, between the first and last indexes */
+static int lowerBound(const LazyTable& table, uintptr_t addr, int first, int last)
+{
+    while (first < last) {
+        int mid = first + (last - first) / 2;
+        if (table.entries[mid].addr < addr)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    return first;
+}
+
+static int lowerBound(const LazyTable& table, uintptr_t addr)
+{
+    return lowerBound(table, addr, 0, table.count);
+}
+
+/* Get the deferred page at addr, or nullptr. Pages that are not deferred
+ * anymore may share the same address. */
+static LazyPage* findPage(LazyTable& table, uintptr_t addr)
+{
+    for (int i = lowerBound(table, addr); (i < table.count) && (table.entries[i].addr == addr); i++) {
+        if (table.entries[i].flag != Area::NONE)
+            return &table.entries[i];
+    }
+    return nullptr;
+}
+
+/* Load all deferred pages. This is only called when game threads are
+ * suspended, so the memory layout won't change. */
+static void loadAll(LazyMapping* l)
+{
+    for (int t = 0; t < 2; t++) {
+        LazyTable& table = l->tables[t];
+        for (int i = 0; (i < table.count) && (table.pending > 0); i++) {
+            LazyPage& page = table.entries[i];
+            if (page.flag == Area::NONE)
+                continue;
+            while (!copyPage(l, t, page, page.addr)) {}
+            page.flag = Area::NONE;
+            table.pending--;
+        }
+    }
+}
+
+/* Forget all deferred pages of a range */
+static void dropRange(LazyMapping* l, uintptr_t start, uintptr_t end)
+{
+    for (int t = 0; t < 2; t++) {
+        LazyTable& table = l->tables[t];
+        for (int i = lowerBound(table, start); (i < table.count) && (table.entries[i].addr < end); i++) {
+            if (table.entries[i].flag != Area::NONE) {
+                table.entries[i].flag = Area::NONE;
+                table.pending--;
+            }
+        }
+    }
+}
+
+/* Deferred pages of an area moved by mremap are now located in another range.
+ * The table must stay sorted, so the moved entries are rotated to their new
+ * position. */
+static void moveRange(LazyMapping* l, uintptr_t from, uintptr_t to, size_t len)
+{
+    for (int t = 0; t < 2; t++) {
+        LazyTable& table = l->tables[t];
+        int first = lowerBound(table, from);
+        int last = lowerBound(table, from + len, first, table.count);
+        if (first == last)
+            continue;
+
+        for (int i = first; i < last; i++)
+            table.entries[i].addr = table.entries[i].addr - from + to;
+
+        if (to > from) {
+            int dest = lowerBound(table, to, last, table.count);
+            std::rotate(table.entries + first, table.entries + last, table.entries + dest);
+        }
+        else {
+            int dest = lowerBound(table, to, 0, first);
+            std::rotate(table.entries + dest, table.entries + first, table.entries + last);
+        }
+    }
+
+    /* Remember the new range, so that it is unregistered later */
+    LazyTable& table = l->tables[l->current];
+    if (table.range_count < LAZY_MAX_RANGES) {
+        table.ranges[table.range_count].addr = to;
+        table.ranges[table.range_count].size = len;
+        table.range_count++;
+    }
+}
+
+static void handleFault(LazyMapping* l, uintptr_t addr)
+{
+    for (int t = 0; t < 2; t++) {
+        LazyPage* page = findPage(l->tables[t], addr);
+        if (page) {
+            if (copyPage(l, t, *page, addr)) {
+                page->flag = Area::NONE;
+                l->tables[t].pending--;
+            }
+            else {
+                /* The thread will fault again after the layout change */
+                wakePage(l, addr);
+            }
+            return;
+        }
+    }
+
+    /* Page is not deferred, it was discarded as a zero page */
+    if (!zeroPage(l, addr))
+        wakePage(l, addr);
+}
+
+static bool registerRange(LazyMapping* l, uintptr_t addr, size_t size)
+{
+    struct uffdio_register reg;
+    reg.range.start = addr;
+    reg.range.len = size;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    return uffdIoctl(l, UFFDIO_REGISTER, &reg) == 0;
+}
+
+static void unregisterRange(LazyMapping* l, uintptr_t addr, size_t size)
+{
+    struct uffdio_range range;
+    range.start = addr;
+    range.len = size;
+    uffdIoctl(l, UFFDIO_UNREGISTER, &range);
+}
+
+static void* lazyLoop(void* arg)
+{
+    LazyMapping* l = static_cast<LazyMapping*>(arg);
+
+    /* This thread only executes our own code, and must not go through any hook */
+    GlobalState::setNative(true);
+
+    /* Resolve now the symbols used by this thread, because the dynamic linker
+     * could access deferred pages when resolving them later. */
+    LZ4_decompress_safe(l->compressed, l->page, 0, 4096);
+    pread(-1, l->page, 0, 0);
+    syscall(SYS_getpid);
+    errno = 0;
+
+    while (true) {
+        struct uffd_msg msg;
+        if (read(l->uffd, &msg, sizeof(msg)) != sizeof(msg))
+            continue;
+
+        lock(l);
+        switch (msg.event) {
+            case UFFD_EVENT_PAGEFAULT:
+                handleFault(l, msg.arg.pagefault.address & ~static_cast<uint64_t>(4095));
+                break;
+            case UFFD_EVENT_REMOVE:
+                /* Our own discarding must not drop the deferred pages. The
+                 * range may be reported in several events, one for each
+                 * mapping, in increasing addresses. */
+                if ((msg.arg.remove.start >= l->discard_start) && (msg.arg.remove.end <= l->discard_end)) {
+                    if (msg.arg.remove.end == l->discard_end)
+                        __atomic_store_n(&l->discard_done, 1, __ATOMIC_RELEASE);
+                    break;
+                }
+
+                /* Pages were discarded by the game, they must read as zero */
+                dropRange(l, msg.arg.remove.start, msg.arg.remove.end);
+                break;
+            case UFFD_EVENT_UNMAP:
+                dropRange(l, msg.arg.remove.start, msg.arg.remove.end);
+                break;
+            case UFFD_EVENT_REMAP:
+                moveRange(l, msg.arg.remap.from, msg.arg.remap.to, msg.arg.remap.len);
+                break;
+        }
+        unlock(l);
+    }
+
+    return nullptr;
+}
+
+static void closeTable(LazyTable& table)
+{
+    if (table.pmfd >= 0)
+        NATIVECALL(close(table.pmfd));
+    if (table.pfd >= 0)
+        NATIVECALL(close(table.pfd));
+    table.pmfd = -1;
+    table.pfd = -1;
+}
+
+static void flushRun(LazyMapping* l)
+{
+    if (l->run_end == l->run_start)
+        return;
+
+    /* Our own discarding must not drop the deferred pages. madvise() returns
+     * once the loading thread has read the events, which may be before it
+     * handled them, so we wait for the thread to acknowledge the range
+     * before forgetting it. The area is registered, so events are always
+     * generated. */
+    lock(l);
+    l->discard_start = l->run_start;
+    l->discard_end = l->run_end;
+    l->discard_done = 0;
+    unlock(l);
+
+    MYASSERT(madvise(reinterpret_cast<void*>(l->run_start), l->run_end - l->run_start, MADV_DONTNEED) == 0)
+
+    while (!__atomic_load_n(&l->discard_done, __ATOMIC_ACQUIRE)) {}
+
+    lock(l);
+    l->discard_start = l->discard_end = 0;
+    unlock(l);
+
+    l->run_start = l->run_end = 0;
+}
+
+#endif
+
+void LazyRestore::init()
+{
+#ifdef __linux__
+    if (lazy)
+        return;
+
+    int uffd = -1;
+#ifdef SYS_userfaultfd
+    uffd = syscall(SYS_userfaultfd, O_CLOEXEC);
+#endif
+#ifdef USERFAULTFD_IOC_NEW
+    if (uffd < 0) {
+        /* Since Linux 6.1, access may be granted through /dev/userfaultfd */
+        int devfd;
+        NATIVECALL(devfd = open("/dev/userfaultfd", O_RDWR | O_CLOEXEC));
+        if (devfd >= 0) {
+            uffd = syscall(SYS_ioctl, devfd, USERFAULTFD_IOC_NEW, O_CLOEXEC);
+            NATIVECALL(close(devfd));
+        }
+    }
+#endif
+    if (uffd < 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "userfaultfd is not available (errno %d), states will be loaded entirely. Setting vm.unprivileged_userfaultfd to 1 may fix this", errno);
+        return;
+    }
+
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_EVENT_REMOVE | UFFD_FEATURE_EVENT_UNMAP | UFFD_FEATURE_EVENT_REMAP;
+    if (syscall(SYS_ioctl, uffd, UFFDIO_API, &api) != 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "userfaultfd does not support the required features");
+        NATIVECALL(close(uffd));
+        return;
+    }
+
+    /* Surround the mapping with guard pages, so that it never gets merged
+     * with a neighbour mapping and can be identified when saving. */
+    lazy_size = (sizeof(LazyMapping) + 4095) & ~static_cast<size_t>(4095);
+    void* addr = mmap(nullptr, lazy_size + (2 * 4096), PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not allocate the lazy loading table");
+        NATIVECALL(close(uffd));
+        return;
+    }
+    addr = static_cast<char*>(addr) + 4096;
+    MYASSERT(mprotect(addr, lazy_size, PROT_READ | PROT_WRITE) == 0)
+
+    LazyMapping* l = static_cast<LazyMapping*>(addr);
+    l->uffd = uffd;
+    l->storefd = -1;
+    l->cached_table = -1;
+    l->cached_block = -1;
+    for (int t = 0; t < 2; t++) {
+        l->tables[t].pmfd = -1;
+        l->tables[t].pfd = -1;
+    }
+
+    /* Block all signals while spawning, so that the thread inherits a full
+     * signal mask and never receives signals targeted at game threads. */
+    sigset_t mask, oldmask;
+    sigfillset(&mask);
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &mask, &oldmask));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    NATIVECALL(pthread_attr_setstack(&attr, l->stack, LAZY_STACK_SIZE));
+
+    pthread_t pthread_id;
+    int ret;
+    NATIVECALL(ret = pthread_create(&pthread_id, &attr, lazyLoop, l));
+    pthread_attr_destroy(&attr);
+
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &oldmask, nullptr));
+
+    if (ret != 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not create the lazy loading thread, error %d", ret);
+        munmap(static_cast<char*>(addr) - 4096, lazy_size + (2 * 4096));
+        NATIVECALL(close(uffd));
+        return;
+    }
+
+    lazy = l;
+#endif
+}
+
+bool LazyRestore::isArea(const Area *area)
+{
+    return lazy && (area->addr == static_cast<void*>(lazy)) && (area->size == lazy_size);
+}
+
+bool LazyRestore::enabled()
+{
+    /* Incremental savestates and snapshots rely on the current content of
+     * memory pages */
+    return lazy &&
+        (shared_config.savestate_settings & SharedConfig::SS_LAZY) &&
+        !(shared_config.savestate_settings & (SharedConfig::SS_INCREMENTAL | SharedConfig::SS_SNAPSHOT));
+}
+
+void LazyRestore::beginLoad(const char* pagemappath, const char* pagespath, int pagemapfd, int pagesfd)
+{
+#ifdef __linux__
+    LazyMapping* l = lazy;
+    if (!l)
+        return;
+
+    /* Open our own descriptors, because the savestate may be closed or
+     * replaced while pages are still deferred */
+    int pmfd, pfd;
+    if (shared_config.savestate_settings & SharedConfig::SS_RAM) {
+        NATIVECALL(pmfd = dup(pagemapfd));
+        NATIVECALL(pfd = dup(pagesfd));
+    }
+    else {
+        NATIVECALL(pmfd = open(pagemappath, O_RDONLY | O_CLOEXEC));
+        NATIVECALL(pfd = open(pagespath, O_RDONLY | O_CLOEXEC));
+    }
+    int storefd = PageStore::isInit() ? PageStore::fd() : -1;
+
+    lock(l);
+    l->current = 1 - l->current;
+    LazyTable& table = l->tables[l->current];
+    table.pmfd = pmfd;
+    table.pfd = pfd;
+    table.count = 0;
+    table.pending = 0;
+    table.range_count = 0;
+    l->storefd = storefd;
+    if (l->cached_table == l->current)
+        l->cached_block = -1;
+    unlock(l);
+#endif
+}
+
+bool LazyRestore::beginArea(const Area& area)
+{
+#ifdef __linux__
+    LazyMapping* l = lazy;
+    LazyTable& table = l->tables[l->current];
+
+    if (!(area.flags & Area::AREA_ANON) || (area.flags & (Area::AREA_SHARED | Area::AREA_STACK)))
+        return false;
+
+    if ((area.prot == PROT_NONE) || (area.size < LAZY_MIN_AREA_SIZE))
+        return false;
+
+    if (table.range_count == LAZY_MAX_RANGES)
+        return false;
+
+    /* Register the area before discarding any page, so that a deferred page
+     * accessed while loading the rest of the area is still loaded */
+    uintptr_t addr = reinterpret_cast<uintptr_t>(area.addr);
+    if (!registerRange(l, addr, area.size))
+        return false;
+
+    table.ranges[table.range_count].addr = addr;
+    table.ranges[table.range_count].size = area.size;
+    table.range_count++;
+
+    l->run_start = l->run_end = 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool LazyRestore::deferPage(char* addr, char flag, off_t offset, int size)
+{
+#ifdef __linux__
+    LazyMapping* l = lazy;
+    LazyTable& table = l->tables[l->current];
+
+    bool zero = (flag == Area::NO_PAGE) || (flag == Area::ZERO_PAGE);
+    bool data = (flag == Area::FULL_PAGE) || (flag == Area::COMPRESSED_PAGE) ||
+        (flag == Area::BLOCK_PAGE) || (flag == Area::STORE_PAGE);
+
+    if (!zero && !data)
+        return false;
+
+    if (data && (table.count == LAZY_MAX_PAGES))
+        return false;
+
+    uintptr_t page_addr = reinterpret_cast<uintptr_t>(addr);
+
+    lock(l);
+
+    /* The page of the previous state is replaced */
+    LazyTable& old_table = l->tables[1 - l->current];
+    LazyPage* old_page = findPage(old_table, page_addr);
+    if (old_page) {
+        old_page->flag = Area::NONE;
+        old_table.pending--;
+    }
+
+    if (data) {
+        LazyPage& page = table.entries[table.count++];
+        page.addr = page_addr;
+        page.offset = offset;
+        page.size = size;
+        page.flag = flag;
+        table.pending++;
+    }
+
+    unlock(l);
+
+    /* Discard the page, so that accessing it triggers the loading */
+    if (l->run_end != page_addr) {
+        flushRun(l);
+        l->run_start = page_addr;
+    }
+    l->run_end = page_addr + 4096;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void LazyRestore::endArea()
+{
+#ifdef __linux__
+    flushRun(lazy);
+#endif
+}
+
+void LazyRestore::endLoad()
+{
+#ifdef __linux__
+    LazyMapping* l = lazy;
+    if (!l)
+        return;
+
+    lock(l);
+
+    /* Remaining pages of the previous state are in areas that were removed,
+     * or in pages that were restored without being accessed, like skipped
+     * unmapped pages. They must not be loaded anymore. */
+    LazyTable& old_table = l->tables[1 - l->current];
+    old_table.count = 0;
+    old_table.pending = 0;
+
+    /* Unregister the areas of the previous state, and register again the
+     * areas of the new state which may have been included */
+    for (int r = 0; r < old_table.range_count; r++)
+        unregisterRange(l, old_table.ranges[r].addr, old_table.ranges[r].size);
+    old_table.range_count = 0;
+
+    LazyTable& table = l->tables[l->current];
+    for (int r = 0; r < table.range_count; r++)
+        registerRange(l, table.ranges[r].addr, table.ranges[r].size);
+
+    if (l->cached_table != l->current)
+        l->cached_block = -1;
+
+    int errors = l->errors;
+    l->errors = 0;
+
+    unlock(l);
+
+    closeTable(old_table);
+
+    if (errors > 0)
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not load %d deferred pages", errors);
+#endif
+}
+
+void LazyRestore::finish()
+{
+#ifdef __linux__
+    LazyMapping* l = lazy;
+    if (!l)
+        return;
+
+    lock(l);
+    loadAll(l);
+    for (int t = 0; t < 2; t++) {
+        LazyTable& table = l->tables[t];
+        for (int r = 0; r < table.range_count; r++)
+            unregisterRange(l, table.ranges[r].addr, table.ranges[r].size);
+        table.range_count = 0;
+        table.count = 0;
+    }
+    l->cached_block = -1;
+    int errors = l->errors;
+    l->errors = 0;
+    unlock(l);
+
+    for (int t = 0; t < 2; t++)
+        closeTable(l->tables[t]);
+
+    if (errors > 0)
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not load %d deferred pages", errors);
+#endif
+}
+
+int LazyRestore::pendingCount()
+{
+    if (!lazy)
+        return 0;
+    return lazy->tables[0].pending + lazy->tables[1].pending;
+}
+
+}
@@ -0,0 +1,68 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_LAZYRESTORE_H
+#define LIBTAS_LAZYRESTORE_H
+
+#include "MemArea.h"
+#include <sys/types.h>
+
+namespace libtas {
+namespace LazyRestore {
+
+    /* Create the userfaultfd object, the table of deferred pages and the
+     * thread that loads pages when they are first accessed. The table is
+     * located in a dedicated mapping that is skipped by savestates, so it must
+     * be created before any savestate is made. */
+    void init();
+
+    /* Is this area the table mapping? */
+    bool isArea(const Area *area);
+
+    /* Are pages of the next loaded state deferred until they are accessed? */
+    bool enabled();
+
+    /* Open the files of the savestate that is being loaded. Pages of the
+     * previous state that are still deferred are replaced while loading. */
+    void beginLoad(const char* pagemappath, const char* pagespath, int pagemapfd, int pagesfd);
+
+    /* Start deferring pages of an area. Returns if pages of this area can be
+     * deferred. */
+    bool beginArea(const Area& area);
+
+    /* Defer the loading of a page, or discard a zero page. Offset and size
+     * are given by SaveState::getPageLocation(). Returns false if the page
+     * must be loaded now. */
+    bool deferPage(char* addr, char flag, off_t offset, int size);
+
+    /* Discard the deferred pages of the area */
+    void endArea();
+
+    /* Forget the pages of the previous state that were not replaced */
+    void endLoad();
+
+    /* Load all deferred pages, before memory is being saved */
+    void finish();
+
+    /* Number of pages that are still deferred */
+    int pendingCount();
+}
+}
+
+#endif
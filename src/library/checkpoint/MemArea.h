@@ -53,6 +53,8 @@ struct Area {
         FULL_PAGE, /* Area contains a copy of the page */
         BASE_PAGE, /* Page was not modified from base savestate */
         COMPRESSED_PAGE, /* Full page but compressed */
+        BLOCK_PAGE, /* Page is stored inside a compressed block */
+        STORE_PAGE, /* Page is stored in the page store, its id is saved */
     };
 
     void* addr;
@@ -0,0 +1,163 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "PageScan.h"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace libtas {
+
+/* Generic implementation, checking 64 bytes at a time */
+static bool isZeroPageGeneric(const void* addr)
+{
+    const uint64_t* buf = static_cast<const uint64_t*>(addr);
+    for (int i = 0; i < 4096 / 8; i += 8) {
+        if (buf[i + 0] | buf[i + 1] | buf[i + 2] | buf[i + 3] |
+            buf[i + 4] | buf[i + 5] | buf[i + 6] | buf[i + 7])
+            return false;
+    }
+    return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* SSE2 implementation, checking 128 bytes at a time */
+__attribute__((target("sse2")))
+static bool isZeroPageSSE2(const void* addr)
+{
+    const __m128i* buf = static_cast<const __m128i*>(addr);
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < 4096 / 16; i += 8) {
+        __m128i acc = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_load_si128(buf + i + 0), _mm_load_si128(buf + i + 1)),
+                         _mm_or_si128(_mm_load_si128(buf + i + 2), _mm_load_si128(buf + i + 3))),
+            _mm_or_si128(_mm_or_si128(_mm_load_si128(buf + i + 4), _mm_load_si128(buf + i + 5)),
+                         _mm_or_si128(_mm_load_si128(buf + i + 6), _mm_load_si128(buf + i + 7))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+            return false;
+    }
+    return true;
+}
+
+/* AVX2 implementation, checking 256 bytes at a time */
+__attribute__((target("avx2")))
+static bool isZeroPageAVX2(const void* addr)
+{
+    const __m256i* buf = static_cast<const __m256i*>(addr);
+    for (int i = 0; i < 4096 / 32; i += 8) {
+        __m256i acc = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(_mm256_load_si256(buf + i + 0), _mm256_load_si256(buf + i + 1)),
+                            _mm256_or_si256(_mm256_load_si256(buf + i + 2), _mm256_load_si256(buf + i + 3))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_load_si256(buf + i + 4), _mm256_load_si256(buf + i + 5)),
+                            _mm256_or_si256(_mm256_load_si256(buf + i + 6), _mm256_load_si256(buf + i + 7))));
+        if (!_mm256_testz_si256(acc, acc))
+            return false;
+    }
+    return true;
+}
+
+#endif
+
+typedef bool (*ZeroPageFunc)(const void*);
+
+/* Select the implementation on first use. This only reads the cpuid
+ * results, so it can be done inside the checkpoint handler. */
+static ZeroPageFunc zeroPageFunc()
+{
+    static ZeroPageFunc func = nullptr;
+    if (func)
+        return func;
+
+    func = isZeroPageGeneric;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        func = isZeroPageAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        func = isZeroPageSSE2;
+#endif
+    return func;
+}
+
+bool PageScan::isZeroPage(const void* addr)
+{
+    return zeroPageFunc()(addr);
+}
+
+void PageScan::classify(const uint64_t* pagemaps, int nb_pages, Window &window)
+{
+    window.nb_pages = nb_pages;
+    memset(window.present, 0, sizeof(window.present));
+    memset(window.swapped, 0, sizeof(window.swapped));
+    memset(window.soft_dirty, 0, sizeof(window.soft_dirty));
+    memset(window.zero, 0, sizeof(window.zero));
+    memset(window.dirty, 0, sizeof(window.dirty));
+
+    if (!pagemaps) {
+        for (int w = 0; w < WINDOW_WORDS; w++) {
+            window.present[w] = validMask(nb_pages, w);
+            window.soft_dirty[w] = window.present[w];
+        }
+        return;
+    }
+
+    /* Bit 63 is page present, bit 62 is page swapped and bit 55 is soft-dirty.
+     * Written without branches, so that the compiler can vectorize it. */
+    for (int w = 0; w < WINDOW_WORDS; w++) {
+        int count = nb_pages - 64*w;
+        if (count <= 0)
+            break;
+        if (count > 64)
+            count = 64;
+
+        const uint64_t* entries = pagemaps + 64*w;
+        uint64_t present = 0;
+        uint64_t swapped = 0;
+        uint64_t soft_dirty = 0;
+        for (int i = 0; i < count; i++) {
+            present |= (entries[i] >> 63) << i;
+            swapped |= ((entries[i] >> 62) & 0x1) << i;
+            soft_dirty |= ((entries[i] >> 55) & 0x1) << i;
+        }
+        window.present[w] = present;
+        window.swapped[w] = swapped;
+        window.soft_dirty[w] = soft_dirty;
+    }
+}
+
+void PageScan::findZeroPages(const char* addr, const uint64_t* candidates, Window &window)
+{
+    ZeroPageFunc func = zeroPageFunc();
+    for (int w = 0; w < WINDOW_WORDS; w++) {
+        uint64_t bits = candidates[w] & validMask(window.nb_pages, w);
+        uint64_t zero = 0;
+        while (bits) {
+            int i = lowestBit(bits);
+            bits &= bits - 1;
+            if (func(addr + (64*w + i) * 4096))
+                zero |= 1ull << i;
+        }
+        window.zero[w] |= zero;
+    }
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_PAGESCAN_H
+#define LIBTAS_PAGESCAN_H
+
+#include <cstdint>
+
+namespace libtas {
+namespace PageScan {
+
+    /* Number of pages classified at once (2 MB of memory) */
+    static const int WINDOW_PAGES = 512;
+    static const int WINDOW_WORDS = WINDOW_PAGES / 64;
+
+    /* Bitmaps of the pages of a window, bit i of word j describing page
+     * 64*j+i. Bits past the number of pages of the window are never set. */
+    struct Window {
+        int nb_pages;
+        uint64_t present[WINDOW_WORDS]; // page is mapped in memory
+        uint64_t swapped[WINDOW_WORDS]; // page is swapped out
+        uint64_t soft_dirty[WINDOW_WORDS]; // page was written since soft-dirty bits were cleared
+        uint64_t zero[WINDOW_WORDS]; // page only contains zeros
+        uint64_t dirty[WINDOW_WORDS]; // page must be stored in the savestate
+    };
+
+    /* Build the present, swapped and soft-dirty bitmaps from a chunk of
+     * /proc/self/pagemap entries. If pagemaps is null, all pages are
+     * considered present and soft-dirty. Other bitmaps are cleared. */
+    void classify(const uint64_t* pagemaps, int nb_pages, Window &window);
+
+    /* Check the pages of the window starting at addr that have their bit set
+     * in candidates, and set the bit in the zero bitmap of the ones that only
+     * contain zeros. */
+    void findZeroPages(const char* addr, const uint64_t* candidates, Window &window);
+
+    /* Returns if the page only contains zeros, using the widest vector
+     * instructions supported by the processor */
+    bool isZeroPage(const void* addr);
+
+    /* Index of the lowest bit set in a non-zero word, used to iterate over the
+     * set bits of a bitmap */
+    inline int lowestBit(uint64_t word) {return __builtin_ctzll(word);}
+
+    /* Mask of the valid bits of word `w` of a window of `nb_pages` pages */
+    inline uint64_t validMask(int nb_pages, int w)
+    {
+        int bits = nb_pages - 64*w;
+        if (bits <= 0) return 0;
+        if (bits >= 64) return ~0ull;
+        return (1ull << bits) - 1;
+    }
+}
+}
+
+#endif
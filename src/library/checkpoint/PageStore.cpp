@@ -0,0 +1,377 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "PageStore.h"
+#include "ReservedMemory.h"
+#include "../logging.h"
+#include "../../shared/SharedConfig.h"
+#include "../global.h" // shared_config
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstring>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace libtas {
+
+/* Maximum number of distinct pages (16 GB) and size of the hash table */
+#define STORE_MAX_PAGES (1 << 22)
+#define STORE_TABLE_SIZE (1 << 23)
+
+/* Number of tombstones above which the table is rehashed, so that probing
+ * sequences always end on an empty slot */
+#define STORE_MAX_TOMBSTONES (STORE_TABLE_SIZE / 4)
+
+/* Values of StoreEntry::id_plus_one that don't refer to a page */
+#define STORE_EMPTY 0
+#define STORE_TOMBSTONE 0xffffffff
+
+struct StoreHeader {
+    int fd;
+    uint32_t next_id; // Next id never used
+    uint32_t free_count; // Number of ids in the free list
+    uint32_t page_count; // Number of referenced pages
+    uint32_t tombstone_count; // Number of tombstones in the table
+};
+
+struct StoreEntry {
+    uint64_t hash1;
+    uint64_t hash2;
+    uint32_t id_plus_one;
+    uint32_t refcount;
+};
+
+/* The store state must not be overwritten when loading a savestate, so it is
+ * entirely located in the skipped mapping. Only its address, which never
+ * changes, is stored in regular memory. */
+struct StoreMapping {
+    StoreHeader header;
+    StoreEntry entries[STORE_TABLE_SIZE];
+    uint32_t slots[STORE_MAX_PAGES]; // Table slot of each page id
+    uint32_t free_ids[STORE_MAX_PAGES];
+    StoreEntry rehash_entries[STORE_MAX_PAGES]; // Live entries during a rehash
+    char slot_paths[SLOTS_MAX][1024]; // Savestate path of each slot using the store
+};
+
+static char storepath[1024] = "\0";
+static StoreMapping* store = nullptr;
+static size_t store_size = 0;
+
+/* 128-bit page hash, computed as two interleaved xxHash64 with different seeds */
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t hashMerge(uint64_t acc, uint64_t val)
+{
+    acc ^= hashRound(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static inline uint64_t hashFinish(const uint64_t* v)
+{
+    uint64_t h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+    for (int i = 0; i < 4; i++)
+        h = hashMerge(h, v[i]);
+    h += 4096;
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void hashPage(const char* page, uint64_t& hash1, uint64_t& hash2)
+{
+    const uint64_t seed1 = 0;
+    const uint64_t seed2 = PRIME64_3;
+    uint64_t a[4] = {seed1 + PRIME64_1 + PRIME64_2, seed1 + PRIME64_2, seed1, seed1 - PRIME64_1};
+    uint64_t b[4] = {seed2 + PRIME64_1 + PRIME64_2, seed2 + PRIME64_2, seed2, seed2 - PRIME64_1};
+
+    const uint64_t* p = reinterpret_cast<const uint64_t*>(page);
+    for (int i = 0; i < 4096 / 8; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            a[j] = hashRound(a[j], p[i+j]);
+            b[j] = hashRound(b[j], p[i+j]);
+        }
+    }
+
+    hash1 = hashFinish(a);
+    hash2 = hashFinish(b);
+}
+
+void PageStore::setPath(std::string path)
+{
+    strncpy(storepath, path.c_str(), 1023);
+}
+
+void PageStore::init()
+{
+    if (store)
+        return;
+
+    /* Surround the mapping with guard pages, so that it never gets merged
+     * with a neighbour mapping and can be identified when saving. */
+    store_size = (sizeof(StoreMapping) + 4095) & ~static_cast<size_t>(4095);
+    void* addr = mmap(nullptr, store_size + (2 * 4096), PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not allocate the page store table");
+        return;
+    }
+    addr = static_cast<char*>(addr) + 4096;
+    MYASSERT(mprotect(addr, store_size, PROT_READ | PROT_WRITE) == 0)
+
+    int fd = -1;
+#ifdef __linux__
+    if (shared_config.savestate_settings & SharedConfig::SS_RAM) {
+        fd = syscall(SYS_memfd_create, "pagestore", 0);
+    }
+    else
+#endif
+    if (storepath[0] != '\0') {
+        NATIVECALL(fd = open(storepath, O_RDWR | O_CREAT | O_TRUNC, 0644));
+    }
+
+    if (fd < 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not create the page store file");
+        munmap(static_cast<char*>(addr) - 4096, store_size + (2 * 4096));
+        return;
+    }
+
+    store = static_cast<StoreMapping*>(addr);
+    store->header.fd = fd;
+}
+
+bool PageStore::isInit()
+{
+    return store != nullptr;
+}
+
+bool PageStore::enabled()
+{
+    return store &&
+        (shared_config.savestate_settings & SharedConfig::SS_DEDUP) &&
+        !(shared_config.savestate_settings & SharedConfig::SS_FORK);
+}
+
+bool PageStore::isArea(const Area *area)
+{
+    return store && (area->addr == static_cast<void*>(store)) && (area->size == store_size);
+}
+
+/* Rebuild the hash table without tombstones. Live entries are moved to a
+ * scratch array, then inserted back into the cleared table. */
+static void rehash()
+{
+    uint32_t count = 0;
+    for (uint32_t slot = 0; slot < STORE_TABLE_SIZE; slot++) {
+        const StoreEntry& entry = store->entries[slot];
+        if ((entry.id_plus_one != STORE_EMPTY) && (entry.id_plus_one != STORE_TOMBSTONE))
+            store->rehash_entries[count++] = entry;
+    }
+
+    memset(store->entries, 0, sizeof(store->entries));
+
+    for (uint32_t i = 0; i < count; i++) {
+        const StoreEntry& entry = store->rehash_entries[i];
+        uint32_t slot = entry.hash1 & (STORE_TABLE_SIZE - 1);
+        while (store->entries[slot].id_plus_one != STORE_EMPTY)
+            slot = (slot + 1) & (STORE_TABLE_SIZE - 1);
+        store->entries[slot] = entry;
+        store->slots[entry.id_plus_one - 1] = slot;
+    }
+
+    store->header.tombstone_count = 0;
+
+    /* Give back the memory of the scratch array */
+    madvise(store->rehash_entries, sizeof(store->rehash_entries), MADV_DONTNEED);
+
+    debuglogstdio(LCF_CHECKPOINT, "Rehashed the page store table with %u pages", count);
+}
+
+int64_t PageStore::put(const char* page)
+{
+    if (store->header.tombstone_count > STORE_MAX_TOMBSTONES)
+        rehash();
+
+    uint64_t hash1, hash2;
+    hashPage(page, hash1, hash2);
+
+    /* Look for the page in the table, remembering the first free slot */
+    uint32_t slot = hash1 & (STORE_TABLE_SIZE - 1);
+    int64_t free_slot = -1;
+    for (uint32_t probe = 0; probe < STORE_TABLE_SIZE; probe++) {
+        StoreEntry& entry = store->entries[slot];
+        if (entry.id_plus_one == STORE_EMPTY) {
+            if (free_slot == -1)
+                free_slot = slot;
+            break;
+        }
+        if (entry.id_plus_one == STORE_TOMBSTONE) {
+            if (free_slot == -1)
+                free_slot = slot;
+        }
+        else if ((entry.hash1 == hash1) && (entry.hash2 == hash2)) {
+            /* Check that the pages are identical, so that a hash collision
+             * never restores the content of another page */
+            char stored[4096];
+            ssize_t ret = pread(store->header.fd, stored, 4096, static_cast<off_t>(entry.id_plus_one - 1) * 4096);
+            if ((ret == 4096) && (memcmp(stored, page, 4096) == 0)) {
+                entry.refcount++;
+                return entry.id_plus_one - 1;
+            }
+            debuglogstdio(LCF_CHECKPOINT, "Page store hash collision with page %u", entry.id_plus_one - 1);
+        }
+        slot = (slot + 1) & (STORE_TABLE_SIZE - 1);
+    }
+
+    /* The table is full */
+    if (free_slot == -1)
+        return -1;
+
+    /* Get an id for the new page */
+    uint32_t id;
+    if (store->header.free_count > 0) {
+        id = store->free_ids[--store->header.free_count];
+    }
+    else if (store->header.next_id < STORE_MAX_PAGES) {
+        id = store->header.next_id++;
+    }
+    else {
+        return -1;
+    }
+
+    ssize_t ret = pwrite(store->header.fd, page, 4096, static_cast<off_t>(id) * 4096);
+    if (ret != 4096) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not write to the page store, errno %d", errno);
+        store->free_ids[store->header.free_count++] = id;
+        return -1;
+    }
+
+    StoreEntry& entry = store->entries[free_slot];
+    if (entry.id_plus_one == STORE_TOMBSTONE)
+        store->header.tombstone_count--;
+    entry.hash1 = hash1;
+    entry.hash2 = hash2;
+    entry.id_plus_one = id + 1;
+    entry.refcount = 1;
+    store->slots[id] = free_slot;
+    store->header.page_count++;
+
+    return id;
+}
+
+void PageStore::release(int64_t id)
+{
+    StoreEntry& entry = store->entries[store->slots[id]];
+    MYASSERT(entry.id_plus_one == id + 1)
+
+    if (--entry.refcount == 0) {
+        entry.id_plus_one = STORE_TOMBSTONE;
+        store->header.tombstone_count++;
+        store->free_ids[store->header.free_count++] = id;
+        store->header.page_count--;
+    }
+}
+
+void PageStore::setSlotPath(int slot, const char* path)
+{
+    if ((slot < 0) || (slot >= SLOTS_MAX))
+        return;
+
+    strncpy(store->slot_paths[slot], path, 1023);
+    store->slot_paths[slot][1023] = '\0';
+}
+
+const char* PageStore::slotPath(int slot)
+{
+    if ((slot < 0) || (slot >= SLOTS_MAX))
+        return "";
+
+    return store->slot_paths[slot];
+}
+
+void PageStore::beginRebuild()
+{
+    /* Only go through the ids in use, instead of the whole table */
+    for (uint32_t id = 0; id < store->header.next_id; id++) {
+        StoreEntry& entry = store->entries[store->slots[id]];
+        if (entry.id_plus_one == id + 1)
+            entry.refcount = 0;
+    }
+}
+
+void PageStore::addReference(int64_t id)
+{
+    StoreEntry& entry = store->entries[store->slots[id]];
+    MYASSERT(entry.id_plus_one == id + 1)
+    entry.refcount++;
+}
+
+void PageStore::endRebuild()
+{
+    uint32_t freed = 0;
+    for (uint32_t id = 0; id < store->header.next_id; id++) {
+        StoreEntry& entry = store->entries[store->slots[id]];
+        if ((entry.id_plus_one == id + 1) && (entry.refcount == 0)) {
+            entry.id_plus_one = STORE_TOMBSTONE;
+            store->header.tombstone_count++;
+            store->free_ids[store->header.free_count++] = id;
+            store->header.page_count--;
+            freed++;
+        }
+    }
+
+    debuglogstdio(LCF_CHECKPOINT, "Rebuilt the page store references, %u pages were freed", freed);
+}
+
+void PageStore::read(int64_t id, char* page)
+{
+    MYASSERT(pread(store->header.fd, page, 4096, static_cast<off_t>(id) * 4096) == 4096)
+}
+
+int PageStore::fd()
+{
+    return store->header.fd;
+}
+
+uint64_t PageStore::pageCount()
+{
+    return store ? store->header.page_count : 0;
+}
+
+}
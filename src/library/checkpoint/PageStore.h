@@ -0,0 +1,79 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_PAGESTORE_H
+#define LIBTAS_PAGESTORE_H
+
+#include "MemArea.h"
+#include <cstdint>
+#include <string>
+
+namespace libtas {
+namespace PageStore {
+
+    /* Set the path of the store file, when savestates are stored on disk */
+    void setPath(std::string path);
+
+    /* Create the store file (or memfd) and the hash table. The table is
+     * located in a dedicated mapping that is skipped by savestates, so it must
+     * be created before any savestate is made. */
+    void init();
+
+    /* Was the store initialized? */
+    bool isInit();
+
+    /* Are new savestates storing pages in the store? */
+    bool enabled();
+
+    /* Is this area the hash table mapping? */
+    bool isArea(const Area *area);
+
+    /* Store a page and add a reference to it. Returns the page id, or -1 if
+     * the store is full. */
+    int64_t put(const char* page);
+
+    /* Remove a reference to a page, which is freed if not used anymore */
+    void release(int64_t id);
+
+    /* Remember the path of the savestate files of a slot, without extension,
+     * while the slot holds references to the store. An empty path means
+     * that the slot holds no reference. */
+    void setSlotPath(int slot, const char* path);
+    const char* slotPath(int slot);
+
+    /* Rebuild the reference counts. All references are dropped, then the
+     * references of the remaining savestates are added back with
+     * addReference(), and endRebuild() frees the pages that are not used
+     * anymore. */
+    void beginRebuild();
+    void addReference(int64_t id);
+    void endRebuild();
+
+    /* Read a page from the store */
+    void read(int64_t id, char* page);
+
+    /* File descriptor of the store file. Page id is located at offset id*4096 */
+    int fd();
+
+    /* Number of distinct pages currently in the store */
+    uint64_t pageCount();
+}
+}
+
+#endif
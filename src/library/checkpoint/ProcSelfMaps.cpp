@@ -54,6 +54,19 @@ ProcSelfMaps::ProcSelfMaps()
     }
 }
 
+ProcSelfMaps::ProcSelfMaps(char* buffer, size_t size)
+    : data(buffer),
+    dataIdx(0),
+    numAreas(0),
+    numBytes(size)
+{
+    for (size_t i = 0; i < numBytes; i++) {
+        if (data[i] == '\n') {
+            numAreas++;
+        }
+    }
+}
+
 void ProcSelfMaps::reset()
 {
     dataIdx = 0;
@@ -31,6 +31,9 @@ class ProcSelfMaps
         /* Read the /proc/self/maps file into reserved memory */
         ProcSelfMaps();
 
+        /* Parse a copy of the /proc/self/maps file stored elsewhere */
+        ProcSelfMaps(char* buffer, size_t size);
+
         /* Parse the next memory section into the area */
         bool getNextArea(Area *area);
 
@@ -28,6 +28,7 @@ namespace libtas {
 
 static intptr_t restoreAddr = 0;
 static size_t restoreLength = 0;
+static int slotTableCount = SLOTS_MIN;
 
 void ReservedMemory::init()
 {
@@ -36,13 +37,17 @@ void ReservedMemory::init()
      * the ProcSelfMaps object that need some space.
      */
     if (restoreAddr == 0) {
-        restoreLength = RESTORE_TOTAL_SIZE;
+        restoreLength = RESTORE_FIXED_SIZE + SLOTS_MAX * sizeof(SlotData);
         void* addr = mmap(nullptr, restoreLength + (2 * 4096), PROT_NONE,
             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         MYASSERT(addr != MAP_FAILED)
         restoreAddr = reinterpret_cast<intptr_t>(addr) + 4096;
         MYASSERT(mprotect(reinterpret_cast<void*>(restoreAddr), restoreLength, PROT_READ | PROT_WRITE) == 0)
-        memset(reinterpret_cast<void*>(restoreAddr), 0, restoreLength);
+        /* Worker stacks and buffers, the snapshot buffer, the writer, the
+         * restore plan, the savestate statistics and the slot table are
+         * already zeroed by mmap, so we don't commit them until they are
+         * actually used. */
+        memset(reinterpret_cast<void*>(restoreAddr), 0, WORKERS_ADDR);
     }
 }
 
@@ -56,4 +61,25 @@ size_t ReservedMemory::getSize()
     return restoreLength;
 }
 
+void ReservedMemory::setSlotCount(int count)
+{
+    if (count < SLOTS_MIN)
+        count = SLOTS_MIN;
+    if (count > SLOTS_MAX)
+        count = SLOTS_MAX;
+    slotTableCount = count;
+}
+
+int ReservedMemory::slotCount()
+{
+    return slotTableCount;
+}
+
+SlotData* ReservedMemory::getSlot(int slot)
+{
+    if ((slot < 0) || (slot >= slotTableCount))
+        return nullptr;
+    return static_cast<SlotData*>(getAddr(SLOTS_ADDR)) + slot;
+}
+
 }
@@ -24,31 +24,77 @@
 
 #include <cstdint> // intptr_t
 #include <cstddef> // size_t
+#include <sys/types.h> // pid_t
 
 #define ONE_MB 1024 * 1024
-#define RESTORE_TOTAL_SIZE 5 * ONE_MB
+#define WORKERS_MAX 8
+#define WORKER_STACK_SIZE 256 * 1024
+#define WORKER_BUFFER_SIZE 768 * 1024
+#define SNAPSHOT_TOTAL_SIZE ONE_MB + 4096
+#define WRITER_STACK_SIZE 256 * 1024
+#define WRITER_BUFFER_SIZE ONE_MB
+#define WRITER_TOTAL_SIZE 4 * 4096 + WRITER_STACK_SIZE + WRITER_BUFFER_SIZE
+#define PLAN_TOTAL_SIZE 2 * ONE_MB
+#define STATS_TOTAL_SIZE ONE_MB
+#define RESTORE_FIXED_SIZE 5 * ONE_MB + 4096 + WORKERS_MAX * (WORKER_STACK_SIZE + WORKER_BUFFER_SIZE) + SNAPSHOT_TOTAL_SIZE + WRITER_TOTAL_SIZE + PLAN_TOTAL_SIZE + STATS_TOTAL_SIZE
+
+/* Minimum number of savestate slots: the base slot 0, slots 1 to 9 and the
+ * backtrack slot 10 */
+#define SLOTS_MIN 11
+#define SLOTS_MAX 65536
 
 namespace libtas {
+
+/* Information on a savestate slot that must survive state loading */
+struct SlotData {
+    /* memfds of the state when stored in RAM, or 0 */
+    int pagemap_fd;
+    int pages_fd;
+
+    /* Forked process that is saving the state, or that holds the state */
+    pid_t pid;
+
+    /* The state is still being saved by a forked process */
+    bool dirty;
+};
+
 namespace ReservedMemory {
     enum Addresses {
-        PAGEMAPS_ADDR = 0,
-        PAGES_ADDR = 11*sizeof(int),
-        SS_SLOTS_ADDR = 22*sizeof(int),
-        PSM_ADDR = 22*sizeof(int)+11*sizeof(bool),
+        PSM_ADDR = 0,
         STACK_ADDR = ONE_MB,
+        WORKERS_CTRL_ADDR = 5 * ONE_MB,
+        WORKERS_ADDR = 5 * ONE_MB + 4096,
+        SNAPSHOT_ADDR = 5 * ONE_MB + 4096 + WORKERS_MAX * (WORKER_STACK_SIZE + WORKER_BUFFER_SIZE),
+        WRITER_CTRL_ADDR = SNAPSHOT_ADDR + SNAPSHOT_TOTAL_SIZE,
+        WRITER_ADDR = WRITER_CTRL_ADDR + 4 * 4096,
+        PLAN_ADDR = WRITER_ADDR + WRITER_STACK_SIZE + WRITER_BUFFER_SIZE,
+        STATS_ADDR = PLAN_ADDR + PLAN_TOTAL_SIZE,
+        SLOTS_ADDR = RESTORE_FIXED_SIZE,
     };
     enum Sizes {
-        PAGEMAPS_SIZE = PAGES_ADDR - PAGEMAPS_ADDR,
-        PAGES_SIZE = SS_SLOTS_ADDR - PAGES_ADDR,
-        SS_SLOTS_SIZE = PSM_ADDR - SS_SLOTS_ADDR,
         PSM_SIZE = STACK_ADDR - PSM_ADDR,
-        STACK_SIZE = RESTORE_TOTAL_SIZE - STACK_ADDR,
+        STACK_SIZE = WORKERS_CTRL_ADDR - STACK_ADDR,
+        WORKERS_CTRL_SIZE = WORKERS_ADDR - WORKERS_CTRL_ADDR,
+        WORKERS_SIZE = SNAPSHOT_ADDR - WORKERS_ADDR,
+        SNAPSHOT_SIZE = WRITER_CTRL_ADDR - SNAPSHOT_ADDR,
+        WRITER_CTRL_SIZE = WRITER_ADDR - WRITER_CTRL_ADDR,
+        PLAN_SIZE = STATS_ADDR - PLAN_ADDR,
+        STATS_SIZE = SLOTS_ADDR - STATS_ADDR,
     };
 
     void init();
     void* getAddr(intptr_t offset);
     size_t getSize();
 
+    /* Set the number of savestate slots, which is only known after receiving
+     * the config. The table located at SLOTS_ADDR is reserved for SLOTS_MAX
+     * slots, and is only committed when used. */
+    void setSlotCount(int count);
+    int slotCount();
+
+    /* Information on a savestate slot, or nullptr if out of range */
+    SlotData* getSlot(int slot);
+
 
 }
 }
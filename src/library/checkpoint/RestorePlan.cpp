@@ -0,0 +1,235 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "RestorePlan.h"
+#include "ReservedMemory.h"
+#include "WorkerPool.h"
+#include "StateStats.h"
+#include "../logging.h"
+#include "../../external/lz4.h"
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+
+namespace libtas {
+
+/* Maximum number of iovecs of a single preadv() call */
+#define PLAN_IOV_MAX 1024
+
+struct PlanEntry {
+    char* addr;
+    off_t offset;
+    int size;
+    int fd;
+    int codec;
+};
+
+struct Plan {
+    int count;
+    PlanEntry entries[1];
+};
+
+static const int PLAN_MAX_ENTRIES = (ReservedMemory::PLAN_SIZE - sizeof(Plan)) / sizeof(PlanEntry) + 1;
+
+static Plan* getPlan()
+{
+    return static_cast<Plan*>(ReservedMemory::getAddr(ReservedMemory::PLAN_ADDR));
+}
+
+void RestorePlan::add(char* addr, int fd, off_t offset, int size, Codec codec)
+{
+    Plan* plan = getPlan();
+    if (plan->count == PLAN_MAX_ENTRIES)
+        execute();
+
+    PlanEntry& entry = plan->entries[plan->count++];
+    entry.addr = addr;
+    entry.offset = offset;
+    entry.size = size;
+    entry.fd = fd;
+    entry.codec = codec;
+
+    SavestateAreaStats* stats = StateStats::area();
+    stats->pages_dirty++;
+    stats->bytes += size;
+}
+
+/* Read a contiguous file range into the buffers described by iov */
+static void readvAll(int fd, struct iovec* iov, int iovcnt, off_t offset)
+{
+    while (iovcnt > 0) {
+        ssize_t count;
+        NATIVECALL(count = preadv(fd, iov, iovcnt, offset));
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "preadv failed with error %d", errno);
+            return;
+        }
+        MYASSERT(count > 0)
+        offset += count;
+
+        /* Skip the buffers that were filled */
+        while ((iovcnt > 0) && (static_cast<size_t>(count) >= iov->iov_len)) {
+            count -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + count;
+            iov->iov_len -= count;
+        }
+    }
+}
+
+/* Read all raw pages, merging the ones that follow each other in a file */
+static void readRawPages(Plan* plan)
+{
+    struct iovec iov[PLAN_IOV_MAX];
+    int iovcnt = 0;
+    int fd = -1;
+    off_t start = 0;
+    off_t end = 0;
+
+    for (int i = 0; i < plan->count; i++) {
+        const PlanEntry& entry = plan->entries[i];
+        if (entry.codec != RestorePlan::RAW)
+            continue;
+
+        if ((iovcnt > 0) && (entry.fd == fd) && (entry.offset == end)) {
+            /* Extend the last buffer if the page follows it in memory */
+            if (static_cast<char*>(iov[iovcnt-1].iov_base) + iov[iovcnt-1].iov_len == entry.addr) {
+                iov[iovcnt-1].iov_len += entry.size;
+                end += entry.size;
+                continue;
+            }
+            if (iovcnt < PLAN_IOV_MAX) {
+                iov[iovcnt].iov_base = entry.addr;
+                iov[iovcnt].iov_len = entry.size;
+                iovcnt++;
+                end += entry.size;
+                continue;
+            }
+        }
+
+        if (iovcnt > 0)
+            readvAll(fd, iov, iovcnt, start);
+
+        iov[0].iov_base = entry.addr;
+        iov[0].iov_len = entry.size;
+        iovcnt = 1;
+        fd = entry.fd;
+        start = entry.offset;
+        end = entry.offset + entry.size;
+    }
+
+    if (iovcnt > 0)
+        readvAll(fd, iov, iovcnt, start);
+}
+
+/* Compressed pages are split into groups of consecutive entries whose data
+ * fits in a worker buffer. Each worker reads the whole range of a group at
+ * once and decompresses its pages. Groups are assigned to workers in turn. */
+static void decompressGroups(int worker, void* arg)
+{
+    Plan* plan = getPlan();
+    int workers = *static_cast<int*>(arg);
+    char* buffer = WorkerPool::getBuffer(worker);
+
+    int group = 0;
+    int i = 0;
+    while (i < plan->count) {
+        if (plan->entries[i].codec != RestorePlan::LZ4) {
+            i++;
+            continue;
+        }
+
+        /* Find the extent of the group */
+        int first = i;
+        int fd = plan->entries[i].fd;
+        off_t start = plan->entries[i].offset;
+        off_t end = start + plan->entries[i].size;
+        for (i++; i < plan->count; i++) {
+            const PlanEntry& entry = plan->entries[i];
+            if (entry.codec != RestorePlan::LZ4)
+                continue;
+            if ((entry.fd != fd) || (entry.offset < end) ||
+                (entry.offset + entry.size - start > WORKER_BUFFER_SIZE))
+                break;
+            end = entry.offset + entry.size;
+        }
+
+        if ((group++ % workers) != worker)
+            continue;
+
+        ssize_t count;
+        NATIVECALL(count = pread(fd, buffer, end - start, start));
+        MYASSERT(count == (end - start))
+
+        for (int j = first; j < i; j++) {
+            const PlanEntry& entry = plan->entries[j];
+            if (entry.codec != RestorePlan::LZ4)
+                continue;
+            int size = LZ4_decompress_safe(buffer + (entry.offset - start), entry.addr, entry.size, 4096);
+            MYASSERT(size == 4096)
+        }
+    }
+}
+
+void RestorePlan::execute()
+{
+    Plan* plan = getPlan();
+    if (plan->count == 0)
+        return;
+
+    SavestateAreaStats* stats = StateStats::area();
+    uint64_t io_start = StateStats::now();
+    readRawPages(plan);
+    stats->io_ns += StateStats::now() - io_start;
+
+    int workers = WorkerPool::count();
+    bool compressed = false;
+    for (int i = 0; i < plan->count; i++) {
+        if (plan->entries[i].codec == LZ4) {
+            compressed = true;
+            break;
+        }
+    }
+
+    /* Reading compressed pages is done by the workers, and counted as
+     * decompression time */
+    if (compressed) {
+        uint64_t decompress_start = StateStats::now();
+        if (workers > 0) {
+            WorkerPool::run(decompressGroups, &workers);
+        }
+        else {
+            /* Without worker threads, we use the buffer of the first worker */
+            workers = 1;
+            decompressGroups(0, &workers);
+        }
+        stats->compress_ns += StateStats::now() - decompress_start;
+    }
+
+    plan->count = 0;
+}
+
+}
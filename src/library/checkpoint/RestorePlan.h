@@ -0,0 +1,45 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_RESTOREPLAN_H
+#define LIBTAS_RESTOREPLAN_H
+
+#include <sys/types.h>
+
+namespace libtas {
+namespace RestorePlan {
+
+    /* How the data of a page is stored */
+    enum Codec {
+        RAW, // 4096 bytes of page content
+        LZ4, // compressed page
+    };
+
+    /* Add a page to load from a file. Pages are not loaded until execute()
+     * is called, or when the plan is full. */
+    void add(char* addr, int fd, off_t offset, int size, Codec codec);
+
+    /* Load all planned pages. Raw pages that are contiguous in a file are
+     * read with a single preadv() call, and compressed pages are read by
+     * chunks and decompressed by the savestate workers. */
+    void execute();
+}
+}
+
+#endif
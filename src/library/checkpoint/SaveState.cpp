@@ -22,16 +22,21 @@
 #include "SaveState.h"
 #include "../Utils.h"
 #include "StateHeader.h"
+#include "PageStore.h"
+#include "RestorePlan.h"
+#include "StateStats.h"
 #include "../logging.h"
 #include <fcntl.h>
 #include <unistd.h>
-#include "../../external/lz4.h"
+#include <cstddef> // offsetof
+#include <cstring> // memcpy
 
 namespace libtas {
 
 SaveState::SaveState(const char* pagemappath, const char* pagespath, int pagemapfd, int pagesfd)
 {
-    queued_size = 0;
+    lengths_size = 0;
+    ids_count = 0;
 
     if (shared_config.savestate_settings & SharedConfig::SS_RAM) {
         pmfd = pagemapfd;
@@ -78,6 +83,9 @@ void SaveState::readHeader(StateHeader& sh)
 
 void SaveState::restart()
 {
+    /* Get the format version */
+    MYASSERT(pread(pmfd, &version, sizeof(int), offsetof(StateHeader, version)) == sizeof(int))
+
     /* Seek after the savestate header */
     lseek(pmfd, sizeof(StateHeader), SEEK_SET);
     flags_remaining = 0;
@@ -111,10 +119,19 @@ Area SaveState::nextArea()
     next_pfd_offset = area.page_offset;
     current_addr = static_cast<char*>(area.addr);
     flag_i = 4096;
+    block_page_i = 0;
+    cached_block = -1;
     if (area.skip) {
         flags_remaining = 0;
     } else {
         flags_remaining = area.size / 4096;
+
+        /* Skip the block index, which is located before the area flags */
+        if ((version == STATEVERSION_BLOCK) && (area.addr != nullptr)) {
+            index_offset = lseek(pmfd, 0, SEEK_CUR);
+            int nb_blocks = (flags_remaining + STATEBLOCKPAGES - 1) / STATEBLOCKPAGES;
+            lseek(pmfd, nb_blocks * sizeof(StateBlock), SEEK_CUR);
+        }
     }
     return area;
 }
@@ -149,68 +166,119 @@ char SaveState::getPageFlag(char* addr)
     char flag;
     do {
         flag = nextFlag();
-        if (flag == Area::FULL_PAGE) {
-            next_pfd_offset += 4096;
-        }
-        else if (flag == Area::COMPRESSED_PAGE) {
-            lseek(pfd, next_pfd_offset, SEEK_SET);
-            Utils::readAll(pfd, &compressed_length, sizeof(int));
-            next_pfd_offset += sizeof(int) + compressed_length;
-        }
+        processFlag(flag);
         current_addr += 4096;
     } while (current_addr <= addr);
 
     return flag;
 }
 
-/* Like getPageFlag(), but assumes you're going through the addresses
- * sequentially.  This means it can skip some checks and be a little faster. */
-char SaveState::getNextPageFlag()
+void SaveState::processFlag(char flag)
 {
-    char flag = nextFlag();
     if (flag == Area::FULL_PAGE) {
         next_pfd_offset += 4096;
     }
     else if (flag == Area::COMPRESSED_PAGE) {
-        lseek(pfd, next_pfd_offset, SEEK_SET);
-        Utils::readAll(pfd, &compressed_length, sizeof(int));
+        /* Compressed pages are mostly contiguous in the pages file, so we
+         * read their lengths from a larger chunk */
+        if ((lengths_size == 0) || (next_pfd_offset < lengths_offset) ||
+            (next_pfd_offset + static_cast<off_t>(sizeof(int)) > lengths_offset + lengths_size)) {
+            ssize_t size = pread(pfd, lengths, sizeof(lengths), next_pfd_offset);
+            MYASSERT(size >= static_cast<ssize_t>(sizeof(int)))
+            lengths_offset = next_pfd_offset;
+            lengths_size = size;
+        }
+        memcpy(&compressed_length, lengths + (next_pfd_offset - lengths_offset), sizeof(int));
         next_pfd_offset += sizeof(int) + compressed_length;
     }
+    else if (flag == Area::BLOCK_PAGE) {
+        /* Page position is only given by the number of stored pages before */
+        block_page_i++;
+    }
+    else if (flag == Area::STORE_PAGE) {
+        /* Page ids are contiguous in the pages file, so we read them in chunks */
+        if ((ids_count == 0) || (next_pfd_offset < ids_offset) ||
+            (next_pfd_offset >= ids_offset + ids_count * static_cast<off_t>(sizeof(int64_t)))) {
+            ssize_t size = pread(pfd, store_ids, sizeof(store_ids), next_pfd_offset);
+            MYASSERT(size >= static_cast<ssize_t>(sizeof(int64_t)))
+            ids_offset = next_pfd_offset;
+            ids_count = size / sizeof(int64_t);
+        }
+        store_id = store_ids[(next_pfd_offset - ids_offset) / sizeof(int64_t)];
+        next_pfd_offset += sizeof(int64_t);
+    }
+}
+
+/* Like getPageFlag(), but assumes you're going through the addresses
+ * sequentially.  This means it can skip some checks and be a little faster. */
+char SaveState::getNextPageFlag()
+{
+    char flag = nextFlag();
+    processFlag(flag);
     current_addr += 4096;
     return flag;
 }
 
-void SaveState::finishLoad()
+void SaveState::loadBlock(int block)
 {
-    if (queued_size > 0) {
-        lseek(pfd, queued_offset, SEEK_SET);
-        Utils::readAll(pfd, queued_addr, queued_size);
-        queued_size = 0;
+    if (block == cached_block)
+        return;
+
+    SavestateAreaStats* stats = StateStats::area();
+    uint64_t io_start = StateStats::now();
+    StateBlock entry;
+    MYASSERT(pread(pmfd, &entry, sizeof(StateBlock), index_offset + block * sizeof(StateBlock)) == sizeof(StateBlock))
+    MYASSERT(pread(pfd, compressed_block, entry.compressed_size, entry.offset) == entry.compressed_size)
+    stats->bytes += entry.compressed_size;
+
+    uint64_t decompress_start = StateStats::now();
+    stats->io_ns += decompress_start - io_start;
+    int size = LZ4_decompress_safe(compressed_block, block_cache, entry.compressed_size, sizeof(block_cache));
+    MYASSERT(size == entry.page_count * 4096)
+    stats->compress_ns += StateStats::now() - decompress_start;
+    cached_block = block;
+}
+
+void SaveState::getPageLocation(off_t& offset, int& size)
+{
+    if (current_flag == Area::FULL_PAGE) {
+        offset = next_pfd_offset - 4096;
+        size = 4096;
+    }
+    else if (current_flag == Area::COMPRESSED_PAGE) {
+        offset = next_pfd_offset - compressed_length;
+        size = compressed_length;
+    }
+    else if (current_flag == Area::BLOCK_PAGE) {
+        int page_i = block_page_i - 1;
+        offset = index_offset + (page_i / STATEBLOCKPAGES) * sizeof(StateBlock);
+        size = page_i % STATEBLOCKPAGES;
+    }
+    else if (current_flag == Area::STORE_PAGE) {
+        offset = store_id;
+        size = 0;
     }
 }
 
-void SaveState::queuePageLoad(char* addr)
+void SaveState::planPageLoad(char* addr)
 {
     MYASSERT(addr + 4096 == current_addr);
 
     if (current_flag == Area::FULL_PAGE) {
-        if (queued_size > 0) {
-        	if ((next_pfd_offset - 4096) == queued_offset + queued_size &&
-        	    addr == queued_addr + queued_size) {
-                queued_size += 4096;
-                return;
-        	} else {
-                finishLoad();
-        	}
-        }
-        queued_offset = (next_pfd_offset - 4096);
-        queued_addr = addr;
-        queued_size = 4096;
+        RestorePlan::add(addr, pfd, next_pfd_offset - 4096, 4096, RestorePlan::RAW);
     }
     else if (current_flag == Area::COMPRESSED_PAGE) {
-        char compressed[LZ4_COMPRESSBOUND(4096)];
-        Utils::readAll(pfd, compressed, compressed_length);
-        LZ4_decompress_safe(compressed, addr, compressed_length, 4096);
+        RestorePlan::add(addr, pfd, next_pfd_offset - compressed_length, compressed_length, RestorePlan::LZ4);
+    }
+    else if (current_flag == Area::BLOCK_PAGE) {
+        /* Decompress the whole block once, and serve its pages from the cache */
+        int page_i = block_page_i - 1;
+        loadBlock(page_i / STATEBLOCKPAGES);
+        memcpy(addr, block_cache + (page_i % STATEBLOCKPAGES) * 4096, 4096);
+        StateStats::area()->pages_dirty++;
+    }
+    else if (current_flag == Area::STORE_PAGE) {
+        RestorePlan::add(addr, PageStore::fd(), static_cast<off_t>(store_id) * 4096, 4096, RestorePlan::RAW);
     }
 }
 
@@ -24,6 +24,7 @@
 
 #include "MemArea.h"
 #include "StateHeader.h"
+#include "../../external/lz4.h"
 
 namespace libtas {
 class SaveState
@@ -43,8 +44,19 @@ class SaveState
 
     char getPageFlag(char* addr);
 	char getNextPageFlag();
-	void queuePageLoad(char* addr);
-	void finishLoad();
+
+	/* Id of the current page in the page store, if flag is STORE_PAGE */
+	int64_t getStorePageId() const { return store_id; }
+
+	/* Load the current page at addr. Stored pages are added to the restore
+	 * plan, and are only loaded when the plan is executed. */
+	void planPageLoad(char* addr);
+
+	/* Location of the current page data, to load it later. Offset and size
+	 * depend on the page flag: position and size of the data in the pages
+	 * file, position of the block index entry and index of the page in the
+	 * block, or page store id. */
+	void getPageLocation(off_t& offset, int& size);
 
     explicit operator bool() const {
         return (pmfd != -1);
@@ -53,6 +65,12 @@ class SaveState
     private:
 	char nextFlag();
 
+	/* Update the page position for the current flag */
+	void processFlag(char flag);
+
+	/* Load a compressed block of the current area in the block cache */
+	void loadBlock(int block);
+
 	char flags[4096];
     char current_flag;
 	int flag_i;
@@ -65,9 +83,33 @@ class SaveState
     off_t next_pfd_offset;
 
     int compressed_length;
-    char* queued_addr;
-	off_t queued_offset;
-	int queued_size;
+
+    /* Read-ahead chunk of the pages file starting at lengths_offset, used to
+     * get the lengths of compressed pages without a read for each page */
+    char lengths[65536];
+    off_t lengths_offset;
+    int lengths_size;
+
+    /* Savestate format version */
+    int version;
+
+    /* Position of the block index of the current area in the pagemap file */
+    off_t index_offset;
+
+    /* Number of block pages that were already processed in the current area */
+    int block_page_i;
+
+    /* Index of the block that is decompressed in the block cache, or -1 */
+    int cached_block;
+    char block_cache[STATEBLOCKPAGES * 4096];
+    char compressed_block[LZ4_COMPRESSBOUND(STATEBLOCKPAGES * 4096)];
+
+    /* Page store id of the current page, and chunk of ids read from the
+     * pages file, starting at ids_offset */
+    int64_t store_id;
+    int64_t store_ids[512];
+    off_t ids_offset;
+    int ids_count;
 };
 }
 
@@ -43,6 +43,7 @@
 #endif
 #include "AltStack.h"
 #include "ReservedMemory.h"
+#include "StateWriter.h"
 #include "../fileio/FileHandleList.h"
 #include "../renderhud/RenderHUD.h"
 #ifdef __unix__
@@ -58,7 +59,6 @@ static volatile bool restoreInProgress = false;
 static int numThreads;
 static int sig_suspend_threads = SIGXFSZ;
 static int sig_checkpoint = SIGSYS;
-static bool* state_dirty;
 
 int SaveStateManager::sigCheckpoint()
 {
@@ -76,9 +76,6 @@ void SaveStateManager::init()
     sem_init(&semWaitForCkptThreadSignal, 0, 0);
 
     ReservedMemory::init();
-
-    state_dirty = static_cast<bool*>(ReservedMemory::getAddr(ReservedMemory::SS_SLOTS_ADDR));
-    memset(state_dirty, 0, 11*sizeof(bool));
 }
 
 void SaveStateManager::initCheckpointThread()
@@ -131,53 +128,85 @@ void SaveStateManager::initThreadFromChild(ThreadInfo* thread)
     }
 }
 
-int SaveStateManager::waitChild()
+/* Are states saved in a child process that exits when done? Snapshot
+ * processes are kept alive, and must not be reaped here. */
+static bool forkedSaves()
 {
-    if (!(shared_config.savestate_settings & SharedConfig::SS_FORK))
-        return -1;
+    return (shared_config.savestate_settings & SharedConfig::SS_FORK) &&
+        !(shared_config.savestate_settings & SharedConfig::SS_SNAPSHOT);
+}
 
-    int status;
-    pid_t pid = waitpid(-1, &status, WNOHANG);
-    if (pid <= 0) {
-        return -1;
-    }
-    status = WEXITSTATUS(status);
-    if ((status < 0) && (status > 10)) {
-        debuglogstdio(LCF_THREAD | LCF_CHECKPOINT | LCF_ERROR, "Got unknown status code %d from pid %d", status, pid);
-        return -1;
-    }
-    if (!state_dirty[status]) {
-        debuglogstdio(LCF_THREAD | LCF_CHECKPOINT | LCF_ERROR, "State saving %d completed but was already ready", status);
+int SaveStateManager::waitChild(bool& failed)
+{
+    failed = false;
+
+    /* States written in the background are reported the same way */
+    if (StateWriter::enabled())
+        return StateWriter::nextWritten(failed);
+
+    if (!forkedSaves())
         return -1;
-    }
 
-    state_dirty[status] = false;
-    return status;
+    while (true) {
+        pid_t pid = waitpid(-1, nullptr, WNOHANG);
+        if (pid <= 0) {
+            return -1;
+        }
+
+        /* Look for the slot that the child was saving. We don't use the exit
+         * status, which cannot hold every slot number. */
+        for (int slot = 0; slot < ReservedMemory::slotCount(); slot++) {
+            SlotData* slot_data = ReservedMemory::getSlot(slot);
+            if (slot_data->pid != pid)
+                continue;
+
+            slot_data->pid = 0;
+            if (slot_data->dirty) {
+                slot_data->dirty = false;
+                return slot;
+            }
+        }
+
+        /* The base savestate or another child terminated, try the next one */
+    }
 }
 
 bool SaveStateManager::stateReady(int slot)
 {
-    if (!(shared_config.savestate_settings & SharedConfig::SS_FORK))
-        return true;
-
-    if ((slot < 0) && (slot > 10)) {
+    SlotData* slot_data = ReservedMemory::getSlot(slot);
+    if (!slot_data) {
         debuglogstdio(LCF_THREAD | LCF_CHECKPOINT | LCF_ERROR, "Wrong slot number");
         return false;
     }
-    return !state_dirty[slot];
+
+    if (StateWriter::enabled())
+        return !StateWriter::pending(slot);
+
+    if (!forkedSaves())
+        return true;
+
+    return !slot_data->dirty;
 }
 
 void SaveStateManager::stateStatus(int slot, bool dirty)
 {
-    if (shared_config.savestate_settings & SharedConfig::SS_FORK)
-        state_dirty[slot] = dirty;
+    SlotData* slot_data = ReservedMemory::getSlot(slot);
+    if (forkedSaves() && slot_data)
+        slot_data->dirty = dirty;
 }
 
 int SaveStateManager::checkpoint(int slot)
 {
+    if (!ReservedMemory::getSlot(slot))
+        return ESTATE_UNKNOWN;
+
     if (!stateReady(slot))
         return ESTATE_NOTCOMPLETE;
 
+    /* Incremental savestates read their parent, which must be on disk */
+    if (shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)
+        StateWriter::wait();
+
     ThreadInfo *current_thread = ThreadManager::getCurrentThread();
     MYASSERT(current_thread->state == ThreadInfo::ST_CKPNTHREAD)
 
@@ -309,9 +338,15 @@ int SaveStateManager::checkpoint(int slot)
 
 int SaveStateManager::restore(int slot)
 {
+    if (!ReservedMemory::getSlot(slot))
+        return ESTATE_NOSTATE;
+
     if (!stateReady(slot))
         return ESTATE_NOTCOMPLETE;
 
+    /* The loaded state may depend on other states, which must be on disk */
+    StateWriter::wait();
+
     ThreadInfo *current_thread = ThreadManager::getCurrentThread();
     MYASSERT(current_thread->state == ThreadInfo::ST_CKPNTHREAD)
     ThreadSync::acquireLocks();
@@ -50,8 +50,9 @@ void initCheckpointThread();
 
 void initThreadFromChild(ThreadInfo* thread);
 
-/* Wait for a child to terminate and register the savestate slot */
-int waitChild();
+/* Wait for a child to terminate and register the savestate slot. `failed` is
+ * set if the state could not be written */
+int waitChild(bool& failed);
 
 /* Returns if a state is completed (useful for fork savestates) */
 bool stateReady(int slot);
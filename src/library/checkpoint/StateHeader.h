@@ -23,15 +23,34 @@
 #define LIBTAS_STATEHEADER_H
 
 #include <pthread.h>
+#include <sys/types.h> // off_t
 
 #define STATEMAXTHREADS 1000
 
+/* Savestate format versions */
+#define STATEVERSION_PAGE 1 /* Each stored page is written (and compressed) individually */
+#define STATEVERSION_BLOCK 2 /* Stored pages are compressed in blocks, indexed per area */
+
+/* Number of stored pages in a compressed block */
+#define STATEBLOCKPAGES 32
+
 namespace libtas {
 struct StateHeader {
+    int version;
     int thread_count;
     pthread_t pthread_ids[STATEMAXTHREADS];
     pid_t tids[STATEMAXTHREADS];
 };
+
+/* Entry of the block index, which is located in the pagemap file right after
+ * each area struct, and contains one entry for every STATEBLOCKPAGES pages of
+ * the area. The n-th stored page of the area is located in block
+ * n / STATEBLOCKPAGES at position n % STATEBLOCKPAGES. */
+struct StateBlock {
+    off_t offset; // position of the compressed block in the pages file
+    int compressed_size;
+    int page_count;
+};
 }
 
 #endif
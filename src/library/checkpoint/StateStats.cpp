@@ -0,0 +1,155 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "StateStats.h"
+#include "ReservedMemory.h"
+#include "MemArea.h"
+#include "../GlobalState.h"
+#include <cstring>
+#include <time.h>
+
+namespace libtas {
+
+/* The table is located in our reserved memory, so that it is not overwritten
+ * when loading a savestate */
+struct StatsTable {
+    /* A savestate was processed */
+    bool started;
+
+    SavestateStats header;
+    uint64_t start_ns;
+
+    /* Index of the current area, or -1 */
+    int64_t current;
+
+    SavestateAreaStats scratch;
+    SavestateAreaStats areas[1];
+};
+
+static_assert(sizeof(StatsTable) <= ReservedMemory::STATS_SIZE, "Statistics table does not fit in reserved memory");
+
+static const int STATS_MAX_AREAS = (ReservedMemory::STATS_SIZE - sizeof(StatsTable)) / sizeof(SavestateAreaStats) + 1;
+
+static StatsTable* getTable()
+{
+    return static_cast<StatsTable*>(ReservedMemory::getAddr(ReservedMemory::STATS_ADDR));
+}
+
+uint64_t StateStats::now()
+{
+    struct timespec ts;
+    NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &ts));
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+void StateStats::begin(int slot, bool loading)
+{
+    StatsTable* table = getTable();
+    table->started = true;
+    table->header.slot = slot;
+    table->header.loading = loading ? 1 : 0;
+    table->header.total_ns = 0;
+    table->header.area_count = 0;
+    table->start_ns = now();
+    table->current = -1;
+}
+
+void StateStats::end()
+{
+    StatsTable* table = getTable();
+    table->header.total_ns = now() - table->start_ns;
+    table->current = -1;
+}
+
+void StateStats::beginArea(const Area &area)
+{
+    StatsTable* table = getTable();
+    SavestateAreaStats* entry;
+    if (table->header.area_count < static_cast<uint64_t>(STATS_MAX_AREAS)) {
+        table->current = table->header.area_count++;
+        entry = &table->areas[table->current];
+    }
+    else {
+        table->current = -1;
+        entry = &table->scratch;
+    }
+
+    memset(entry, 0, sizeof(SavestateAreaStats));
+    entry->addr = reinterpret_cast<uintptr_t>(area.addr);
+    entry->size = area.size;
+    entry->pages = area.size / 4096;
+    entry->skip = area.skip ? 1 : 0;
+    entry->flags = area.flags;
+    strncpy(entry->name, area.name, sizeof(entry->name) - 1);
+}
+
+SavestateAreaStats* StateStats::area()
+{
+    StatsTable* table = getTable();
+    if (table->current < 0)
+        return &table->scratch;
+    return &table->areas[table->current];
+}
+
+void StateStats::countFlags(const char* flags, int count)
+{
+    SavestateAreaStats* entry = area();
+    for (int i = 0; i < count; i++) {
+        switch (flags[i]) {
+            case Area::NO_PAGE:
+                entry->pages_skipped++;
+                break;
+            case Area::ZERO_PAGE:
+                entry->pages_zero++;
+                break;
+            case Area::FULL_PAGE:
+                entry->pages_full++;
+                break;
+            case Area::COMPRESSED_PAGE:
+            case Area::BLOCK_PAGE:
+                entry->pages_compressed++;
+                break;
+            case Area::BASE_PAGE:
+                entry->pages_base++;
+                break;
+            case Area::STORE_PAGE:
+                entry->pages_shared++;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+const SavestateStats* StateStats::header()
+{
+    static const SavestateStats none;
+    StatsTable* table = getTable();
+    if (!table->started)
+        return &none;
+    return &table->header;
+}
+
+const SavestateAreaStats* StateStats::areas()
+{
+    return getTable()->areas;
+}
+
+}
@@ -0,0 +1,59 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_STATESTATS_H
+#define LIBTAS_STATESTATS_H
+
+#include "../../shared/SavestateStats.h"
+#include <cstdint>
+
+namespace libtas {
+
+struct Area;
+
+namespace StateStats {
+
+    /* Clear the statistics when starting to save or load a savestate */
+    void begin(int slot, bool loading);
+
+    /* Store the total time of the savestate */
+    void end();
+
+    /* Add an entry for a memory area, which becomes the current one */
+    void beginArea(const Area &area);
+
+    /* Entry of the current area. If no area was started, or if the table is
+     * full, a scratch entry that is never reported is returned, so that
+     * callers don't have to check. */
+    SavestateAreaStats* area();
+
+    /* Count the savestate flags of a chunk of pages for the current area */
+    void countFlags(const char* flags, int count);
+
+    /* Monotonic time in nanoseconds */
+    uint64_t now();
+
+    /* Statistics of the last savestate, followed by header()->area_count
+     * area entries */
+    const SavestateStats* header();
+    const SavestateAreaStats* areas();
+}
+}
+
+#endif
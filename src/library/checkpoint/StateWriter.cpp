@@ -0,0 +1,324 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "StateWriter.h"
+#include "ReservedMemory.h"
+#include "../logging.h"
+#include "../Utils.h"
+#include "../GlobalState.h"
+#include "../TimeHolder.h"
+#include "../global.h" // shared_config
+#include "../../shared/SharedConfig.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace libtas {
+
+/* Number of staged states that can wait to be written. With two entries,
+ * a state can be saved while the previous one is still being written. */
+#define WRITER_QUEUE_SIZE 2
+
+/* Number of written slots kept for notification */
+#define WRITER_DONE_SIZE 64
+
+struct WriteJob {
+    int slot; // -1 if the job is not used
+    int pmfd;
+    int pfd;
+    char pagemappath[1024];
+    char pagespath[1024];
+};
+
+struct WriterControl {
+    bool init;
+    int head; // next job to write
+    int tail; // next job to fill
+    WriteJob jobs[WRITER_QUEUE_SIZE];
+    sem_t free_jobs;
+    sem_t queued_jobs;
+    int done[WRITER_DONE_SIZE];
+    bool done_failed[WRITER_DONE_SIZE];
+    int done_head;
+    int done_tail;
+};
+
+static_assert(sizeof(WriterControl) <= ReservedMemory::WRITER_CTRL_SIZE, "Writer control block does not fit in reserved memory");
+
+static WriterControl* getControl()
+{
+    return static_cast<WriterControl*>(ReservedMemory::getAddr(ReservedMemory::WRITER_CTRL_ADDR));
+}
+
+static char* getStack()
+{
+    return static_cast<char*>(ReservedMemory::getAddr(ReservedMemory::WRITER_ADDR));
+}
+
+static char* getBuffer()
+{
+    return getStack() + WRITER_STACK_SIZE;
+}
+
+static void semWait(sem_t* sem)
+{
+    int ret;
+    do {
+        NATIVECALL(ret = sem_wait(sem));
+    } while ((ret != 0) && (errno == EINTR));
+}
+
+/* Copy the content of a memfd into a file, in large chunks. The file is
+ * written under a temporary name, so that an older state stays valid until
+ * the new one is complete. Returns false if the file could not be written,
+ * in which case the temporary file is removed. */
+static bool writeFile(int memfd, const char* path)
+{
+    char temppath[1024];
+    strcpy(temppath, path);
+    strncat(temppath, ".temp", 1023 - strlen(temppath));
+
+    int fd = open(temppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not create %s, error %d", temppath, errno);
+        close(memfd);
+        return false;
+    }
+
+    off_t size = lseek(memfd, 0, SEEK_END);
+    bool success = true;
+
+    /* Reserve the whole file at once, to limit fragmentation. Filesystems
+     * that cannot reserve space are not an error. */
+    if (size > 0) {
+        int ret = posix_fallocate(fd, 0, size);
+        if ((ret != 0) && (ret != EINVAL) && (ret != EOPNOTSUPP)) {
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not reserve %s, error %d", temppath, ret);
+            success = false;
+        }
+    }
+
+    char* buffer = getBuffer();
+    for (off_t offset = 0; success && (offset < size); ) {
+        ssize_t count = pread(memfd, buffer, WRITER_BUFFER_SIZE, offset);
+        if (count <= 0) {
+            if ((count < 0) && (errno == EINTR))
+                continue;
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not read the staged state, error %d", errno);
+            success = false;
+            break;
+        }
+        if (Utils::writeAll(fd, buffer, count) != count) {
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not write %s, error %d", temppath, errno);
+            success = false;
+            break;
+        }
+        offset += count;
+    }
+
+    if (close(fd) != 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not close %s, error %d", temppath, errno);
+        success = false;
+    }
+    close(memfd);
+
+    if (success && (rename(temppath, path) != 0)) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not rename %s, error %d", temppath, errno);
+        success = false;
+    }
+
+    if (!success)
+        unlink(temppath);
+
+    return success;
+}
+
+static void* writerLoop(void*)
+{
+    /* The writer only executes our own code, and must not go through any hook */
+    GlobalState::setNative(true);
+
+    WriterControl* control = getControl();
+    while (true) {
+        semWait(&control->queued_jobs);
+
+        WriteJob& job = control->jobs[control->head];
+
+        TimeHolder old_time, new_time, delta_time;
+        NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &old_time));
+
+        /* Pages are written first, so that a complete pagemap file always
+         * comes with its pages */
+        bool success = writeFile(job.pfd, job.pagespath);
+        if (success) {
+            success = writeFile(job.pmfd, job.pagemappath);
+        }
+        else {
+            close(job.pmfd);
+        }
+
+        /* The files of the slot cannot be used anymore if only one of them
+         * was replaced, so we remove both of them */
+        if (!success) {
+            unlink(job.pagespath);
+            unlink(job.pagemappath);
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not write state %d to disk", job.slot);
+        }
+
+        NATIVECALL(clock_gettime(CLOCK_MONOTONIC, &new_time));
+        delta_time = new_time - old_time;
+        debuglogstdio(LCF_CHECKPOINT, "Wrote state %d to disk in %f seconds", job.slot, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+
+        /* Notify that the slot was written */
+        int done_head = __atomic_load_n(&control->done_head, __ATOMIC_ACQUIRE);
+        control->done[done_head % WRITER_DONE_SIZE] = job.slot;
+        control->done_failed[done_head % WRITER_DONE_SIZE] = !success;
+        __atomic_store_n(&control->done_head, done_head + 1, __ATOMIC_RELEASE);
+
+        __atomic_store_n(&job.slot, -1, __ATOMIC_RELEASE);
+        control->head = (control->head + 1) % WRITER_QUEUE_SIZE;
+        sem_post(&control->free_jobs);
+    }
+
+    return nullptr;
+}
+
+void StateWriter::init()
+{
+    WriterControl* control = getControl();
+    if (control->init)
+        return;
+
+    control->head = 0;
+    control->tail = 0;
+    for (int j = 0; j < WRITER_QUEUE_SIZE; j++)
+        control->jobs[j].slot = -1;
+    control->done_head = 0;
+    control->done_tail = 0;
+    sem_init(&control->free_jobs, 0, WRITER_QUEUE_SIZE);
+    sem_init(&control->queued_jobs, 0, 0);
+
+    /* Block all signals while spawning, so that the writer inherits a full
+     * signal mask and never receives signals targeted at game threads. */
+    sigset_t mask, oldmask;
+    sigfillset(&mask);
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &mask, &oldmask));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    NATIVECALL(pthread_attr_setstack(&attr, getStack(), WRITER_STACK_SIZE));
+
+    pthread_t pthread_id;
+    int ret;
+    NATIVECALL(ret = pthread_create(&pthread_id, &attr, writerLoop, nullptr));
+    pthread_attr_destroy(&attr);
+
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &oldmask, nullptr));
+
+    if (ret != 0) {
+        debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not create savestate writer, error %d", ret);
+        return;
+    }
+
+    control->init = true;
+    debuglogstdio(LCF_CHECKPOINT, "Spawned savestate writer");
+}
+
+bool StateWriter::enabled()
+{
+#ifdef __linux__
+    return getControl()->init &&
+        (shared_config.savestate_settings & SharedConfig::SS_ASYNC) &&
+        !(shared_config.savestate_settings & (SharedConfig::SS_RAM | SharedConfig::SS_FORK | SharedConfig::SS_SNAPSHOT | SharedConfig::SS_DEDUP));
+#else
+    /* States are staged in memfds */
+    return false;
+#endif
+}
+
+void StateWriter::submit(int slot, int pmfd, int pfd, const char* pagemappath, const char* pagespath)
+{
+    WriterControl* control = getControl();
+    semWait(&control->free_jobs);
+
+    WriteJob& job = control->jobs[control->tail];
+    job.pmfd = pmfd;
+    job.pfd = pfd;
+    strncpy(job.pagemappath, pagemappath, 1023);
+    job.pagemappath[1023] = '\0';
+    strncpy(job.pagespath, pagespath, 1023);
+    job.pagespath[1023] = '\0';
+    __atomic_store_n(&job.slot, slot, __ATOMIC_RELEASE);
+    control->tail = (control->tail + 1) % WRITER_QUEUE_SIZE;
+
+    NATIVECALL(sem_post(&control->queued_jobs));
+}
+
+bool StateWriter::pending(int slot)
+{
+    WriterControl* control = getControl();
+    if (!control->init)
+        return false;
+
+    for (int j = 0; j < WRITER_QUEUE_SIZE; j++) {
+        if (__atomic_load_n(&control->jobs[j].slot, __ATOMIC_ACQUIRE) == slot)
+            return true;
+    }
+    return false;
+}
+
+void StateWriter::wait()
+{
+    WriterControl* control = getControl();
+    if (!control->init)
+        return;
+
+    /* All jobs are written when we can take every free entry */
+    for (int j = 0; j < WRITER_QUEUE_SIZE; j++)
+        semWait(&control->free_jobs);
+    for (int j = 0; j < WRITER_QUEUE_SIZE; j++)
+        NATIVECALL(sem_post(&control->free_jobs));
+}
+
+int StateWriter::nextWritten(bool& failed)
+{
+    WriterControl* control = getControl();
+    if (!control->init)
+        return -1;
+
+    int done_head = __atomic_load_n(&control->done_head, __ATOMIC_ACQUIRE);
+    if (control->done_tail == done_head)
+        return -1;
+
+    /* Skip notifications that were overwritten */
+    if (done_head - control->done_tail > WRITER_DONE_SIZE)
+        control->done_tail = done_head - WRITER_DONE_SIZE;
+
+    int index = control->done_tail++ % WRITER_DONE_SIZE;
+    failed = control->done_failed[index];
+    return control->done[index];
+}
+
+}
@@ -0,0 +1,53 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_STATEWRITER_H
+#define LIBTAS_STATEWRITER_H
+
+namespace libtas {
+namespace StateWriter {
+
+    /* Spawn the thread that writes savestates to disk. Like workers, it is
+     * created natively with its stack in our reserved memory, so that it is
+     * never suspended during a checkpoint. Must be called before the game
+     * creates any thread. */
+    void init();
+
+    /* Are new savestates staged in memory and written in the background? */
+    bool enabled();
+
+    /* Queue the writing of a state staged in the memfds into the savestate
+     * files. The memfds are closed when done. Files are written under a
+     * temporary name and renamed at the end. Blocks if the queue is full. */
+    void submit(int slot, int pmfd, int pfd, const char* pagemappath, const char* pagespath);
+
+    /* Is the state of this slot still being written? */
+    bool pending(int slot);
+
+    /* Wait until all queued states are written */
+    void wait();
+
+    /* Returns a slot whose state was written since the last call, or -1.
+     * If the state could not be written, `failed` is set and the files of
+     * the slot are removed. */
+    int nextWritten(bool& failed);
+}
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerPool.h"
+#include "ReservedMemory.h"
+#include "../logging.h"
+#include "../GlobalState.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <csignal>
+#include <cerrno>
+
+namespace libtas {
+
+struct WorkerControl {
+    int count;
+    void (*func)(int, void*);
+    void* arg;
+    sem_t start[WORKERS_MAX];
+    sem_t done;
+};
+
+static_assert(sizeof(WorkerControl) <= ReservedMemory::WORKERS_CTRL_SIZE, "Worker control block does not fit in reserved memory");
+
+static WorkerControl* getControl()
+{
+    return static_cast<WorkerControl*>(ReservedMemory::getAddr(ReservedMemory::WORKERS_CTRL_ADDR));
+}
+
+static char* getSlot(int worker)
+{
+    return static_cast<char*>(ReservedMemory::getAddr(ReservedMemory::WORKERS_ADDR + worker * (WORKER_STACK_SIZE + WORKER_BUFFER_SIZE)));
+}
+
+static void* workerLoop(void* arg)
+{
+    int worker = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+
+    /* Workers only execute our own code, and must not go through any hook */
+    GlobalState::setNative(true);
+
+    WorkerControl* control = getControl();
+    while (true) {
+        while (sem_wait(&control->start[worker]) != 0) {}
+        control->func(worker, control->arg);
+        sem_post(&control->done);
+    }
+
+    return nullptr;
+}
+
+void WorkerPool::init(int count)
+{
+    WorkerControl* control = getControl();
+    control->count = 0;
+
+    /* A single worker would only add synchronization overhead */
+    if (count <= 1)
+        return;
+
+    if (count > WORKERS_MAX)
+        count = WORKERS_MAX;
+
+    sem_init(&control->done, 0, 0);
+
+    /* Block all signals while spawning, so that workers inherit a full
+     * signal mask and never receive signals targeted at game threads. */
+    sigset_t mask, oldmask;
+    sigfillset(&mask);
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &mask, &oldmask));
+
+    for (int w = 0; w < count; w++) {
+        sem_init(&control->start[w], 0, 0);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        NATIVECALL(pthread_attr_setstack(&attr, getSlot(w), WORKER_STACK_SIZE));
+
+        pthread_t pthread_id;
+        int ret;
+        NATIVECALL(ret = pthread_create(&pthread_id, &attr, workerLoop, reinterpret_cast<void*>(static_cast<intptr_t>(w))));
+        pthread_attr_destroy(&attr);
+
+        if (ret != 0) {
+            debuglogstdio(LCF_CHECKPOINT | LCF_ERROR, "Could not create savestate worker %d, error %d", w, ret);
+            break;
+        }
+        control->count++;
+    }
+
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &oldmask, nullptr));
+
+    debuglogstdio(LCF_CHECKPOINT, "Spawned %d savestate workers", control->count);
+}
+
+int WorkerPool::count()
+{
+    return getControl()->count;
+}
+
+char* WorkerPool::getBuffer(int worker)
+{
+    return getSlot(worker) + WORKER_STACK_SIZE;
+}
+
+void WorkerPool::run(void (*func)(int worker, void* arg), void* arg)
+{
+    WorkerControl* control = getControl();
+    control->func = func;
+    control->arg = arg;
+
+    for (int w = 0; w < control->count; w++) {
+        NATIVECALL(sem_post(&control->start[w]));
+    }
+
+    for (int w = 0; w < control->count; w++) {
+        int ret;
+        do {
+            NATIVECALL(ret = sem_wait(&control->done));
+        } while ((ret != 0) && (errno == EINTR));
+    }
+}
+
+}
@@ -0,0 +1,47 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_WORKERPOOL_H
+#define LIBTAS_WORKERPOOL_H
+
+#include <cstddef> // size_t
+
+namespace libtas {
+namespace WorkerPool {
+
+    /* Spawn the worker threads used to process savestates. Threads are created
+     * natively so that they are not registered in the thread list, and their
+     * stacks are located in our reserved memory, so that they are neither
+     * saved nor suspended during a checkpoint. Must be called before the game
+     * creates any thread. */
+    void init(int count);
+
+    /* Number of available workers, 0 if savestates are processed serially */
+    int count();
+
+    /* Get the private buffer of a worker, of size WORKER_BUFFER_SIZE */
+    char* getBuffer(int worker);
+
+    /* Execute func(worker, arg) on all workers in parallel, and return when
+     * all workers have finished. Must only be called by the checkpoint thread. */
+    void run(void (*func)(int worker, void* arg), void* arg);
+}
+}
+
+#endif
@@ -36,10 +36,13 @@
 #include "checkpoint/SaveStateManager.h"
 #include "checkpoint/Checkpoint.h"
 #include "checkpoint/ThreadSync.h"
+#include "checkpoint/ReservedMemory.h"
+#include "checkpoint/StateStats.h"
 #include "ScreenCapture.h"
 #include "WindowTitle.h"
 #include "sdl/SDLEventQueue.h"
 #include "BusyLoopDetection.h"
+#include "MemoryShadow.h"
 #include "audio/AudioContext.h"
 #include "hook.h"
 #include "GameHacks.h"
@@ -305,9 +308,17 @@ void frameBoundary(std::function<void()> draw)
         sendMessage(MSGB_NONDRAW_FRAME);
     }
 
+    /* Copy the pages that the program reads into the memory shadow, while
+     * the game is stopped */
+    if (shared_config.memory_shadow)
+        MemoryShadow::sync();
+
     /* Last message to send */
     sendMessage(MSGB_START_FRAMEBOUNDARY);
 
+    /* All messages of the frame boundary are sent at once */
+    flushSocket();
+
     /* Reset ramwatches and lua drawings */
 #ifdef LIBTAS_ENABLE_HUD
     RenderHUD::resetWatches();
@@ -321,10 +332,17 @@ void frameBoundary(std::function<void()> draw)
         switch (message) {
         case MSGN_RAMWATCH:
         {
-            /* Get ramwatch from the program */
-            std::string ramwatch = receiveString();
+            /* Get all ramwatches from the program, one per line */
+            std::string ramwatches = receiveString();
 #ifdef LIBTAS_ENABLE_HUD
-            RenderHUD::insertWatch(ramwatch);
+            size_t pos = 0;
+            while (pos < ramwatches.size()) {
+                size_t end = ramwatches.find('\n', pos);
+                if (end == std::string::npos)
+                    end = ramwatches.size();
+                RenderHUD::insertWatch(ramwatches.substr(pos, end - pos));
+                pos = end + 1;
+            }
 #endif
             break;
         }
@@ -642,12 +660,13 @@ static void receive_messages(std::function<void()> draw)
 
     /* Catch dead children spawned for state saving */
     while (1) {
-        int slot = SaveStateManager::waitChild();
+        bool failed;
+        int slot = SaveStateManager::waitChild(failed);
         if (slot < 0) break;
 #ifdef LIBTAS_ENABLE_HUD
         std::string msg = "State ";
         msg += std::to_string(slot);
-        msg += " saved";
+        msg += failed ? " could not be saved" : " saved";
         RenderHUD::insertMessage(msg.c_str());
         screen_redraw(draw, hud, preview_ai);
 #endif
@@ -675,16 +694,18 @@ static void receive_messages(std::function<void()> draw)
             if (is_exiting)
                 return;
             
-            NATIVECALL(usleep(1000));
+            /* Wait for the next message, and return early when it arrives */
+            NATIVECALL(waitSocketData(1000));
 
             /* Catch dead children spawned for state saving */
             while (1) {
-                int slot = SaveStateManager::waitChild();
+                bool failed;
+                int slot = SaveStateManager::waitChild(failed);
                 if (slot < 0) break;
 #ifdef LIBTAS_ENABLE_HUD
                 std::string msg = "State ";
                 msg += std::to_string(slot);
-                msg += " saved";
+                msg += failed ? " could not be saved" : " saved";
                 RenderHUD::insertMessage(msg.c_str());
                 screen_redraw(draw, hud, preview_ai);
 #endif
@@ -804,7 +825,8 @@ static void receive_messages(std::function<void()> draw)
 
                     /* Print the successful message, unless we are saving in a fork */
 #ifdef LIBTAS_ENABLE_HUD
-                    if (!(shared_config.savestate_settings & SharedConfig::SS_FORK)) {
+                    if (!(shared_config.savestate_settings & SharedConfig::SS_FORK) ||
+                        (shared_config.savestate_settings & SharedConfig::SS_SNAPSHOT)) {
                         if (shared_config.osd & SharedConfig::OSD_MESSAGES) {
                             std::string msg;
                             msg = "State ";
@@ -845,6 +867,45 @@ static void receive_messages(std::function<void()> draw)
 
                 break;
 
+            case MSGN_SAVESTATE_SIZES:
+            {
+                int count = ReservedMemory::slotCount();
+                sendMessage(MSGB_SAVESTATE_SIZES);
+                sendData(&count, sizeof(int));
+                for (int i = 0; i < count; i++) {
+                    uint64_t size = Checkpoint::stateSize(i);
+                    sendData(&size, sizeof(uint64_t));
+                }
+                break;
+            }
+
+            case MSGN_SAVESTATE_STATS:
+            {
+                const SavestateStats* stats = StateStats::header();
+                sendMessage(MSGB_SAVESTATE_STATS);
+                sendData(stats, sizeof(SavestateStats));
+                if (stats->area_count)
+                    sendData(StateStats::areas(), stats->area_count * sizeof(SavestateAreaStats));
+                break;
+            }
+
+            case MSGN_CLEAR_SOFT_DIRTY:
+            {
+                bool cleared = Checkpoint::clearSoftDirtyForSearch();
+                sendMessage(MSGB_CLEAR_SOFT_DIRTY);
+                sendData(&cleared, sizeof(bool));
+                break;
+            }
+
+            case MSGN_FREE_SAVESTATE:
+            {
+                int freed_slot;
+                receiveData(&freed_slot, sizeof(int));
+                std::string freed_path = receiveString();
+                Checkpoint::freeState(freed_slot, freed_path);
+                break;
+            }
+
             case MSGN_STOP_ENCODE:
                 if (avencoder) {
                     debuglogstdio(LCF_DUMP, "Stop AV dumping");
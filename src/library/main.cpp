@@ -32,6 +32,12 @@
 #include "checkpoint/ThreadManager.h"
 #include "checkpoint/SaveStateManager.h"
 #include "checkpoint/Checkpoint.h"
+#include "checkpoint/WorkerPool.h"
+#include "checkpoint/StateWriter.h"
+#include "checkpoint/PageStore.h"
+#include "checkpoint/LazyRestore.h"
+#include "checkpoint/ReservedMemory.h"
+#include "MemoryShadow.h"
 #include "audio/AudioContext.h"
 #include "encoding/AVEncoder.h"
 #include <unistd.h> // getpid()
@@ -112,6 +118,7 @@ void __attribute__((constructor)) init(void)
     int message = receiveMessage();
     while (message != MSGN_END_INIT) {
         std::string basesavestatepath;
+        std::string pagestorepath;
         std::string steamuserdatapath;
         std::string steamremotestorage;
         int index;
@@ -138,6 +145,10 @@ void __attribute__((constructor)) init(void)
                 basesavestatepath = receiveString();
                 Checkpoint::setBaseSavestatePath(basesavestatepath);
                 break;
+            case MSGN_PAGESTORE_PATH:
+                pagestorepath = receiveString();
+                PageStore::setPath(pagestorepath);
+                break;
             case MSGN_BASE_SAVESTATE_INDEX:
                 receiveData(&index, sizeof(int));
                 Checkpoint::setBaseSavestateIndex(index);
@@ -183,6 +194,36 @@ void __attribute__((constructor)) init(void)
     /* Initialize sound parameters */
     audiocontext.init();
 
+    /* Set the number of savestate slots that the program may use */
+    ReservedMemory::setSlotCount(shared_config.savestate_slots);
+
+    /* Spawn the savestate worker threads, before the game creates any thread */
+    WorkerPool::init(shared_config.savestate_threads);
+
+    /* Create the page store, before any savestate is made */
+    if (shared_config.savestate_settings & SharedConfig::SS_DEDUP)
+        PageStore::init();
+
+    /* Spawn the thread that writes savestates to disk in the background */
+    if (shared_config.savestate_settings & SharedConfig::SS_ASYNC)
+        StateWriter::init();
+
+    /* Spawn the thread that loads savestate pages on first access */
+    if (shared_config.savestate_settings & SharedConfig::SS_LAZY)
+        LazyRestore::init();
+
+    /* Create the memory shadow if enabled, before any savestate is made, and
+     * send its file descriptor with the first frame messages so that the
+     * program can map it */
+    if (shared_config.memory_shadow) {
+        MemoryShadow::init();
+        int shadow_fd = MemoryShadow::fd();
+        if (shadow_fd >= 0) {
+            sendMessage(MSGB_MEMORY_SHADOW);
+            sendData(&shadow_fd, sizeof(int));
+        }
+    }
+
     is_inited = true;
 }
 
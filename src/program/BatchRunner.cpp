@@ -0,0 +1,457 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BatchRunner.h"
+#include "utils.h"
+#include "movie/MovieFile.h"
+#include "ramsearch/MemAccess.h"
+#include "ramsearch/MemLayout.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QMap>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <unistd.h> // fork, execvp
+#include <fcntl.h> // open
+#include <signal.h> // kill
+#include <sys/wait.h> // waitpid
+
+/* Desyncs detected by this instance */
+static std::vector<std::string> desyncs;
+
+static bool report_written = false;
+
+/* A single run of a movie by an instance */
+struct BatchJob {
+    std::string movie; // movie as given by the user
+    std::string perturbation; // applied perturbation, if any
+    std::string moviefile; // movie file actually played
+    std::string reportfile; // report of the instance
+    std::string logfile; // output of the instance
+    pid_t pid = 0;
+    int slot = -1;
+    bool timed_out = false;
+    int exit_status = -1;
+    double wall_seconds = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+void BatchRunner::addDesync(const std::string& desync)
+{
+    desyncs.push_back(desync);
+}
+
+/* Hash the writable memory of the game: data, bss and heap, except the
+ * sections of libTAS itself. Addresses and pointers are part of the hash, so
+ * it is only reproducible because instances writing a report run the game
+ * without address space randomization. */
+static uint64_t hashGameMemory(Context* context)
+{
+    std::unique_ptr<MemLayout> memlayout(new MemLayout(context->game_pid));
+    MemSection section;
+    std::vector<char> buf(1024*1024);
+
+    /* FNV-1a on 64-bit words */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](uint64_t word) {
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+    };
+
+    int types = MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemHeap;
+    while (memlayout->nextSection(types, MemSection::MemNoSpecial, section)) {
+        if ((section.filename == context->libtaspath) || (section.filename == context->libtas32path))
+            continue;
+
+        mix(section.addr);
+        mix(section.size);
+
+        for (uintptr_t addr = section.addr; addr < section.endaddr; addr += buf.size()) {
+            size_t size = section.endaddr - addr;
+            if (size > buf.size())
+                size = buf.size();
+
+            size_t ret = MemAccess::read(buf.data(), reinterpret_cast<void*>(addr), size);
+            if (ret != size)
+                memset(buf.data(), 0, size);
+
+            /* Sections are page-aligned, so the size is a multiple of 8 */
+            for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+                uint64_t word;
+                memcpy(&word, buf.data() + i, sizeof(uint64_t));
+                mix(word);
+            }
+        }
+    }
+
+    return hash;
+}
+
+void BatchRunner::writeReport(Context* context, bool completed)
+{
+    if (context->report_file.empty() || report_written)
+        return;
+    report_written = true;
+
+    QJsonObject report;
+    report["movie"] = QString::fromStdString(context->config.moviefile);
+    report["frames"] = static_cast<qint64>(context->framecount);
+    report["movie_frames"] = static_cast<qint64>(context->config.sc.movie_framecount);
+    report["completed"] = completed;
+
+    /* The memory can only be hashed while the game is at a frame boundary */
+    if (completed && context->game_pid)
+        report["ram_hash"] = QString("%1").arg(hashGameMemory(context), 16, 16, QChar('0'));
+    else
+        report["ram_hash"] = QJsonValue();
+
+    QJsonArray desync_array;
+    for (const std::string& desync : desyncs)
+        desync_array.append(QString::fromStdString(desync));
+    report["desyncs"] = desync_array;
+
+    QFile file(QString::fromStdString(context->report_file));
+    if (!file.open(QIODevice::WriteOnly)) {
+        std::cerr << "Could not write report " << context->report_file << std::endl;
+        return;
+    }
+    file.write(QJsonDocument(report).toJson());
+}
+
+/* Read the lines of a file, skipping empty lines and comments */
+static bool readLines(const std::string& filename, std::vector<std::string>& lines)
+{
+    std::ifstream file(filename);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || (line[0] == '#'))
+            continue;
+        lines.push_back(line);
+    }
+    return true;
+}
+
+static QJsonObject readJson(const std::string& filename)
+{
+    QFile file(QString::fromStdString(filename));
+    if (!file.open(QIODevice::ReadOnly))
+        return QJsonObject();
+    return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+static QString runKey(const QString& movie, const QString& perturbation)
+{
+    return movie + "\n" + perturbation;
+}
+
+/* Generate one movie for each perturbation of the movie in the context.
+ * A perturbation is a frame number, followed by the inputs for this frame
+ * using the format of the movie inputs file */
+static bool buildPerturbedJobs(Context* context, const std::string& perturbfile, const std::string& workdir, std::vector<BatchJob>& jobs)
+{
+    std::vector<std::string> lines;
+    if (!readLines(perturbfile, lines)) {
+        std::cerr << "Could not read perturbations " << perturbfile << std::endl;
+        return false;
+    }
+
+    MovieFile movie(context);
+    int ret = movie.loadMovie(context->config.moviefile);
+    if (ret < 0) {
+        std::cerr << MovieFile::errorString(ret) << std::endl;
+        return false;
+    }
+
+    for (const std::string& line : lines) {
+        std::istringstream iss(line);
+        uint64_t frame;
+        std::string inputs;
+        if (!(iss >> frame) || !(iss >> std::ws) || !std::getline(iss, inputs)) {
+            std::cerr << "Invalid perturbation: " << line << std::endl;
+            return false;
+        }
+
+        AllInputs original, perturbed;
+        if (movie.inputs->getInputs(original, frame) < 0) {
+            std::cerr << "Perturbation frame " << frame << " is outside the movie" << std::endl;
+            return false;
+        }
+        movie.inputs->readFrame(inputs, perturbed);
+
+        BatchJob job;
+        job.movie = context->config.moviefile;
+        job.perturbation = line;
+        job.moviefile = workdir + "/run" + std::to_string(jobs.size()) + ".ltm";
+
+        movie.inputs->setInputs(perturbed, frame, true);
+        movie.saveMovie(job.moviefile);
+        movie.inputs->setInputs(original, frame, true);
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+static pid_t startJob(Context* context, const BatchRunner::Options& options, BatchJob& job, const std::string& instance)
+{
+    std::vector<std::string> args = {options.executable,
+        "--instance", instance,
+        "--report", job.reportfile,
+        "--read", job.moviefile,
+        "--libtas-so-path", context->libtaspath};
+    if (!context->libtas32path.empty()) {
+        args.push_back("--libtas32-so-path");
+        args.push_back(context->libtas32path);
+    }
+    args.push_back(context->gamepath);
+    if (!context->config.gameargs.empty())
+        args.push_back(context->config.gameargs);
+
+    std::vector<char*> argv;
+    for (std::string& arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid != 0) {
+        /* Also set the process group from the parent, so that it exists
+         * when the job is killed before the child has run */
+        if (pid > 0)
+            setpgid(pid, pid);
+        return pid;
+    }
+
+    /* Use a separate process group, so that the game can be killed with
+     * the instance */
+    setpgid(0, 0);
+
+    int fd = open(job.logfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+
+    execvp(argv[0], argv.data());
+    std::cerr << "Could not execute " << argv[0] << std::endl;
+    _exit(-1);
+}
+
+int BatchRunner::run(Context* context, const Options& options)
+{
+    std::string workdir = options.report + ".d";
+    if (create_dir(workdir) < 0) {
+        std::cerr << "Cannot create dir " << workdir << std::endl;
+        return -1;
+    }
+
+    std::vector<BatchJob> jobs;
+    if (!options.perturbations.empty()) {
+        if (context->config.moviefile.empty()) {
+            std::cerr << "Perturbations require a movie to be given with --read" << std::endl;
+            return -1;
+        }
+        if (!buildPerturbedJobs(context, options.perturbations, workdir, jobs))
+            return -1;
+    }
+    else {
+        std::vector<std::string> movies;
+        if (!readLines(options.movielist, movies)) {
+            std::cerr << "Could not read movie list " << options.movielist << std::endl;
+            return -1;
+        }
+        for (const std::string& movie : movies) {
+            BatchJob job;
+            job.movie = realpath_nonexist(movie);
+            job.moviefile = job.movie;
+            jobs.push_back(job);
+        }
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].reportfile = workdir + "/run" + std::to_string(i) + ".json";
+        jobs[i].logfile = workdir + "/run" + std::to_string(i) + ".log";
+        unlink(jobs[i].reportfile.c_str());
+    }
+
+    /* Instances are named after the slot they run in, so that their working
+     * directories are reused between runs */
+    std::string instance = context->instance.empty() ? "batch" : context->instance;
+    int jobcount = (options.jobs > 0) ? options.jobs : 1;
+    std::vector<bool> slot_used(jobcount, false);
+
+    auto batch_start = std::chrono::steady_clock::now();
+    size_t next = 0, finished = 0;
+    int running = 0;
+
+    while (finished < jobs.size()) {
+        /* Fill the free slots */
+        while ((running < jobcount) && (next < jobs.size())) {
+            BatchJob& job = jobs[next++];
+            job.slot = 0;
+            while (slot_used[job.slot])
+                job.slot++;
+            slot_used[job.slot] = true;
+
+            job.start = std::chrono::steady_clock::now();
+            job.pid = startJob(context, options, job, instance + "-" + std::to_string(job.slot));
+            if (job.pid < 0) {
+                std::cerr << "Could not start an instance for " << job.movie << std::endl;
+                job.pid = 0;
+                slot_used[job.slot] = false;
+                finished++;
+                continue;
+            }
+            running++;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid > 0) {
+            for (BatchJob& job : jobs) {
+                if (job.pid != pid)
+                    continue;
+
+                /* Kill any process left by the instance, such as the game */
+                kill(-pid, SIGKILL);
+
+                job.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.start).count();
+                job.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+                job.pid = 0;
+                slot_used[job.slot] = false;
+                running--;
+                finished++;
+
+                std::cout << "[" << finished << "/" << jobs.size() << "] " << job.movie;
+                if (!job.perturbation.empty())
+                    std::cout << " (" << job.perturbation << ")";
+                std::cout << " finished in " << job.wall_seconds << " s" << std::endl;
+                break;
+            }
+            continue;
+        }
+
+        /* Kill the instances that take too long */
+        if (options.timeout > 0) {
+            auto now = std::chrono::steady_clock::now();
+            for (BatchJob& job : jobs) {
+                if (job.pid && !job.timed_out &&
+                    (std::chrono::duration<double>(now - job.start).count() > options.timeout)) {
+                    job.timed_out = true;
+                    kill(-job.pid, SIGKILL);
+                }
+            }
+        }
+
+        usleep(50000);
+    }
+
+    double batch_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+
+    /* Hashes of the reference report */
+    QMap<QString, QString> reference_hashes;
+    if (!options.reference.empty()) {
+        QJsonArray reference_runs = readJson(options.reference)["runs"].toArray();
+        for (const QJsonValue& value : reference_runs) {
+            QJsonObject run = value.toObject();
+            reference_hashes[runKey(run["movie"].toString(), run["perturbation"].toString())] = run["ram_hash"].toString();
+        }
+    }
+
+    /* Gather the instance reports */
+    QJsonArray runs;
+    int completed = 0, desynced = 0;
+    qint64 total_frames = 0;
+    for (const BatchJob& job : jobs) {
+        QJsonObject instance_report = readJson(job.reportfile);
+
+        QJsonObject run;
+        run["movie"] = QString::fromStdString(job.movie);
+        run["perturbation"] = QString::fromStdString(job.perturbation);
+        run["log"] = QString::fromStdString(job.logfile);
+        run["wall_seconds"] = job.wall_seconds;
+        run["exit_status"] = job.exit_status;
+        run["frames"] = instance_report["frames"];
+        run["movie_frames"] = instance_report["movie_frames"];
+        run["ram_hash"] = instance_report["ram_hash"];
+
+        QJsonArray run_desyncs = instance_report["desyncs"].toArray();
+        bool run_completed = instance_report["completed"].toBool();
+        if (job.timed_out)
+            run_desyncs.append(QString("The instance was killed after %1 seconds").arg(options.timeout));
+        else if (!run_completed)
+            run_desyncs.append(QString("The game exited before the end of the movie"));
+
+        QString key = runKey(run["movie"].toString(), run["perturbation"].toString());
+        if (run_completed && reference_hashes.contains(key)) {
+            run["reference_ram_hash"] = reference_hashes[key];
+            if (reference_hashes[key] != run["ram_hash"].toString())
+                run_desyncs.append(QString("The memory hash differs from the reference"));
+        }
+
+        run["completed"] = run_completed;
+        run["desyncs"] = run_desyncs;
+        run["desync"] = !run_desyncs.isEmpty();
+
+        if (run_completed)
+            completed++;
+        if (!run_desyncs.isEmpty())
+            desynced++;
+        total_frames += run["frames"].toVariant().toLongLong();
+
+        runs.append(run);
+    }
+
+    QJsonObject summary;
+    summary["runs"] = static_cast<int>(jobs.size());
+    summary["completed"] = completed;
+    summary["desynced"] = desynced;
+    summary["jobs"] = jobcount;
+    summary["wall_seconds"] = batch_seconds;
+    summary["frames"] = total_frames;
+    summary["frames_per_second"] = (batch_seconds > 0) ? (total_frames / batch_seconds) : 0.0;
+
+    QJsonObject report;
+    report["game"] = QString::fromStdString(context->gamepath);
+    report["summary"] = summary;
+    report["runs"] = runs;
+
+    QFile file(QString::fromStdString(options.report));
+    if (!file.open(QIODevice::WriteOnly)) {
+        std::cerr << "Could not write report " << options.report << std::endl;
+        return -1;
+    }
+    file.write(QJsonDocument(report).toJson());
+
+    std::cout << completed << "/" << jobs.size() << " runs completed, " << desynced << " desynced, in " << batch_seconds << " s" << std::endl;
+    return desynced;
+}
@@ -0,0 +1,71 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_BATCHRUNNER_H_INCLUDED
+#define LIBTAS_BATCHRUNNER_H_INCLUDED
+
+#include "Context.h"
+
+#include <string>
+
+/* Verification of movies by running many instances of the game in parallel.
+ * The runner starts one non-interactive libTAS instance per movie, each with
+ * its own socket and working directories. Each instance writes a report at
+ * the end of the movie, which the runner collects into a single report.
+ * Instances run the game with address space randomization disabled, so that
+ * the memory hashes of the reports can be compared between executions. */
+namespace BatchRunner {
+
+    struct Options {
+        /* libTAS executable used to start the instances */
+        std::string executable;
+
+        /* File listing the movies to run, one per line */
+        std::string movielist;
+
+        /* File listing the perturbations to run on the movie, one per line */
+        std::string perturbations;
+
+        /* Number of instances running in parallel */
+        int jobs;
+
+        /* Time after which an instance is killed, in seconds (0 for none) */
+        int timeout;
+
+        /* JSON report of all runs */
+        std::string report;
+
+        /* Previous report that RAM hashes are compared against */
+        std::string reference;
+    };
+
+    /* Run all the movies and write the report. Returns the number of runs
+     * that desynced or failed, or a negative value on error */
+    int run(Context* context, const Options& options);
+
+    /* Register a desync detected while playing the movie, which is stored in
+     * the instance report */
+    void addDesync(const std::string& desync);
+
+    /* Write the instance report, with the hash of the game memory if the
+     * movie was completed. Only the first call writes the report */
+    void writeReport(Context* context, bool completed);
+}
+
+#endif
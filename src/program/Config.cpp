@@ -95,6 +95,10 @@ void Config::save(const std::string& gamepath) {
     settings.setValue("autosave_delay_sec", autosave_delay_sec);
     settings.setValue("autosave_frames", autosave_frames);
     settings.setValue("autosave_count", autosave_count);
+    settings.setValue("ramsearch_memory_budget", ramsearch_memory_budget);
+    settings.setValue("ramsearch_soft_dirty", ramsearch_soft_dirty);
+    settings.setValue("shared_memory_transport", shared_memory_transport);
+    settings.setValue("movie_text_inputs", movie_text_inputs);
     settings.setValue("auto_restart", auto_restart);
     settings.setValue("mouse_warp", mouse_warp);
     settings.setValue("use_proton", use_proton);
@@ -176,6 +180,10 @@ void Config::save(const std::string& gamepath) {
     settings.endArray();
 
     settings.setValue("savestate_settings", sc.savestate_settings);
+    settings.setValue("savestate_threads", sc.savestate_threads);
+    settings.setValue("savestate_slots", sc.savestate_slots);
+    settings.setValue("savestate_budget", static_cast<qlonglong>(sc.savestate_budget));
+    settings.setValue("memory_shadow", sc.memory_shadow);
 
     settings.endGroup();
 }
@@ -236,6 +244,10 @@ void Config::load(const std::string& gamepath) {
     autosave_delay_sec = settings.value("autosave_delay_sec", autosave_delay_sec).toDouble();
     autosave_frames = settings.value("autosave_frames", autosave_frames).toInt();
     autosave_count = settings.value("autosave_count", autosave_count).toInt();
+    ramsearch_memory_budget = settings.value("ramsearch_memory_budget", ramsearch_memory_budget).toInt();
+    ramsearch_soft_dirty = settings.value("ramsearch_soft_dirty", ramsearch_soft_dirty).toBool();
+    shared_memory_transport = settings.value("shared_memory_transport", shared_memory_transport).toBool();
+    movie_text_inputs = settings.value("movie_text_inputs", movie_text_inputs).toBool();
     auto_restart = settings.value("auto_restart", auto_restart).toBool();
     mouse_warp = settings.value("mouse_warp", mouse_warp).toBool();
     use_proton = settings.value("use_proton", use_proton).toBool();
@@ -311,6 +323,10 @@ void Config::load(const std::string& gamepath) {
     sc.audio_codec = settings.value("audio_codec", sc.audio_codec).toInt();
     sc.audio_bitrate = settings.value("audio_bitrate", sc.audio_bitrate).toInt();
     sc.savestate_settings = settings.value("savestate_settings", sc.savestate_settings).toInt();
+    sc.savestate_threads = settings.value("savestate_threads", sc.savestate_threads).toInt();
+    sc.savestate_slots = settings.value("savestate_slots", sc.savestate_slots).toInt();
+    sc.savestate_budget = settings.value("savestate_budget", static_cast<qlonglong>(sc.savestate_budget)).toLongLong();
+    sc.memory_shadow = settings.value("memory_shadow", sc.memory_shadow).toBool();
     sc.opengl_soft = settings.value("opengl_soft", sc.opengl_soft).toBool();
     sc.opengl_performance = settings.value("opengl_performance", sc.opengl_performance).toBool();
 
@@ -86,6 +86,24 @@ public:
     /* Directory holding files storing ram search results */
     std::string ramsearchdir;
 
+    /* Memory used to store ram search results before storing them in files
+     * inside ramsearchdir, in MB (0 for unlimited) */
+    int ramsearch_memory_budget = 1024;
+
+    /* Only read the memory pages modified since the previous ram search
+     * using soft-dirty bits, when available */
+    bool ramsearch_soft_dirty = true;
+
+    /* Also write the inputs of movies in text format, next to the binary
+     * inputs, so that they can be read by previous versions and by users.
+     * Exported movies always contain the text inputs. */
+    bool movie_text_inputs = false;
+
+    /* Exchange messages with the game through rings in shared memory
+     * instead of the socket, when the game supports it. Off by default,
+     * because it is only faster than the socket with several CPUs. */
+    bool shared_memory_transport = false;
+
     /* Flags when end of movie */
     enum MovieEnd {
         MOVIEEND_READ = 0,
@@ -28,6 +28,10 @@
 #endif
 
 #include <string>
+#include <utility>
+#include <atomic>
+#include <future>
+#include <memory>
 #include <stdint.h>
 #include "ConcurrentQueue.h"
 #include "KeyMapping.h"
@@ -100,6 +104,14 @@ struct Context {
     /* PID of the game */
     pid_t game_pid;
 
+    /* Name of this instance if set, which gets its own socket and working
+     * directories so that several instances can run concurrently */
+    std::string instance;
+
+    /* Path of the report written at the end of the movie, when verifying a
+     * movie without interaction */
+    std::string report_file;
+
     /* Attaching gdb? */
     bool attach_gdb = false;
 
@@ -112,6 +124,15 @@ struct Context {
     /* Queue of released hotkeys that where pushed by the UI, to process by the main thread */
     ConcurrentQueue<HotKeyType> hotkey_released_queue;
 
+    /* Queue of savestate requests pushed by Lua scripts, as a slot and
+     * whether the state must be loaded (true) or saved (false) */
+    ConcurrentQueue<std::pair<int, bool>> lua_savestate_queue;
+
+    /* Queue of requests from the ram search to clear the soft-dirty bits of
+     * the game before reading its memory. The promise is set to the new
+     * value of soft_dirty_epoch, or 0 if the bits were not cleared */
+    ConcurrentQueue<std::shared_ptr<std::promise<uint64_t>>> soft_dirty_clear_queue;
+
     /* Store some game information sent by the game, that is shown in the UI */
     GameInfo game_info;
 
@@ -124,6 +145,11 @@ struct Context {
     /* Can we use incremental savestates? */
     bool is_soft_dirty = false;
 
+    /* Incremented each time the soft-dirty bits of the game may have been
+     * cleared, or the game memory replaced (savestate save and load). Read
+     * by the ram search thread */
+    std::atomic<uint64_t> soft_dirty_epoch{0};
+
     /* MD5 hash of the game executable */
     std::string md5_game;
 
@@ -41,6 +41,135 @@ void GameEvents::init()
     ar_freq = 2;
 }
 
+void GameEvents::saveState(int statei)
+{
+    /* Perform a savestate:
+     * - save the moviefile if we are recording
+     * - tell the game to save its state
+     */
+
+    /* Saving is not allowed if currently encoding */
+    if (context->config.sc.av_dumping) {
+        emit alertToShow(QString("Saving is not allowed when in the middle of video encoding"));
+        return;
+    }
+
+    /* Perform savestate */
+    int message = SaveStateList::save(statei, context, *movie);
+
+    /* Checking that saving succeeded */
+    if (message == MSGB_SAVING_SUCCEEDED) {
+        context->didASavestate = true;
+        emit savestatePerformed(statei, context->framecount);
+    }
+}
+
+void GameEvents::loadState(int statei, bool load_branch)
+{
+    /* Load a savestate:
+     * - check for an existing savestate in the slot
+     * - if in read-only move, we must check that the movie
+         associated with the savestate must be a prefix of the
+         current movie
+     * - tell the game to load its state
+     * - if loading succeeded:
+     * -- send the shared config
+     * -- increment the rerecord count
+     * -- receive the frame count and the current time
+     */
+
+    /* Loading is not allowed if currently encoding */
+    if (context->config.sc.av_dumping) {
+        emit alertToShow(QString("Loading is not allowed when in the middle of video encoding"));
+        return;
+    }
+
+    /* Perform state loading */
+    int error = SaveStateList::load(statei, context, *movie, load_branch);
+
+    /* Handle errors */
+    if (error == SaveState::EINVALID) {
+        if (!(context->config.sc.osd & SharedConfig::OSD_MESSAGES))
+            emit alertToShow(QString("State invalid because new threads were created"));
+        return;
+    }
+
+    if (error == SaveState::ENOSTATEMOVIEPREFIX) {
+        /* Ask the user if they want to load the movie, and get the answer.
+         * Prompting a alert window must be done by the UI thread, so we are
+         * using std::future/std::promise mechanism.
+         */
+        std::promise<bool> answer;
+        std::future<bool> future = answer.get_future();
+        emit askToShow(QString("There is a savestate in that slot from a previous game iteration. Do you want to load the associated movie?"), &answer);
+
+        if (! future.get()) {
+            /* User answered no */
+            return;
+        }
+
+        /* Loading the movie */
+        emit inputsToBeChanged();
+        movie->loadSavestateMovie(SaveStateList::get(statei).getMoviePath());
+        emit inputsChanged();
+
+        /* Return if we already are on the correct frame */
+        if (context->framecount == movie->header->savestate_framecount)
+            return;
+
+        /* Fast-forward to savestate frame */
+        context->config.sc.recording = SharedConfig::RECORDING_READ;
+        context->config.sc.movie_framecount = movie->inputs->nbFrames();
+        context->movie_time_sec = movie->header->length_sec;
+        context->movie_time_nsec = movie->header->length_nsec;
+        context->pause_frame = movie->header->savestate_framecount;
+        context->config.sc.running = true;
+        context->config.sc_modified = true;
+
+        emit sharedConfigChanged();
+
+        return;
+    }
+
+    if (error == SaveState::ENOSTATE) {
+        if (!(context->config.sc.osd & SharedConfig::OSD_MESSAGES))
+            emit alertToShow(QString("There is no savestate to load in this slot"));
+        return;
+    }
+
+    if (error == SaveState::ENOMOVIE) {
+        emit alertToShow(QString("Could not load the moviefile associated with the savestate"));
+        return;
+    }
+
+    if (error == SaveState::EINPUTMISMATCH) {
+        if (!(context->config.sc.osd & SharedConfig::OSD_MESSAGES)) {
+            emit alertToShow(QString("Trying to load a state in read-only but the inputs mismatch"));
+        }
+        return;
+    }
+
+    emit inputsToBeChanged();
+
+    /* Processing after state loading */
+    int message = SaveStateList::postLoad(statei, context, *movie, load_branch);
+
+    /* Handle errors and return values */
+    if (message == SaveState::ENOLOAD) {
+        if (!context->config.sc.opengl_soft) {
+            emit alertToShow(QString("Crash after loading the savestate. Savestates are unstable unless you check Video>Force software rendering"));
+        }
+
+        return;
+    }
+
+    if (message == MSGB_LOADING_SUCCEEDED) {
+        emit savestatePerformed(statei, 0);
+    }
+
+    emit inputsChanged();
+}
+
 bool GameEvents::processEvent(GameEvents::EventType type, struct HotKey &hk)
 {
     switch (type) {
@@ -109,29 +238,9 @@ bool GameEvents::processEvent(GameEvents::EventType type, struct HotKey &hk)
         case HOTKEY_SAVESTATE9:
         case HOTKEY_SAVESTATE_BACKTRACK:
         {
-            /* Perform a savestate:
-             * - save the moviefile if we are recording
-             * - tell the game to save its state
-             */
-
-            /* Saving is not allowed if currently encoding */
-            if (context->config.sc.av_dumping) {
-                emit alertToShow(QString("Saving is not allowed when in the middle of video encoding"));
-                return false;
-            }
-
             /* Slot number */
             int statei = hk.type - HOTKEY_SAVESTATE1 + 1;
-
-            /* Perform savestate */
-            int message = SaveStateList::save(statei, context, *movie);
-
-            /* Checking that saving succeeded */
-            if (message == MSGB_SAVING_SUCCEEDED) {
-                context->didASavestate = true;
-                emit savestatePerformed(statei, context->framecount);
-            }
-
+            saveState(statei);
             return false;
         }
 
@@ -156,116 +265,13 @@ bool GameEvents::processEvent(GameEvents::EventType type, struct HotKey &hk)
         case HOTKEY_LOADBRANCH9:
         case HOTKEY_LOADBRANCH_BACKTRACK:
 
-            /* Load a savestate:
-             * - check for an existing savestate in the slot
-             * - if in read-only move, we must check that the movie
-                 associated with the savestate must be a prefix of the
-                 current movie
-             * - tell the game to load its state
-             * - if loading succeeded:
-             * -- send the shared config
-             * -- increment the rerecord count
-             * -- receive the frame count and the current time
-             */
         {
-
-            /* Loading is not allowed if currently encoding */
-            if (context->config.sc.av_dumping) {
-                emit alertToShow(QString("Loading is not allowed when in the middle of video encoding"));
-                return false;
-            }
-
             /* Loading branch? */
             bool load_branch = (hk.type >= HOTKEY_LOADBRANCH1) && (hk.type <= HOTKEY_LOADBRANCH_BACKTRACK);
 
             /* Slot number */
             int statei = hk.type - (load_branch?HOTKEY_LOADBRANCH1:HOTKEY_LOADSTATE1) + 1;
-
-            /* Perform state loading */
-            int error = SaveStateList::load(statei, context, *movie, load_branch);
-
-            /* Handle errors */
-            if (error == SaveState::EINVALID) {
-                if (!(context->config.sc.osd & SharedConfig::OSD_MESSAGES))
-                    emit alertToShow(QString("State invalid because new threads were created"));
-                return false;
-            }
-
-            if (error == SaveState::ENOSTATEMOVIEPREFIX) {
-                /* Ask the user if they want to load the movie, and get the answer.
-                 * Prompting a alert window must be done by the UI thread, so we are
-                 * using std::future/std::promise mechanism.
-                 */
-                std::promise<bool> answer;
-                std::future<bool> future = answer.get_future();
-                emit askToShow(QString("There is a savestate in that slot from a previous game iteration. Do you want to load the associated movie?"), &answer);
-
-                if (! future.get()) {
-                    /* User answered no */
-                    return false;
-                }
-
-                /* Loading the movie */
-                emit inputsToBeChanged();
-                movie->loadSavestateMovie(SaveStateList::get(statei).getMoviePath());
-                emit inputsChanged();
-
-                /* Return if we already are on the correct frame */
-                if (context->framecount == movie->header->savestate_framecount)
-                    return false;
-
-                /* Fast-forward to savestate frame */
-                context->config.sc.recording = SharedConfig::RECORDING_READ;
-                context->config.sc.movie_framecount = movie->inputs->nbFrames();
-                context->movie_time_sec = movie->header->length_sec;
-                context->movie_time_nsec = movie->header->length_nsec;
-                context->pause_frame = movie->header->savestate_framecount;
-                context->config.sc.running = true;
-                context->config.sc_modified = true;
-
-                emit sharedConfigChanged();
-
-                return false;
-            }
-
-            if (error == SaveState::ENOSTATE) {
-                if (!(context->config.sc.osd & SharedConfig::OSD_MESSAGES))
-                    emit alertToShow(QString("There is no savestate to load in this slot"));
-                return false;
-            }
-
-            if (error == SaveState::ENOMOVIE) {
-                emit alertToShow(QString("Could not load the moviefile associated with the savestate"));
-                return false;                
-            }
-
-            if (error == SaveState::EINPUTMISMATCH) {
-                if (!(context->config.sc.osd & SharedConfig::OSD_MESSAGES)) {
-                    emit alertToShow(QString("Trying to load a state in read-only but the inputs mismatch"));
-                }
-                return false;                
-            }
-
-            emit inputsToBeChanged();
-
-            /* Processing after state loading */
-            int message = SaveStateList::postLoad(statei, context, *movie, load_branch);
-
-            /* Handle errors and return values */
-            if (message == SaveState::ENOLOAD) {
-                if (!context->config.sc.opengl_soft) {
-                    emit alertToShow(QString("Crash after loading the savestate. Savestates are unstable unless you check Video>Force software rendering"));
-                }
-
-                return false;
-            }
-
-            if (message == MSGB_LOADING_SUCCEEDED) {
-                emit savestatePerformed(statei, 0);
-            }
-
-            emit inputsChanged();
-
+            loadState(statei, load_branch);
             return false;
         }
 
@@ -361,11 +367,36 @@ int GameEvents::handleEvent()
             ar_advance = true;
     }
 
+    int flags = ar_advance?RETURN_FLAG_ADVANCE:0;
+
+    /* Process a savestate request from a Lua script */
+    if (!context->lua_savestate_queue.empty()) {
+        std::pair<int, bool> request;
+        context->lua_savestate_queue.pop(request);
+        if (request.second)
+            loadState(request.first, false);
+        else
+            saveState(request.first);
+        return flags | RETURN_FLAG_UPDATE;
+    }
+
+    /* Clear the soft-dirty bits for the ram search, which waits for it
+     * before reading the game memory */
+    if (!context->soft_dirty_clear_queue.empty()) {
+        std::shared_ptr<std::promise<uint64_t>> request;
+        context->soft_dirty_clear_queue.pop(request);
+
+        bool cleared = false;
+        sendMessage(MSGN_CLEAR_SOFT_DIRTY);
+        if (receiveMessage() == MSGB_CLEAR_SOFT_DIRTY)
+            receiveData(&cleared, sizeof(bool));
+        uint64_t epoch = ++context->soft_dirty_epoch;
+        request->set_value(cleared ? epoch : 0);
+    }
+
     struct HotKey hk;
     EventType eventType = nextEvent(hk);
 
-    int flags = ar_advance?RETURN_FLAG_ADVANCE:0;
-
     if (eventType) {
         flags |= RETURN_FLAG_EVENT;
         flags |= RETURN_FLAG_UPDATE; // For now, mark all events for update
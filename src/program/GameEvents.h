@@ -81,6 +81,12 @@ protected:
 
     bool processEvent(EventType type, struct HotKey &hk);
 
+    /* Save the state into a slot */
+    void saveState(int statei);
+
+    /* Load the state of a slot, or a branch if `load_branch` is set */
+    void loadState(int statei, bool load_branch);
+
 signals:
     void alertToShow(QString str);
     void sharedConfigChanged();
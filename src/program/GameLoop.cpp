@@ -32,11 +32,13 @@
 
 #include "utils.h"
 #include "AutoSave.h"
+#include "BatchRunner.h"
 // #include "SaveState.h"
 #include "SaveStateList.h"
 #include "lua/Input.h"
 #include "lua/Main.h"
 #include "ramsearch/MemAccess.h"
+#include "ramsearch/MemShadow.h"
 
 #include "../shared/sockethelpers.h"
 #include "../shared/SharedConfig.h"
@@ -124,8 +126,11 @@ void GameLoop::start()
             ((context->config.sc.movie_framecount + context->pause_frame) == (context->framecount + 1)))) {
 
             if (!context->interactive) {
-                /* Quit at the end of the movie if non-interactive */
-                shouldQuit = true;
+                /* Quit at the end of the movie if non-interactive. When
+                 * writing a report, the inputs of the last frame must be
+                 * executed first, so we quit one frame later */
+                if (context->report_file.empty())
+                    shouldQuit = true;
             } else {
                 /* Disable pause */
                 context->pause_frame = 0;
@@ -138,6 +143,14 @@ void GameLoop::start()
             }
         }
 
+        /* Write the report once all the movie inputs were executed */
+        if (!context->report_file.empty() &&
+            (context->config.sc.recording == SharedConfig::RECORDING_READ) &&
+            (context->framecount >= context->config.sc.movie_framecount)) {
+            BatchRunner::writeReport(context, true);
+            shouldQuit = true;
+        }
+
         Lua::Main::callLua(context, "onFrame");
 
         endFrameMessages(ai);
@@ -186,7 +199,7 @@ void GameLoop::init()
     /* Remove the file socket */
     int err = removeSocket();
     if (err != 0)
-        emit alertToShow(QString("Could not remove socket file /tmp/libTAS.socket: %2").arg(strerror(err)));
+        emit alertToShow(QString("Could not remove socket file %1: %2").arg(getSocketFilename()).arg(strerror(err)));
 
     /* Init savestate list */
     SaveStateList::init(context);
@@ -228,8 +241,10 @@ void GameLoop::init()
             }
 
             /* Check md5 match */
-            if ((!context->md5_movie.empty()) && (context->md5_game.compare(context->md5_movie) != 0))
+            if ((!context->md5_movie.empty()) && (context->md5_game.compare(context->md5_movie) != 0)) {
                 emit alertToShow(QString("Game executable hash does not match with the hash stored in the movie!"));
+                BatchRunner::addDesync("Game executable hash does not match with the hash stored in the movie");
+            }
 
         }
         else {
@@ -268,7 +283,7 @@ void GameLoop::init()
 void GameLoop::initProcessMessages()
 {
     /* Connect to the socket between the program and the game */
-    initSocketProgram();
+    initSocketProgram(context->config.shared_memory_transport);
 
     /* Receive informations from the game */
     int message = receiveMessage();
@@ -344,6 +359,16 @@ void GameLoop::initProcessMessages()
         }
     }
 
+    /* Send the path of the page store shared by all savestates */
+    if ((context->config.sc.savestate_settings & SharedConfig::SS_DEDUP) &&
+        !(context->config.sc.savestate_settings & SharedConfig::SS_RAM)) {
+        std::string pagestorepath = context->config.savestatedir + '/';
+        pagestorepath += context->gamename;
+        pagestorepath += ".pagestore";
+        sendMessage(MSGN_PAGESTORE_PATH);
+        sendString(pagestorepath);
+    }
+
     /* Send the Steam user data path and remote storage */
     if (context->config.sc.virtual_steam) {
         sendMessage(MSGN_STEAM_USER_DATA_PATH);
@@ -423,6 +448,14 @@ bool GameLoop::startFrameMessages()
         case MSGB_ENCODING_SEGMENT:
             receiveData(&context->encoding_segment, sizeof(int));
             break;
+        case MSGB_MEMORY_SHADOW:
+        {
+            /* Sent with the first frame messages if the shadow is enabled */
+            int shadow_fd;
+            receiveData(&shadow_fd, sizeof(int));
+            MemShadow::init(context->game_pid, shadow_fd);
+            break;
+        }
         case MSGB_INVALIDATE_SAVESTATES:
             /* Only save a backtrack savestate if we did at least one savestate.
              * This prevent incremental savestating from being inefficient if a
@@ -454,6 +487,7 @@ bool GameLoop::startFrameMessages()
         case MSGB_QUIT:
             if (!context->interactive) {
                 /* Exit the program when game has exit */
+                BatchRunner::writeReport(context, false);
                 exit(0);
             }
             return true;
@@ -470,18 +504,21 @@ bool GameLoop::startFrameMessages()
         message = receiveMessage();
     }
 
+    /* The game is stopped and has filled the memory shadow */
+    MemShadow::setValid(context->config.sc.memory_shadow);
+
     /* Store in movie and indicate the input editor if the current frame
      * is a draw frame or not */
     movie.editor->setDraw(draw_frame);
 
     /* Send ram watches */
     if (context->config.sc.osd & SharedConfig::OSD_RAMWATCHES) {
-        std::string ramwatch;
-        emit getRamWatch(ramwatch);
-        while(!ramwatch.empty()) {
+        /* All watches are sent in a single message */
+        std::string ramwatches;
+        emit getRamWatch(ramwatches);
+        if (!ramwatches.empty()) {
             sendMessage(MSGN_RAMWATCH);
-            sendString(ramwatch);
-            emit getRamWatch(ramwatch);
+            sendString(ramwatches);
         }
     }
 
@@ -495,6 +532,9 @@ bool GameLoop::startFrameMessages()
 
 void GameLoop::sleepSendPreview()
 {
+    /* Messages sent while handling events must reach the game now */
+    flushSocket();
+
     /* Sleep a bit to not surcharge the processor */
     struct timespec tim = {0, 17L*1000L*1000L};
     nanosleep(&tim, NULL);
@@ -524,6 +564,7 @@ void GameLoop::sleepSendPreview()
     if (!(preview_ai == last_preview_ai)) {
         sendMessage(MSGN_PREVIEW_INPUTS);
         sendData(&preview_ai, sizeof(AllInputs));
+        flushSocket();
         last_preview_ai = preview_ai;
     }
 
@@ -661,7 +702,9 @@ void GameLoop::processInputs(AllInputs &ai)
                         ((context->movie_time_sec != cur_sec) ||
                         (context->movie_time_nsec != cur_nsec))) {
 
-                        emit alertToShow(QString("Movie length mismatch. Metadata stores %1.%2 seconds but end time is %3.%4 seconds.").arg(context->movie_time_sec).arg(context->movie_time_nsec, 9, 10, QChar('0')).arg(cur_sec).arg(cur_nsec, 9, 10, QChar('0')));
+                        QString alert = QString("Movie length mismatch. Metadata stores %1.%2 seconds but end time is %3.%4 seconds.").arg(context->movie_time_sec).arg(context->movie_time_nsec, 9, 10, QChar('0')).arg(cur_sec).arg(cur_nsec, 9, 10, QChar('0'));
+                        emit alertToShow(alert);
+                        BatchRunner::addDesync(alert.toStdString());
                     }
                     context->movie_time_sec = cur_sec;
                     context->movie_time_nsec = cur_nsec;
@@ -719,6 +762,12 @@ void GameLoop::endFrameMessages(AllInputs &ai)
         sendMessage(MSGN_USERQUIT);
     }
 
+    /* The game is about to run, so the shadow gets outdated. Request the
+     * pages read during this frame for the next one. */
+    MemShadow::setValid(false);
+    if (context->config.sc.memory_shadow)
+        MemShadow::update();
+
     sendMessage(MSGN_END_FRAMEBOUNDARY);
 }
 
@@ -784,6 +833,7 @@ void GameLoop::loopExit()
 
     /* Unvalidate game pid */
     MemAccess::init(0);
+    MemShadow::init(0, -1);
 
     /* Reset the frame count */
     context->framecount = 0;
@@ -793,4 +843,10 @@ void GameLoop::loopExit()
 
     context->status = Context::INACTIVE;
     emit statusChanged();
+
+    /* Nothing else can happen when verifying a movie */
+    if (!context->report_file.empty()) {
+        BatchRunner::writeReport(context, false);
+        exit(0);
+    }
 }
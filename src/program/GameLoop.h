@@ -83,7 +83,7 @@ signals:
     void inputsToBeEdited(unsigned long long framecount);
     void inputsEdited(unsigned long long framecount);
 
-    void getRamWatch(std::string &watch);
+    void getRamWatch(std::string &watches);
 
     void getTimeTrace(int type, unsigned long long hash, std::string stacktrace);
     
@@ -25,6 +25,7 @@
 #include "GameThread.h"
 #include "utils.h"
 #include "../shared/SharedConfig.h"
+#include "../shared/sockethelpers.h"
 
 #include <string>
 #include <sstream>
@@ -117,6 +118,9 @@ void GameThread::launch(Context *context)
 
     setenv("LIBTAS_START_FRAME", std::to_string(context->framecount).c_str(), 1);
 
+    /* Pass the socket file of this instance to the game */
+    setenv("LIBTAS_SOCKET_PATH", getSocketFilename(), 1);
+
     /* Override timezone for determinism */
     setenv("TZ", "UTC0", 1);
 
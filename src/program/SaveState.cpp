@@ -25,6 +25,7 @@
 #include "../shared/sockethelpers.h"
 #include "../shared/SharedConfig.h"
 #include "../shared/messages.h"
+#include "ramsearch/MemShadow.h"
 
 void SaveState::init(Context* context, int i)
 {
@@ -33,6 +34,10 @@ void SaveState::init(Context* context, int i)
     framecount = 0; // Special value for `no state`
     parent = -1;
     invalid = false;
+    pinned = false;
+    evicted = false;
+    size = 0;
+    last_used = 0;
     movie = std::unique_ptr<MovieFile>(new MovieFile(context));
 
     buildPaths(context);
@@ -123,12 +128,12 @@ int SaveState::save(Context* context, const MovieFile& m)
     sendData(&id, sizeof(int));
 
     /* Send the savestate path */
-    if (! (context->config.sc.savestate_settings & SharedConfig::SS_RAM)) {
+    if (! (context->config.sc.savestate_settings & (SharedConfig::SS_RAM | SharedConfig::SS_SNAPSHOT))) {
         sendMessage(MSGN_SAVESTATE_PATH);
         sendString(path);
     }
     else {
-        /* Create empty savestate files if stored in RAM */
+        /* Create empty savestate files if stored in RAM or in processes */
         std::ofstream opm(pagemap_path);
         opm.close();
         std::ofstream op(pages_path);
@@ -140,6 +145,9 @@ int SaveState::save(Context* context, const MovieFile& m)
         sendString(saving_msg);
     }
 
+    /* Saving may clear the soft-dirty bits of the game, so the ram search
+     * must not rely on them anymore */
+    context->soft_dirty_epoch++;
     sendMessage(MSGN_SAVESTATE);
 
     /* Checking that saving succeeded */
@@ -149,6 +157,7 @@ int SaveState::save(Context* context, const MovieFile& m)
     if (message == MSGB_SAVING_SUCCEEDED) {
         framecount = context->framecount;
         invalid = false;
+        evicted = false;
     }
     
     return message;
@@ -206,7 +215,7 @@ int SaveState::load(Context* context, const MovieFile& m, bool branch)
     sendData(&id, sizeof(int));
 
     /* Send savestate path */
-    if (! (context->config.sc.savestate_settings & SharedConfig::SS_RAM)) {
+    if (! (context->config.sc.savestate_settings & (SharedConfig::SS_RAM | SharedConfig::SS_SNAPSHOT))) {
         sendMessage(MSGN_SAVESTATE_PATH);
         sendString(path);
     }
@@ -231,6 +240,12 @@ int SaveState::load(Context* context, const MovieFile& m, bool branch)
         sendString(loading_msg);
     }
 
+    /* Loading replaces the game memory, so the values stored by the ram
+     * search are not the current ones anymore */
+    context->soft_dirty_epoch++;
+
+    /* The memory shadow is only copied at the next frame boundary */
+    MemShadow::setValid(false);
     sendMessage(MSGN_LOADSTATE);
      
     return 0;
@@ -301,6 +316,27 @@ int SaveState::postLoad(Context* context, MovieFile& m, bool branch)
     return 0;
 }
 
+void SaveState::evict(Context* context)
+{
+    /* The game releases the pages of the state and removes its files.
+     * States stored on disk must not be removed before, because the game
+     * reads them to release their pages from the page store. */
+    sendMessage(MSGN_FREE_SAVESTATE);
+    sendData(&id, sizeof(int));
+    sendString(path);
+
+    /* Remove the empty savestate files, so that the slot appears empty */
+    if (context->config.sc.savestate_settings & (SharedConfig::SS_RAM | SharedConfig::SS_SNAPSHOT)) {
+        unlink(pagemap_path.c_str());
+        unlink(pages_path.c_str());
+    }
+
+    framecount = 0;
+    parent = -1;
+    size = 0;
+    evicted = true;
+}
+
 void SaveState::backupMovie()
 {
     if (framecount) // 0 means no state has been made
@@ -56,6 +56,19 @@ public:
     /* Is invalid because threads have changed */
     bool invalid;
 
+    /* Is protected from eviction when above the memory budget. States are
+     * only pinned by Lua scripts. */
+    bool pinned;
+
+    /* Was removed because of the memory budget */
+    bool evicted;
+
+    /* Memory used by the state when stored in RAM or in a process */
+    uint64_t size;
+
+    /* Value of the use counter when the state was last saved or loaded */
+    uint64_t last_used;
+
     /* Movie file */
     std::unique_ptr<MovieFile> movie;
 
@@ -78,6 +91,9 @@ public:
     /* Process after state loading. Return message or error */
     int postLoad(Context* context, MovieFile& movie, bool branch);
 
+    /* Remove the state stored in RAM, in a process or on disk */
+    void evict(Context* context);
+
     /* Save movie on disk when exiting */
     void backupMovie();
 
@@ -18,15 +18,21 @@
  */
 
 #include <iostream>
+#include <vector>
+#include <mutex>
+#include <atomic>
 
 #include "SaveStateList.h"
 #include "SaveState.h"
 #include "../shared/messages.h"
+#include "../shared/sockethelpers.h"
 
-#define NB_STATES 11
+/* Bounds on the number of savestates, which must match the game */
+#define MIN_STATES 11
+#define MAX_STATES 65536
 
-/* Array of savestates */
-static SaveState states[NB_STATES];
+/* Array of savestates, which is only accessed by the game thread */
+static std::vector<SaveState> states;
 
 /* Id of last loaded or saved savestate */
 static int last_state_id;
@@ -34,19 +40,60 @@ static int last_state_id;
 /* Old id of root savestate */
 static uint64_t old_root_framecount;
 
+/* Counter incremented each time a state is saved or loaded */
+static uint64_t use_counter;
+
+/* Number of slots, memory used by all states, number of states loaded, of
+ * slots that could not be loaded because they were evicted, and of evicted
+ * states. They are also read by the UI thread, so they are published as
+ * atomics by the game thread each time the states change. */
+static std::atomic<int> state_count;
+static std::atomic<uint64_t> total_size;
+static std::atomic<uint64_t> hit_count;
+static std::atomic<uint64_t> miss_count;
+static std::atomic<uint64_t> eviction_count;
+
+/* Statistics of the last savestate, which are read by the UI thread */
+static std::mutex stats_mutex;
+static SavestateStats last_stats;
+static std::vector<SavestateAreaStats> last_area_stats;
+static uint64_t stats_count;
+
+/* Are the statistics asked to the game after each savestate? */
+static std::atomic<bool> stats_enabled(false);
+
 void SaveStateList::init(Context* context)
 {
-    for (int i = 0; i < NB_STATES; i++) {
+    int nb_states = context->config.sc.savestate_slots;
+    if (nb_states < MIN_STATES)
+        nb_states = MIN_STATES;
+    if (nb_states > MAX_STATES)
+        nb_states = MAX_STATES;
+
+    states.clear();
+    states.resize(nb_states);
+    for (int i = 0; i < nb_states; i++) {
         states[i].init(context, i);
     }
     
     last_state_id = -1;
     old_root_framecount = 0;
+    use_counter = 0;
+    hit_count = 0;
+    miss_count = 0;
+    eviction_count = 0;
+    state_count = nb_states;
+    total_size = 0;
+}
+
+int SaveStateList::count()
+{
+    return state_count;
 }
 
 SaveState& SaveStateList::get(int id)
 {
-    if (id < 0 || id >= NB_STATES) {
+    if (id < 0 || id >= static_cast<int>(states.size())) {
         std::cerr << "Unknown savestate " << id << std::endl;
         id = 0;
     }
@@ -54,6 +101,108 @@ SaveState& SaveStateList::get(int id)
     return states[id];
 }
 
+/* Are states stored in memory and subject to a memory budget? Sizes are only
+ * asked to the game in that case. */
+static bool hasBudget(Context* context)
+{
+    return (context->config.sc.savestate_settings & (SharedConfig::SS_RAM | SharedConfig::SS_SNAPSHOT)) &&
+        (context->config.sc.savestate_budget > 0);
+}
+
+/* Memory used by all states, computed from the game thread */
+static uint64_t computeTotalSize()
+{
+    uint64_t total = 0;
+    for (const SaveState& ss : states) {
+        if (ss.framecount != 0)
+            total += ss.size;
+    }
+    return total;
+}
+
+/* Ask the game for the memory used by each state */
+static void updateSizes()
+{
+    sendMessage(MSGN_SAVESTATE_SIZES);
+
+    int message = receiveMessage();
+    if (message != MSGB_SAVESTATE_SIZES) {
+        std::cerr << "Got wrong message after asking for savestate sizes" << std::endl;
+        return;
+    }
+
+    int nb_sizes;
+    receiveData(&nb_sizes, sizeof(int));
+    for (int i = 0; i < nb_sizes; i++) {
+        uint64_t size;
+        receiveData(&size, sizeof(uint64_t));
+        if (i < static_cast<int>(states.size()))
+            states[i].size = size;
+    }
+}
+
+/* Ask the game for the statistics of the last savestate */
+static void updateStats()
+{
+    sendMessage(MSGN_SAVESTATE_STATS);
+
+    int message = receiveMessage();
+    if (message != MSGB_SAVESTATE_STATS) {
+        std::cerr << "Got wrong message after asking for savestate statistics" << std::endl;
+        return;
+    }
+
+    SavestateStats stats;
+    receiveData(&stats, sizeof(SavestateStats));
+    std::vector<SavestateAreaStats> area_stats(stats.area_count);
+    if (stats.area_count)
+        receiveData(area_stats.data(), stats.area_count * sizeof(SavestateAreaStats));
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    last_stats = stats;
+    last_area_stats.swap(area_stats);
+    stats_count++;
+}
+
+/* Remove the least recently used states that are not pinned, until the
+ * memory budget is respected */
+static void enforceBudget(int keep_id, Context* context)
+{
+    int64_t budget = context->config.sc.savestate_budget;
+    if (budget <= 0)
+        return;
+
+    uint64_t total = computeTotalSize();
+    while (total > static_cast<uint64_t>(budget)) {
+        int lru_id = -1;
+        for (int i = 1; i < static_cast<int>(states.size()); i++) {
+            if ((i == keep_id) || states[i].pinned || (states[i].framecount == 0))
+                continue;
+            if ((lru_id == -1) || (states[i].last_used < states[lru_id].last_used))
+                lru_id = i;
+        }
+
+        if (lru_id == -1) {
+            std::cerr << "Savestates use " << total << " bytes, but all remaining states are pinned" << std::endl;
+            return;
+        }
+
+        SaveState& lru = states[lru_id];
+        total -= lru.size;
+
+        /* Update parent of every child to its grandparent */
+        for (SaveState& child : states) {
+            if (child.parent == lru_id)
+                child.parent = lru.parent;
+        }
+        if (last_state_id == lru_id)
+            last_state_id = lru.parent;
+
+        lru.evict(context);
+        eviction_count++;
+    }
+}
+
 int SaveStateList::save(int id, Context* context, MovieFile& movie)
 {
     SaveState& ss = get(id);
@@ -64,7 +213,7 @@ int SaveStateList::save(int id, Context* context, MovieFile& movie)
         old_root_framecount = rootStateFramecount();        
         
         /* Update parent of every child to its grandparent */
-        for (int cid = 0; cid < NB_STATES; cid++) {
+        for (int cid = 0; cid < static_cast<int>(states.size()); cid++) {
             if (cid == id)
                 continue;
             if (states[cid].parent == id)
@@ -76,6 +225,16 @@ int SaveStateList::save(int id, Context* context, MovieFile& movie)
             ss.parent = last_state_id;
             
         last_state_id = id;
+        ss.last_used = ++use_counter;
+
+        if (hasBudget(context)) {
+            updateSizes();
+            enforceBudget(id, context);
+        }
+        total_size = computeTotalSize();
+
+        if (stats_enabled)
+            updateStats();
     }
     
     return message;
@@ -84,7 +243,12 @@ int SaveStateList::save(int id, Context* context, MovieFile& movie)
 int SaveStateList::load(int id, Context* context, MovieFile& movie, bool branch)
 {
     SaveState& ss = get(id);
-    return ss.load(context, movie, branch);
+    int error = ss.load(context, movie, branch);
+
+    if ((error == SaveState::ENOSTATE) && ss.evicted)
+        miss_count++;
+
+    return error;
 }
 
 int SaveStateList::postLoad(int id, Context* context, MovieFile& movie, bool branch)
@@ -96,6 +260,15 @@ int SaveStateList::postLoad(int id, Context* context, MovieFile& movie, bool bra
         /* Update root savestate */
         old_root_framecount = rootStateFramecount();
         last_state_id = id;
+        ss.last_used = ++use_counter;
+        hit_count++;
+
+        if (hasBudget(context))
+            updateSizes();
+        total_size = computeTotalSize();
+
+        if (stats_enabled)
+            updateStats();
     }
     
     return message;
@@ -103,19 +276,20 @@ int SaveStateList::postLoad(int id, Context* context, MovieFile& movie, bool bra
 
 void SaveStateList::invalidate()
 {
-    for (int i = 0; i < NB_STATES; i++) {
-        states[i].invalidate();
+    for (SaveState& ss : states) {
+        ss.invalidate();
     }
     
     last_state_id = -1;
     old_root_framecount = 0;
+    total_size = computeTotalSize();
 }
 
 int SaveStateList::stateAtFrame(uint64_t frame)
 {
-    for (int i = 0; i < NB_STATES; i++) {
-        if ((states[i].framecount == frame) && !states[i].invalid)
-            return states[i].id;
+    for (const SaveState& ss : states) {
+        if ((ss.framecount == frame) && !ss.invalid)
+            return ss.id;
     }
 
     return -1;
@@ -160,7 +334,46 @@ int SaveStateList::nearestState(uint64_t framecount)
 
 void SaveStateList::backupMovies()
 {
-    for (int i = 0; i < NB_STATES; i++) {
-        states[i].backupMovie();
+    for (SaveState& ss : states) {
+        ss.backupMovie();
     }
 }
+
+uint64_t SaveStateList::totalSize()
+{
+    return total_size;
+}
+
+uint64_t SaveStateList::hitCount()
+{
+    return hit_count;
+}
+
+uint64_t SaveStateList::missCount()
+{
+    return miss_count;
+}
+
+uint64_t SaveStateList::evictionCount()
+{
+    return eviction_count;
+}
+
+uint64_t SaveStateList::lastStats(SavestateStats& stats, std::vector<SavestateAreaStats>& area_stats)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats = last_stats;
+    area_stats = last_area_stats;
+    return stats_count;
+}
+
+uint64_t SaveStateList::statsCount()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return stats_count;
+}
+
+void SaveStateList::setStatsEnabled(bool enabled)
+{
+    stats_enabled = enabled;
+}
@@ -22,7 +22,9 @@
 
 #include "Context.h"
 #include "SaveState.h"
+#include "../shared/SavestateStats.h"
 #include <string>
+#include <vector>
 #include <stdint.h>
 
 namespace SaveStateList {
@@ -30,6 +32,9 @@ namespace SaveStateList {
     /* Init savestates and movies */
     void init(Context* context);
 
+    /* Number of savestate slots, which can be called from any thread */
+    int count();
+
     /* Return the savestate from its id */
     SaveState& get(int id);
     
@@ -60,6 +65,31 @@ namespace SaveStateList {
     /* Save movies on disk when exiting */
     void backupMovies();
 
+    /* Memory used by all states stored in RAM or in processes, which is only
+     * known when a memory budget is set. This and the following counters can
+     * be called from any thread */
+    uint64_t totalSize();
+
+    /* Number of states that were loaded */
+    uint64_t hitCount();
+
+    /* Number of loadings that failed because the state was evicted */
+    uint64_t missCount();
+
+    /* Number of states that were evicted because of the memory budget */
+    uint64_t evictionCount();
+
+    /* Copy the statistics of the last savestate that was saved or loaded,
+     * which can be called from any thread. Returns statsCount() */
+    uint64_t lastStats(SavestateStats& stats, std::vector<SavestateAreaStats>& area_stats);
+
+    /* Number of times the statistics were received, to detect new ones */
+    uint64_t statsCount();
+
+    /* Ask the game for the statistics after each savestate, which is only
+     * done while they are displayed */
+    void setStatsEnabled(bool enabled);
+
 }
 
 #endif
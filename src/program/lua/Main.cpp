@@ -22,6 +22,7 @@
 #include "Input.h"
 #include "Movie.h"
 #include "Memory.h"
+#include "Savestate.h"
 #include <iostream>
 extern "C" {
 #include <lua.h>
@@ -42,6 +43,7 @@ void Lua::Main::init(Context* context)
     Lua::Input::registerFunctions(context);
     Lua::Memory::registerFunctions(context);
     Lua::Movie::registerFunctions(context);
+    Lua::Savestate::registerFunctions(context);
 }
 
 void Lua::Main::exit(Context* context)
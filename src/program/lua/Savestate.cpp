@@ -0,0 +1,117 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Savestate.h"
+#include "../SaveStateList.h"
+#include "../SaveState.h"
+
+#include <iostream>
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+static Context* context;
+
+/* List of functions to register */
+static const luaL_Reg savestate_functions[] =
+{
+    { "save", Lua::Savestate::save},
+    { "load", Lua::Savestate::load},
+    { "pin", Lua::Savestate::pin},
+    { "exists", Lua::Savestate::exists},
+    { "size", Lua::Savestate::size},
+    { "stats", Lua::Savestate::stats},
+    { "slots", Lua::Savestate::slots},
+    { NULL, NULL }
+};
+
+void Lua::Savestate::registerFunctions(Context* c)
+{
+    context = c;
+    luaL_newlib(context->lua_state, savestate_functions);
+    lua_setglobal(context->lua_state, "savestate");
+}
+
+/* Get the slot argument, or -1 if it is not a valid slot */
+static int checkSlot(lua_State *L)
+{
+    int slot = static_cast<int>(lua_tointeger(L, 1));
+    if ((slot < 1) || (slot >= SaveStateList::count())) {
+        std::cerr << "Lua: invalid savestate slot " << slot << std::endl;
+        return -1;
+    }
+    return slot;
+}
+
+int Lua::Savestate::save(lua_State *L)
+{
+    int slot = checkSlot(L);
+    if (slot != -1)
+        context->lua_savestate_queue.push(std::make_pair(slot, false));
+    return 0;
+}
+
+int Lua::Savestate::load(lua_State *L)
+{
+    int slot = checkSlot(L);
+    if (slot != -1)
+        context->lua_savestate_queue.push(std::make_pair(slot, true));
+    return 0;
+}
+
+int Lua::Savestate::pin(lua_State *L)
+{
+    int slot = checkSlot(L);
+    if (slot != -1)
+        SaveStateList::get(slot).pinned = lua_toboolean(L, 2);
+    return 0;
+}
+
+int Lua::Savestate::exists(lua_State *L)
+{
+    int slot = checkSlot(L);
+    lua_pushboolean(L, (slot != -1) && (SaveStateList::get(slot).framecount != 0));
+    return 1;
+}
+
+int Lua::Savestate::size(lua_State *L)
+{
+    int slot = checkSlot(L);
+    if ((slot == -1) || (SaveStateList::get(slot).framecount == 0))
+        lua_pushinteger(L, 0);
+    else
+        lua_pushinteger(L, static_cast<lua_Integer>(SaveStateList::get(slot).size));
+    return 1;
+}
+
+int Lua::Savestate::stats(lua_State *L)
+{
+    lua_pushinteger(L, static_cast<lua_Integer>(SaveStateList::totalSize()));
+    lua_pushinteger(L, static_cast<lua_Integer>(SaveStateList::hitCount()));
+    lua_pushinteger(L, static_cast<lua_Integer>(SaveStateList::missCount()));
+    lua_pushinteger(L, static_cast<lua_Integer>(SaveStateList::evictionCount()));
+    return 4;
+}
+
+int Lua::Savestate::slots(lua_State *L)
+{
+    lua_pushinteger(L, static_cast<lua_Integer>(SaveStateList::count()));
+    return 1;
+}
@@ -0,0 +1,62 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_LUASAVESTATE_H_INCLUDED
+#define LIBTAS_LUASAVESTATE_H_INCLUDED
+
+#include "../Context.h"
+extern "C" {
+#include <lua.h>
+}
+
+namespace Lua {
+
+namespace Savestate {
+
+    /* Register all functions */
+    void registerFunctions(Context* context);
+
+    /* Request to save a state in a slot. It is performed at the next
+     * processing of events */
+    int save(lua_State *L);
+
+    /* Request to load the state of a slot. It is performed at the next
+     * processing of events */
+    int load(lua_State *L);
+
+    /* Set if a state is protected from being evicted */
+    int pin(lua_State *L);
+
+    /* Does a slot contain a state */
+    int exists(lua_State *L);
+
+    /* Get the memory used by the state of a slot */
+    int size(lua_State *L);
+
+    /* Get the total memory used by states, the number of loads, of failed
+     * loads because the state was evicted, and of evicted states */
+    int stats(lua_State *L);
+
+    /* Get the number of savestate slots */
+    int slots(lua_State *L);
+
+}
+}
+
+#endif
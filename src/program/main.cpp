@@ -26,6 +26,8 @@
 #include "lua/Main.h"
 #include "KeyMapping.h"
 #include "ramsearch/MemScanner.h"
+#include "BatchRunner.h"
+#include "../shared/sockethelpers.h"
 #ifdef __unix__
 #include "KeyMappingXcb.h"
 #elif defined(__APPLE__) && defined(__MACH__)
@@ -48,6 +50,10 @@
 #include <mach-o/dyld.h> // _NSGetExecutablePath
 #endif
 
+#ifdef __linux__
+#include <sys/personality.h> // ADDR_NO_RANDOMIZE
+#endif
+
 #ifdef __unix__
 #include <xcb/xcb.h>
 #define explicit _explicit
@@ -65,11 +71,34 @@ static void print_usage(void)
     std::cout << "  -r, --read MOVIE        Play game inputs from MOVIE file" << std::endl;
     std::cout << "  -w, --write MOVIE       Record game inputs into the specified MOVIE file" << std::endl;
     std::cout << "  -n, --non-interactive   Don't offer any interactive choice, so that it can run headless" << std::endl;
+    std::cout << "      --instance NAME     Use a socket and working directories specific to instance NAME," << std::endl;
+    std::cout << "                          so that several instances can run concurrently" << std::endl;
+    std::cout << "      --report FILE       Write a JSON report with the final memory hash and detected desyncs" << std::endl;
+    std::cout << "                          at the end of the movie. Implies -n, fast-forwards without rendering, disables" << std::endl;
+    std::cout << "                          address space randomization of the game" << std::endl;
+    std::cout << "      --batch LIST        Run each movie listed in LIST in parallel instances, and write the" << std::endl;
+    std::cout << "                          report of all runs in the file given by --report" << std::endl;
+    std::cout << "      --perturb FILE      Instead of --batch, run the movie given by -r once for each line" << std::endl;
+    std::cout << "                          of FILE, which contains a frame and the inputs to use for this frame" << std::endl;
+    std::cout << "      --jobs N            Number of instances running in parallel (default: number of CPUs)" << std::endl;
+    std::cout << "      --timeout SEC       Kill instances that run for more than SEC seconds" << std::endl;
+    std::cout << "      --reference FILE    Report memory hashes that differ from a previous batch report" << std::endl;
     std::cout << "      --libtas-so-path    Path to libtas.so (equivalent to setting LIBTAS_SO_PATH)" << std::endl;
     std::cout << "      --libtas32-so-path  Path to libtas32.so (equivalent to setting LIBTAS32_SO_PATH)" << std::endl;
     std::cout << "  -h, --help              Show this message" << std::endl;
 }
 
+/* Working directories of an unnamed headless execution, removed at exit */
+static std::string temp_instance_dir;
+static pid_t temp_instance_pid = 0;
+
+static void remove_temp_instance_dir(void)
+{
+    /* Forked processes that exit without executing must not remove it */
+    if (getpid() == temp_instance_pid)
+        remove_dir(temp_instance_dir);
+}
+
 int main(int argc, char **argv)
 {
 #ifdef LIBTAS_INTERIM_COMMIT
@@ -91,6 +120,10 @@ int main(int argc, char **argv)
     std::string moviefile;
     std::string dumpfile;
     int recordingmode = SharedConfig::RECORDING_WRITE;
+    BatchRunner::Options batch_options;
+    batch_options.executable = argv[0];
+    batch_options.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    batch_options.timeout = 0;
 
     static struct option long_options[] =
     {
@@ -100,6 +133,13 @@ int main(int argc, char **argv)
         {"non-interactive", no_argument, nullptr, 'n'},
         {"libtas-so-path", required_argument, nullptr, 'p'},
         {"libtas32-so-path", required_argument, nullptr, 'P'},
+        {"instance", required_argument, nullptr, 'i'},
+        {"report", required_argument, nullptr, 'R'},
+        {"batch", required_argument, nullptr, 'b'},
+        {"perturb", required_argument, nullptr, 'x'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"timeout", required_argument, nullptr, 't'},
+        {"reference", required_argument, nullptr, 'f'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, 0, nullptr, 0}
     };
@@ -139,6 +179,33 @@ int main(int argc, char **argv)
                     context.libtas32path = abspath;
                 }
                 break;
+            case 'i':
+                /* The name is used in paths, including the socket file
+                 * which has a limited length */
+                context.instance = optarg;
+                if (context.instance.empty() || (context.instance.size() > 64) || (context.instance.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.") != std::string::npos) || (context.instance[0] == '.')) {
+                    std::cerr << "Invalid instance name " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 'R':
+                context.report_file = realpath_nonexist(optarg);
+                break;
+            case 'b':
+                batch_options.movielist = realpath_nonexist(optarg);
+                break;
+            case 'x':
+                batch_options.perturbations = realpath_nonexist(optarg);
+                break;
+            case 'j':
+                batch_options.jobs = atoi(optarg);
+                break;
+            case 't':
+                batch_options.timeout = atoi(optarg);
+                break;
+            case 'f':
+                batch_options.reference = realpath_nonexist(optarg);
+                break;
             case '?':
                 std::cout << "Unknown option character" << std::endl;
                 break;
@@ -150,6 +217,19 @@ int main(int argc, char **argv)
         }
     }
 
+    bool batch = !batch_options.movielist.empty() || !batch_options.perturbations.empty();
+    if (batch) {
+        if (context.report_file.empty()) {
+            std::cerr << "Batch mode requires a report file to be given with --report" << std::endl;
+            return -1;
+        }
+        batch_options.report = context.report_file;
+        context.report_file.clear();
+    }
+    else if (!context.report_file.empty()) {
+        context.interactive = false;
+    }
+
     /* Game path */
     if (argv[optind]) {
         abspath = realpath_nonexist(argv[optind]);
@@ -294,6 +374,27 @@ int main(int argc, char **argv)
         context.config.dumping = true;
     }
 
+    /* When verifying a movie, run at maximum speed, and don't switch to
+     * recording at the end of the movie, because the report is written one
+     * frame later. These changes are not saved into the config. */
+    if (! context.report_file.empty()) {
+        if (! context.config.dumping) {
+            context.config.sc.fastforward = true;
+            context.config.sc.fastforward_mode |= SharedConfig::FF_SLEEP | SharedConfig::FF_RENDERING;
+        }
+        context.config.on_movie_end = Config::MOVIEEND_READ;
+
+#ifdef __linux__
+        /* The report contains a hash of the game memory, which includes
+         * addresses and pointers. Disable address space randomization for
+         * the game, which inherits it, so that the hash is the same on each
+         * execution of the movie. */
+        int persona = personality(0xffffffff);
+        if ((persona == -1) || (personality(persona | ADDR_NO_RANDOMIZE) == -1))
+            std::cerr << "Could not disable address space randomization, memory hashes may differ between executions" << std::endl;
+#endif
+    }
+
     /* If the config file set custom directories for the remaining working dir,
      * we create these directories (if not already created).
      * Otherwise, we set and create the default ones. */
@@ -313,6 +414,23 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    /* Each instance gets its own working directories for movie, savestates
+     * and memory scans, which are written during the execution. Without an
+     * instance name, headless executions use directories specific to their
+     * PID like the socket, so that they can run concurrently, and these are
+     * removed at exit. Interactive executions use the same directories,
+     * which keeps the autosaves between them. */
+    std::string instance_dir = data_dir;
+    if (!context.instance.empty()) {
+        instance_dir += "/instances/" + context.instance;
+    }
+    else if (!context.interactive && !batch) {
+        instance_dir += "/instances/pid" + std::to_string(getpid());
+        temp_instance_dir = instance_dir;
+        temp_instance_pid = getpid();
+        atexit(remove_temp_instance_dir);
+    }
+
     if (context.config.steamuserdir.empty()) {
         context.config.steamuserdir = data_dir + "/steam";
     }
@@ -322,7 +440,7 @@ int main(int argc, char **argv)
     }
 
     if (context.config.tempmoviedir.empty()) {
-        context.config.tempmoviedir = data_dir + "/movie";
+        context.config.tempmoviedir = instance_dir + "/movie";
     }
     if (create_dir(context.config.tempmoviedir) < 0) {
         std::cerr << "Cannot create dir " << context.config.tempmoviedir << std::endl;
@@ -330,7 +448,7 @@ int main(int argc, char **argv)
     }
 
     if (context.config.savestatedir.empty()) {
-        context.config.savestatedir = data_dir + "/states";
+        context.config.savestatedir = instance_dir + "/states";
     }
     if (create_dir(context.config.savestatedir) < 0) {
         std::cerr << "Cannot create dir " << context.config.savestatedir << std::endl;
@@ -338,7 +456,7 @@ int main(int argc, char **argv)
     }
 
     if (context.config.ramsearchdir.empty()) {
-        context.config.ramsearchdir = data_dir + "/ramsearch";
+        context.config.ramsearchdir = instance_dir + "/ramsearch";
     }
     if (create_dir(context.config.ramsearchdir) < 0) {
         std::cerr << "Cannot create dir " << context.config.ramsearchdir << std::endl;
@@ -346,6 +464,28 @@ int main(int argc, char **argv)
     }
     MemScanner::init(context.config.ramsearchdir);
 
+    /* Socket file used to communicate with the game, which is specific to
+     * the instance, or to this process if no instance name was given */
+    std::string socket_filename = "/tmp/libTAS-";
+    if (context.instance.empty())
+        socket_filename += std::to_string(getpid());
+    else
+        socket_filename += context.instance;
+    socket_filename += ".socket";
+    if (!setSocketFilename(socket_filename.c_str())) {
+        std::cerr << "Socket file " << socket_filename << " is too long" << std::endl;
+        return -1;
+    }
+
+    /* The batch runner only starts other instances */
+    if (batch) {
+        int ret = BatchRunner::run(&context, batch_options);
+#ifdef __unix__
+        xcb_disconnect(context.conn);
+#endif
+        return (ret == 0) ? 0 : 1;
+    }
+
     /* Store current content of LD_PRELOAD/DYLD_INSERT_LIBRARIES */
 
 #ifdef __unix__
@@ -384,7 +524,8 @@ int main(int argc, char **argv)
 
     app.exec();
 
-    context.config.save(context.gamepath);
+    if (context.report_file.empty())
+        context.config.save(context.gamepath);
 
     /* Stop the lua VM */
     Lua::Main::exit(&context);
@@ -413,6 +554,8 @@ int main(int argc, char **argv)
         }
     }
 
+    removeSocket();
+
 #ifdef __unix__
     xcb_disconnect(context.conn);
 #endif
@@ -73,10 +73,12 @@ int MovieFile::extractMovie(const std::string& moviefile)
     std::string configfile = context->config.tempmoviedir + "/config.ini";
     std::string editorfile = context->config.tempmoviedir + "/editor.ini";
     std::string inputfile = context->config.tempmoviedir + "/inputs";
+    std::string binaryinputfile = context->config.tempmoviedir + "/inputs.bin";
     std::string annotationsfile = context->config.tempmoviedir + "/annotations.txt";
     unlink(configfile.c_str());
     unlink(editorfile.c_str());
     unlink(inputfile.c_str());
+    unlink(binaryinputfile.c_str());
     unlink(annotationsfile.c_str());
 
     /* Build the tar command */
@@ -97,7 +99,7 @@ int MovieFile::extractMovie(const std::string& moviefile)
     /* Check the presence of the inputs and config files */
     if (access(configfile.c_str(), F_OK) != 0)
         return ENOCONFIG;
-    if (access(inputfile.c_str(), F_OK) != 0)
+    if ((access(inputfile.c_str(), F_OK) != 0) && (access(binaryinputfile.c_str(), F_OK) != 0))
         return ENOINPUTS;
 
     return 0;
@@ -152,13 +154,13 @@ int MovieFile::loadSavestateMovie(const std::string& moviefile)
     return 0;
 }
 
-int MovieFile::saveMovie(const std::string& moviefile, uint64_t nb_frames)
+int MovieFile::saveMovie(const std::string& moviefile, uint64_t nb_frames, bool text_inputs)
 {
     /* Skip empty moviefiles, if user tested the annotations without specifying a movie */
     if (moviefile.empty())
         return ENOMOVIE;
 
-    inputs->save();
+    inputs->save(text_inputs);
     header->save(inputs->input_list.size(), nb_frames);
     annotations->save();
     editor->save();
@@ -169,7 +171,15 @@ int MovieFile::saveMovie(const std::string& moviefile, uint64_t nb_frames)
     oss << moviefile;
     oss << "\" -C ";
     oss << context->config.tempmoviedir;
-    oss << " inputs config.ini editor.ini annotations.txt";
+    oss << " config.ini editor.ini annotations.txt";
+
+    /* The text inputs may not be exported */
+    std::string inputfile = context->config.tempmoviedir + "/inputs";
+    std::string binaryinputfile = context->config.tempmoviedir + "/inputs.bin";
+    if (access(binaryinputfile.c_str(), F_OK) == 0)
+        oss << " inputs.bin";
+    if (access(inputfile.c_str(), F_OK) == 0)
+        oss << " inputs";
 
     /* Execute the tar command */
     // std::cout << oss.str() << std::endl;
@@ -192,6 +202,11 @@ int MovieFile::saveMovie()
     return saveMovie(context->config.moviefile);
 }
 
+int MovieFile::exportMovie(const std::string& moviefile)
+{
+    return saveMovie(moviefile, inputs->input_list.size(), true);
+}
+
 void MovieFile::copyTo(MovieFile& movie) const
 {
     /* This will only be used for savestate movies, we only care to copy relevant data */
@@ -74,7 +74,11 @@ public:
     int saveMovie(const std::string& moviefile);
 
     /* Write only the n first frames of input into the movie file. Used for savestate movies */
-    int saveMovie(const std::string& moviefile, uint64_t frame_nb);
+    int saveMovie(const std::string& moviefile, uint64_t frame_nb, bool text_inputs = false);
+
+    /* Write the movie into another file, always with the text inputs so that
+     * it can be read by previous versions and by users */
+    int exportMovie(const std::string& moviefile);
 
     /* Copy movie to another one */
     void copyTo(MovieFile& movie) const;
@@ -20,6 +20,13 @@
 #include <QtCore/QSettings>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <climits>
+#include <new>
+#include <fcntl.h> // open
+#include <unistd.h> // ftruncate
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "MovieFileInputs.h"
 #include "../utils.h"
@@ -29,7 +36,8 @@ MovieFileInputs::MovieFileInputs(Context* c) : context(c)
 {
     rek.assign(R"(\|K([0-9a-f]*(?::[0-9a-f]+)*)\|)", std::regex::ECMAScript|std::regex::optimize);
     rem.assign(R"(\|M([\-0-9]+:[\-0-9]+:(?:[AR]:)?[\.1-5]{5})\|)", std::regex::ECMAScript|std::regex::optimize);
-    rec.assign(R"(\|C([1-4](?:[\-0-9]+:){6}.{15})\|)", std::regex::ECMAScript|std::regex::optimize);
+    /* The closing separator of a controller is the opening one of the next */
+    rec.assign(R"(\|C([1-4](?:[\-0-9]+:){6}.{15})(?=\|))", std::regex::ECMAScript|std::regex::optimize);
     ref.assign(R"(\|F(.{1,9})\|)", std::regex::ECMAScript|std::regex::optimize);
     ret.assign(R"(\|T([0-9]+:[0-9]+)\|)", std::regex::ECMAScript|std::regex::optimize);
     
@@ -44,13 +52,288 @@ void MovieFileInputs::clear()
     input_list.clear();
 }
 
+/* The binary input stream stores the inputs as a list of 32-bit words. Only
+ * the words that changed from the previous frame are stored, as fixed-size
+ * records, starting from empty inputs before the first frame. The frame
+ * count and the checksum of the text inputs saved along are stored as well,
+ * so that text inputs edited by hand are read instead. */
+
+#define BINARY_INPUTS_MAGIC "LTMINPUT"
+#define BINARY_INPUTS_VERSION 2
+
+/* Maximum number of frames of the binary inputs (more than 77 hours at 60
+ * fps). Longer movies are only saved as text inputs, and binary inputs
+ * claiming more frames are corrupted. */
+#define BINARY_INPUTS_MAX_FRAMES (1ull << 24)
+
+/* Number of words of a frame of inputs */
+#define BINARY_INPUTS_WORDS (AllInputs::MAXKEYS + 4 + AllInputs::MAXJOYS*AllInputs::MAXAXES/2 + AllInputs::MAXJOYS/2 + 3)
+
+struct BinaryInputsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t words; // number of words of a frame
+    uint64_t frames; // number of frames
+    uint64_t records; // number of records following the header
+    uint64_t text_frames; // number of frames of the text inputs
+    uint64_t text_checksum; // checksum of the text inputs, or 0 if not saved
+};
+
+/* Word `word` of the inputs has value `value`, starting from frame `frame` */
+struct BinaryInputsRecord {
+    uint32_t frame;
+    uint32_t word;
+    uint32_t value;
+};
+
+static void inputsToWords(const AllInputs& inputs, uint32_t* words)
+{
+    int w = 0;
+    for (int k=0; k<AllInputs::MAXKEYS; k++)
+        words[w++] = inputs.keyboard[k];
+    words[w++] = inputs.pointer_x;
+    words[w++] = inputs.pointer_y;
+    words[w++] = inputs.pointer_mode;
+    words[w++] = inputs.pointer_mask;
+    for (int joy=0; joy<AllInputs::MAXJOYS; joy++)
+        for (int axis=0; axis<AllInputs::MAXAXES; axis+=2)
+            words[w++] = static_cast<uint16_t>(inputs.controller_axes[joy][axis]) |
+                (static_cast<uint32_t>(static_cast<uint16_t>(inputs.controller_axes[joy][axis+1])) << 16);
+    for (int joy=0; joy<AllInputs::MAXJOYS; joy+=2)
+        words[w++] = inputs.controller_buttons[joy] | (static_cast<uint32_t>(inputs.controller_buttons[joy+1]) << 16);
+    words[w++] = inputs.flags;
+    words[w++] = inputs.framerate_den;
+    words[w++] = inputs.framerate_num;
+}
+
+static void wordsToInputs(const uint32_t* words, AllInputs& inputs)
+{
+    int w = 0;
+    for (int k=0; k<AllInputs::MAXKEYS; k++)
+        inputs.keyboard[k] = words[w++];
+    inputs.pointer_x = words[w++];
+    inputs.pointer_y = words[w++];
+    inputs.pointer_mode = words[w++];
+    inputs.pointer_mask = words[w++];
+    for (int joy=0; joy<AllInputs::MAXJOYS; joy++) {
+        for (int axis=0; axis<AllInputs::MAXAXES; axis+=2) {
+            inputs.controller_axes[joy][axis] = static_cast<short>(words[w] & 0xffff);
+            inputs.controller_axes[joy][axis+1] = static_cast<short>(words[w] >> 16);
+            w++;
+        }
+    }
+    for (int joy=0; joy<AllInputs::MAXJOYS; joy+=2) {
+        inputs.controller_buttons[joy] = words[w] & 0xffff;
+        inputs.controller_buttons[joy+1] = words[w] >> 16;
+        w++;
+    }
+    inputs.flags = words[w++];
+    inputs.framerate_den = words[w++];
+    inputs.framerate_num = words[w++];
+}
+
+/* Count the frames of the text inputs and compute the FNV-1a hash of the
+ * file. Returns false if the file can't be read */
+static bool textInputsChecksum(const std::string& input_file, uint64_t& frames, uint64_t& checksum)
+{
+    int fd = open(input_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    frames = 0;
+    checksum = 0xcbf29ce484222325ull;
+    bool line_start = true;
+
+    char buf[65536];
+    ssize_t size;
+    while ((size = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < size; i++) {
+            /* Frames are the lines starting with '|' */
+            if (line_start && (buf[i] == '|'))
+                frames++;
+            line_start = (buf[i] == '\n');
+
+            checksum ^= static_cast<unsigned char>(buf[i]);
+            checksum *= 0x100000001b3ull;
+        }
+    }
+
+    ::close(fd);
+    return size == 0;
+}
+
+int MovieFileInputs::loadBinary(const std::string& input_file, const std::string& text_file)
+{
+    int fd = open(input_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(BinaryInputsHeader))) {
+        ::close(fd);
+        return -1;
+    }
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return -1;
+
+    const BinaryInputsHeader* header = static_cast<const BinaryInputsHeader*>(addr);
+    const BinaryInputsRecord* records = reinterpret_cast<const BinaryInputsRecord*>(header + 1);
+
+    if ((memcmp(header->magic, BINARY_INPUTS_MAGIC, sizeof(header->magic)) != 0) ||
+        (header->version != BINARY_INPUTS_VERSION) ||
+        (header->words != BINARY_INPUTS_WORDS) ||
+        (header->frames > BINARY_INPUTS_MAX_FRAMES) ||
+        (header->records > (st.st_size - sizeof(BinaryInputsHeader)) / sizeof(BinaryInputsRecord))) {
+        std::cerr << "Unsupported binary inputs, reading the text inputs" << std::endl;
+        munmap(addr, st.st_size);
+        return -1;
+    }
+
+    /* Text inputs that differ from the ones saved along were edited */
+    uint64_t text_frames, text_checksum;
+    if (textInputsChecksum(text_file, text_frames, text_checksum) &&
+        ((text_frames != header->text_frames) || (text_checksum != header->text_checksum))) {
+        std::cerr << "The text inputs were modified, reading them instead of the binary inputs" << std::endl;
+        munmap(addr, st.st_size);
+        return -1;
+    }
+
+    input_list.clear();
+
+    try {
+        input_list.reserve(header->frames);
+
+        AllInputs ai;
+        ai.emptyInputs();
+        uint32_t words[BINARY_INPUTS_WORDS];
+        inputsToWords(ai, words);
+
+        bool changed = false;
+        for (uint64_t r = 0; r < header->records; r++) {
+            const BinaryInputsRecord& record = records[r];
+            if ((record.frame < input_list.size()) || (record.frame >= header->frames) || (record.word >= BINARY_INPUTS_WORDS)) {
+                std::cerr << "Corrupted binary inputs, reading the text inputs" << std::endl;
+                input_list.clear();
+                munmap(addr, st.st_size);
+                return -1;
+            }
+
+            /* Frames before the record are identical */
+            if (record.frame > input_list.size()) {
+                if (changed) {
+                    wordsToInputs(words, ai);
+                    changed = false;
+                }
+                input_list.resize(record.frame, ai);
+            }
+
+            words[record.word] = record.value;
+            changed = true;
+        }
+
+        if (changed)
+            wordsToInputs(words, ai);
+        input_list.resize(header->frames, ai);
+    }
+    catch (const std::bad_alloc&) {
+        std::cerr << "Could not allocate the binary inputs, reading the text inputs" << std::endl;
+        input_list.clear();
+        input_list.shrink_to_fit();
+        munmap(addr, st.st_size);
+        return -1;
+    }
+
+    munmap(addr, st.st_size);
+    return 0;
+}
+
+void MovieFileInputs::saveBinary(const std::string& input_file, const std::string& text_file) const
+{
+    /* Identify the text inputs, if they were saved */
+    uint64_t text_frames = 0, text_checksum = 0;
+    if (!textInputsChecksum(text_file, text_frames, text_checksum)) {
+        text_frames = 0;
+        text_checksum = 0;
+    }
+
+    /* Count the records to size the file */
+    uint32_t words[BINARY_INPUTS_WORDS], prev_words[BINARY_INPUTS_WORDS];
+    AllInputs ai;
+    ai.emptyInputs();
+    inputsToWords(ai, prev_words);
+
+    uint64_t record_count = 0;
+    for (const AllInputs& inputs : input_list) {
+        inputsToWords(inputs, words);
+        for (int w = 0; w < BINARY_INPUTS_WORDS; w++)
+            if (words[w] != prev_words[w])
+                record_count++;
+        memcpy(prev_words, words, sizeof(words));
+    }
+
+    size_t size = sizeof(BinaryInputsHeader) + record_count * sizeof(BinaryInputsRecord);
+
+    int fd = open(input_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not create the binary inputs file" << std::endl;
+        return;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        std::cerr << "Could not resize the binary inputs file" << std::endl;
+        ::close(fd);
+        return;
+    }
+
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Could not map the binary inputs file" << std::endl;
+        return;
+    }
+
+    BinaryInputsHeader* header = static_cast<BinaryInputsHeader*>(addr);
+    memcpy(header->magic, BINARY_INPUTS_MAGIC, sizeof(header->magic));
+    header->version = BINARY_INPUTS_VERSION;
+    header->words = BINARY_INPUTS_WORDS;
+    header->frames = input_list.size();
+    header->records = record_count;
+    header->text_frames = text_frames;
+    header->text_checksum = text_checksum;
+
+    BinaryInputsRecord* record = reinterpret_cast<BinaryInputsRecord*>(header + 1);
+    inputsToWords(ai, prev_words);
+    for (uint32_t f = 0; f < input_list.size(); f++) {
+        inputsToWords(input_list[f], words);
+        for (uint32_t w = 0; w < BINARY_INPUTS_WORDS; w++) {
+            if (words[w] != prev_words[w]) {
+                record->frame = f;
+                record->word = w;
+                record->value = words[w];
+                record++;
+            }
+        }
+        memcpy(prev_words, words, sizeof(words));
+    }
+
+    munmap(addr, size);
+}
+
 void MovieFileInputs::load()
 {
     /* Clear structures */
     input_list.clear();
-    
-    /* Open the input file and parse each line to fill our input list */
+
+    /* Read the binary inputs if present, unless the text inputs were
+     * edited */
     std::string input_file = context->config.tempmoviedir + "/inputs";
+    if (loadBinary(context->config.tempmoviedir + "/inputs.bin", input_file) == 0)
+        return;
+
+    /* Open the input file and parse each line to fill our input list */
     std::ifstream input_stream(input_file);
     std::string line;
 
@@ -67,16 +350,31 @@ void MovieFileInputs::load()
     return;
 }
 
-void MovieFileInputs::save()
+void MovieFileInputs::save(bool text_inputs)
 {
-    /* Format and write input frames into the input file */
+    /* The number of frames of the binary inputs is bounded */
+    bool binary = input_list.size() <= BINARY_INPUTS_MAX_FRAMES;
+
+    /* Format and write input frames into the input file, which is kept for
+     * previous versions and for reading and editing the inputs. It is
+     * written first, because the binary inputs identify it. */
     std::string input_file = context->config.tempmoviedir + "/inputs";
-    std::ofstream input_stream(input_file, std::ofstream::trunc);
+    if (context->config.movie_text_inputs || text_inputs || !binary) {
+        std::ofstream input_stream(input_file, std::ofstream::trunc);
 
-    for (auto it = input_list.begin(); it != input_list.end(); ++it) {
-        writeFrame(input_stream, *it);
+        for (auto it = input_list.begin(); it != input_list.end(); ++it) {
+            writeFrame(input_stream, *it);
+        }
+        input_stream.close();
     }
-    input_stream.close();
+    else {
+        unlink(input_file.c_str());
+    }
+
+    if (binary)
+        saveBinary(context->config.tempmoviedir + "/inputs.bin", input_file);
+    else
+        unlink((context->config.tempmoviedir + "/inputs.bin").c_str());
 }
 
 int MovieFileInputs::writeFrame(std::ostream& input_stream, const AllInputs& inputs)
@@ -70,12 +70,13 @@ public:
     /* Clear */
     void clear();
 
-    /* Import the inputs into a list, and all the parameters.
-     * Returns 0 if no error, or a negative value if an error occured */
+    /* Import the inputs into a list, from the binary inputs if present, or
+     * from the text inputs if absent or if the text inputs were edited */
     void load();
 
-    /* Write the inputs into a file and compress to the whole moviefile */
-    void save();
+    /* Write the inputs into the binary inputs file, and into the text inputs
+     * file if enabled or if `text_inputs` is set */
+    void save(bool text_inputs = false);
 
     /* Write a single frame of inputs into the input stream */
     int writeFrame(std::ostream& input_stream, const AllInputs& inputs);
@@ -158,6 +159,15 @@ private:
     /* Read the framerate input string */
     void readFramerateFrame(std::istringstream& input_string, AllInputs& inputs);
 
+    /* Import the inputs from the binary inputs file using mmap. Returns 0 if
+     * no error, or a negative value if the file is missing or invalid, or if
+     * the text inputs file differs from the one saved along */
+    int loadBinary(const std::string& input_file, const std::string& text_file);
+
+    /* Write the inputs into the binary inputs file using mmap, identifying
+     * the text inputs file that was just saved, if any */
+    void saveBinary(const std::string& input_file, const std::string& text_file) const;
+
 };
 
 #endif
@@ -21,7 +21,13 @@
 #include "TypeIndex.h"
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 #include <inttypes.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 typedef union {
     int8_t v_int8_t;
@@ -40,127 +46,285 @@ typedef union {
 static value_t compare_value;
 static value_t different_value;
 
-typedef bool (*compare_t)(const value_t*);
-static compare_t compare_method;
+/* With the Different operator on types smaller than int, the difference is
+ * computed without overflow. Vector kernels compute it modulo the type size,
+ * so they also check that the reference value is between these bounds. */
+static value_t different_min;
+static value_t different_max;
+
+/* Kernel comparing a chunk of values, selected when the search starts */
+typedef void (*chunk_compare_t)(const uint8_t* values, const uint8_t* old_values, int count, uint64_t* mask);
+static chunk_compare_t value_kernel;
+static chunk_compare_t previous_kernel;
 
 static int value_type;
 
-#define DEFINE_CHECK_TYPED(T) \
-static bool check_equal_##T(const value_t* value) \
-{\
-    return value->v_##T == compare_value.v_##T;\
-}\
-static bool check_notequal_##T(const value_t* value) \
-{\
-    return value->v_##T != compare_value.v_##T;\
-}\
-static bool check_less_##T(const value_t* value) \
-{\
-    return value->v_##T < compare_value.v_##T;\
-}\
-static bool check_greater_##T(const value_t* value) \
-{\
-    return value->v_##T > compare_value.v_##T;\
-}\
-static bool check_lessequal_##T(const value_t* value) \
-{\
-    return value->v_##T <= compare_value.v_##T;\
-}\
-static bool check_greaterequal_##T(const value_t* value) \
-{\
-    return value->v_##T>= compare_value.v_##T;\
-}\
-static bool check_different_##T(const value_t* value) \
-{\
-    return (value->v_##T - compare_value.v_##T) == different_value.v_##T;\
-}\
-
-DEFINE_CHECK_TYPED(int8_t)
-DEFINE_CHECK_TYPED(uint8_t)
-DEFINE_CHECK_TYPED(int16_t)
-DEFINE_CHECK_TYPED(uint16_t)
-DEFINE_CHECK_TYPED(int32_t)
-DEFINE_CHECK_TYPED(uint32_t)
-DEFINE_CHECK_TYPED(int64_t)
-DEFINE_CHECK_TYPED(uint64_t)
-DEFINE_CHECK_TYPED(float)
-DEFINE_CHECK_TYPED(double)
-
-#define DEFINE_COMPARE_METHOD_TYPED(T) \
-compare_value.v_##T = static_cast<T>(compare_value_db);\
-different_value.v_##T = static_cast<T>(different_value_db);\
-switch(compare_operator) {\
-    case CompareOperator::Equal:\
-        compare_method = &check_equal_##T;\
-        break;\
-    case CompareOperator::NotEqual:\
-        compare_method = &check_notequal_##T;\
-        break;\
-    case CompareOperator::Less:\
-        compare_method = &check_less_##T;\
-        break;\
-    case CompareOperator::Greater:\
-        compare_method = &check_greater_##T;\
-        break;\
-    case CompareOperator::LessEqual:\
-        compare_method = &check_lessequal_##T;\
-        break;\
-    case CompareOperator::GreaterEqual:\
-        compare_method = &check_greaterequal_##T;\
-        break;\
-    case CompareOperator::Different:\
-        compare_method = &check_different_##T;\
-        break;\
-}\
+template <typename T>
+static inline T typed(const value_t& v)
+{
+    T t;
+    memcpy(&t, &v, sizeof(T));
+    return t;
+}
+
+template <typename T>
+static inline void set_typed(value_t& v, T t)
+{
+    memcpy(&v, &t, sizeof(T));
+}
+
+/* Compare a single value. Types smaller than int are promoted when computing
+ * a difference, as in the scalar expression. */
+template <typename T, CompareOperator Op>
+static inline bool compare_scalar(T value, T reference)
+{
+    switch (Op) {
+        case CompareOperator::Equal:
+            return value == reference;
+        case CompareOperator::NotEqual:
+            return value != reference;
+        case CompareOperator::Less:
+            return value < reference;
+        case CompareOperator::Greater:
+            return value > reference;
+        case CompareOperator::LessEqual:
+            return value <= reference;
+        case CompareOperator::GreaterEqual:
+            return value >= reference;
+        case CompareOperator::Different:
+            return (value - reference) == typed<T>(different_value);
+    }
+    return false;
+}
+
+/* Generic kernel, comparing one value at a time */
+template <typename T, CompareOperator Op, bool Previous>
+static void chunk_scalar(const uint8_t* values, const uint8_t* old_values, int count, uint64_t* mask)
+{
+    T reference = typed<T>(compare_value);
+    for (int w = 0; w < count; w += 64) {
+        int last = (count - w) > 64 ? 64 : (count - w);
+        uint64_t bits = 0;
+        for (int i = 0; i < last; i++) {
+            T value;
+            memcpy(&value, values + (w + i) * sizeof(T), sizeof(T));
+            if (Previous)
+                memcpy(&reference, old_values + (w + i) * sizeof(T), sizeof(T));
+            if (compare_scalar<T, Op>(value, reference))
+                bits |= 1ull << i;
+        }
+        mask[w / 64] = bits;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Gather the sign bit of each lane of a comparison result */
+__attribute__((target("sse2")))
+static inline uint32_t movemask_sse2(__m128i m, int lane_size)
+{
+    switch (lane_size) {
+        case 1:
+            return _mm_movemask_epi8(m);
+        case 2:
+            return _mm_movemask_epi8(_mm_packs_epi16(m, _mm_setzero_si128()));
+        case 4:
+            return _mm_movemask_ps(_mm_castsi128_ps(m));
+        default:
+            return _mm_movemask_pd(_mm_castsi128_pd(m));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t movemask_avx2(__m256i m, int lane_size)
+{
+    switch (lane_size) {
+        case 1:
+            return _mm256_movemask_epi8(m);
+        case 2:
+            return _mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1)));
+        case 4:
+            return _mm256_movemask_ps(_mm256_castsi256_ps(m));
+        default:
+            return _mm256_movemask_pd(_mm256_castsi256_pd(m));
+    }
+}
+
+/* Vector kernel, comparing BYTES bytes of values at once using GCC vector
+ * extensions, and building 64 bits of mask from consecutive vectors. The
+ * remaining values are compared by the generic kernel. Values are located at
+ * a multiple of their size, so lanes never straddle two values. */
+#define DEFINE_CHUNK_KERNEL(NAME, TARGET, BYTES, VECTOR, MOVEMASK) \
+template <typename T, CompareOperator Op, bool Previous> \
+__attribute__((target(TARGET))) \
+static void NAME(const uint8_t* values, const uint8_t* old_values, int count, uint64_t* mask) \
+{ \
+    typedef T vec_t __attribute__((vector_size(BYTES))); \
+    typedef decltype(vec_t{} == vec_t{}) mask_t; \
+    const int lanes = BYTES / sizeof(T); \
+\
+    vec_t reference = vec_t{} + typed<T>(compare_value); \
+    const vec_t different = vec_t{} + typed<T>(different_value); \
+    const vec_t lower = vec_t{} + typed<T>(different_min); \
+    const vec_t upper = vec_t{} + typed<T>(different_max); \
+    const bool bounded = std::is_integral<T>::value && (sizeof(T) < sizeof(int)); \
+\
+    int words = count / 64; \
+    for (int w = 0; w < words; w++) { \
+        uint64_t bits = 0; \
+        for (int v = 0; v < 64; v += lanes) { \
+            vec_t value; \
+            memcpy(&value, values + (64*w + v) * sizeof(T), BYTES); \
+            if (Previous) \
+                memcpy(&reference, old_values + (64*w + v) * sizeof(T), BYTES); \
+\
+            mask_t result; \
+            switch (Op) { \
+                case CompareOperator::Equal: result = value == reference; break; \
+                case CompareOperator::NotEqual: result = value != reference; break; \
+                case CompareOperator::Less: result = value < reference; break; \
+                case CompareOperator::Greater: result = value > reference; break; \
+                case CompareOperator::LessEqual: result = value <= reference; break; \
+                case CompareOperator::GreaterEqual: result = value >= reference; break; \
+                case CompareOperator::Different: \
+                    result = static_cast<vec_t>(value - reference) == different; \
+                    if (bounded) \
+                        result &= (reference >= lower) & (reference <= upper); \
+                    break; \
+            } \
+            bits |= static_cast<uint64_t>(MOVEMASK(reinterpret_cast<VECTOR>(result), sizeof(T))) << v; \
+        } \
+        mask[w] = bits; \
+    } \
+\
+    if (count % 64) \
+        chunk_scalar<T, Op, Previous>(values + words * 64 * sizeof(T), \
+            Previous ? (old_values + words * 64 * sizeof(T)) : nullptr, \
+            count % 64, mask + words); \
+}
+
+DEFINE_CHUNK_KERNEL(chunk_sse2, "sse2", 16, __m128i, movemask_sse2)
+DEFINE_CHUNK_KERNEL(chunk_avx2, "avx2", 32, __m256i, movemask_avx2)
+
+#endif
+
+/* Select the widest implementation supported by the processor */
+template <typename T, CompareOperator Op, bool Previous>
+static chunk_compare_t select_isa()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return chunk_avx2<T, Op, Previous>;
+    if (__builtin_cpu_supports("sse2"))
+        return chunk_sse2<T, Op, Previous>;
+#endif
+    return chunk_scalar<T, Op, Previous>;
+}
+
+template <typename T, bool Previous>
+static chunk_compare_t select_kernel(CompareOperator compare_operator)
+{
+    switch(compare_operator) {
+        case CompareOperator::Equal:
+            return select_isa<T, CompareOperator::Equal, Previous>();
+        case CompareOperator::NotEqual:
+            return select_isa<T, CompareOperator::NotEqual, Previous>();
+        case CompareOperator::Less:
+            return select_isa<T, CompareOperator::Less, Previous>();
+        case CompareOperator::Greater:
+            return select_isa<T, CompareOperator::Greater, Previous>();
+        case CompareOperator::LessEqual:
+            return select_isa<T, CompareOperator::LessEqual, Previous>();
+        case CompareOperator::GreaterEqual:
+            return select_isa<T, CompareOperator::GreaterEqual, Previous>();
+        case CompareOperator::Different:
+            return select_isa<T, CompareOperator::Different, Previous>();
+    }
+    return nullptr;
+}
+
+template <typename T>
+static void init_typed(CompareOperator compare_operator, double compare_value_db, double different_value_db)
+{
+    set_typed<T>(compare_value, static_cast<T>(compare_value_db));
+    set_typed<T>(different_value, static_cast<T>(different_value_db));
+
+    /* Bounds of the reference value so that reference + different fits in
+     * the type. Only used for types smaller than int. */
+    if (std::is_integral<T>::value && (sizeof(T) < sizeof(int))) {
+        int64_t tmin = static_cast<int64_t>(std::numeric_limits<T>::min());
+        int64_t tmax = static_cast<int64_t>(std::numeric_limits<T>::max());
+        int64_t diff = static_cast<int64_t>(typed<T>(different_value));
+        set_typed<T>(different_min, static_cast<T>((tmin - diff) > tmin ? (tmin - diff) : tmin));
+        set_typed<T>(different_max, static_cast<T>((tmax - diff) < tmax ? (tmax - diff) : tmax));
+    }
+
+    value_kernel = select_kernel<T, false>(compare_operator);
+    previous_kernel = select_kernel<T, true>(compare_operator);
+}
 
 void CompareOperations::init(int vt, CompareOperator compare_operator, double compare_value_db, double different_value_db)
 {
     value_type = vt;
     
-    /* Initialize the comparaison method and values */
+    /* Initialize the comparaison kernels and values */
     switch(value_type) {
         case RamChar:
-            DEFINE_COMPARE_METHOD_TYPED(int8_t)
+            init_typed<int8_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamUnsignedChar:
-            DEFINE_COMPARE_METHOD_TYPED(uint8_t)
+            init_typed<uint8_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamShort:
-            DEFINE_COMPARE_METHOD_TYPED(int16_t)
+            init_typed<int16_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamUnsignedShort:
-            DEFINE_COMPARE_METHOD_TYPED(uint16_t)
+            init_typed<uint16_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamInt:
-            DEFINE_COMPARE_METHOD_TYPED(int32_t)
+            init_typed<int32_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamUnsignedInt:
-            DEFINE_COMPARE_METHOD_TYPED(uint32_t)
+            init_typed<uint32_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamLong:
-            DEFINE_COMPARE_METHOD_TYPED(int64_t)
+            init_typed<int64_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamUnsignedLong:
-            DEFINE_COMPARE_METHOD_TYPED(uint64_t)
+            init_typed<uint64_t>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamFloat:
-            DEFINE_COMPARE_METHOD_TYPED(float)
+            init_typed<float>(compare_operator, compare_value_db, different_value_db);
             break;
         case RamDouble:
-            DEFINE_COMPARE_METHOD_TYPED(double)
+            init_typed<double>(compare_operator, compare_value_db, different_value_db);
             break;
     }
 }
 
 bool CompareOperations::check_value(const void* value)
 {
-    return compare_method(static_cast<const value_t*>(value));
+    uint64_t mask;
+    value_kernel(static_cast<const uint8_t*>(value), nullptr, 1, &mask);
+    return mask & 1;
 }
 
 bool CompareOperations::check_previous(const void* value, const void* old_value)
 {
-    compare_value = *static_cast<const value_t*>(old_value);
-    return compare_method(static_cast<const value_t*>(value));
+    uint64_t mask;
+    previous_kernel(static_cast<const uint8_t*>(value), static_cast<const uint8_t*>(old_value), 1, &mask);
+    return mask & 1;
+}
+
+void CompareOperations::check_value_chunk(const void* values, int count, uint64_t* mask)
+{
+    value_kernel(static_cast<const uint8_t*>(values), nullptr, count, mask);
+}
+
+void CompareOperations::check_previous_chunk(const void* values, const void* old_values, int count, uint64_t* mask)
+{
+    previous_kernel(static_cast<const uint8_t*>(values), static_cast<const uint8_t*>(old_values), count, mask);
 }
 
 const char* CompareOperations::tostring(const void* value, bool hex)
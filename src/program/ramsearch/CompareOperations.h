@@ -47,6 +47,14 @@ namespace CompareOperations {
 
     /* Compute the comparaison between the content of value and the old value */
     bool check_previous(const void* value, const void* old_value);
+
+    /* Compare `count` consecutive values against the stored constant value,
+     * and set bit i of `mask` if value i matches. `mask` must hold
+     * (count+63)/64 words, which are all overwritten. */
+    void check_value_chunk(const void* values, int count, uint64_t* mask);
+
+    /* Same as check_value_chunk(), comparing against consecutive old values */
+    void check_previous_chunk(const void* values, const void* old_values, int count, uint64_t* mask);
     
     /* Format a value to be shown */
     const char* tostring(const void* value, bool hex);
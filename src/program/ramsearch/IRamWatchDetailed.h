@@ -36,6 +36,13 @@ public:
     /* Return the current value of the ram watch as a string */
     virtual std::string value_str() = 0;
 
+    /* Format a raw value of the watch type into [first, last), and return
+     * the end of the written characters */
+    virtual char* format_value(const void* raw, char* first, char* last) = 0;
+
+    /* Returns the size of the stored type */
+    virtual int value_size() = 0;
+
     /* Poke a value (given as a string) into the ram watch address. Return
      * the result of process_vm_writev call
      */
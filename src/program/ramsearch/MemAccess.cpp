@@ -18,11 +18,18 @@
  */
 
 #include "MemAccess.h"
+#include "MemShadow.h"
 
 #include <stdint.h>
 #include <iostream>
 #ifdef __unix__
 #include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 #elif defined(__APPLE__) && defined(__MACH__)
 #include <mach/vm_map.h>
 #include <mach/mach_traps.h>
@@ -56,7 +63,10 @@ size_t MemAccess::read(void* local_addr, void* remote_addr, size_t size)
 {
     if (!game_pid)
         return 0;
-        
+
+    if (MemShadow::read(local_addr, remote_addr, size))
+        return size;
+
 #ifdef __unix__
     struct iovec local, remote;
     local.iov_base = local_addr;
@@ -75,6 +85,85 @@ size_t MemAccess::read(void* local_addr, void* remote_addr, size_t size)
 #endif
 }
 
+size_t MemAccess::read(Segment* segments, size_t count)
+{
+    for (size_t s = 0; s < count; s++)
+        segments[s].valid = false;
+
+    if (!game_pid)
+        return 0;
+
+    size_t valid_count = 0;
+
+    /* Segments inside the memory shadow don't need to be read */
+    for (size_t s = 0; s < count; s++) {
+        if (MemShadow::read(segments[s].local_addr, segments[s].remote_addr, segments[s].size)) {
+            segments[s].valid = true;
+            valid_count++;
+        }
+    }
+
+#ifdef __unix__
+    struct iovec local[IOV_MAX], remote[IOV_MAX];
+    size_t index[IOV_MAX];
+
+    size_t s = 0;
+    while (s < count) {
+        /* Gather the next segments to read */
+        size_t n = 0;
+        size_t next = s;
+        for (; (next < count) && (n < IOV_MAX); next++) {
+            if (segments[next].valid)
+                continue;
+            index[n] = next;
+            local[n].iov_base = segments[next].local_addr;
+            local[n].iov_len = segments[next].size;
+            remote[n].iov_base = segments[next].remote_addr;
+            remote[n].iov_len = segments[next].size;
+            n++;
+        }
+
+        if (n == 0)
+            break;
+
+        ssize_t ret = process_vm_readv(game_pid, local, n, remote, n, 0);
+        if (ret < 0) {
+            /* Nothing could be read. Skip the first segment if it is the
+             * culprit, otherwise the other segments won't be read either */
+            if (errno != EFAULT)
+                return valid_count;
+            s = index[0] + 1;
+            continue;
+        }
+
+        /* The read stops at the first segment that cannot be fully read */
+        size_t i = 0;
+        for (; (i < n) && (static_cast<size_t>(ret) >= segments[index[i]].size); i++) {
+            ret -= segments[index[i]].size;
+            segments[index[i]].valid = true;
+            valid_count++;
+        }
+
+        /* Skip the segment that failed */
+        if (i < n)
+            s = index[i] + 1;
+        else
+            s = next;
+    }
+#elif defined(__APPLE__) && defined(__MACH__)
+    for (size_t s = 0; s < count; s++) {
+        if (segments[s].valid)
+            continue;
+        if (read(segments[s].local_addr, segments[s].remote_addr, segments[s].size) == segments[s].size) {
+            segments[s].valid = true;
+            valid_count++;
+        }
+    }
+#endif
+
+    return valid_count;
+}
+
 size_t MemAccess::write(void* local_addr, void* remote_addr, size_t size)
 {
     if (!game_pid)
@@ -87,7 +176,10 @@ size_t MemAccess::write(void* local_addr, void* remote_addr, size_t size)
     remote.iov_base = remote_addr;
     remote.iov_len = size;
 
-    return process_vm_writev(game_pid, &local, 1, &remote, 1, 0);    
+    ssize_t ret = process_vm_writev(game_pid, &local, 1, &remote, 1, 0);
+    if (ret > 0)
+        MemShadow::write(local_addr, remote_addr, ret);
+    return ret;
 #elif defined(__APPLE__) && defined(__MACH__)
     kern_return_t error = vm_write(task, reinterpret_cast<vm_address_t>(remote_addr), reinterpret_cast<vm_offset_t>(local_addr), size);
 
@@ -32,6 +32,19 @@ namespace MemAccess {
     
     size_t read(void* local_addr, void* remote_addr, size_t size);
 
+    /* Segment of game memory to be read, with the result of the read */
+    struct Segment {
+        void* local_addr;
+        void* remote_addr;
+        size_t size;
+        bool valid; // set if the segment was fully read
+    };
+
+    /* Read multiple segments using as few calls as possible. A segment that
+     * cannot be read does not prevent the following ones from being read.
+     * Returns the number of valid segments. */
+    size_t read(Segment* segments, size_t count);
+
     size_t write(void* local_addr, void* remote_addr, size_t size);    
 }
 
@@ -22,29 +22,20 @@
 #include "MemLayout.h"
 #include "MemScanner.h"
 #include "MemScannerThread.h"
-#include <sstream>
-#include <fstream>
 #include <iostream>
 #include <thread>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
 
 std::string MemScanner::memscan_path;
-std::string MemScanner::addresses_path;
-std::string MemScanner::values_path;
 
 void MemScanner::init(std::string path)
 {
     memscan_path = path;
-    
-    std::ostringstream ossov;
-    ossov << memscan_path << "/memory.bin";
-    values_path = ossov.str();
-
-    std::ostringstream ossoa;
-    ossoa << memscan_path << "/addresses.bin";
-    addresses_path = ossoa.str();
 }
 
-void MemScanner::first_scan(pid_t pid, int mem_flags, int type, CompareType ct, CompareOperator co, double cv, double dv)
+int MemScanner::first_scan(pid_t pid, int mem_flags, int type, CompareType ct, CompareOperator co, double cv, double dv)
 {
     value_type = type;
     switch (value_type) {
@@ -68,24 +59,28 @@ void MemScanner::first_scan(pid_t pid, int mem_flags, int type, CompareType ct,
             break;
     }
 
+    new_results.clear();
+    new_arenas.clear();
+    new_result_count = 0;
+
     /* Read the whole memory layout */
     std::unique_ptr<MemLayout> memlayout (new MemLayout(pid));
 
     memsections.clear();
     
     MemSection section;
-    total_size = 0;
+    uint64_t total_size = 0;
     while (memlayout->nextSection(MemSection::MemAll, mem_flags, section)) {
         memsections.push_back(section);
         total_size += section.size;
     }
         
-    if (total_size == 0) return;
+    if (total_size == 0) return 0;
 
-    scan(true, ct, co, cv, dv);
+    return scan(true, ct, co, cv, dv);
 }
 
-void MemScanner::scan(bool first, CompareType ct, CompareOperator co, double cv, double dv)
+int MemScanner::scan(bool first, CompareType ct, CompareOperator co, double cv, double dv)
 {
     compare_type = ct;
     compare_operator = co;
@@ -94,189 +89,184 @@ void MemScanner::scan(bool first, CompareType ct, CompareOperator co, double cv,
 
     CompareOperations::init(value_type, compare_operator, compare_value, different_value);
 
-    /* Split the work between threads */
-    std::vector<MemScannerThread> memscanners;
-    std::vector<std::thread> memscan_threads;
-    uint64_t block_size = (total_size / THREAD_COUNT) & 0xfffffffffffff000;
+    /* Split the work into chunks of pages */
+    chunks.clear();
+    if (first) {
+        for (const MemSection& section : memsections) {
+            uint64_t section_pages = section.size / 4096;
+            for (uint64_t p = 0; p < section_pages; p += CHUNK_PAGES) {
+                int pages = (section_pages - p < CHUNK_PAGES) ? (section_pages - p) : CHUNK_PAGES;
+                chunks.push_back({section.addr + p*4096, 0, pages});
+            }
+        }
+    }
+    else {
+        for (uint64_t i = 0; i < results.size(); i += CHUNK_PAGES) {
+            int pages = (results.size() - i < CHUNK_PAGES) ? (results.size() - i) : CHUNK_PAGES;
+            chunks.push_back({0, i, pages});
+        }
+    }
+
+    /* Soft-dirty bits of the game pages are read from its pagemap. If it
+     * cannot be opened, all pages are read. */
+    pagemap_fd = -1;
+    if (!first && dirty_only) {
+        std::string pagemap_path = "/proc/" + std::to_string(MemAccess::getPid()) + "/pagemap";
+        pagemap_fd = open(pagemap_path.c_str(), O_RDONLY);
+    }
 
-    int beg_region = 0;
-    int end_region = 0;
-    uintptr_t beg_address = 0;
-    uintptr_t end_address = 0;
-    size_t cur_region_offset = 0;
+    chunk_results.assign(chunks.size(), std::vector<PageResults>());
+    next_chunk = 0;
+    processed_size = 0;
+    store_failed = false;
 
-    int thread_count = THREAD_COUNT;
-    if (block_size == 0)
+    unsigned int thread_count = std::thread::hardware_concurrency();
+    if (thread_count > chunks.size())
+        thread_count = chunks.size();
+    if (thread_count == 0)
         thread_count = 1;
-    
-    for (int t = 0; t < thread_count-1; t++) {
-        uint64_t cur_block_size = memsections[beg_region].size - cur_region_offset;    
-        while ((cur_block_size < block_size) && (end_region < memsections.size())) {
-            end_region++;
-            cur_block_size += memsections[end_region].size;
-        }
-        
-        cur_region_offset = memsections[end_region].size - (cur_block_size - block_size);
-        end_address = memsections[end_region].addr + cur_region_offset;
-        
-        /* Sanitize beg and end addresses */
-        if (beg_address < memsections[beg_region].addr)
-            beg_address = memsections[beg_region].addr;
-        if (end_address > memsections[end_region].endaddr)
-            end_address = memsections[end_region].endaddr;
-
-        /* Configure the scanner thread */
-        memscanners.emplace_back(*this, beg_region, end_region, beg_address, end_address, t*block_size, block_size);
-        
-        /* Set the beg variables for the next thread */
-        if (cur_block_size == block_size) {
-            /* Nothing left in this section, skip to the beginning of the next section */
-            beg_region = end_region + 1;
-            beg_address = memsections[beg_region].addr;
-        }
-        else {
-            beg_region = end_region;
-            beg_address = end_address;
-        }
+
+    running_threads = thread_count;
+
+    std::vector<MemScannerThread> memscanners;
+    std::vector<std::thread> memscan_threads;
+    memscanners.reserve(thread_count);
+
+    for (unsigned int t = 0; t < thread_count; t++) {
+        memscanners.emplace_back(*this, first);
     }
-    
-    /* Last scanner thread gets the remaining memory */
-    end_region = memsections.size() - 1;
-    end_address = memsections.back().endaddr;
-    memscanners.emplace_back(*this, beg_region, end_region, beg_address, end_address, (thread_count-1)*block_size, total_size-((thread_count-1)*block_size));
-    
+
     /* Start all threads */
-    for (int t = 0; t < thread_count; t++) {
-        if (first) {
-            if (compare_type == CompareType::Previous)
-                memscan_threads.emplace_back(&MemScannerThread::first_region_scan, &memscanners[t]);
-            else
-                memscan_threads.emplace_back(&MemScannerThread::first_address_scan, &memscanners[t]);            
-        }
-        else {
-            if (last_scan_was_region)
-                memscan_threads.emplace_back(&MemScannerThread::next_scan_from_region, &memscanners[t]);
-            else
-                memscan_threads.emplace_back(&MemScannerThread::next_scan_from_address, &memscanners[t]);
-        }
+    for (unsigned int t = 0; t < thread_count; t++) {
+        memscan_threads.emplace_back(&MemScannerThread::run, &memscanners[t]);
     }
 
-    /* Update progress bar */
-    /* We would normally just join all threads, but we need to update the scan
-     * state periodically to update the progress bar. So we check if all
-     * scan threads have finished. */
-    bool scan_finished = false;
-    while (!scan_finished) { 
-        uint64_t total_processed_size = 0;
-        scan_finished = true;
-        
-        for (const auto& ms : memscanners) {
-            total_processed_size += ms.processed_memory_size;
-            scan_finished &= ms.finished;
+    /* Update the progress bar periodically until all threads have finished */
+    {
+        std::unique_lock<std::mutex> lock(threads_mutex);
+        while (!threads_cv.wait_for(lock, std::chrono::milliseconds(100), [this]{return running_threads == 0;})) {
+            /* The progress signal is queued to the UI thread, which may
+             * cancel the scan, so don't hold the lock here */
+            lock.unlock();
+            emit signalProgress(processed_size);
+            lock.lock();
         }
-        emit signalProgress(total_processed_size);
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
-    last_scan_was_region = (first && (compare_type == CompareType::Previous));
-
-    /* Wait for the thread to finish. TODO: be able to cancel it. */
-    total_size = 0;
-    for (int t = 0; t < thread_count; t++) {
+    for (unsigned int t = 0; t < thread_count; t++) {
         memscan_threads[t].join();
-
-        /* Compute total size */
-        total_size += memscanners[t].new_memory_size;
     }
 
-    /* Wait for each thread to finish and merge all individual files created
-     * by each thread into a single file, and inside vectors to be displayed. */
-    /* TODO: this can take a bit of time, do this in another thread if we don't
-     * need to display values (above threshold).
-     * Prevent a new search until the file merge is completed */
-    std::ofstream ovfs(values_path, std::ofstream::binary);
-    std::ofstream oafs;
-    if (!last_scan_was_region) {
-        oafs.open(addresses_path, std::ofstream::binary);
+    if (pagemap_fd >= 0) {
+        close(pagemap_fd);
+        pagemap_fd = -1;
     }
-    
-    for (int t = 0; t < thread_count; t++) {
-        const MemScannerThread& mst = memscanners[t];
-        
-        /* Append memscan_thread file to unique file */
-        if (!last_scan_was_region) {
-            std::ifstream iafs(mst.addresses_path, std::ios_base::binary);
-            oafs << iafs.rdbuf();
+
+    if (stop_requested) {
+        /* Drop the partial results. A cancelled first scan has no results */
+        chunks.clear();
+        chunk_results.clear();
+        if (first)
+            memsections.clear();
+        if (store_failed) {
+            std::cerr << "Could not store the ram search results" << std::endl;
+            return ESTOREFAILED;
         }
-        std::ifstream ivfs(mst.values_path, std::ios_base::binary);
-        ovfs << ivfs.rdbuf();
+        return ECANCELLED;
     }
-    
-    /* If the total size is below threshold, load all data (except if region data) */
-    if (last_scan_was_region) return;
 
-    addresses.clear();
-    old_values.clear();
-    
-    if (total_size < (DISPLAY_THRESHOLD*value_type_size)) {
-        /* Close the streams before reading the files */
-        oafs.close();
-        ovfs.close();
-        
-        std::ifstream iafs(addresses_path, std::ios::in | std::ios::binary);
-        addresses = std::vector<char>(std::istreambuf_iterator<char>(iafs), std::istreambuf_iterator<char>());
+    /* Gather the results of each chunk. Chunks are in address order, so
+     * results stay sorted by address. The previous results are still shown
+     * until the new ones are committed. */
+    new_results.clear();
+    new_arenas.clear();
+    new_result_count = 0;
+
+    for (const auto& cr : chunk_results) {
+        new_results.insert(new_results.end(), cr.begin(), cr.end());
+    }
 
-        std::ifstream ivfs(values_path, std::ios::in | std::ios::binary);
-        old_values = std::vector<char>(std::istreambuf_iterator<char>(ivfs), std::istreambuf_iterator<char>());
+    for (auto& mst : memscanners) {
+        new_arenas.push_back(std::move(mst.arena));
+        new_result_count += mst.new_count;
     }
+
+    chunks.clear();
+    chunk_results.clear();
+
+    return 0;
+}
+
+void MemScanner::commit_scan()
+{
+    results.swap(new_results);
+    arenas.swap(new_arenas);
+    result_count = new_result_count;
+
+    new_results.clear();
+    new_arenas.clear();
+    new_result_count = 0;
+
+    results_view.reset(&results, value_type_size);
 }
 
 uint64_t MemScanner::scan_size() const
 {
-    return total_size;
+    return results.size() * 4096;
+}
+
+uint64_t MemScanner::store_size() const
+{
+    uint64_t size = results.capacity() * sizeof(PageResults);
+    for (const auto& arena : arenas)
+        size += arena->memorySize() + arena->fileSize();
+    return size;
 }
 
 uint64_t MemScanner::scan_count() const
 {
-    return total_size / value_type_size;
+    return result_count;
 }
 
-uint64_t MemScanner::display_scan_count() const
+uintptr_t MemScanner::get_address(uint64_t index) const
 {
-    return addresses.size() / sizeof(uintptr_t);
+    return results_view.address(index);
 }
 
-uintptr_t MemScanner::get_address(int index) const
+const std::string& MemScanner::get_previous_value(uint64_t index, bool hex) const
 {
-    if (addresses.empty())
-        return 0;
-        
-    return *reinterpret_cast<const uintptr_t*>(&addresses[index*sizeof(uintptr_t)]);
+    return results_view.previous_value(index, hex);
 }
 
-const char* MemScanner::get_previous_value(int index, bool hex) const
+const std::string& MemScanner::get_current_value(uint64_t index, bool hex) const
 {
-    if (old_values.empty())
-        return "";
-        
-    return CompareOperations::tostring(&old_values[index*value_type_size], hex);
+    return results_view.current_value(index, hex);
 }
 
-const char* MemScanner::get_current_value(int index, bool hex) const
+void MemScanner::invalidate_current_values()
 {
-    uintptr_t addr = get_address(index);
-    uint8_t value[8];
-    int readValues = MemAccess::read(value, reinterpret_cast<void*>(addr), value_type_size);
-    if (readValues != value_type_size)
-        return "";
+    results_view.invalidate_current();
+}
 
-    return CompareOperations::tostring(value, hex);
+void MemScanner::cancel()
+{
+    stop_requested = true;
+}
+
+void MemScanner::thread_finished()
+{
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        running_threads--;
+    }
+    threads_cv.notify_all();
 }
 
 void MemScanner::clear()
 {
-    total_size = 0;
-    addresses.clear();
-    old_values.clear();
+    results.clear();
+    arenas.clear();
+    result_count = 0;
+    results_view.clear();
     memsections.clear();
 }
@@ -22,11 +22,16 @@
 
 #include "CompareOperations.h"
 #include "MemSection.h"
-// #include "MemScanner.h"
+#include "ScanStore.h"
+#include "ScanResultsView.h"
 
 #include <QtCore/QObject>
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <cstdint>
 
 /* Store a section of the game memory */
@@ -34,47 +39,102 @@ class MemScanner : public QObject {
     Q_OBJECT
     
     public:
+        enum Error {
+            ECANCELLED = -1, // The scan was cancelled
+            ESTOREFAILED = -2, // The results could not be stored
+        };
+
         /* Initialize the memory scanner with the memory scan path */
         static void init(std::string path);
 
-        /* First memory scan */
-        void first_scan(pid_t pid, int mem_flags, int type, CompareType ct, CompareOperator co, double cv, double dv);
+        /* First memory scan. Returns 0 or an error code, in which case the
+         * previous results are kept. Scans are run outside of the UI thread,
+         * and their results are only shown after commit_scan(). */
+        int first_scan(pid_t pid, int mem_flags, int type, CompareType ct, CompareOperator co, double cv, double dv);
+
+        /* Generic memory scan method. Returns 0 or an error code */
+        int scan(bool first, CompareType ct, CompareOperator co, double cv, double dv);
 
-        /* Generic memory scan method */
-        void scan(bool first, CompareType ct, CompareOperator co, double cv, double dv);
+        /* Replace the results by the ones of the last successful scan. Must
+         * be called from the UI thread when no scan is running. */
+        void commit_scan();
 
-        /* Returns the total size of results */
+        /* Returns the total size of memory pages containing results */
         uint64_t scan_size() const;
 
+        /* Returns the size used to store results, in memory and in files */
+        uint64_t store_size() const;
+
         /* Returns the total number of scan results */
         uint64_t scan_count() const;
 
-        /* Returns the number of scan results showed to the user (may be zero
-         * when too many results have been found) */
-        uint64_t display_scan_count() const;
-
         /* Get the address of the scan result with index */
-        uintptr_t get_address(int index) const;
+        uintptr_t get_address(uint64_t index) const;
 
         /* Get the previous value of the scan result with index as string */
-        const char* get_previous_value(int index, bool hex) const;
+        const std::string& get_previous_value(uint64_t index, bool hex) const;
 
-        /* Get the current value of the scan result with index as string */
-        const char* get_current_value(int index, bool hex) const;
+        /* Get the current value of the scan result with index as string.
+         * Values are read again after invalidate_current_values() */
+        const std::string& get_current_value(uint64_t index, bool hex) const;
+
+        /* The game memory has changed */
+        void invalidate_current_values();
 
         /* Clear all results */
         void clear();
 
+        /* Stop the current scan as soon as possible. The results of the
+         * previous scan are kept. Can be called from any thread. The request
+         * is reset by the caller before starting a scan, so that it is not
+         * lost if made before the scan thread started. */
+        void cancel();
+
+        /* Called by each scanner thread when it has no more work */
+        void thread_finished();
+
         /* Array of all memory sections parsed from /proc/self/maps */
         std::vector<MemSection> memsections;
         
-        const int THREAD_COUNT = 4;
-        const uint64_t DISPLAY_THRESHOLD = 10000; // don't display results when above threshold
+        static constexpr int CHUNK_PAGES = 256; // maximum number of pages scanned at once by a thread
         
         static std::string memscan_path; // directory containing all scan files
-        static std::string addresses_path; // output file containing all scan addresses
-        static std::string values_path; // output file containing all scan values
-        
+
+        /* Memory used to store results before spilling them into files
+         * (0 for unlimited) */
+        uint64_t memory_budget = 0;
+
+        /* On next scans, only read the result pages whose soft-dirty bit is
+         * set. The caller must ensure that the bits were cleared before the
+         * stored values were read, and were not cleared since. Other pages
+         * are unchanged, so their stored values are used as current values. */
+        bool dirty_only = false;
+
+        /* File descriptor of /proc/pid/pagemap during a dirty-only scan,
+         * or -1 */
+        int pagemap_fd = -1;
+
+        /* Pages containing results of the last scan, sorted by address */
+        std::vector<PageResults> results;
+
+        /* Unit of work of a scan: `pages` pages starting at `addr` for a
+         * first scan, or `pages` result pages starting at `index` in
+         * `results` for a next scan */
+        struct ScanChunk {
+            uintptr_t addr;
+            uint64_t index;
+            int pages;
+        };
+
+        /* Chunks of the current scan, and the results of each chunk */
+        std::vector<ScanChunk> chunks;
+        std::vector<std::vector<PageResults>> chunk_results;
+
+        std::atomic<uint64_t> next_chunk; // next chunk to be picked by a thread
+        std::atomic<uint64_t> processed_size; // processed size (in bytes), used for progress bar
+        std::atomic<bool> stop_requested; // the current scan must stop
+        std::atomic<bool> store_failed; // results of the current scan could not be stored
+
         int value_type;
         int value_type_size;
         CompareType compare_type;
@@ -83,11 +143,23 @@ class MemScanner : public QObject {
         double different_value;
         
     private:
-        bool last_scan_was_region = true;
-        uint64_t total_size; // total size of the last scan (in bytes)
+        uint64_t result_count = 0; // number of results of the last scan
+
+        /* Number of scanner threads still running, and its notification */
+        int running_threads = 0;
+        std::mutex threads_mutex;
+        std::condition_variable threads_cv;
+
+        /* Storage of the results, one arena per scanner thread */
+        std::vector<std::unique_ptr<ScanArena>> arenas;
+
+        /* Results of the last scan, until they are committed */
+        std::vector<PageResults> new_results;
+        std::vector<std::unique_ptr<ScanArena>> new_arenas;
+        uint64_t new_result_count = 0;
 
-        std::vector<char> addresses; // scan addresses shown to the user
-        std::vector<char> old_values; // scan previous values shown to the user
+        /* Access to the results shown to the user, which caches them */
+        mutable ScanResultsView results_view;
 
     signals:
         /* Update the scan progress bar */
@@ -24,375 +24,156 @@
 #include "CompareOperations.h"
 
 #include <cstring>
-#include <sstream>
-#include <fstream>
-#include <iostream>
 #include <vector>
-#include <thread>
+#include <sys/types.h>
+#include <unistd.h>
 
-#define MEMORY_CHUNK_SIZE 1024*1024
+MemScannerThread::MemScannerThread(MemScanner& ms, bool f) : memscanner(ms), first(f) {}
 
-MemScannerThread::MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, off_t mo, uint64_t mem) : memscanner(ms), beg_region(br), end_region(er), beg_address(ba), end_address(ea), memory_offset(mo), memory_size(mem)
+void MemScannerThread::process_page(uintptr_t addr, const char* page, const PageResults* old_page, std::vector<PageResults>& results)
 {
-    finished = false;
-}
-
-MemScannerThread::~MemScannerThread()
-{
-    if (!addresses_path.empty())
-        std::remove(addresses_path.c_str());
-    if (!values_path.empty())
-        std::remove(values_path.c_str());
-}
-
-void MemScannerThread::create_output_files()
-{
-    /* Create the files with names from the thread tid */
-    std::ostringstream ossa;
-    ossa << memscanner.memscan_path << "/addresses-" << std::this_thread::get_id() << ".tmp";    
-    addresses_path = ossa.str();
+    int value_count = 4096 / memscanner.value_type_size;
+    uint64_t matches[4096/64];
+    uint32_t count = 0;
 
-    std::ostringstream ossv;
-    ossv << memscanner.memscan_path << "/memory-" << std::this_thread::get_id() << ".tmp";
-    values_path = ossv.str();
-}
-
-void MemScannerThread::first_region_scan()
-{
-    create_output_files();    
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-    
-    /* Start searching from beg_address to end_address, which were split evenly
-     * between all threads. Read memory by chunks */
-    uintptr_t cur_beg_addr = beg_address;
-    uintptr_t cur_end_addr;
-    for (int r = beg_region; r <= end_region; r++) {
-        const MemSection& ms = memscanner.memsections[r];
-
-        /* Determine region start and end addresses */
-        if (r > beg_region) cur_beg_addr = ms.addr;
-    
-        if (r == end_region) {
-            if ((end_address <= ms.addr) || (end_address > ms.endaddr)) {
-                std::cerr << "Wrong end address" << std::endl;
-                return;
-            }
-            cur_end_addr = end_address;
-        }
-        else {
-            cur_end_addr = ms.endaddr;
-        }
-        
-        /* Write data */
-        uint8_t chunk[4096];
-        
-        for (uintptr_t ca = cur_beg_addr; ca < cur_end_addr; ca += 4096) {
-            int readValues = MemAccess::read(chunk, reinterpret_cast<void*>(ca), 4096);
-            if (readValues < 0) {
-                std::cerr << "Cound not read game process at address " << ca << std::endl;
-            }
-            vfs.write((char*)chunk, 4096);
-            new_memory_size += 4096;
-            processed_memory_size += 4096;
-        }
+    if (!old_page && (memscanner.compare_type == CompareType::Previous)) {
+        /* Unknown value on first scan, every value is a result */
+        count = value_count;
     }
-    finished = true;
-}
-
-void MemScannerThread::first_address_scan()
-{
-    create_output_files();    
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
-    /* Save in files by batches */
-    uintptr_t batch_addresses[4096];
-    uint8_t batch_values[4096*8];
-    int batch_index = 0;
-    
-    /* Start searching from beg_address to end_address, which were split evenly
-     * between all threads. Read memory by chunks */
-    uintptr_t cur_beg_addr = beg_address;
-    uintptr_t cur_end_addr;
-    for (int r = beg_region; r <= end_region; r++) {
-        const MemSection& ms = memscanner.memsections[r];
-
-        /* Determine region start and end addresses */
-        if (r > beg_region) cur_beg_addr = ms.addr;
-    
-        if (r == end_region) {
-            if ((end_address <= ms.addr) || (end_address > ms.endaddr)) {
-                std::cerr << "Wrong end address" << std::endl;
+    else {
+        if (memscanner.compare_type == CompareType::Previous) {
+            char old_values[4096];
+            if (!loadPage(*old_page, old_values))
                 return;
-            }
-            cur_end_addr = end_address;
+            CompareOperations::check_previous_chunk(page, old_values, value_count, matches);
         }
         else {
-            cur_end_addr = ms.endaddr;
+            CompareOperations::check_value_chunk(page, value_count, matches);
         }
-        
-        /* Write data */
-        uint8_t chunk[4096];
-        
-        for (uintptr_t ca = cur_beg_addr; ca < cur_end_addr; ca += 4096) {
-            processed_memory_size += 4096;
 
-            int readValues = MemAccess::read(chunk, reinterpret_cast<void*>(ca), 4096);
-            if (readValues < 0)
-                continue;
-            for (int v = 0; v < 4096; v += memscanner.value_type_size) {
-                if (CompareOperations::check_value(chunk+v)) {
-                    batch_addresses[batch_index] = ca + v;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), chunk+v, memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == 4096) {
-                        afs.write((char*)batch_addresses, 4096*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, 4096*memscanner.value_type_size);
-                        new_memory_size += 4096*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
-            }
+        int words = (value_count + 63) / 64;
+        if (old_page) {
+            uint64_t old_matches[4096/64];
+            loadMatches(*old_page, value_count, old_matches);
+            for (int w = 0; w < words; w++)
+                matches[w] &= old_matches[w];
         }
+        for (int w = 0; w < words; w++)
+            count += __builtin_popcountll(matches[w]);
     }
-    
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    new_memory_size += batch_index*memscanner.value_type_size;
-    finished = true;
-}
-
-void MemScannerThread::next_scan_from_region()
-{
-    create_output_files();    
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
 
-    std::vector<uint8_t> new_memory;
-    new_memory.resize(MEMORY_CHUNK_SIZE);
+    if (count == 0)
+        return;
 
-    /* If we compare from previous memory, read and process saved memory by
-     * chunks and by region, because all threads access to the same file. */
-    std::vector<char> old_memory;
-    std::ifstream ivfs;
-    if (memscanner.compare_type == CompareType::Previous) {
-        old_memory.resize(MEMORY_CHUNK_SIZE);
-        
-        ivfs.open(memscanner.values_path, std::ofstream::binary);
-        ivfs.seekg(memory_offset);
+    PageResults page_results = storePage(*arena, addr, page, matches, value_count, count);
+    if (page_results.count == 0) {
+        /* The arena is full or could not grow, so the scan cannot give
+         * complete results and is stopped */
+        memscanner.store_failed = true;
+        memscanner.stop_requested = true;
+        return;
     }
-    
-    /* Save in files by batches */
-    uintptr_t batch_addresses[4096];
-    uint8_t batch_values[4096*8];
-    int batch_index = 0;
 
-    uintptr_t cur_beg_addr = beg_address;
-    uintptr_t cur_end_addr;
-    for (int r = beg_region; r <= end_region; r++) {
-        const MemSection& ms = memscanner.memsections[r];
-
-        /* Determine region start and end addresses */
-        if (r > beg_region) cur_beg_addr = ms.addr;
-    
-        if (r == end_region) {
-            if ((end_address <= ms.addr) || (end_address > ms.endaddr)) {
-                std::cerr << "Wrong end address" << std::endl;
-                return;
-            }
-            cur_end_addr = end_address;
-        }
-        else {
-            cur_end_addr = ms.endaddr;
-        }
-        
-        /* Read chunks of memory */
-        while (cur_beg_addr < cur_end_addr) {
-            int chunk_size = MEMORY_CHUNK_SIZE;
-            if ((cur_end_addr - cur_beg_addr) < chunk_size)
-                chunk_size = cur_end_addr - cur_beg_addr;
-            
-            processed_memory_size += chunk_size;
+    results.push_back(page_results);
+    new_count += count;
+}
 
-            if (memscanner.compare_type == CompareType::Previous) {
-                ivfs.read(old_memory.data(), chunk_size);
-            }
-            
-            int readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(cur_beg_addr), chunk_size);
-            if (readValues < 0) {
-                std::cerr << "Cound not read game process at address " << cur_beg_addr << std::endl;
-            }
-            if (readValues < chunk_size) {
-                std::cerr << "Did not read enough memory at address " << cur_beg_addr << std::endl;
-            }
-            
-            for (int v = 0; v < chunk_size; v += memscanner.value_type_size) {
-                if (((memscanner.compare_type == CompareType::Previous) && 
-                    CompareOperations::check_previous(&new_memory[v], &old_memory[v])) ||
-                    ((memscanner.compare_type == CompareType::Value) && 
-                    CompareOperations::check_value(&new_memory[v]))) {
-                    batch_addresses[batch_index] = cur_beg_addr + v;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), &new_memory[v], memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == 4096) {
-                        afs.write((char*)batch_addresses, 4096*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, 4096*memscanner.value_type_size);
-                        new_memory_size += 4096*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
-            }
-            
-            cur_beg_addr += chunk_size;            
+void MemScannerThread::read_soft_dirty(const PageResults* old_pages, int count, bool* dirty)
+{
+    /* Bit 55 of a pagemap entry is the soft-dirty bit, bits 62 and 63 tell
+     * if the page is swapped or present. Pages that are neither may have been
+     * unmapped, so they are read again. */
+    static constexpr uint64_t SOFT_DIRTY_BIT = 1ULL << 55;
+    static constexpr uint64_t MAPPED_BITS = (1ULL << 62) | (1ULL << 63);
+    static constexpr int MAX_ENTRIES = 512;
+    uint64_t entries[MAX_ENTRIES];
+
+    /* Result pages are sparse but close to each other, so read the entries
+     * of a whole range of pages at once, including the pages in between */
+    int p = 0;
+    while (p < count) {
+        uintptr_t first_page = old_pages[p].addr / 4096;
+        int n = 1;
+        while ((p + n < count) && (old_pages[p+n].addr / 4096 - first_page < MAX_ENTRIES))
+            n++;
+
+        size_t entry_count = old_pages[p+n-1].addr / 4096 - first_page + 1;
+        ssize_t ret = pread(memscanner.pagemap_fd, entries, entry_count*sizeof(uint64_t), first_page*sizeof(uint64_t));
+
+        for (int i = 0; i < n; i++) {
+            size_t e = old_pages[p+i].addr / 4096 - first_page;
+            if (ret < static_cast<ssize_t>((e+1)*sizeof(uint64_t)))
+                dirty[p+i] = true;
+            else
+                dirty[p+i] = (entries[e] & SOFT_DIRTY_BIT) || !(entries[e] & MAPPED_BITS);
         }
+        p += n;
     }
-    
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    new_memory_size += batch_index*memscanner.value_type_size;
-    finished = true;
 }
 
-void MemScannerThread::next_scan_from_address()
+void MemScannerThread::scan_chunk(const MemScanner::ScanChunk& chunk, std::vector<PageResults>& results, char* buf)
 {
-    create_output_files();
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
-    int size_ratio = sizeof(uintptr_t)/memscanner.value_type_size;
+    const PageResults* old_pages = first ? nullptr : &memscanner.results[chunk.index];
+
+    /* Only pages modified since the previous scan must be read */
+    bool dirty[MemScanner::CHUNK_PAGES];
+    if (!first && memscanner.pagemap_fd >= 0)
+        read_soft_dirty(old_pages, chunk.pages, dirty);
+    else
+        for (int i = 0; i < chunk.pages; i++)
+            dirty[i] = true;
+
+    /* Read all dirty pages of the chunk at once. Pages of a next scan are not
+     * necessarily contiguous. */
+    MemAccess::Segment segments[MemScanner::CHUNK_PAGES];
+    int page_index[MemScanner::CHUNK_PAGES];
+    int segment_count = 0;
+
+    for (int i = 0; i < chunk.pages; i++) {
+        if (!dirty[i])
+            continue;
+        segments[segment_count].local_addr = &buf[i*4096];
+        segments[segment_count].remote_addr = reinterpret_cast<void*>(first ? (chunk.addr + i*4096) : old_pages[i].addr);
+        segments[segment_count].size = 4096;
+        page_index[segment_count++] = i;
+    }
 
-    std::vector<uint8_t> new_memory;
-    new_memory.resize(4096);
+    MemAccess::read(segments, segment_count);
 
-    /* If we compare from previous memory, read and process saved memory by
-     * chunks and by region, because all threads access to the same file. */
-    int max_chunk_size = MEMORY_CHUNK_SIZE;
-    if (memory_size < max_chunk_size)
-        max_chunk_size = memory_size;
+    bool readable[MemScanner::CHUNK_PAGES];
+    for (int s = 0; s < segment_count; s++)
+        readable[page_index[s]] = segments[s].valid;
 
-    std::vector<char> old_memory;
+    for (int i = 0; i < chunk.pages; i++) {
+        /* Clean pages still hold the values of the previous scan */
+        if (!dirty[i])
+            readable[i] = loadPage(old_pages[i], &buf[i*4096]);
 
-    std::ifstream ivfs;
-    if (memscanner.compare_type == CompareType::Previous) {
-        old_memory.resize(max_chunk_size);
-        
-        ivfs.open(memscanner.values_path, std::ifstream::binary);
-        ivfs.seekg(memory_offset);
+        if (readable[i]) {
+            uintptr_t addr = first ? (chunk.addr + i*4096) : old_pages[i].addr;
+            process_page(addr, &buf[i*4096], first ? nullptr : &old_pages[i], results);
+        }
     }
 
-    std::vector<uintptr_t> old_addresses;
-    old_addresses.resize(max_chunk_size/memscanner.value_type_size);
-
-    std::ifstream iafs(memscanner.addresses_path, std::ifstream::binary);
-    if (!iafs)
-        std::cerr << "error: could not open file " << memscanner.addresses_path << std::endl;
-    iafs.seekg(memory_offset*size_ratio);
-    if (!iafs)
-        std::cerr << "error: could not seek to offset " << memory_offset*size_ratio << std::endl;
-    
-    /* Save in files by batches */
-    uintptr_t batch_addresses[4096];
-    uint8_t batch_values[4096*8];
-    int batch_index = 0;
+    memscanner.processed_size += chunk.pages*4096;
+}
 
-    /* Read chunks of memory */
-    uint64_t remaining_memory_size = memory_size;
-    while (remaining_memory_size > 0) {
-        int chunk_size = MEMORY_CHUNK_SIZE;
-        if (remaining_memory_size < chunk_size)
-            chunk_size = remaining_memory_size;
-        
-        if (memscanner.compare_type == CompareType::Previous) {
-            ivfs.read(old_memory.data(), chunk_size);
-            if (!ivfs)
-                std::cerr << "error: only " << ivfs.gcount() << " could be read from " << chunk_size << std::endl;
-        }
-        iafs.read((char*)old_addresses.data(), chunk_size*size_ratio);
-        if (!iafs)
-        std::cerr << "error: only " << iafs.gcount() << " could be read from " << chunk_size << std::endl;
-        
-        int addr_beg_index = 0;
-        int addr_end_index = chunk_size / memscanner.value_type_size;
+void MemScannerThread::run()
+{
+    arena.reset(new ScanArena(MemScanner::memscan_path, memscanner.memory_budget));
+    new_count = 0;
 
-        // std::cout << "Index " << addr_beg_index << " to " << addr_end_index << " for thread " << std::this_thread::get_id() << std::endl;
-        // std::cout << "Chunk " << old_addresses[addr_beg_index] << " to " << old_addresses[addr_end_index-1] << " for thread " << std::this_thread::get_id() << std::endl;
-        
-        while (addr_beg_index < addr_end_index) {
-            
-            /* Look at all old addresses that are inside the same memory page.
-             * From cheatengine source code comments, it is faster to load an 
-             * entire memory page and look at the specific addresses than loading
-             * each individual addresses (because caching), except if you only
-             * need one address in the memory page.
-             */
-            uintptr_t beg_addr = old_addresses[addr_beg_index];
-            uintptr_t beg_page = beg_addr & 0xfffffffffffff000;
-            
-            int addr_cur_index;
-            for (addr_cur_index = addr_beg_index+1; addr_cur_index < addr_end_index; addr_cur_index++) {
-                if ((old_addresses[addr_cur_index] & 0xfffffffffffff000) != beg_page)
-                    break;
-            }
-            
-            processed_memory_size += (addr_cur_index-addr_beg_index)*memscanner.value_type_size;
+    std::vector<char> buf(MemScanner::CHUNK_PAGES*4096);
 
-            int readValues;
+    /* Threads pick the next chunk to scan as soon as they finish one, so that
+     * they all keep busy whatever the cost of each memory region */
+    while (!memscanner.stop_requested) {
+        uint64_t c = memscanner.next_chunk++;
+        if (c >= memscanner.chunks.size())
+            break;
 
-            /* If only one address in page, load that address */
-            if ((addr_cur_index-addr_beg_index) == 1) {
-                readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(beg_addr), memscanner.value_type_size);
-            }
-            else {
-                /* Load all values from first to last address */
-                uintptr_t last_addr = old_addresses[addr_cur_index-1];
-                readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(beg_addr), (last_addr-beg_addr)+memscanner.value_type_size);
-            }
-            if (readValues < 0)
-                continue;
-            
-            for (int i = addr_beg_index; i < addr_cur_index; i++) {
-                uintptr_t addr = old_addresses[i];
-                int mem_index = addr-beg_addr;
-                
-                if (((memscanner.compare_type == CompareType::Previous) && 
-                    CompareOperations::check_previous(&new_memory[mem_index], &old_memory[i*memscanner.value_type_size])) ||
-                    ((memscanner.compare_type == CompareType::Value) && 
-                    CompareOperations::check_value(&new_memory[mem_index]))) {
-                    batch_addresses[batch_index] = addr;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), &new_memory[mem_index], memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == 4096) {
-                        afs.write((char*)batch_addresses, 4096*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, 4096*memscanner.value_type_size);
-                        new_memory_size += 4096*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
-            }
-            
-            addr_beg_index = addr_cur_index;
-        }
-        memory_offset += chunk_size;
-        remaining_memory_size -= chunk_size;
+        scan_chunk(memscanner.chunks[c], memscanner.chunk_results[c], buf.data());
     }
-    
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    new_memory_size += batch_index*memscanner.value_type_size;
-    finished = true;
+
+    memscanner.thread_finished();
 }
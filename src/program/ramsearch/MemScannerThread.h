@@ -21,46 +21,39 @@
 #define LIBTAS_MEMSCANNERTHREAD_H_INCLUDED
 
 #include "MemScanner.h"
+#include "ScanStore.h"
 
-#include <string>
+#include <vector>
+#include <memory>
 #include <cstdint>
 
-/* Store a section of the game memory */
+/* Thread processing chunks of a memory scan */
 class MemScannerThread {
     public:
-        MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, off_t mo, uint64_t mem);
-        ~MemScannerThread();
+        MemScannerThread(MemScanner& ms, bool f);
 
-        /* Create the output files that are named based on the scanning thread id */
-        void create_output_files();
-        
-        /* First scan that will store the full memory when user set 'unknown value' */
-        void first_region_scan();
+        /* Process chunks of the scan until none is left or the scan is
+         * cancelled. On first scan, if user set 'unknown value', all values
+         * of readable pages are results. */
+        void run();
 
-        /* First scan that will store memory and addresses because user compare
-         * to some value */
-        void first_address_scan();
+        MemScanner& memscanner; // Reference to the scanner controller
+        bool first; // First scan, over memory sections instead of previous results
 
-        /* Subsequent scan when previous was unknown (full memory) */
-        void next_scan_from_region();
+        std::unique_ptr<ScanArena> arena; // Storage of the page results
+        uint64_t new_count; // Number of results found by this thread
 
-        /* Subsequent scan when previous had memory and addresses (common case) */
-        void next_scan_from_address();
+    private:
+        /* Scan a chunk and store the pages with results */
+        void scan_chunk(const MemScanner::ScanChunk& chunk, std::vector<PageResults>& results, char* buf);
 
-        const MemScanner& memscanner; // Reference to the scanner controller
-        int beg_region, end_region; // Range of memory regions to search into
-        uintptr_t beg_address, end_address; // Range of memory addresses to search into
-        
-        off_t memory_offset; // Offset in the memory file pointed by the starting address
-        uint64_t memory_size; // Size of the memory file portion to process (in bytes)
-        
-        uint64_t new_memory_size; // New size after the scan (in bytes)
-        volatile uint64_t processed_memory_size; // Current processed size (in bytes), used for progress bar
-        
-        std::string addresses_path; // Output file of addresses
-        std::string values_path; // Output file of values
-        
-        volatile bool finished; // indicate if scan is finished, used for progress bar
+        /* Fill `dirty` with the soft-dirty bit of each result page of a
+         * chunk. Pages whose bit can't be read are considered dirty. */
+        void read_soft_dirty(const PageResults* old_pages, int count, bool* dirty);
+
+        /* Compare the values of a page that was just read against its
+         * previous results if any, and store the page if a value matches */
+        void process_page(uintptr_t addr, const char* page, const PageResults* old_page, std::vector<PageResults>& results);
 };
 
 #endif
@@ -0,0 +1,186 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemShadow.h"
+#include "../../shared/MemoryShadow.h"
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static MemoryShadowMapping* shadow = nullptr;
+static bool shadow_valid = false;
+
+/* Pages of the shadow that were read since the last update */
+static bool shadow_used[MemoryShadowMapping::PAGES_MAX];
+
+/* Pages outside the shadow that were read since the last update */
+static std::set<uintptr_t> missed_pages;
+
+/* Reads may come from both the UI thread and the game loop thread */
+static std::mutex shadow_mutex;
+
+/* Small reads typically come from watches and scripts that poll the same
+ * values each frame, which is what the shadow is for */
+static const size_t RECORD_MAX_SIZE = 64;
+
+void MemShadow::init(pid_t pid, int fd)
+{
+    std::lock_guard<std::mutex> lock(shadow_mutex);
+
+    if (shadow) {
+        munmap(shadow, sizeof(MemoryShadowMapping));
+        shadow = nullptr;
+    }
+    shadow_valid = false;
+    missed_pages.clear();
+
+    if (!pid)
+        return;
+
+    /* The memfd of the game is opened through procfs, which has the same
+     * permission requirements as reading the game memory */
+    std::string path = "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(fd);
+    int shadow_fd = open(path.c_str(), O_RDWR);
+    if (shadow_fd < 0) {
+        std::cerr << "Could not open the memory shadow " << path << std::endl;
+        return;
+    }
+
+    void* addr = mmap(nullptr, sizeof(MemoryShadowMapping), PROT_READ | PROT_WRITE, MAP_SHARED, shadow_fd, 0);
+    close(shadow_fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Could not map the memory shadow" << std::endl;
+        return;
+    }
+
+    shadow = static_cast<MemoryShadowMapping*>(addr);
+    shadow->page_count = 0;
+    memset(shadow_used, 0, sizeof(shadow_used));
+}
+
+void MemShadow::setValid(bool valid)
+{
+    std::lock_guard<std::mutex> lock(shadow_mutex);
+    shadow_valid = valid && shadow;
+}
+
+/* Index of the shadow page containing an address, or -1 */
+static int pageIndex(uintptr_t addr)
+{
+    uint64_t page = addr & ~static_cast<uintptr_t>(4095);
+    const uint64_t* begin = shadow->page_addr;
+    const uint64_t* end = begin + shadow->page_count;
+    const uint64_t* it = std::lower_bound(begin, end, page);
+    if ((it == end) || (*it != page))
+        return -1;
+    return it - begin;
+}
+
+bool MemShadow::read(void* local_addr, const void* remote_addr, size_t size)
+{
+    std::lock_guard<std::mutex> lock(shadow_mutex);
+
+    if (!shadow_valid)
+        return false;
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(remote_addr);
+    uintptr_t end = addr + size;
+    bool record = (size <= RECORD_MAX_SIZE);
+
+    /* Check that all pages of the range are shadowed, the range may be split
+     * across two pages */
+    for (uintptr_t page = addr & ~static_cast<uintptr_t>(4095); page < end; page += 4096) {
+        int index = pageIndex(page);
+        if ((index < 0) || !shadow->page_valid[index]) {
+            if (record && (missed_pages.size() < MemoryShadowMapping::PAGES_MAX))
+                missed_pages.insert(page);
+            return false;
+        }
+    }
+
+    char* out = static_cast<char*>(local_addr);
+    while (addr < end) {
+        int index = pageIndex(addr);
+        size_t offset = addr & 4095;
+        size_t len = std::min(static_cast<size_t>(end - addr), 4096 - offset);
+        memcpy(out, &shadow->pages[index][offset], len);
+        if (record)
+            shadow_used[index] = true;
+        out += len;
+        addr += len;
+    }
+
+    return true;
+}
+
+void MemShadow::write(const void* local_addr, const void* remote_addr, size_t size)
+{
+    std::lock_guard<std::mutex> lock(shadow_mutex);
+
+    if (!shadow)
+        return;
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(remote_addr);
+    uintptr_t end = addr + size;
+    const char* in = static_cast<const char*>(local_addr);
+    while (addr < end) {
+        size_t offset = addr & 4095;
+        size_t len = std::min(static_cast<size_t>(end - addr), 4096 - offset);
+        int index = pageIndex(addr);
+        if (index >= 0)
+            memcpy(&shadow->pages[index][offset], in, len);
+        in += len;
+        addr += len;
+    }
+}
+
+void MemShadow::update()
+{
+    std::lock_guard<std::mutex> lock(shadow_mutex);
+
+    if (!shadow)
+        return;
+
+    /* Keep the pages that were used, and add the ones that were missed */
+    std::vector<uint64_t> pages;
+    for (uint64_t i = 0; i < shadow->page_count; i++) {
+        if (shadow_used[i])
+            pages.push_back(shadow->page_addr[i]);
+    }
+    for (uintptr_t page : missed_pages) {
+        if (pages.size() >= MemoryShadowMapping::PAGES_MAX)
+            break;
+        pages.push_back(page);
+    }
+    std::sort(pages.begin(), pages.end());
+
+    /* The game reads the new list when entering the next frame boundary */
+    std::copy(pages.begin(), pages.end(), shadow->page_addr);
+    shadow->page_count = pages.size();
+    memset(shadow_used, 0, sizeof(shadow_used));
+    missed_pages.clear();
+}
@@ -0,0 +1,53 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MEMSHADOW_H_INCLUDED
+#define LIBTAS_MEMSHADOW_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Read game memory from the memory shadow, a shared mapping where the game
+ * copies the pages that the program reads the most at each frame boundary.
+ * Reads from the shadow don't need any system call. */
+namespace MemShadow {
+
+    /* Map the memory shadow from its file descriptor in the game process,
+     * or unmap it if pid is 0 */
+    void init(pid_t pid, int fd);
+
+    /* Set if the shadow holds the current game memory, which is only the
+     * case while the game is stopped at a frame boundary */
+    void setValid(bool valid);
+
+    /* Read from the shadow. Returns false if the range is not entirely
+     * inside shadowed pages. Small reads are recorded so that their pages
+     * are shadowed on next frames. */
+    bool read(void* local_addr, const void* remote_addr, size_t size);
+
+    /* Keep the shadow up-to-date after writing into the game memory */
+    void write(const void* local_addr, const void* remote_addr, size_t size);
+
+    /* Request the game to copy the pages that were read since the last call.
+     * Must be called while the game is stopped. */
+    void update();
+}
+
+#endif
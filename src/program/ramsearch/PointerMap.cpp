@@ -0,0 +1,169 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PointerMap.h"
+#include "BaseAddresses.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char pointermap_magic[8] = {'L', 'T', 'P', 'T', 'R', 'M', 'A', 'P'};
+
+PointerMap::~PointerMap()
+{
+    if (map_addr)
+        munmap(map_addr, map_size);
+}
+
+bool PointerMap::save(const std::string& path, const PointerScanner& scanner, uintptr_t target)
+{
+    /* Gather the modules of all static pointers */
+    std::map<std::string, uintptr_t> module_anchors;
+    for (const PointerScanner::Pointer& p : scanner.static_pointers) {
+        off_t offset;
+        std::string file = BaseAddresses::getFileAndOffset(p.second, offset);
+        if (!file.empty())
+            module_anchors[file] = p.second - offset;
+    }
+
+    std::vector<Entry> sorted_entries;
+    sorted_entries.reserve(scanner.pointers.size() + scanner.static_pointers.size());
+    for (const PointerScanner::Pointer& p : scanner.pointers)
+        sorted_entries.push_back({p.second, p.first});
+    for (const PointerScanner::Pointer& p : scanner.static_pointers)
+        sorted_entries.push_back({p.second, p.first});
+    std::sort(sorted_entries.begin(), sorted_entries.end(), [](const Entry& a, const Entry& b) {
+        return a.source < b.source;
+    });
+
+    std::ofstream ofs(path, std::ofstream::binary);
+    if (!ofs) {
+        std::cerr << "Could not open pointer map file " << path << std::endl;
+        return false;
+    }
+
+    Header header;
+    memcpy(header.magic, pointermap_magic, sizeof(header.magic));
+    header.version = VERSION;
+    header.module_count = module_anchors.size();
+    header.pointer_count = sorted_entries.size();
+    header.target = target;
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& ma : module_anchors) {
+        Module module;
+        memset(module.name, 0, sizeof(module.name));
+        strncpy(module.name, ma.first.c_str(), sizeof(module.name) - 1);
+        module.anchor = ma.second;
+        ofs.write(reinterpret_cast<const char*>(&module), sizeof(module));
+    }
+
+    ofs.write(reinterpret_cast<const char*>(sorted_entries.data()), sorted_entries.size() * sizeof(Entry));
+    return ofs.good();
+}
+
+bool PointerMap::load(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open pointer map file " << path << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(Header))) {
+        close(fd);
+        return false;
+    }
+
+    map_size = st.st_size;
+    map_addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map_addr == MAP_FAILED) {
+        map_addr = nullptr;
+        return false;
+    }
+
+    const Header* header = static_cast<const Header*>(map_addr);
+    if (memcmp(header->magic, pointermap_magic, sizeof(header->magic)) || (header->version != VERSION)) {
+        std::cerr << "Wrong pointer map file format " << path << std::endl;
+        return false;
+    }
+
+    /* Check the counts against the file size before computing the size of
+     * the tables, so that it can't overflow */
+    size_t tables_size = map_size - sizeof(Header);
+    bool valid = header->module_count <= tables_size / sizeof(Module);
+    if (valid) {
+        tables_size -= header->module_count * sizeof(Module);
+        valid = (header->pointer_count <= tables_size / sizeof(Entry)) &&
+            (tables_size == header->pointer_count * sizeof(Entry));
+    }
+    if (!valid) {
+        std::cerr << "Corrupted pointer map file " << path << std::endl;
+        return false;
+    }
+
+    const Module* module_table = reinterpret_cast<const Module*>(header + 1);
+    for (uint32_t m = 0; m < header->module_count; m++) {
+        std::string name(module_table[m].name, strnlen(module_table[m].name, sizeof(module_table[m].name)));
+        modules[name] = module_table[m].anchor;
+    }
+
+    target = header->target;
+    entries = reinterpret_cast<const Entry*>(module_table + header->module_count);
+    entry_count = header->pointer_count;
+    return true;
+}
+
+bool PointerMap::validate(const PointerScanner::Chain& chain) const
+{
+    if (!entries)
+        return false;
+
+    /* Translate the base address into the snapshot */
+    off_t offset;
+    std::string file = BaseAddresses::getFileAndOffset(chain.first, offset);
+    uintptr_t addr = chain.first;
+    if (!file.empty()) {
+        auto it = modules.find(file);
+        if (it == modules.end())
+            return false;
+        addr = it->second + offset;
+    }
+
+    /* Offsets are stored in reverse order */
+    for (auto o = chain.second.rbegin(); o != chain.second.rend(); o++) {
+        const Entry* entry = std::lower_bound(entries, entries + entry_count, addr, [](const Entry& e, uintptr_t a) {
+            return e.source < a;
+        });
+        if ((entry == entries + entry_count) || (entry->source != addr))
+            return false;
+        addr = entry->value + *o;
+    }
+
+    return addr == target;
+}
@@ -0,0 +1,82 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_POINTERMAP_H_INCLUDED
+#define LIBTAS_POINTERMAP_H_INCLUDED
+
+#include "PointerScanner.h"
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+/* Snapshot of all pointers of the game memory, used to validate pointer
+ * chains found at another frame or in another game execution. The file is
+ * made of a header, a table of modules with their address, and all pointers
+ * sorted by source address. Static addresses are stored relative to their
+ * module, so that snapshots are comparable between executions. The file is
+ * memory-mapped when loaded. */
+class PointerMap {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t module_count;
+        uint64_t pointer_count;
+        uint64_t target; // address that was searched in the snapshot
+    };
+
+    struct Module {
+        char name[248];
+        uint64_t anchor; // address that module offsets are relative to
+    };
+
+    struct Entry {
+        uint64_t source;
+        uint64_t value;
+    };
+
+    PointerMap() = default;
+    PointerMap(const PointerMap&) = delete;
+    PointerMap& operator=(const PointerMap&) = delete;
+    ~PointerMap();
+
+    /* Save the pointers located by the scanner, with the searched address */
+    static bool save(const std::string& path, const PointerScanner& scanner, uintptr_t target);
+
+    /* Load a snapshot file */
+    bool load(const std::string& path);
+
+    /* Follow a chain found in the current execution inside the snapshot,
+     * and return if it leads to the address searched in the snapshot */
+    bool validate(const PointerScanner::Chain& chain) const;
+
+private:
+    void* map_addr = nullptr;
+    size_t map_size = 0;
+
+    uintptr_t target = 0;
+    const Entry* entries = nullptr;
+    uint64_t entry_count = 0;
+    std::map<std::string, uintptr_t> modules;
+};
+
+#endif
@@ -0,0 +1,389 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PointerScanner.h"
+#include "MemLayout.h"
+#include "MemAccess.h"
+
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <iterator>
+#include <cstring>
+
+/* Number of pages read at once when locating pointers */
+#define LOCATE_PAGES 64
+
+/* Number of nodes processed at once during the search */
+#define SEARCH_BLOCK 256
+
+/* Sections where pointers are static */
+static const int static_flag = MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemStack;
+
+static unsigned int thread_count(size_t work_count)
+{
+    unsigned int count = std::thread::hardware_concurrency();
+    if (count > work_count)
+        count = work_count;
+    if (count == 0)
+        count = 1;
+    return count;
+}
+
+/* Merge sorted arrays two by two */
+static std::vector<PointerScanner::Pointer> merge_sorted(std::vector<std::vector<PointerScanner::Pointer>>& parts)
+{
+    while (parts.size() > 1) {
+        std::vector<std::vector<PointerScanner::Pointer>> merged;
+        for (size_t i = 0; i < parts.size(); i += 2) {
+            if (i + 1 == parts.size()) {
+                merged.push_back(std::move(parts[i]));
+                break;
+            }
+            std::vector<PointerScanner::Pointer> m(parts[i].size() + parts[i+1].size());
+            std::merge(parts[i].begin(), parts[i].end(), parts[i+1].begin(), parts[i+1].end(), m.begin());
+            merged.push_back(std::move(m));
+        }
+        parts.swap(merged);
+    }
+
+    if (parts.empty())
+        return std::vector<PointerScanner::Pointer>();
+    return std::move(parts[0]);
+}
+
+PointerScanner::~PointerScanner()
+{
+    if (controller.joinable())
+        controller.join();
+}
+
+void PointerScanner::start(pid_t pid, bool locate, uintptr_t addr, int max_level, int max_offset)
+{
+    if (controller.joinable())
+        controller.join();
+
+    finished = false;
+    progress = 0;
+    pending_chains.clear();
+
+    controller = std::thread([=]{
+        if (locate)
+            locate_pointers(pid);
+
+        progress = 0;
+        search(addr, max_level, max_offset);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        finished_cv.notify_all();
+    });
+}
+
+bool PointerScanner::wait(int ms)
+{
+    bool done;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done = finished_cv.wait_for(lock, std::chrono::milliseconds(ms), [this]{return finished;});
+    }
+
+    if (done && controller.joinable())
+        controller.join();
+
+    return done;
+}
+
+void PointerScanner::collect(std::vector<Chain>& chains)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::move(pending_chains.begin(), pending_chains.end(), std::back_inserter(chains));
+    pending_chains.clear();
+}
+
+void PointerScanner::filter_page(const uintptr_t* values, uintptr_t addr, bool is_static, std::vector<Pointer>& out_pointers, std::vector<Pointer>& out_static) const
+{
+    typedef uintptr_t vptr __attribute__ ((vector_size (4*sizeof(uintptr_t))));
+
+    std::vector<Pointer>& out = is_static ? out_static : out_pointers;
+    const uintptr_t low = target_starts.front();
+    const uintptr_t span = target_ends.back() - low;
+
+    for (unsigned int i = 0; i < 4096/sizeof(uintptr_t); i += 4) {
+        /* Reject values outside all target areas, four at a time */
+        vptr v;
+        memcpy(&v, &values[i], sizeof(v));
+        auto in = (v - low) < span;
+        if (!(in[0] | in[1] | in[2] | in[3]))
+            continue;
+
+        /* Look for the target area of the remaining values */
+        for (int j = 0; j < 4; j++) {
+            if (!in[j])
+                continue;
+
+            uintptr_t value = values[i+j];
+            auto it = std::upper_bound(target_starts.begin(), target_starts.end(), value);
+            size_t area = (it - target_starts.begin()) - 1;
+            if (value < target_ends[area])
+                out.emplace_back(value, addr + (i+j)*sizeof(uintptr_t));
+        }
+    }
+}
+
+void PointerScanner::locate_pointers(pid_t pid)
+{
+    pointers.clear();
+    static_pointers.clear();
+    target_starts.clear();
+    target_ends.clear();
+
+    std::unique_ptr<MemLayout> memlayout (new MemLayout(pid));
+
+    int type_flag = (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemHeap | MemSection::MemAnonymousMappingRW | MemSection::MemFileMappingRW | MemSection::MemStack);
+
+    /* Split all sections that could contain pointers into chunks */
+    struct Chunk {
+        uintptr_t addr;
+        int pages;
+        bool is_static;
+    };
+    std::vector<Chunk> chunks;
+
+    MemSection section;
+    while (memlayout->nextSection(type_flag, 0, section)) {
+        bool is_static = section.type & static_flag;
+
+        /* Pointers to a static section are not followed, so only dynamic
+         * sections are targets. Sections are ordered, so we merge adjacent
+         * ones. */
+        if (!is_static) {
+            if (!target_ends.empty() && (target_ends.back() == section.addr))
+                target_ends.back() = section.endaddr;
+            else {
+                target_starts.push_back(section.addr);
+                target_ends.push_back(section.endaddr);
+            }
+        }
+
+        for (uintptr_t addr = section.addr; addr < section.endaddr; addr += LOCATE_PAGES*4096) {
+            int pages = (section.endaddr - addr) / 4096;
+            if (pages > LOCATE_PAGES)
+                pages = LOCATE_PAGES;
+            chunks.push_back({addr, pages, is_static});
+        }
+    }
+
+    if (target_starts.empty() || chunks.empty())
+        return;
+
+    uint64_t total_size = 0;
+    for (const Chunk& chunk : chunks)
+        total_size += chunk.pages * 4096;
+
+    /* Threads pick chunks as they go, and sort their own pointers */
+    unsigned int count = thread_count(chunks.size());
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<uint64_t> processed_size(0);
+    std::vector<std::vector<Pointer>> thread_pointers(count);
+    std::vector<std::vector<Pointer>> thread_static(count);
+
+    auto worker = [&](unsigned int t) {
+        std::vector<uintptr_t> buf(LOCATE_PAGES*4096/sizeof(uintptr_t));
+        MemAccess::Segment segments[LOCATE_PAGES];
+
+        while (true) {
+            size_t c = next_chunk++;
+            if (c >= chunks.size())
+                break;
+
+            const Chunk& chunk = chunks[c];
+            for (int p = 0; p < chunk.pages; p++) {
+                segments[p].local_addr = &buf[p*4096/sizeof(uintptr_t)];
+                segments[p].remote_addr = reinterpret_cast<void*>(chunk.addr + p*4096);
+                segments[p].size = 4096;
+            }
+            MemAccess::read(segments, chunk.pages);
+
+            for (int p = 0; p < chunk.pages; p++) {
+                if (segments[p].valid)
+                    filter_page(&buf[p*4096/sizeof(uintptr_t)], chunk.addr + p*4096, chunk.is_static, thread_pointers[t], thread_static[t]);
+            }
+
+            processed_size += chunk.pages*4096;
+            progress = 100 * processed_size / total_size;
+        }
+
+        std::sort(thread_pointers[t].begin(), thread_pointers[t].end());
+        std::sort(thread_static[t].begin(), thread_static[t].end());
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < count; t++)
+        threads.emplace_back(worker, t);
+    for (auto& thread : threads)
+        thread.join();
+
+    pointers = merge_sorted(thread_pointers);
+    static_pointers = merge_sorted(thread_static);
+}
+
+void PointerScanner::build_chain(int level, uint32_t index, int offset, uintptr_t base, Chain& chain) const
+{
+    chain.first = base;
+    chain.second.resize(level + 1);
+    chain.second[level] = offset;
+
+    for (int l = level; l > 0; l--) {
+        const Node& node = levels[l][index];
+        chain.second[l-1] = node.offset;
+        index = node.parent;
+    }
+}
+
+void PointerScanner::search(uintptr_t addr, int max_level, int max_offset)
+{
+    levels.assign(1, std::vector<Node>(1, Node{addr, 0, 0}));
+    truncated = false;
+
+    for (int level = 0; level < max_level; level++) {
+        const std::vector<Node>& frontier = levels[level];
+        if (frontier.empty())
+            break;
+
+        /* Chains can only end with a static pointer on the last level */
+        bool last = (level == (max_level-1));
+
+        unsigned int count = thread_count((frontier.size() + SEARCH_BLOCK - 1) / SEARCH_BLOCK);
+        std::atomic<size_t> next_node(0);
+        std::atomic<size_t> next_count(0);
+        std::atomic<bool> frontier_full(false);
+        std::vector<std::vector<Node>> thread_nodes(count);
+
+        auto worker = [&](unsigned int t) {
+            std::vector<Chain> chains;
+
+            while (true) {
+                size_t beg = next_node.fetch_add(SEARCH_BLOCK);
+                if (beg >= frontier.size())
+                    break;
+                size_t end = std::min(beg + SEARCH_BLOCK, frontier.size());
+
+                for (size_t n = beg; n < end; n++) {
+                    uintptr_t a = frontier[n].addr;
+                    Pointer low((a > static_cast<uintptr_t>(max_offset)) ? (a - max_offset) : 0, 0);
+
+                    /* Search inside static data */
+                    for (auto it = std::lower_bound(static_pointers.begin(), static_pointers.end(), low);
+                        (it != static_pointers.end()) && (it->first <= a); it++) {
+                        chains.emplace_back();
+                        build_chain(level, n, a - it->first, it->second, chains.back());
+                    }
+
+                    if (last)
+                        continue;
+
+                    /* Search inside dynamic data */
+                    for (auto it = std::lower_bound(pointers.begin(), pointers.end(), low);
+                        (it != pointers.end()) && (it->first <= a); it++) {
+                        if (next_count++ >= MAX_FRONTIER) {
+                            frontier_full = true;
+                            break;
+                        }
+                        thread_nodes[t].push_back(Node{it->second, static_cast<uint32_t>(n), static_cast<int>(a - it->first)});
+                    }
+                }
+
+                /* Make the chains available to the caller */
+                if (!chains.empty()) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    std::move(chains.begin(), chains.end(), std::back_inserter(pending_chains));
+                    chains.clear();
+                }
+
+                progress = (100 * level + 100 * end / frontier.size()) / max_level;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < count; t++)
+            threads.emplace_back(worker, t);
+        for (auto& thread : threads)
+            thread.join();
+
+        if (frontier_full)
+            truncated = true;
+
+        if (last)
+            break;
+
+        std::vector<Node> next_level;
+        for (auto& nodes : thread_nodes)
+            next_level.insert(next_level.end(), nodes.begin(), nodes.end());
+        levels.push_back(std::move(next_level));
+    }
+
+    levels.clear();
+}
+
+void PointerScanner::filter_chains(std::vector<Chain>& chains, uintptr_t addr) const
+{
+    std::vector<uintptr_t> addresses(chains.size());
+    std::vector<uintptr_t> values(chains.size());
+    std::vector<bool> valid(chains.size(), true);
+    std::vector<MemAccess::Segment> segments;
+
+    size_t max_length = 0;
+    for (size_t c = 0; c < chains.size(); c++) {
+        addresses[c] = chains[c].first;
+        max_length = std::max(max_length, chains[c].second.size());
+    }
+
+    /* Follow all chains one level at a time, with a single read per level.
+     * Offsets are stored in reverse order */
+    for (size_t step = 0; step < max_length; step++) {
+        segments.clear();
+        for (size_t c = 0; c < chains.size(); c++) {
+            if (valid[c] && (step < chains[c].second.size()))
+                segments.push_back({&values[c], reinterpret_cast<void*>(addresses[c]), sizeof(uintptr_t), false});
+        }
+
+        MemAccess::read(segments.data(), segments.size());
+
+        size_t s = 0;
+        for (size_t c = 0; c < chains.size(); c++) {
+            if (valid[c] && (step < chains[c].second.size())) {
+                valid[c] = segments[s++].valid;
+                addresses[c] = values[c] + chains[c].second[chains[c].second.size() - 1 - step];
+            }
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t c = 0; c < chains.size(); c++) {
+        if (valid[c] && (addresses[c] == addr)) {
+            if (kept != c)
+                chains[kept] = std::move(chains[c]);
+            kept++;
+        }
+    }
+    chains.resize(kept);
+}
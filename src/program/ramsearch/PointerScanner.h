@@ -0,0 +1,116 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_POINTERSCANNER_H_INCLUDED
+#define LIBTAS_POINTERSCANNER_H_INCLUDED
+
+#include "MemSection.h"
+
+#include <vector>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+
+/* Find chains of pointers leading to an address. All values of the game
+ * memory that could be pointers are first gathered into sorted arrays, then
+ * chains are discovered with a breadth-first search bounded by the chain
+ * length. Both steps run in worker threads, and chains can be collected
+ * while the search is running. */
+class PointerScanner {
+public:
+    /* Pointer chain: base address, and offsets from the last to the first */
+    typedef std::pair<uintptr_t, std::vector<int>> Chain;
+
+    /* Pointer stored at `source` with value `target` */
+    typedef std::pair<uintptr_t, uintptr_t> Pointer;
+
+    /* Maximum number of addresses at a single level of the search */
+    static constexpr size_t MAX_FRONTIER = 1 << 24;
+
+    ~PointerScanner();
+
+    /* Start the search of all chains that start from a static address and
+     * end with `addr`, in maximum `max_level` levels and with a maximum
+     * offset of `max_offset`. Pointers are located first if `locate` is set.
+     */
+    void start(pid_t pid, bool locate, uintptr_t addr, int max_level, int max_offset);
+
+    /* Wait up to `ms` milliseconds for the search to finish, and return if
+     * it is finished */
+    bool wait(int ms);
+
+    /* Move the chains found since the last call at the end of `chains` */
+    void collect(std::vector<Chain>& chains);
+
+    /* Keep only the chains that lead to `addr` in the current game memory.
+     * This only follows the chains, which is much cheaper than a new search */
+    void filter_chains(std::vector<Chain>& chains, uintptr_t addr) const;
+
+    /* Progress of the current step, in percent */
+    std::atomic<int> progress;
+
+    /* Did the last search reach the frontier size limit */
+    bool truncated = false;
+
+    /* Pointers sorted by target, with a source in a dynamic or a static area */
+    std::vector<Pointer> pointers;
+    std::vector<Pointer> static_pointers;
+
+private:
+    /* Address reached by the search */
+    struct Node {
+        uintptr_t addr;
+        uint32_t parent; // index of the node in the previous level
+        int offset; // offset between the pointer stored at `addr` and the parent address
+    };
+
+    /* Read all game memory and store all pointers */
+    void locate_pointers(pid_t pid);
+
+    /* Store the pointers of a memory page that point inside a target area */
+    void filter_page(const uintptr_t* values, uintptr_t addr, bool is_static, std::vector<Pointer>& out_pointers, std::vector<Pointer>& out_static) const;
+
+    /* Breadth-first search of pointer chains */
+    void search(uintptr_t addr, int max_level, int max_offset);
+
+    /* Build the offsets of the chain ending with the node */
+    void build_chain(int level, uint32_t index, int offset, uintptr_t base, Chain& chain) const;
+
+    /* Main thread of the scanner */
+    std::thread controller;
+    bool finished = true;
+    std::mutex mutex;
+    std::condition_variable finished_cv;
+
+    /* Chains found but not collected yet */
+    std::vector<Chain> pending_chains;
+
+    /* Sorted and merged areas that pointers can target */
+    std::vector<uintptr_t> target_starts;
+    std::vector<uintptr_t> target_ends;
+
+    /* Nodes of each level of the search */
+    std::vector<std::vector<Node>> levels;
+};
+
+#endif
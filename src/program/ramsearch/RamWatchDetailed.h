@@ -25,6 +25,9 @@
 #include "MemAccess.h"
 #include <sstream>
 #include <iostream>
+#include <cstdio>
+#include <type_traits>
+#include <cstring>
 
 template <class T>
 class RamWatchDetailed : public IRamWatchDetailed {
@@ -45,24 +48,33 @@ public:
 
     std::string value_str()
     {
-        std::ostringstream oss;
-        if (hex) oss << std::hex;
-        /* Output char and unsigned char as integer values. There might be a
-         * more elegant solution.
-         */
-        if (std::is_same<T, char>::value) {
-            oss << static_cast<int>(get_value());
-        }
-        else if (std::is_same<T, unsigned char>::value) {
-            oss << static_cast<unsigned int>(get_value());
-        }
-        else {
-            oss << get_value();
-        }
+        T value = get_value();
         if (!isValid)
             return std::string("??????");
 
-        return oss.str();
+        char str[64];
+        return std::string(str, format_value(&value, str, str + sizeof(str)));
+    }
+
+    char* format_value(const void* raw, char* first, char* last)
+    {
+        T value;
+        memcpy(&value, raw, sizeof(T));
+
+        /* Use the same format as output streams: 6 significant digits for
+         * floating-point values, and the unsigned representation for
+         * hexadecimal integers */
+        int len = format_number(first, last - first, value, typename std::is_floating_point<T>::type());
+        if (len < 0)
+            return first;
+        if (len >= (last - first))
+            return last - 1;
+        return first + len;
+    }
+
+    int value_size()
+    {
+        return sizeof(T);
     }
 
     int poke_value(std::string str_value)
@@ -97,6 +109,21 @@ public:
         return type_index<T>();
     }
 
+private:
+    int format_number(char* str, size_t size, T value, std::true_type)
+    {
+        return snprintf(str, size, "%g", static_cast<double>(value));
+    }
+
+    int format_number(char* str, size_t size, T value, std::false_type)
+    {
+        if (hex)
+            return snprintf(str, size, "%llx", static_cast<unsigned long long>(static_cast<typename std::make_unsigned<T>::type>(value)));
+        if (std::is_signed<T>::value)
+            return snprintf(str, size, "%lld", static_cast<long long>(value));
+        return snprintf(str, size, "%llu", static_cast<unsigned long long>(value));
+    }
+
 };
 
 #endif
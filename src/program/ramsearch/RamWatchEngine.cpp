@@ -0,0 +1,137 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RamWatchEngine.h"
+#include "BaseAddresses.h"
+
+#include <algorithm>
+
+void RamWatchEngine::compile(const std::vector<std::unique_ptr<IRamWatchDetailed>>& watches)
+{
+    states.resize(watches.size());
+    order.resize(watches.size());
+    max_level = 0;
+
+    for (size_t w = 0; w < watches.size(); w++) {
+        IRamWatchDetailed* watch = watches[w].get();
+        order[w] = w;
+        states[w].valid = true;
+        states[w].levels = 0;
+
+        if (!watch->isPointer) {
+            states[w].address = watch->address;
+            continue;
+        }
+
+        /* The base address is cached inside the watch */
+        if (!watch->base_address) {
+            /* If file is empty, address is absolute */
+            if (watch->base_file.empty())
+                watch->base_address = watch->base_file_offset;
+            else
+                watch->base_address = BaseAddresses::getBaseAddress(watch->base_file) + watch->base_file_offset;
+        }
+
+        watch->pointer_addresses.assign(watch->pointer_offsets.size(), 0);
+        states[w].address = watch->base_address;
+        states[w].levels = watch->pointer_offsets.size();
+        max_level = std::max(max_level, states[w].levels);
+    }
+
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        return states[a].levels > states[b].levels;
+    });
+}
+
+void RamWatchEngine::execute(const std::vector<std::unique_ptr<IRamWatchDetailed>>& watches)
+{
+    /* Follow pointer chains */
+    for (size_t level = 0; level < max_level; level++) {
+        segments.clear();
+        for (int w : order) {
+            if (states[w].levels <= level)
+                break;
+            if (!states[w].valid)
+                continue;
+
+            segments.push_back({&states[w].next_address, reinterpret_cast<void*>(states[w].address), sizeof(uintptr_t), false});
+        }
+
+        MemAccess::read(segments.data(), segments.size());
+
+        /* Segments were built in the same order */
+        size_t s = 0;
+        for (int w : order) {
+            if (states[w].levels <= level)
+                break;
+            if (!states[w].valid)
+                continue;
+
+            IRamWatchDetailed* watch = watches[w].get();
+            states[w].valid = segments[s++].valid;
+            if (states[w].valid) {
+                watch->pointer_addresses[level] = states[w].next_address;
+                states[w].address = states[w].next_address + watch->pointer_offsets[level];
+            }
+        }
+    }
+
+    /* Read all values */
+    segments.clear();
+    for (size_t w = 0; w < watches.size(); w++) {
+        if (!states[w].valid)
+            continue;
+
+        if (watches[w]->isPointer)
+            watches[w]->address = states[w].address;
+        states[w].value = 0;
+        segments.push_back({&states[w].value, reinterpret_cast<void*>(states[w].address), static_cast<size_t>(watches[w]->value_size()), false});
+    }
+
+    MemAccess::read(segments.data(), segments.size());
+
+    size_t s = 0;
+    for (size_t w = 0; w < watches.size(); w++) {
+        if (states[w].valid)
+            states[w].valid = segments[s++].valid;
+    }
+}
+
+void RamWatchEngine::evaluate(const std::vector<std::unique_ptr<IRamWatchDetailed>>& watches, std::string& packed)
+{
+    packed.clear();
+    if (watches.empty())
+        return;
+
+    compile(watches);
+    execute(watches);
+
+    char value[64];
+    for (size_t w = 0; w < watches.size(); w++) {
+        if (w > 0)
+            packed.push_back('\n');
+
+        packed += watches[w]->label;
+        packed += ": ";
+        if (states[w].valid)
+            packed.append(value, watches[w]->format_value(&states[w].value, value, value + sizeof(value)));
+        else
+            packed += "??????";
+    }
+}
@@ -0,0 +1,66 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_RAMWATCHENGINE_H_INCLUDED
+#define LIBTAS_RAMWATCHENGINE_H_INCLUDED
+
+#include "IRamWatchDetailed.h"
+#include "MemAccess.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+/* Evaluate all ram watches at once. Pointer chains are resolved level by
+ * level, each level reading the next pointer of all chains in a single
+ * batched read, and then all values are read in a final batch. */
+class RamWatchEngine {
+public:
+    /* Evaluate all watches, and pack them as "label: value" lines */
+    void evaluate(const std::vector<std::unique_ptr<IRamWatchDetailed>>& watches, std::string& packed);
+
+private:
+    /* Evaluation state of a single watch */
+    struct WatchState {
+        uintptr_t address;
+        size_t levels; // length of the pointer chain
+        uintptr_t next_address; // output of a pointer read
+        uint64_t value; // output of the value read
+        bool valid;
+    };
+
+    /* Build the read plan: resolve base addresses and sort watches by
+     * pointer chain length */
+    void compile(const std::vector<std::unique_ptr<IRamWatchDetailed>>& watches);
+
+    /* Execute the read plan */
+    void execute(const std::vector<std::unique_ptr<IRamWatchDetailed>>& watches);
+
+    std::vector<WatchState> states;
+
+    /* Watch indices sorted by decreasing pointer chain length, so that the
+     * watches still needing a read at some level are a prefix */
+    std::vector<int> order;
+    size_t max_level = 0;
+
+    std::vector<MemAccess::Segment> segments;
+};
+
+#endif
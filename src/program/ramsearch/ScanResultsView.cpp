@@ -0,0 +1,186 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScanResultsView.h"
+#include "CompareOperations.h"
+#include "MemAccess.h"
+
+#include <algorithm>
+
+void ScanResultsView::reset(const std::vector<PageResults>* r, int vts)
+{
+    results = r;
+    value_type_size = vts;
+    blocks.clear();
+
+    page_first.clear();
+    page_first.reserve(results->size());
+    result_count = 0;
+    for (const PageResults& page_results : *results) {
+        page_first.push_back(result_count);
+        result_count += page_results.count;
+    }
+}
+
+void ScanResultsView::clear()
+{
+    results = nullptr;
+    page_first.clear();
+    result_count = 0;
+    blocks.clear();
+}
+
+uint64_t ScanResultsView::size() const
+{
+    return result_count;
+}
+
+uintptr_t ScanResultsView::address(uint64_t index)
+{
+    if (index >= result_count)
+        return 0;
+
+    Block& b = block(index);
+    return b.addresses[index - b.first];
+}
+
+const std::string& ScanResultsView::previous_value(uint64_t index, bool hex)
+{
+    static const std::string empty;
+    if (index >= result_count)
+        return empty;
+
+    Block& b = block(index);
+    if (b.hex != hex)
+        fill(b, hex);
+    return b.previous[index - b.first];
+}
+
+const std::string& ScanResultsView::current_value(uint64_t index, bool hex)
+{
+    static const std::string empty;
+    if (index >= result_count)
+        return empty;
+
+    Block& b = block(index);
+    if (b.hex != hex)
+        fill(b, hex);
+    if (!b.current_valid)
+        read_current(b);
+    return b.current[index - b.first];
+}
+
+void ScanResultsView::invalidate_current()
+{
+    for (Block& b : blocks)
+        b.current_valid = false;
+}
+
+ScanResultsView::Block& ScanResultsView::block(uint64_t index)
+{
+    uint64_t first = index - (index % BLOCK_ROWS);
+
+    for (Block& b : blocks) {
+        if (b.first == first) {
+            b.last_use = ++use_count;
+            return b;
+        }
+    }
+
+    /* Replace the least recently used block */
+    Block* b;
+    if (blocks.size() < BLOCK_COUNT) {
+        blocks.emplace_back();
+        b = &blocks.back();
+    }
+    else {
+        b = &*std::min_element(blocks.begin(), blocks.end(), [](const Block& a, const Block& c) {return a.last_use < c.last_use;});
+    }
+
+    /* Values are formatted like the last requested ones */
+    b->first = first;
+    b->last_use = ++use_count;
+    fill(*b, last_hex);
+    return *b;
+}
+
+void ScanResultsView::fill(Block& b, bool hex)
+{
+    b.hex = hex;
+    last_hex = hex;
+    b.current_valid = false;
+    b.addresses.clear();
+    b.previous.clear();
+
+    uint64_t count = std::min(static_cast<uint64_t>(BLOCK_ROWS), result_count - b.first);
+    int value_count = 4096 / value_type_size;
+
+    /* Find the page of the first result of the block */
+    uint64_t p = std::upper_bound(page_first.begin(), page_first.end(), b.first) - page_first.begin() - 1;
+    uint64_t skip = b.first - page_first[p];
+
+    char page[4096];
+    uint64_t matches[4096/64];
+    while ((b.addresses.size() < count) && (p < results->size())) {
+        const PageResults& page_results = (*results)[p++];
+        bool loaded = loadPage(page_results, page);
+        loadMatches(page_results, value_count, matches);
+
+        for (int v = 0; (v < value_count) && (b.addresses.size() < count); v++) {
+            if (!((matches[v / 64] >> (v % 64)) & 1))
+                continue;
+            if (skip > 0) {
+                skip--;
+                continue;
+            }
+
+            b.addresses.push_back(page_results.addr + v*value_type_size);
+            b.previous.push_back(loaded ? CompareOperations::tostring(&page[v*value_type_size], hex) : "");
+        }
+    }
+
+    /* Should not happen, unless the result counts are inconsistent */
+    b.addresses.resize(count, 0);
+    b.previous.resize(count);
+    b.current.assign(count, std::string());
+}
+
+void ScanResultsView::read_current(Block& b)
+{
+    size_t count = b.addresses.size();
+    std::vector<char> values(count * value_type_size);
+    std::vector<MemAccess::Segment> segments(count);
+
+    for (size_t i = 0; i < count; i++) {
+        segments[i].local_addr = &values[i*value_type_size];
+        segments[i].remote_addr = reinterpret_cast<void*>(b.addresses[i]);
+        segments[i].size = value_type_size;
+    }
+
+    MemAccess::read(segments.data(), count);
+
+    for (size_t i = 0; i < count; i++) {
+        if (segments[i].valid)
+            b.current[i] = CompareOperations::tostring(&values[i*value_type_size], b.hex);
+        else
+            b.current[i].clear();
+    }
+
+    b.current_valid = true;
+}
@@ -0,0 +1,93 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SCANRESULTSVIEW_H_INCLUDED
+#define LIBTAS_SCANRESULTSVIEW_H_INCLUDED
+
+#include "ScanStore.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/* Random access to the results of a scan, served directly from the result
+ * store. Results are extracted and formatted by blocks of consecutive rows
+ * when they are displayed, and only the last used blocks are kept. Current
+ * values are read for a whole block at once. */
+class ScanResultsView {
+    public:
+        /* Index the results of a new scan. The results must stay valid until
+         * the next call. */
+        void reset(const std::vector<PageResults>* results, int value_type_size);
+
+        /* Drop all results */
+        void clear();
+
+        /* Number of results */
+        uint64_t size() const;
+
+        /* Address of a result */
+        uintptr_t address(uint64_t index);
+
+        /* Value of a result when it was scanned, as string */
+        const std::string& previous_value(uint64_t index, bool hex);
+
+        /* Current value of a result, as string, or empty if it can't be read */
+        const std::string& current_value(uint64_t index, bool hex);
+
+        /* Current values will be read again on next access */
+        void invalidate_current();
+
+    private:
+        static constexpr int BLOCK_ROWS = 256;
+        static constexpr int BLOCK_COUNT = 16;
+
+        struct Block {
+            uint64_t first; // index of the first result of the block
+            uint64_t last_use;
+            bool hex;
+            bool current_valid;
+            std::vector<uintptr_t> addresses;
+            std::vector<std::string> previous;
+            std::vector<std::string> current;
+        };
+
+        const std::vector<PageResults>* results = nullptr;
+        int value_type_size = 1;
+
+        /* Index of the first result of each result page */
+        std::vector<uint64_t> page_first;
+        uint64_t result_count = 0;
+
+        std::vector<Block> blocks;
+        uint64_t use_count = 0;
+
+        bool last_hex = false;
+
+        /* Returns the block containing a result, building it if needed */
+        Block& block(uint64_t index);
+
+        /* Extract the addresses and previous values of a block */
+        void fill(Block& b, bool hex);
+
+        /* Read the current values of a block */
+        void read_current(Block& b);
+};
+
+#endif
@@ -0,0 +1,212 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScanStore.h"
+#include "../../external/lz4.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/* Size of an arena chunk */
+#define ARENA_CHUNK_SIZE 4*1024*1024
+
+std::atomic<uint64_t> ScanArena::memory_used(0);
+
+ScanArena::ScanArena(const std::string& d, uint64_t b) : dir(d), budget(b) {}
+
+ScanArena::~ScanArena()
+{
+    for (const Chunk& chunk : chunks)
+        munmap(chunk.addr, ARENA_CHUNK_SIZE);
+    memory_used -= memory_size;
+}
+
+bool ScanArena::newChunk()
+{
+    Chunk chunk;
+    chunk.used = 0;
+
+    if ((budget == 0) || (memory_used + ARENA_CHUNK_SIZE <= budget)) {
+        chunk.addr = static_cast<char*>(mmap(nullptr, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (chunk.addr == MAP_FAILED)
+            return false;
+        memory_size += ARENA_CHUNK_SIZE;
+        memory_used += ARENA_CHUNK_SIZE;
+    }
+    else {
+        /* The file is removed right away, its content stays available
+         * until the chunk is unmapped */
+        std::string path = dir + "/results-XXXXXX";
+        std::vector<char> tmpl(path.begin(), path.end());
+        tmpl.push_back('\0');
+        int fd = mkstemp(tmpl.data());
+        if (fd < 0) {
+            std::cerr << "Could not create ram search file in " << dir << std::endl;
+            return false;
+        }
+        unlink(tmpl.data());
+
+        if (ftruncate(fd, ARENA_CHUNK_SIZE) != 0) {
+            close(fd);
+            return false;
+        }
+
+        chunk.addr = static_cast<char*>(mmap(nullptr, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        close(fd);
+        if (chunk.addr == MAP_FAILED)
+            return false;
+        file_size += ARENA_CHUNK_SIZE;
+    }
+
+    chunks.push_back(chunk);
+    return true;
+}
+
+const char* ScanArena::append(const void* data, size_t size)
+{
+    if (chunks.empty() || (chunks.back().used + size > ARENA_CHUNK_SIZE)) {
+        if (!newChunk())
+            return nullptr;
+    }
+
+    Chunk& chunk = chunks.back();
+    char* addr = chunk.addr + chunk.used;
+    memcpy(addr, data, size);
+
+    /* Keep bitmaps aligned */
+    chunk.used += (size + 7) & ~static_cast<size_t>(7);
+    return addr;
+}
+
+PageResults storePage(ScanArena& arena, uintptr_t addr, const char* page, const uint64_t* matches, int value_count, uint32_t count)
+{
+    PageResults results;
+    results.addr = addr;
+    results.count = count;
+    results.matches = nullptr;
+    results.sparse = false;
+
+    int value_size = 4096 / value_count;
+    size_t bitmap_size = ((value_count + 63) / 64) * sizeof(uint64_t);
+    size_t sparse_size = count * (sizeof(uint16_t) + value_size);
+
+    /* A list of all values is never smaller than the page, and a list smaller
+     * than the bitmap is always smaller than the page with its bitmap, so the
+     * page is only compressed when it may be stored */
+    bool all_match = (count == static_cast<uint32_t>(value_count));
+    char compressed[LZ4_COMPRESSBOUND(4096)];
+    int compressed_size = 4096;
+    if (all_match || (sparse_size >= bitmap_size)) {
+        compressed_size = LZ4_compress_default(page, compressed, 4096, LZ4_COMPRESSBOUND(4096));
+        if ((compressed_size <= 0) || (compressed_size > 4096))
+            compressed_size = 4096;
+    }
+
+    if (!all_match && (sparse_size < bitmap_size + compressed_size)) {
+        /* Indexes first, so that they stay aligned */
+        char list[4096 * sizeof(uint16_t) + 4096];
+        uint16_t* indexes = reinterpret_cast<uint16_t*>(list);
+        char* values = list + count * sizeof(uint16_t);
+        uint32_t n = 0;
+        for (int w = 0; w < (value_count + 63) / 64; w++) {
+            for (uint64_t bits = matches[w]; bits; bits &= bits - 1) {
+                int v = w * 64 + __builtin_ctzll(bits);
+                indexes[n] = v;
+                memcpy(&values[n * value_size], &page[v * value_size], value_size);
+                n++;
+            }
+        }
+
+        results.values = arena.append(list, sparse_size);
+        results.values_size = sparse_size;
+        results.sparse = true;
+    }
+    else {
+        if (!all_match) {
+            results.matches = reinterpret_cast<const uint64_t*>(arena.append(matches, bitmap_size));
+            if (!results.matches)
+                results.count = 0;
+        }
+
+        if (compressed_size < 4096) {
+            results.values = arena.append(compressed, compressed_size);
+            results.values_size = compressed_size;
+        }
+        else {
+            results.values = arena.append(page, 4096);
+            results.values_size = 4096;
+        }
+    }
+
+    /* The results are dropped if they could not be stored */
+    if (!results.values)
+        results.count = 0;
+
+    return results;
+}
+
+bool loadPage(const PageResults& page, char* out)
+{
+    if (!page.values)
+        return false;
+
+    if (page.sparse) {
+        if (page.count == 0)
+            return false;
+
+        int value_size = (page.values_size / page.count) - sizeof(uint16_t);
+        const uint16_t* indexes = reinterpret_cast<const uint16_t*>(page.values);
+        const char* values = page.values + page.count * sizeof(uint16_t);
+
+        memset(out, 0, 4096);
+        for (uint32_t i = 0; i < page.count; i++)
+            memcpy(&out[indexes[i] * value_size], &values[i * value_size], value_size);
+        return true;
+    }
+
+    if (page.values_size == 4096) {
+        memcpy(out, page.values, 4096);
+        return true;
+    }
+
+    return LZ4_decompress_safe(page.values, out, page.values_size, 4096) == 4096;
+}
+
+void loadMatches(const PageResults& page, int value_count, uint64_t* out)
+{
+    int words = (value_count + 63) / 64;
+
+    if (page.sparse) {
+        memset(out, 0, words * sizeof(uint64_t));
+        const uint16_t* indexes = reinterpret_cast<const uint16_t*>(page.values);
+        for (uint32_t i = 0; i < page.count; i++)
+            out[indexes[i] / 64] |= 1ull << (indexes[i] % 64);
+    }
+    else if (page.matches) {
+        memcpy(out, page.matches, words * sizeof(uint64_t));
+    }
+    else {
+        memset(out, 0xff, words * sizeof(uint64_t));
+        if (value_count % 64)
+            out[words - 1] = (1ull << (value_count % 64)) - 1;
+    }
+}
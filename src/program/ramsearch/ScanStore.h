@@ -0,0 +1,101 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SCANSTORE_H_INCLUDED
+#define LIBTAS_SCANSTORE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+/* Results of a scan inside a single memory page. Only pages with at least
+ * one result are stored. Pages with many results store the whole page with a
+ * bitmap of the matches, and pages with few results only store the index and
+ * the value of each match. */
+struct PageResults {
+    /* Address of the page */
+    uintptr_t addr;
+
+    /* Bitmap of the matching values, one bit per value aligned on its size,
+     * or nullptr if all values of the page match. Not used by sparse pages. */
+    const uint64_t* matches;
+
+    /* Content of the page when it was scanned, compressed with LZ4 unless
+     * values_size is 4096. For sparse pages, the index of each matching
+     * value as uint16_t, followed by the matching values. */
+    const char* values;
+    uint32_t values_size;
+
+    /* Number of matching values */
+    uint32_t count;
+
+    /* Only the matching values are stored */
+    bool sparse;
+};
+
+/* Append-only storage of scan results. Data is stored in anonymous memory
+ * while the memory used by all arenas is below a budget, and then in
+ * memory-mapped files that the system can write back to disk. */
+class ScanArena {
+    public:
+        ScanArena(const std::string& dir, uint64_t budget);
+        ~ScanArena();
+
+        /* Copy data inside the arena, and return its location which stays
+         * valid until the arena is destroyed */
+        const char* append(const void* data, size_t size);
+
+        /* Size of the arena, in anonymous memory and in files */
+        uint64_t memorySize() const {return memory_size;}
+        uint64_t fileSize() const {return file_size;}
+
+        /* Anonymous memory used by all arenas */
+        static std::atomic<uint64_t> memory_used;
+
+    private:
+        struct Chunk {
+            char* addr;
+            size_t used;
+        };
+
+        /* Allocate a new chunk, in memory or in a file */
+        bool newChunk();
+
+        std::string dir;
+        uint64_t budget;
+        std::vector<Chunk> chunks;
+        uint64_t memory_size = 0;
+        uint64_t file_size = 0;
+};
+
+/* Store the matching values of a page, either as a list of the matches or as
+ * the compressed page with its matches bitmap, whichever is smaller.
+ * `matches` is ignored if all `value_count` values match. The returned count
+ * is 0 if the arena could not store the page. */
+PageResults storePage(ScanArena& arena, uintptr_t addr, const char* page, const uint64_t* matches, int value_count, uint32_t count);
+
+/* Restore the stored content of a page into a 4096-byte buffer. For sparse
+ * pages, only the matching values are restored and the rest is zero. */
+bool loadPage(const PageResults& page, char* out);
+
+/* Fill the bitmap of the matching values of a page */
+void loadMatches(const PageResults& page, int value_count, uint64_t* out);
+
+#endif
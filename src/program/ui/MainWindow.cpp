@@ -47,12 +47,14 @@
 #include "AutoSaveWindow.h"
 #include "TimeTraceWindow.h"
 #include "TimeTraceModel.h"
+#include "SavestateStatsWindow.h"
 #include "../movie/MovieFile.h"
 #include "ErrorChecking.h"
 #include "../../shared/version.h"
 #include "../lua/Main.h"
 #include "../utils.h"
 #include "../GameEvents.h"
+#include "../SaveStateList.h"
 
 #include <iostream>
 #include <future>
@@ -106,6 +108,7 @@ MainWindow::MainWindow(Context* c) : QMainWindow(), context(c)
     annotationsWindow = new AnnotationsWindow(c, this);
     autoSaveWindow = new AutoSaveWindow(c, this);
     timeTraceWindow = new TimeTraceWindow(c, this);
+    savestateStatsWindow = new SavestateStatsWindow(c, this);
 
     connect(gameLoop, &GameLoop::inputsToBeChanged, inputEditorWindow->inputEditorView->inputEditorModel, &InputEditorModel::beginModifyInputs);
     connect(gameLoop->gameEvents, &GameEvents::inputsToBeChanged, inputEditorWindow->inputEditorView->inputEditorModel, &InputEditorModel::beginModifyInputs);
@@ -190,6 +193,8 @@ MainWindow::MainWindow(Context* c) : QMainWindow(), context(c)
 
     fpsValues = new QLabel("Current FPS: - / -");
 
+    savestateStats = new QLabel("Savestates: -");
+
     /* Re-record count */
     rerecordCount = new QSpinBox();
     rerecordCount->setReadOnly(true);
@@ -342,6 +347,7 @@ MainWindow::MainWindow(Context* c) : QMainWindow(), context(c)
     generalControlLayout->addWidget(pauseCheck);
     generalControlLayout->addWidget(fastForwardCheck);
     generalControlLayout->addStretch(1);
+    generalControlLayout->addWidget(savestateStats);
 
     generalLayout->addLayout(generalFrameLayout);
     generalLayout->addLayout(generalFpsLayout);
@@ -592,8 +598,37 @@ void MainWindow::createActions()
     disabledActionsOnStart.append(action);
     addActionCheckable(savestateGroup, tr("Backtrack savestate"), SharedConfig::SS_BACKTRACK, tr("Save a state whenether a thread is created/destroyed, so that you can rewind to the earliest time possible"));
     addActionCheckable(savestateGroup, tr("Compressed savestates"), SharedConfig::SS_COMPRESSED);
+    addActionCheckable(savestateGroup, tr("Compress in blocks"), SharedConfig::SS_BLOCKS, tr("Compress stored pages in large blocks for a better ratio and faster loading. Only used with compressed savestates"));
     addActionCheckable(savestateGroup, tr("Skip unmapped pages"), SharedConfig::SS_PRESENT, tr("Shorter savestates, but causes crashes in some games"));
+    action = addActionCheckable(savestateGroup, tr("Share identical pages between savestates"), SharedConfig::SS_DEDUP, tr("Store each distinct memory page only once for all savestates. Pages are not compressed, and this is not used with forked savestates"));
+    disabledActionsOnStart.append(action);
+    action = addActionCheckable(savestateGroup, tr("Load pages on first access"), SharedConfig::SS_LAZY, tr("Loading a state only restores memory pages when the game accesses them. Requires userfaultfd to be allowed (vm.unprivileged_userfaultfd), and is not used with incremental savestates"));
+    disabledActionsOnStart.append(action);
     addActionCheckable(savestateGroup, tr("Fork to save states"), SharedConfig::SS_FORK, tr("Game can resume immediately without waiting for the state to be saved"));
+    action = addActionCheckable(savestateGroup, tr("Write savestates in background"), SharedConfig::SS_ASYNC, tr("States are first copied in memory, and the game resumes while they are written to disk. Not used with savestates in RAM, forked or sharing pages"));
+    disabledActionsOnStart.append(action);
+    addActionCheckable(savestateGroup, tr("Keep savestates in forked processes"), SharedConfig::SS_SNAPSHOT, tr("Each savestate is a paused copy of the game process. Saving is instantaneous and loading only copies the modified memory, but each savestate keeps its own copy of the memory pages that changed since then"));
+
+    savestateThreadsGroup = new QActionGroup(this);
+    addActionCheckable(savestateThreadsGroup, tr("Disabled"), 1);
+    addActionCheckable(savestateThreadsGroup, tr("2 threads"), 2);
+    addActionCheckable(savestateThreadsGroup, tr("4 threads"), 4);
+    addActionCheckable(savestateThreadsGroup, tr("8 threads"), 8);
+
+    savestateSlotsGroup = new QActionGroup(this);
+    addActionCheckable(savestateSlotsGroup, tr("11 slots"), 11);
+    addActionCheckable(savestateSlotsGroup, tr("64 slots"), 64);
+    addActionCheckable(savestateSlotsGroup, tr("256 slots"), 256);
+    addActionCheckable(savestateSlotsGroup, tr("1024 slots"), 1024);
+
+    savestateBudgetGroup = new QActionGroup(this);
+    connect(savestateBudgetGroup, &QActionGroup::triggered, this, &MainWindow::slotSavestateBudget);
+    addActionCheckable(savestateBudgetGroup, tr("Unlimited"), 0);
+    addActionCheckable(savestateBudgetGroup, tr("1 GB"), 1LL << 30);
+    addActionCheckable(savestateBudgetGroup, tr("2 GB"), 2LL << 30);
+    addActionCheckable(savestateBudgetGroup, tr("4 GB"), 4LL << 30);
+    addActionCheckable(savestateBudgetGroup, tr("8 GB"), 8LL << 30);
+    addActionCheckable(savestateBudgetGroup, tr("16 GB"), 16LL << 30);
 
     debugStateGroup = new QActionGroup(this);
     debugStateGroup->setExclusive(false);
@@ -738,6 +773,9 @@ void MainWindow::createMenus()
     action = movieMenu->addAction(tr("Don't enforce movie settings"), this, &MainWindow::slotEnforceMovieSettings);
     action->setCheckable(true);
     action->setToolTip("When checked, settings stored inside the movie metadata won't be enforced (e.g. initial time, mouse/controller support, framerate...). You can then save your movie with the new settings.");
+    movieTextInputsAction = movieMenu->addAction(tr("Save text inputs"), this, &MainWindow::slotMovieTextInputs);
+    movieTextInputsAction->setCheckable(true);
+    movieTextInputsAction->setToolTip("When checked, saved movies also contain the inputs in text format, which can be read by older versions of libTAS and edited by hand. Inputs are always saved in binary format as well, but edited text inputs are read instead. Exported movies always contain text inputs.");
 
     movieMenu->addSeparator();
 
@@ -836,6 +874,22 @@ void MainWindow::createMenus()
     QMenu *savestateMenu = runtimeMenu->addMenu(tr("Savestates"));
     // savestateMenu->setToolTipsVisible(true);
     savestateMenu->addActions(savestateGroup->actions());
+    QMenu *savestateThreadsMenu = savestateMenu->addMenu(tr("Parallel compression"));
+    savestateThreadsMenu->setToolTip(tr("Compress savestates using multiple threads. Not used with forked savestates"));
+    savestateThreadsMenu->installEventFilter(this);
+    disabledWidgetsOnStart.append(savestateThreadsMenu);
+    savestateThreadsMenu->addActions(savestateThreadsGroup->actions());
+
+    QMenu *savestateSlotsMenu = savestateMenu->addMenu(tr("Savestate slots"));
+    savestateSlotsMenu->setToolTip("Number of savestate slots. Slots above 10 can only be accessed from Lua scripts");
+    savestateSlotsMenu->installEventFilter(this);
+    disabledWidgetsOnStart.append(savestateSlotsMenu);
+    savestateSlotsMenu->addActions(savestateSlotsGroup->actions());
+
+    QMenu *savestateBudgetMenu = savestateMenu->addMenu(tr("Memory budget"));
+    savestateBudgetMenu->setToolTip("Maximum memory used by savestates stored in RAM or in forked processes. When exceeded, the least recently used states are removed, unless they were pinned by a Lua script");
+    savestateBudgetMenu->installEventFilter(this);
+    savestateBudgetMenu->addActions(savestateBudgetGroup->actions());
 
     preventSavefileAction = runtimeMenu->addAction(tr("Prevent writing to disk"), this, &MainWindow::slotPreventSavefile);
     preventSavefileAction->setCheckable(true);
@@ -885,6 +939,7 @@ void MainWindow::createMenus()
     debugExcludeMenu->installEventFilter(this);
 
     debugMenu->addAction(tr("Time Trace..."), timeTraceWindow, &TimeTraceWindow::show);
+    debugMenu->addAction(tr("Savestate Statistics..."), savestateStatsWindow, &SavestateStatsWindow::show);
 
     /* Tools Menu */
     QMenu *toolsMenu = menuBar()->addMenu(tr("Tools"));
@@ -909,6 +964,10 @@ void MainWindow::createMenus()
 
     toolsMenu->addAction(tr("Ram Search..."), ramSearchWindow, &RamSearchWindow::show);
     toolsMenu->addAction(tr("Ram Watch..."), ramWatchWindow, &RamWatchWindow::show);
+    memoryShadowAction = toolsMenu->addAction(tr("Shared memory reads"), this, &MainWindow::slotMemoryShadow);
+    memoryShadowAction->setCheckable(true);
+    disabledActionsOnStart.append(memoryShadowAction);
+    memoryShadowAction->setToolTip("When checked, the game shares the memory pages read by ram watches and lua scripts at each frame, so that they are read without system calls");
 
     toolsMenu->addSeparator();
 
@@ -1130,6 +1189,21 @@ void MainWindow::updateUIFrequent()
     /* Update rerecord count */
     rerecordCount->setValue(context->rerecord_count);
 
+    /* Update savestate statistics. The memory used is only known when a
+     * budget is set. */
+    QString savestateSize;
+    if (context->config.sc.savestate_budget > 0)
+        savestateSize = QString("%1 MB, ").arg(SaveStateList::totalSize() / (1024*1024));
+    savestateStats->setText(QString("Savestates: %1 slots, %2%3 loads, %4 misses, %5 evicted")
+        .arg(SaveStateList::count())
+        .arg(savestateSize)
+        .arg(SaveStateList::hitCount())
+        .arg(SaveStateList::missCount())
+        .arg(SaveStateList::evictionCount()));
+
+    if (savestateStatsWindow->isVisible())
+        savestateStatsWindow->refresh();
+
     /* Update fps values */
     if ((context->fps > 0) || (context->lfps > 0)) {
         fpsValues->setText(QString("Current FPS: %1 / %2").arg(context->fps, 0, 'f', 1).arg(context->lfps, 0, 'f', 1));
@@ -1305,6 +1379,8 @@ void MainWindow::updateUIFromConfig()
 
     mouseModeAction->setChecked(context->config.sc.mouse_mode_relative);
     mouseWarpAction->setChecked(context->config.mouse_warp);
+    memoryShadowAction->setChecked(context->config.sc.memory_shadow);
+    movieTextInputsAction->setChecked(context->config.movie_text_inputs);
     mouseGameWarpAction->setChecked(context->config.sc.mouse_prevent_warp);
 
     int screenResValue = (context->config.sc.screen_width << 16) | context->config.sc.screen_height;
@@ -1320,6 +1396,14 @@ void MainWindow::updateUIFromConfig()
     busyloopAction->setChecked(context->config.sc.busyloop_detection);
 
     setRadioFromList(waitGroup, context->config.sc.wait_timeout);
+    setRadioFromList(savestateThreadsGroup, context->config.sc.savestate_threads);
+    setRadioFromList(savestateSlotsGroup, context->config.sc.savestate_slots);
+    for (auto& action : savestateBudgetGroup->actions()) {
+        if (context->config.sc.savestate_budget == action->data().toLongLong()) {
+            action->setChecked(true);
+            break;
+        }
+    }
 
     renderSoftAction->setChecked(context->config.sc.opengl_soft);
     renderPerfAction->setChecked(context->config.sc.opengl_performance);
@@ -1436,6 +1520,9 @@ void MainWindow::slotLaunch(bool attach_gdb)
     }
 
     setListFromRadio(waitGroup, context->config.sc.wait_timeout);
+    setListFromRadio(savestateThreadsGroup, context->config.sc.savestate_threads);
+    setListFromRadio(savestateSlotsGroup, context->config.sc.savestate_slots);
+    slotSavestateBudget();
     setMaskFromCheckboxes(asyncGroup, context->config.sc.async_events);
     setMaskFromCheckboxes(savestateGroup, context->config.sc.savestate_settings);
 
@@ -1574,7 +1661,7 @@ void MainWindow::slotExportMovie()
     if (context->config.sc.recording != SharedConfig::NO_RECORDING) {
         QString filename = QFileDialog::getSaveFileName(this, tr("Choose a movie file"), context->config.moviefile.c_str(), tr("libTAS movie files (*.ltm)"));
         if (!filename.isNull()) {
-            int ret = gameLoop->movie.saveMovie(filename.toStdString());
+            int ret = gameLoop->movie.exportMovie(filename.toStdString());
             if (ret < 0) {
                 QMessageBox::warning(this, "Warning", gameLoop->movie.errorString(ret));
             }
@@ -1724,6 +1811,17 @@ CHECKBOXSLOT(slotLoggingPrint, loggingPrintGroup, context->config.sc.includeFlag
 CHECKBOXSLOT(slotLoggingExclude, loggingExcludeGroup, context->config.sc.excludeFlags)
 CHECKBOXSLOT(slotFastforwardMode, fastforwardGroup, context->config.sc.fastforward_mode)
 
+void MainWindow::slotSavestateBudget()
+{
+    /* Budget values do not fit in an int, so we cannot use setListFromRadio */
+    for (const auto& action : savestateBudgetGroup->actions()) {
+        if (action->isChecked()) {
+            context->config.sc.savestate_budget = action->data().toLongLong();
+            break;
+        }
+    }
+}
+
 void MainWindow::slotSlowdown()
 {
     setListFromRadio(slowdownGroup, context->config.sc.speed_divisor);
@@ -1767,6 +1865,8 @@ BOOLSLOT(slotAutoRestart, context->config.auto_restart)
 BOOLSLOT(slotMouseMode, context->config.sc.mouse_mode_relative)
 BOOLSLOT(slotMouseWarp, context->config.mouse_warp)
 BOOLSLOT(slotMouseGameWarp, context->config.sc.mouse_prevent_warp)
+BOOLSLOT(slotMemoryShadow, context->config.sc.memory_shadow)
+BOOLSLOT(slotMovieTextInputs, context->config.movie_text_inputs)
 
 void MainWindow::slotLuaExecute()
 {
@@ -60,6 +60,7 @@ class OsdWindow;
 class AnnotationsWindow;
 class AutoSaveWindow;
 class TimeTraceWindow;
+class SavestateStatsWindow;
 
 class MainWindow : public QMainWindow
 {
@@ -89,6 +90,7 @@ public:
     AnnotationsWindow* annotationsWindow;
     AutoSaveWindow* autoSaveWindow;
     TimeTraceWindow* timeTraceWindow;
+    SavestateStatsWindow* savestateStatsWindow;
 
     QList<QWidget*> disabledWidgetsOnStart;
     QList<QAction*> disabledActionsOnStart;
@@ -123,6 +125,9 @@ public:
     QAction *recycleThreadsAction;
 
     QActionGroup *savestateGroup;
+    QActionGroup *savestateThreadsGroup;
+    QActionGroup *savestateSlotsGroup;
+    QActionGroup *savestateBudgetGroup;
     QAction *steamAction;
     QActionGroup *waitGroup;
     QActionGroup *asyncGroup;
@@ -142,6 +147,8 @@ public:
     QAction *mouseAction;
     QAction *mouseModeAction;
     QAction *mouseWarpAction;
+    QAction *memoryShadowAction;
+    QAction *movieTextInputsAction;
     QAction *mouseGameWarpAction;
     QActionGroup *joystickGroup;
 
@@ -170,6 +177,7 @@ public:
     QSpinBox *rerecordCount;
     QLabel *currentLength;
     QLabel *movieLength;
+    QLabel *savestateStats;
 
     QSpinBox *initialTimeSec;
     QSpinBox *initialTimeNsec;
@@ -265,6 +273,7 @@ private slots:
     void slotRenderSoft(bool checked);
     void slotRenderPerf(bool checked);
     void slotSavestate();
+    void slotSavestateBudget();
     void slotDebugState();
     void slotLoggingPrint();
     void slotLoggingExclude();
@@ -286,6 +295,8 @@ private slots:
     void slotVariableFramerate(bool checked);
     void slotMouseMode(bool checked);
     void slotMouseWarp(bool checked);
+    void slotMemoryShadow(bool checked);
+    void slotMovieTextInputs(bool checked);
     void slotMouseGameWarp(bool checked);
     void slotLuaExecute();
     void slotLuaReset();
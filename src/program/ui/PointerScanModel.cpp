@@ -19,140 +19,87 @@
 
 #include "PointerScanModel.h"
 #include "../utils.h"
-#include "../ramsearch/MemAccess.h"
-#include "../ramsearch/MemLayout.h"
 #include "../ramsearch/BaseAddresses.h"
-#include <sstream>
-#include <fstream>
+#include "../ramsearch/PointerMap.h"
 #include <iostream>
 #include <memory>
+#include <iterator>
+#include <algorithm>
 
-PointerScanModel::PointerScanModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c) {}
-
-void PointerScanModel::locatePointers()
+PointerScanModel::PointerScanModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c)
 {
-    pointer_map.clear();
-    static_pointer_map.clear();
-
-    std::unique_ptr<MemLayout> memlayout (new MemLayout(context->game_pid));
-    
-    std::vector<MemSection> memory_sections;
-    file_mapping_sections.clear();
-
-    int type_flag = (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemHeap | MemSection::MemAnonymousMappingRW | MemSection::MemFileMappingRW | MemSection::MemStack);
-    uint64_t total_size = memlayout->totalSize(type_flag, 0);
-    
-    MemSection section;
-    while (memlayout->nextSection(type_flag, 0, section)) {
-        /* Only store sections that could contain pointers */
-        memory_sections.push_back(section);
-        
-        /* Keep the file mapping to access to the file and offsets */
-        if (section.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemFileMappingRW | MemSection::MemStack)) {
-            file_mapping_sections.push_back(section);
-        }
-    }
-
-    /* Read all memory and store all pointers */
-    int cur_size = 0;
-    for (const MemSection &section : memory_sections) {
-
-        for (uintptr_t addr = section.addr; addr < section.endaddr; addr += 4096) {
-
-            /* Read values in chunks of 4096 bytes so we lower the number of calls. */
-            uintptr_t chunk[4096/sizeof(uintptr_t)];
-            int readValues = MemAccess::read(chunk, reinterpret_cast<void*>(addr), 4096);
-            if (readValues < 0) {
-                continue;
-            }
-
-            /* Update progress bar */
-            emit signalProgress((int)(100 * ((float)cur_size / total_size)));
-
-            for (unsigned int i = 0; i < readValues/sizeof(uintptr_t); i++, cur_size += sizeof(uintptr_t)) {
-                /* Check if the value could be a pointer */
-                bool isPointer = false;
-
-                for (const MemSection &ms : memory_sections) {
-                    /* If pointing to a static section, we can skip it */
-                    if (ms.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemStack)) {
-                        continue;
-                    }
-
-                    /* We take advantage of the fact that sections are ordered */
-                    if (chunk[i] < ms.addr) {
-                        break;
-                    }
-                    if (chunk[i] < ms.endaddr) {
-                        isPointer = true;
-                        break;
-                    }
-                }
-
-                if (isPointer) {
-                    uintptr_t stored_addr = addr + i*sizeof(uintptr_t);
-                    if (section.type & (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemStack)) {
-                        static_pointer_map.insert(std::make_pair(chunk[i], stored_addr));
-                    }
-                    else {
-                        pointer_map.insert(std::make_pair(chunk[i], stored_addr));
-                    }
-                }
-            }
-        }
-    }
+    pollTimer = new QTimer(this);
+    connect(pollTimer, &QTimer::timeout, this, &PointerScanModel::pollScanner);
 }
 
 void PointerScanModel::findPointerChain(uintptr_t addr, int ml, int max_offset)
 {
     static uint64_t last_scan_frame = 1 << 30;
-    /* Don't locate pointers again if this is the same frame */
-    if (last_scan_frame != context->framecount) {
-        locatePointers();
-        last_scan_frame = context->framecount;
-    }
 
     beginResetModel();
-
     max_level = ml;
+    last_addr = addr;
     pointer_chains.clear();
-    int offsets[10];
-
-    // std::cout << "max offset " << max_offset << std::endl;
+    endResetModel();
 
-    recursiveFind(addr, 0, offsets, max_offset);
+    /* Don't locate pointers again if this is the same frame */
+    scanner.start(context->game_pid, last_scan_frame != context->framecount, addr, ml, max_offset);
+    last_scan_frame = context->framecount;
 
-    endResetModel();
+    scanning = true;
+    pollTimer->start(100);
 }
 
-void PointerScanModel::recursiveFind(uintptr_t addr, int level, int offsets[], int max_offset)
+void PointerScanModel::pollScanner()
 {
-    /* Search inside static data */
-    auto iter = static_pointer_map.lower_bound(addr - max_offset);
-    while ((iter != static_pointer_map.end()) && (iter->first <= addr)) {
-        offsets[level] = addr - iter->first;
-        uintptr_t base_address = iter->second;
-        // std::cout << "Found static chain with last offset " << std::dec << offsets[level] << " and base address " << std::hex << base_address << std::endl;
-        std::vector<int> offset_vec(offsets, offsets + level + 1);
-        pointer_chains.push_back(std::make_pair(base_address,offset_vec));
-        iter++;
+    bool finished = scanner.wait(0);
+
+    /* Insert chains as they are found, and update the progress bar */
+    std::vector<PointerScanner::Chain> chains;
+    scanner.collect(chains);
+    if (!chains.empty()) {
+        beginInsertRows(QModelIndex(), pointer_chains.size(), pointer_chains.size() + chains.size() - 1);
+        std::move(chains.begin(), chains.end(), std::back_inserter(pointer_chains));
+        endInsertRows();
     }
 
-    /* Stop if we reached the last level */
-    if (level == (max_level-1))
-        return;
-
-    /* Search inside dynamic data */
-    iter = pointer_map.lower_bound(addr - max_offset);
-    while ((iter != pointer_map.end()) && (iter->first <= addr)) {
-        offsets[level] = addr - iter->first;
-        uintptr_t base_address = iter->second;
-        // std::cout << "Found chain with offset " << std::dec << offsets[level] << " and base address " << std::hex << base_address << std::endl;
-        recursiveFind(base_address, level+1, offsets, max_offset);
-        iter++;
+    emit signalProgress(scanner.progress);
+
+    if (finished) {
+        pollTimer->stop();
+        scanning = false;
+        emit signalFinished();
     }
 }
 
+void PointerScanModel::rescan(uintptr_t addr)
+{
+    beginResetModel();
+    scanner.filter_chains(pointer_chains, addr);
+    endResetModel();
+}
+
+bool PointerScanModel::saveMap(const std::string& path)
+{
+    if (scanner.pointers.empty())
+        return false;
+
+    return PointerMap::save(path, scanner, last_addr);
+}
+
+bool PointerScanModel::filterWithMap(const std::string& path)
+{
+    PointerMap map;
+    if (!map.load(path))
+        return false;
+
+    beginResetModel();
+    pointer_chains.erase(std::remove_if(pointer_chains.begin(), pointer_chains.end(),
+        [&map](const PointerScanner::Chain& chain) {return !map.validate(chain);}), pointer_chains.end());
+    endResetModel();
+    return true;
+}
+
 int PointerScanModel::rowCount(const QModelIndex & /*parent*/) const
 {
     return pointer_chains.size();
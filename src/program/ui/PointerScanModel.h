@@ -21,15 +21,14 @@
 #define LIBTAS_POINTERSCANMODEL_H_INCLUDED
 
 #include <QtCore/QAbstractTableModel>
+#include <QtCore/QTimer>
 #include <vector>
-#include <map>
-// #include <pair>
 #include <memory>
 #include <sys/types.h>
 #include <stdint.h>
 
 #include "../Context.h"
-#include "../ramsearch/MemSection.h"
+#include "../ramsearch/PointerScanner.h"
 
 class PointerScanModel : public QAbstractTableModel {
     Q_OBJECT
@@ -37,35 +36,44 @@ class PointerScanModel : public QAbstractTableModel {
 public:
     PointerScanModel(Context* c, QObject *parent = Q_NULLPTR);
 
-    /* Map of pointers (key) and addresses (value) */
-    std::multimap<uintptr_t,uintptr_t> pointer_map;
-
-    /* Map of pointers (key) and addresses (value) that are in a static area */
-    std::multimap<uintptr_t,uintptr_t> static_pointer_map;
+    /* Pointers of the game memory and search of pointer chains */
+    PointerScanner scanner;
 
     /* Results of pointer scan */
-    std::vector<std::pair<uintptr_t, std::vector<int>>> pointer_chains;
+    std::vector<PointerScanner::Chain> pointer_chains;
 
     /* Max size of pointer chain */
     int max_level = 5;
 
-    /* Store all pointers from the game memory into a map */
-    void locatePointers();
-
-    /* Find all chains of pointers that start from a static address and
-     * end with the specified address, in maximum `ml` levels and with a maximum
-     * offset of `max_offset`
+    /* Start the search of all chains of pointers that start from a static
+     * address and end with the specified address, in maximum `ml` levels and
+     * with a maximum offset of `max_offset`. Chains are added to the model as
+     * they are found, and signalFinished() is emitted at the end.
      */
     void findPointerChain(uintptr_t addr, int ml, int max_offset);
 
+    /* Is a search running */
+    bool scanning = false;
+
+    /* Keep only the chains that lead to `addr` in the current memory */
+    void rescan(uintptr_t addr);
+
+    /* Save the pointers located by the last search into a snapshot file */
+    bool saveMap(const std::string& path);
+
+    /* Keep only the chains that are also valid in a snapshot file */
+    bool filterWithMap(const std::string& path);
+
 private:
     Context *context;
 
-    /* File mapping sections */
-    std::vector<MemSection> file_mapping_sections;
+    /* Address of the last search */
+    uintptr_t last_addr = 0;
+
+    /* Timer to collect the chains found by the running search */
+    QTimer* pollTimer;
 
-    /* Recursive call for the pointer chain search */
-    void recursiveFind(uintptr_t addr, int level, int offsets[], int max_offset);
+    void pollScanner();
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
@@ -77,6 +85,7 @@ private:
 
 signals:
     void signalProgress(int);
+    void signalFinished();
 
 };
 
@@ -26,6 +26,7 @@
 #include <QtWidgets/QFormLayout>
 #include <QtWidgets/QHeaderView>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QFileDialog>
 
 #include "PointerScanWindow.h"
 #include "PointerScanModel.h"
@@ -61,7 +62,8 @@ PointerScanWindow::PointerScanWindow(Context* c, QWidget *parent) : QDialog(pare
     /* Progress bar */
     searchProgress = new QProgressBar();
     searchProgress->setRange(0, 100);
-    connect(pointerScanModel, &PointerScanModel::signalProgress, searchProgress, &QProgressBar::setValue);
+    connect(pointerScanModel, &PointerScanModel::signalProgress, this, &PointerScanWindow::slotProgress);
+    connect(pointerScanModel, &PointerScanModel::signalFinished, this, &PointerScanWindow::slotSearchFinished);
 
     scanCount = new QLabel();
     searchProgress->hide();
@@ -87,14 +89,29 @@ PointerScanWindow::PointerScanWindow(Context* c, QWidget *parent) : QDialog(pare
     formLayout->addRow(new QLabel(tr("Max offset:")), maxOffsetInput);
 
     /* Buttons */
-    QPushButton *searchButton = new QPushButton(tr("Search"));
+    searchButton = new QPushButton(tr("Search"));
     connect(searchButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotSearch);
 
+    rescanButton = new QPushButton(tr("Rescan"));
+    rescanButton->setToolTip(tr("Keep the results that lead to the address in the current memory"));
+    connect(rescanButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotRescan);
+
+    saveMapButton = new QPushButton(tr("Save Map..."));
+    saveMapButton->setToolTip(tr("Save all pointers of the last search, to filter results of another execution"));
+    connect(saveMapButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotSaveMap);
+
+    filterMapButton = new QPushButton(tr("Filter with Maps..."));
+    filterMapButton->setToolTip(tr("Keep the results that are also valid in saved pointer maps"));
+    connect(filterMapButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotFilterMap);
+
     QPushButton *addButton = new QPushButton(tr("Add Watch"));
     connect(addButton, &QAbstractButton::clicked, this, &PointerScanWindow::slotAdd);
 
-    QDialogButtonBox *buttonBox = new QDialogButtonBox();
+    QDialogButtonBox *buttonBox = new QDialogButtonBox(Qt::Vertical);
     buttonBox->addButton(searchButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(rescanButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(saveMapButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(filterMapButton, QDialogButtonBox::ActionRole);
     buttonBox->addButton(addButton, QDialogButtonBox::ActionRole);
 
     /* Create the options layout */
@@ -116,26 +133,87 @@ void PointerScanWindow::slotSearch()
     bool ok;
     uintptr_t addr = addressInput->text().toULong(&ok, 16);
 
-    if (!ok)
+    if (!ok || pointerScanModel->scanning)
         return;
 
     int max_level = maxLevelInput->value();
     int max_offset = maxOffsetInput->value();
 
+    /* Results can't be modified until the search is finished */
+    setButtonsEnabled(false);
     scanCount->hide();
     searchProgress->show();
 
     pointerScanModel->findPointerChain(addr, max_level, max_offset);
+}
 
+void PointerScanWindow::slotSearchFinished()
+{
     /* Update address count */
     searchProgress->hide();
     scanCount->show();
-    scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
+    if (pointerScanModel->scanner.truncated)
+        scanCount->setText(QString("%1 results (search was limited to %2 addresses per level)").arg(pointerScanModel->pointer_chains.size()).arg(PointerScanner::MAX_FRONTIER));
+    else
+        scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
 
     /* Sort results */
-    for (int c=max_level; c>=0; c--) {
+    for (int c=pointerScanModel->max_level; c>=0; c--) {
         pointerScanView->sortByColumn(c, Qt::AscendingOrder);
     }
+
+    setButtonsEnabled(true);
+}
+
+void PointerScanWindow::setButtonsEnabled(bool enabled)
+{
+    searchButton->setEnabled(enabled);
+    rescanButton->setEnabled(enabled);
+    saveMapButton->setEnabled(enabled);
+    filterMapButton->setEnabled(enabled);
+}
+
+void PointerScanWindow::slotRescan()
+{
+    bool ok;
+    uintptr_t addr = addressInput->text().toULong(&ok, 16);
+
+    if (!ok || pointerScanModel->scanning)
+        return;
+
+    pointerScanModel->rescan(addr);
+    scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
+}
+
+void PointerScanWindow::slotSaveMap()
+{
+    QString defaultPath = QString(context->config.ramsearchdir.c_str()) + "/" + context->gamename.c_str() + ".ptrmap";
+    QString filename = QFileDialog::getSaveFileName(this, tr("Save pointer map"), defaultPath, tr("Pointer maps (*.ptrmap)"));
+    if (filename.isNull())
+        return;
+
+    if (!pointerScanModel->saveMap(filename.toStdString())) {
+        QMessageBox::critical(nullptr, "Error", QString("Could not save the pointer map. A search must be done first."));
+    }
+}
+
+void PointerScanWindow::slotFilterMap()
+{
+    QStringList filenames = QFileDialog::getOpenFileNames(this, tr("Filter with pointer maps"), context->config.ramsearchdir.c_str(), tr("Pointer maps (*.ptrmap)"));
+
+    for (const QString& filename : filenames) {
+        if (!pointerScanModel->filterWithMap(filename.toStdString())) {
+            QMessageBox::critical(nullptr, "Error", QString("Could not load the pointer map %1").arg(filename));
+            break;
+        }
+    }
+
+    scanCount->setText(QString("%1 results").arg(pointerScanModel->pointer_chains.size()));
+}
+
+void PointerScanWindow::slotProgress(int value)
+{
+    searchProgress->setValue(value);
 }
 
 void PointerScanWindow::slotAdd()
@@ -28,6 +28,7 @@
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QProgressBar>
 #include <QtWidgets/QLabel>
+#include <QtWidgets/QPushButton>
 #include <QtCore/QSortFilterProxyModel>
 #include <memory>
 
@@ -54,8 +55,21 @@ private:
     QSpinBox *maxLevelInput;
     QSpinBox *maxOffsetInput;
 
+    QPushButton *searchButton;
+    QPushButton *rescanButton;
+    QPushButton *saveMapButton;
+    QPushButton *filterMapButton;
+
+    /* Enable the buttons that use the results, when no search is running */
+    void setButtonsEnabled(bool enabled);
+
 private slots:
+    void slotProgress(int value);
     void slotSearch();
+    void slotSearchFinished();
+    void slotRescan();
+    void slotSaveMap();
+    void slotFilterMap();
     void slotAdd();
 
 };
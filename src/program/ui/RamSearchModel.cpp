@@ -23,12 +23,25 @@
 
 #include <QtWidgets/QMessageBox>
 #include <memory>
+#include <climits>
+#include <chrono>
+#include <future>
 
 RamSearchModel::RamSearchModel(Context* c, QObject *parent) : QAbstractTableModel(parent), context(c) {}
 
+RamSearchModel::~RamSearchModel()
+{
+    if (scan_thread.joinable()) {
+        memscanner.cancel();
+        scan_thread.join();
+    }
+}
+
 int RamSearchModel::rowCount(const QModelIndex & /*parent*/) const
 {
-   return memscanner.display_scan_count();
+    /* Views can't show more rows than an int can hold */
+    uint64_t count = memscanner.scan_count();
+    return (count > INT_MAX) ? INT_MAX : count;
 }
 
 int RamSearchModel::columnCount(const QModelIndex & /*parent*/) const
@@ -60,9 +73,9 @@ QVariant RamSearchModel::data(const QModelIndex &index, int role) const
             case 0:
                 return QString("%1").arg(memscanner.get_address(index.row()), 0, 16);
             case 1:
-                return QString(memscanner.get_current_value(index.row(), hex));
+                return QString::fromStdString(memscanner.get_current_value(index.row(), hex));
             case 2:
-                return QString(memscanner.get_previous_value(index.row(), hex));
+                return QString::fromStdString(memscanner.get_previous_value(index.row(), hex));
             default:
                 return QString();
         }
@@ -93,24 +106,86 @@ void RamSearchModel::newWatches(int mem_flags, int type, CompareType ct, Compare
     compare_value = cv;
     different_value = dv;
 
-    beginResetModel();
-
-    memscanner.first_scan(context->game_pid, mem_flags, type, ct, co, cv, dv);
-
-    endResetModel();
+    memscanner.memory_budget = static_cast<uint64_t>(context->config.ramsearch_memory_budget) * 1024 * 1024;
+    memscanner.stop_requested = false;
+
+    pid_t pid = context->game_pid;
+    bool soft_dirty = softDirtyAvailable();
+    scan_thread = std::thread([=]() {
+        /* The bits must be cleared before the memory is read, so that any
+         * later write is seen by the next scan */
+        uint64_t epoch = soft_dirty ? clearSoftDirty() : 0;
+        int error = memscanner.first_scan(pid, mem_flags, type, ct, co, cv, dv);
+        soft_dirty_search_epoch = (error == 0) ? epoch : 0;
+        emit signalScanFinished(error);
+    });
 }
 
 void RamSearchModel::searchWatches(CompareType ct, CompareOperator co, double cv, double dv)
 {
+    memscanner.stop_requested = false;
+
+    bool soft_dirty = softDirtyAvailable();
+    scan_thread = std::thread([=]() {
+        /* Pages untouched since the bits were cleared don't need to be read,
+         * as long as no savestate was saved or loaded in between. The bits
+         * are not cleared again, so they keep every write since the stored
+         * values were read. Otherwise, clear them before reading. */
+        memscanner.dirty_only = soft_dirty && (soft_dirty_search_epoch != 0) &&
+            (soft_dirty_search_epoch == context->soft_dirty_epoch);
+        uint64_t epoch = 0;
+        if (soft_dirty)
+            epoch = memscanner.dirty_only ? soft_dirty_search_epoch : clearSoftDirty();
+
+        int error = memscanner.scan(false, ct, co, cv, dv);
+        memscanner.dirty_only = false;
+
+        /* Kept results were read before a new clear */
+        if (error == 0)
+            soft_dirty_search_epoch = epoch;
+        else if (epoch != soft_dirty_search_epoch)
+            soft_dirty_search_epoch = 0;
+        emit signalScanFinished(error);
+    });
+}
+
+int RamSearchModel::finishScan(int error)
+{
+    scan_thread.join();
+
     beginResetModel();
 
-    memscanner.scan(false, ct, co, cv, dv);
+    if (error == 0)
+        memscanner.commit_scan();
 
     endResetModel();
+    return error;
+}
+
+bool RamSearchModel::softDirtyAvailable()
+{
+    /* Incremental savestates rely on the same bits */
+    return context->config.ramsearch_soft_dirty && context->is_soft_dirty &&
+        !(context->config.sc.savestate_settings & SharedConfig::SS_INCREMENTAL);
+}
+
+uint64_t RamSearchModel::clearSoftDirty()
+{
+    /* The bits are cleared by the main thread between two frames. Don't
+     * wait forever if the game does not reach a frame boundary. */
+    auto request = std::make_shared<std::promise<uint64_t>>();
+    std::future<uint64_t> epoch = request->get_future();
+    context->soft_dirty_clear_queue.push(request);
+
+    if (epoch.wait_for(std::chrono::seconds(1)) != std::future_status::ready)
+        return 0;
+    return epoch.get();
 }
 
 void RamSearchModel::update()
 {
+    /* Only the visible rows will read their values again */
+    memscanner.invalidate_current_values();
     if (rowCount() > 0)
         emit dataChanged(index(0,1), index(rowCount()-1,1), QVector<int>(Qt::DisplayRole));
 }
@@ -124,5 +199,6 @@ void RamSearchModel::clear()
 {
     beginResetModel();
     memscanner.clear();
+    soft_dirty_search_epoch = 0;
     endResetModel();
 }
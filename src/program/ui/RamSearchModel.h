@@ -23,6 +23,7 @@
 #include <QtCore/QAbstractTableModel>
 #include <vector>
 #include <memory>
+#include <thread>
 #include <sys/types.h>
 #include <sstream>
 #include <fstream>
@@ -37,6 +38,7 @@ class RamSearchModel : public QAbstractTableModel {
 
 public:
     RamSearchModel(Context* c, QObject *parent = Q_NULLPTR);
+    ~RamSearchModel();
 
     void update();
 
@@ -53,6 +55,8 @@ public:
     double compare_value;
     double different_value;
 
+    /* New scan and next scans. The scan runs in a separate thread, and
+     * signalScanFinished() is emitted when it is done */
     void newWatches(int mem_flags, int type, CompareType ct, CompareOperator co, double cv, double dv);
 
     /* Precompute the size of the next scan (for progress bar) */
@@ -66,6 +70,10 @@ public:
     
     void searchWatches(CompareType ct, CompareOperator co, double cv, double dv);
 
+    /* Show the results of the scan that just finished, if it succeeded.
+     * Returns 0 or a MemScanner error code */
+    int finishScan(int error);
+
     /* Return the address of the given row, used to fill ramwatch */
     uintptr_t address(int row);
     
@@ -75,6 +83,22 @@ public:
 private:
     Context *context;
 
+    /* Thread running the current scan */
+    std::thread scan_thread;
+
+    /* Value of soft_dirty_epoch when the soft-dirty bits were cleared
+     * before reading the current results, or 0. Pages that were not written
+     * since can be skipped if both values are equal */
+    uint64_t soft_dirty_search_epoch = 0;
+
+    /* Returns if the soft-dirty bits of the game can be used by the ram
+     * search */
+    bool softDirtyAvailable();
+
+    /* Clear the soft-dirty bits of the game from the scan thread, and wait
+     * for it. Returns the new soft-dirty epoch, or 0 if not cleared */
+    uint64_t clearSoftDirty();
+
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
@@ -82,6 +106,10 @@ private:
     QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
 
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+signals:
+    /* Emitted from the scan thread when the scan is done */
+    void signalScanFinished(int error);
 };
 
 #endif
@@ -33,6 +33,7 @@
 #include "../ramsearch/CompareOperations.h"
 
 #include <limits>
+#include <climits>
 
 RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent) : QDialog(parent), context(c)
 {
@@ -47,21 +48,31 @@ RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent) : QDialog(parent),
     ramSearchView->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
     ramSearchView->horizontalHeader()->setHighlightSections(false);
     ramSearchView->verticalHeader()->hide();
+    ramSearchView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
 
     ramSearchModel = new RamSearchModel(context);
     ramSearchView->setModel(ramSearchModel);
 
     /* Progress bar */
     searchProgress = new QProgressBar();
-    connect(&ramSearchModel->memscanner, &MemScanner::signalProgress, searchProgress, &QProgressBar::setValue);
+    connect(&ramSearchModel->memscanner, &MemScanner::signalProgress, this, &RamSearchWindow::slotProgress, Qt::QueuedConnection);
+    connect(ramSearchModel, &RamSearchModel::signalScanFinished, this, &RamSearchWindow::slotScanFinished, Qt::QueuedConnection);
+
+    cancelButton = new QPushButton(tr("Cancel"));
+    connect(cancelButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotCancel);
 
     watchCount = new QLabel();
     // watchCount->setHeight(searchProgress->height());
     searchProgress->hide();
+    cancelButton->hide();
+
+    QHBoxLayout *progressLayout = new QHBoxLayout;
+    progressLayout->addWidget(searchProgress, 1);
+    progressLayout->addWidget(cancelButton);
 
     QVBoxLayout *watchLayout = new QVBoxLayout;
     watchLayout->addWidget(ramSearchView);
-    watchLayout->addWidget(searchProgress);
+    watchLayout->addLayout(progressLayout);
     watchLayout->addWidget(watchCount);
 
     /* Memory regions */
@@ -79,6 +90,12 @@ RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent) : QDialog(parent),
     memLayout->addWidget(memExecBox);
     memGroupBox->setLayout(memLayout);
 
+    softDirtyBox = new QCheckBox("Only read modified pages");
+    softDirtyBox->setToolTip("Next searches only read the memory pages that were modified since the previous search, when the game does not save or load states in between");
+    softDirtyBox->setChecked(context->config.ramsearch_soft_dirty);
+    softDirtyBox->setEnabled(context->is_soft_dirty);
+    connect(softDirtyBox, &QCheckBox::toggled, [this](bool checked){context->config.ramsearch_soft_dirty = checked;});
+
     /* Comparisons */
     comparePreviousButton = new QRadioButton("Unknown/Previous Value");
     comparePreviousButton->setChecked(true);
@@ -156,6 +173,7 @@ RamSearchWindow::RamSearchWindow(Context* c, QWidget *parent) : QDialog(parent),
     /* Create the options layout */
     QVBoxLayout *optionLayout = new QVBoxLayout;
     optionLayout->addWidget(memGroupBox);
+    optionLayout->addWidget(softDirtyBox);
     optionLayout->addWidget(compareGroupBox);
     optionLayout->addWidget(operatorGroupBox);
     optionLayout->addWidget(formatGroupBox);
@@ -195,6 +213,17 @@ void RamSearchWindow::update()
     ramSearchModel->update();
 }
 
+void RamSearchWindow::slotProgress(int value)
+{
+    searchProgress->setValue(value);
+}
+
+void RamSearchWindow::slotCancel()
+{
+    cancelButton->setDisabled(true);
+    ramSearchModel->memscanner.cancel();
+}
+
 void RamSearchWindow::getCompareParameters(CompareType& compare_type, CompareOperator& compare_operator, double& compare_value, double& different_value)
 {
     compare_type = CompareType::Previous;
@@ -259,34 +288,14 @@ void RamSearchWindow::slotNew()
 
     watchCount->hide();
     searchProgress->show();
+    cancelButton->setDisabled(false);
+    cancelButton->show();
     searchProgress->setMaximum(ramSearchModel->predictScanCount(memflags));
 
-    /* Call the RamSearch new function using the right type */
+    /* Call the RamSearch new function using the right type. Buttons are
+     * enabled again when the scan is finished. */
+    newScan = true;
     ramSearchModel->newWatches(memflags, typeBox->currentIndex(), compare_type, compare_operator, compare_value, different_value);
-
-    searchProgress->hide();
-    watchCount->show();
-
-    /* Don't display values if too many results */
-    if ((ramSearchModel->memscanner.display_scan_count() == 0) && (ramSearchModel->scanCount() != 0))
-        watchCount->setText(QString("%1 addresses (results are not shown above %2)").arg(ramSearchModel->scanCount()).arg(ramSearchModel->memscanner.DISPLAY_THRESHOLD));
-    else
-        watchCount->setText(QString("%1 addresses").arg(ramSearchModel->scanCount()));
-        
-    /* Change the button to "Stop" and disable some boxes */
-    if (ramSearchModel->scanCount() != 0) {
-        newButton->setText(tr("Stop"));
-        memGroupBox->setDisabled(true);
-        formatGroupBox->setDisabled(true);
-    }
-    else {
-        newButton->setText(tr("New"));
-        memGroupBox->setDisabled(false);
-        formatGroupBox->setDisabled(false);
-    }
-    
-    newButton->setDisabled(false);
-    searchButton->setDisabled(false);
 }
 
 void RamSearchWindow::slotSearch()
@@ -304,26 +313,48 @@ void RamSearchWindow::slotSearch()
     searchProgress->setMaximum(ramSearchModel->scanSize());
     watchCount->hide();
     searchProgress->show();
+    cancelButton->setDisabled(false);
+    cancelButton->show();
 
+    newScan = false;
     ramSearchModel->searchWatches(compare_type, compare_operator, compare_value, different_value);
+}
+
+void RamSearchWindow::slotScanFinished(int error)
+{
+    error = ramSearchModel->finishScan(error);
+    if (error == MemScanner::ESTOREFAILED) {
+        if (newScan)
+            QMessageBox::critical(nullptr, "Error", QString("Could not store the search results. Check the free space of the ram search directory, or exclude more memory regions"));
+        else
+            QMessageBox::critical(nullptr, "Error", QString("Could not store the search results. Check the free space of the ram search directory. The previous results were kept"));
+    }
 
     /* Update address count */
     searchProgress->hide();
+    cancelButton->hide();
     watchCount->show();
-    
-    /* Don't display values if too many results */
-    if ((ramSearchModel->memscanner.display_scan_count() == 0) && (ramSearchModel->scanCount() != 0))
-        watchCount->setText(QString("%1 addresses (results are not shown above %2)").arg(ramSearchModel->scanCount()).arg(ramSearchModel->memscanner.DISPLAY_THRESHOLD));
+
+    /* The view can't show more rows than an int can hold */
+    if (ramSearchModel->scanCount() > INT_MAX)
+        watchCount->setText(QString("%1 addresses (only the first %2 are shown)").arg(ramSearchModel->scanCount()).arg(INT_MAX));
     else
         watchCount->setText(QString("%1 addresses").arg(ramSearchModel->scanCount()));
+    watchCount->setToolTip(QString("Results use %1 KB").arg(ramSearchModel->memscanner.store_size() / 1024));
 
-    /* Change the button to "New" if no results */
-    if (ramSearchModel->scanCount() == 0) {
+    /* Change the button to "Stop" and disable some boxes if there are
+     * results, or back to "New" otherwise */
+    if (ramSearchModel->scanCount() != 0) {
+        newButton->setText(tr("Stop"));
+        memGroupBox->setDisabled(true);
+        formatGroupBox->setDisabled(true);
+    }
+    else {
         newButton->setText(tr("New"));
         memGroupBox->setDisabled(false);
         formatGroupBox->setDisabled(false);
     }
-    
+
     newButton->setDisabled(false);
     searchButton->setDisabled(false);
 }
@@ -53,12 +53,14 @@ private:
 
     RamSearchModel *ramSearchModel;
     QProgressBar *searchProgress;
+    QPushButton *cancelButton;
     QLabel *watchCount;
 
     QGroupBox *memGroupBox;
     QCheckBox *memSpecialBox;
     QCheckBox *memROBox;
     QCheckBox *memExecBox;
+    QCheckBox *softDirtyBox;
 
     QRadioButton *comparePreviousButton;
     QRadioButton *compareValueButton;
@@ -79,6 +81,9 @@ private:
 
     QPushButton *newButton;
     QPushButton *searchButton;
+
+    /* If the running scan is a new scan */
+    bool newScan;
     
     /* Timer to limit the number of update calls */
     QElapsedTimer* updateTimer;
@@ -92,6 +97,9 @@ private slots:
     void slotNew();
     void slotSearch();
     void slotAdd();
+    void slotProgress(int value);
+    void slotCancel();
+    void slotScanFinished(int error);
 
 };
 
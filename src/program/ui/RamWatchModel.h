@@ -26,6 +26,7 @@
 #include <memory>
 
 #include "../ramsearch/IRamWatchDetailed.h"
+#include "../ramsearch/RamWatchEngine.h"
 
 class RamWatchModel : public QAbstractTableModel {
     Q_OBJECT
@@ -36,6 +37,9 @@ public:
     /* A reference to the vector of addresses to watch */
     std::vector<std::unique_ptr<IRamWatchDetailed>> ramwatches;
 
+    /* Evaluation of all watches for the on-screen display */
+    RamWatchEngine engine;
+
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
@@ -104,22 +104,9 @@ void RamWatchWindow::slotAdd()
     }
 }
 
-void RamWatchWindow::slotGet(std::string &watch)
+void RamWatchWindow::slotGet(std::string &watches)
 {
-    static unsigned int index = 0;
-
-    if (index >= ramWatchModel->ramwatches.size()) {
-        /* We sent all watches, returning NULL */
-        watch = "";
-        index = 0;
-        return;
-    }
-
-    watch = ramWatchModel->ramwatches[index]->label;
-    watch += ": ";
-    watch += ramWatchModel->ramwatches[index]->value_str();
-
-    index++;
+    ramWatchModel->engine.evaluate(ramWatchModel->ramwatches, watches);
 }
 
 void RamWatchWindow::slotEdit()
@@ -47,7 +47,7 @@ private:
 
 public slots:
     void slotAdd();
-    void slotGet(std::string &watch);
+    void slotGet(std::string &watches);
 
 private slots:
     void slotEdit();
@@ -0,0 +1,278 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QDialogButtonBox>
+#include <QtWidgets/QVBoxLayout>
+#include <QtWidgets/QHeaderView>
+#include <QtWidgets/QFileDialog>
+#include <QtWidgets/QMessageBox>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+
+#include "SavestateStatsWindow.h"
+#include "../SaveStateList.h"
+
+/* Columns of the table and of the exported files */
+static const char* columnNames[] = {
+    "address", "size", "name", "pages", "present", "dirty", "skipped", "zero",
+    "full", "compressed", "base", "shared", "bytes", "ratio", "scan_ms",
+    "compress_ms", "io_ms"
+};
+static const int columnCount = sizeof(columnNames) / sizeof(columnNames[0]);
+
+/* Ratio between the size of the saved pages and the bytes that were written
+ * or read for them, or 0 if nothing was saved */
+static double compressionRatio(const SavestateAreaStats& area)
+{
+    if (area.bytes == 0)
+        return 0;
+    return static_cast<double>(area.pages_dirty * 4096) / area.bytes;
+}
+
+static double toMs(uint64_t ns)
+{
+    return ns / 1000000.0;
+}
+
+/* Value of a column for an area, as a string for the table and csv file */
+static QString columnValue(const SavestateAreaStats& area, int column)
+{
+    switch (column) {
+        case 0: return QString("%1").arg(area.addr, 0, 16);
+        case 1: return QString::number(area.size);
+        case 2: return QString(area.name);
+        case 3: return QString::number(area.pages);
+        case 4: return QString::number(area.pages_present);
+        case 5: return QString::number(area.pages_dirty);
+        case 6: return QString::number(area.pages_skipped);
+        case 7: return QString::number(area.pages_zero);
+        case 8: return QString::number(area.pages_full);
+        case 9: return QString::number(area.pages_compressed);
+        case 10: return QString::number(area.pages_base);
+        case 11: return QString::number(area.pages_shared);
+        case 12: return QString::number(area.bytes);
+        case 13: return QString::number(compressionRatio(area), 'f', 2);
+        case 14: return QString::number(toMs(area.scan_ns), 'f', 3);
+        case 15: return QString::number(toMs(area.compress_ns), 'f', 3);
+        case 16: return QString::number(toMs(area.io_ns), 'f', 3);
+    }
+    return QString();
+}
+
+SavestateStatsWindow::SavestateStatsWindow(Context* c, QWidget *parent) : QDialog(parent), context(c)
+{
+    setWindowTitle("Savestate Statistics");
+
+    summaryLabel = new QLabel(tr("No savestate was saved or loaded while this window was open"));
+
+    /* Table */
+    areaTable = new QTableWidget(0, columnCount, this);
+    QStringList headers;
+    for (int i = 0; i < columnCount; i++)
+        headers << columnNames[i];
+    areaTable->setHorizontalHeaderLabels(headers);
+    areaTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    areaTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    areaTable->setShowGrid(false);
+    areaTable->setAlternatingRowColors(true);
+    areaTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+    areaTable->horizontalHeader()->setHighlightSections(false);
+    areaTable->verticalHeader()->setDefaultSectionSize(areaTable->verticalHeader()->minimumSectionSize());
+    areaTable->verticalHeader()->hide();
+
+    /* Buttons */
+    QPushButton *csvButton = new QPushButton(tr("Export CSV"));
+    connect(csvButton, &QAbstractButton::clicked, this, &SavestateStatsWindow::slotExportCsv);
+
+    QPushButton *jsonButton = new QPushButton(tr("Export JSON"));
+    connect(jsonButton, &QAbstractButton::clicked, this, &SavestateStatsWindow::slotExportJson);
+
+    QDialogButtonBox *buttonBox = new QDialogButtonBox();
+    buttonBox->addButton(csvButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(jsonButton, QDialogButtonBox::ActionRole);
+
+    /* Layout */
+    QVBoxLayout *mainLayout = new QVBoxLayout;
+
+    mainLayout->addWidget(summaryLabel);
+    mainLayout->addWidget(areaTable, 1);
+    mainLayout->addWidget(buttonBox);
+
+    setLayout(mainLayout);
+}
+
+void SavestateStatsWindow::showEvent(QShowEvent *event)
+{
+    SaveStateList::setStatsEnabled(true);
+    QDialog::showEvent(event);
+}
+
+void SavestateStatsWindow::hideEvent(QHideEvent *event)
+{
+    SaveStateList::setStatsEnabled(false);
+    QDialog::hideEvent(event);
+}
+
+void SavestateStatsWindow::refresh()
+{
+    if (SaveStateList::statsCount() == stats_count)
+        return;
+
+    stats_count = SaveStateList::lastStats(stats, area_stats);
+
+    if (stats.slot < 0) {
+        summaryLabel->setText(tr("No savestate was saved or loaded while this window was open"));
+        areaTable->setRowCount(0);
+        return;
+    }
+
+    /* Sum the values of all areas */
+    SavestateAreaStats total = {};
+    for (const SavestateAreaStats& area : area_stats) {
+        total.pages_dirty += area.pages_dirty;
+        total.bytes += area.bytes;
+        total.scan_ns += area.scan_ns;
+        total.compress_ns += area.compress_ns;
+        total.io_ns += area.io_ns;
+    }
+
+    QString summary = QString("%1 state %2 in %3 ms: %4 areas, %5 pages, %6 bytes (ratio %7), scan %8 ms, compression %9 ms, I/O %10 ms")
+        .arg(stats.loading ? "Loaded" : "Saved")
+        .arg(stats.slot)
+        .arg(toMs(stats.total_ns), 0, 'f', 3)
+        .arg(area_stats.size())
+        .arg(total.pages_dirty)
+        .arg(total.bytes)
+        .arg(compressionRatio(total), 0, 'f', 2)
+        .arg(toMs(total.scan_ns), 0, 'f', 3)
+        .arg(toMs(total.compress_ns), 0, 'f', 3)
+        .arg(toMs(total.io_ns), 0, 'f', 3);
+
+    /* Forked and snapshot savestates are not processed by the game itself */
+    if (area_stats.empty())
+        summary += tr(" (no per-area statistics with this savestate mode)");
+    summaryLabel->setText(summary);
+
+    areaTable->setRowCount(area_stats.size());
+    for (int row = 0; row < static_cast<int>(area_stats.size()); row++) {
+        for (int column = 0; column < columnCount; column++) {
+            QTableWidgetItem *item = areaTable->item(row, column);
+            if (!item) {
+                item = new QTableWidgetItem();
+                areaTable->setItem(row, column, item);
+            }
+            item->setText(columnValue(area_stats[row], column));
+        }
+    }
+}
+
+QString SavestateStatsWindow::exportFilename(const QString& filter, const QString& extension)
+{
+    QString filename = QFileDialog::getSaveFileName(this, tr("Choose an export file"), context->gamepath.c_str(), filter);
+    if (filename.isNull())
+        return filename;
+
+    if (!filename.endsWith(extension))
+        filename += extension;
+
+    return filename;
+}
+
+void SavestateStatsWindow::slotExportCsv()
+{
+    QString filename = exportFilename(tr("CSV files (*.csv)"), ".csv");
+    if (filename.isNull())
+        return;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QMessageBox::warning(this, "Error", QString("Could not open %1").arg(filename));
+        return;
+    }
+
+    QTextStream out(&file);
+    for (int column = 0; column < columnCount; column++)
+        out << (column ? "," : "") << columnNames[column];
+    out << "\n";
+
+    for (const SavestateAreaStats& area : area_stats) {
+        for (int column = 0; column < columnCount; column++) {
+            QString value = columnValue(area, column);
+            /* Names may contain commas */
+            if (column == 2)
+                value = QString("\"%1\"").arg(value.replace("\"", "\"\""));
+            out << (column ? "," : "") << value;
+        }
+        out << "\n";
+    }
+}
+
+void SavestateStatsWindow::slotExportJson()
+{
+    QString filename = exportFilename(tr("JSON files (*.json)"), ".json");
+    if (filename.isNull())
+        return;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QMessageBox::warning(this, "Error", QString("Could not open %1").arg(filename));
+        return;
+    }
+
+    QJsonArray areas;
+    for (const SavestateAreaStats& area : area_stats) {
+        QJsonObject object;
+        object["address"] = columnValue(area, 0);
+        object["size"] = static_cast<double>(area.size);
+        object["name"] = QString(area.name);
+        object["skip"] = static_cast<bool>(area.skip);
+        object["pages"] = static_cast<double>(area.pages);
+        object["present"] = static_cast<double>(area.pages_present);
+        object["dirty"] = static_cast<double>(area.pages_dirty);
+        object["skipped"] = static_cast<double>(area.pages_skipped);
+        object["zero"] = static_cast<double>(area.pages_zero);
+        object["full"] = static_cast<double>(area.pages_full);
+        object["compressed"] = static_cast<double>(area.pages_compressed);
+        object["base"] = static_cast<double>(area.pages_base);
+        object["shared"] = static_cast<double>(area.pages_shared);
+        object["bytes"] = static_cast<double>(area.bytes);
+        object["ratio"] = compressionRatio(area);
+        object["scan_ms"] = toMs(area.scan_ns);
+        object["compress_ms"] = toMs(area.compress_ns);
+        object["io_ms"] = toMs(area.io_ns);
+        areas.append(object);
+    }
+
+    QJsonObject root;
+    root["slot"] = stats.slot;
+    root["loading"] = static_cast<bool>(stats.loading);
+    root["total_ms"] = toMs(stats.total_ns);
+    root["areas"] = areas;
+
+    file.write(QJsonDocument(root).toJson());
+}
+
+QSize SavestateStatsWindow::sizeHint() const
+{
+    return QSize(800, 600);
+}
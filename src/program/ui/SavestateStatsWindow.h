@@ -0,0 +1,70 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATESTATSWINDOW_H_INCLUDED
+#define LIBTAS_SAVESTATESTATSWINDOW_H_INCLUDED
+
+#include <QtWidgets/QDialog>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QTableWidget>
+#include <QtGui/QShowEvent>
+#include <QtGui/QHideEvent>
+#include <vector>
+#include <stdint.h>
+
+#include "../Context.h"
+#include "../../shared/SavestateStats.h"
+
+class SavestateStatsWindow : public QDialog {
+    Q_OBJECT
+
+public:
+    SavestateStatsWindow(Context *c, QWidget *parent = Q_NULLPTR);
+
+    QSize sizeHint() const override;
+
+protected:
+    /* Statistics are only received while the window is shown */
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private:
+    Context *context;
+
+    QLabel *summaryLabel;
+    QTableWidget *areaTable;
+
+    /* Statistics that are displayed */
+    SavestateStats stats;
+    std::vector<SavestateAreaStats> area_stats;
+    uint64_t stats_count = 0;
+
+    /* Ask a filename to export the statistics to */
+    QString exportFilename(const QString& filter, const QString& extension);
+
+public slots:
+    /* Update UI elements if new statistics were received */
+    void refresh();
+
+private slots:
+    void slotExportCsv();
+    void slotExportJson();
+};
+
+#endif
@@ -19,6 +19,8 @@
 
 #include "utils.h"
 #include <sys/stat.h>
+#include <ftw.h>
+#include <cstdio> // remove
 #include <cerrno> // errno
 #include <cstring> // strerror
 #include <iostream>
@@ -113,16 +115,30 @@ int create_dir(const std::string& path)
     return 0;
 }
 
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+int remove_dir(const std::string& path)
+{
+    /* Visit the content of directories before the directories themselves,
+     * and don't follow symbolic links */
+    return nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
 void remove_savestates(Context* context)
 {
     std::string savestateprefix = context->config.savestatedir + '/';
     savestateprefix += context->gamename;
-    for (int i=0; i<=10; i++) {
+    for (int i=0; i<context->config.sc.savestate_slots; i++) {
         std::string savestatepmpath = savestateprefix + ".state" + std::to_string(i) + ".pm";
         unlink(savestatepmpath.c_str());
         std::string savestatepspath = savestateprefix + ".state" + std::to_string(i) + ".p";
         unlink(savestatepspath.c_str());
     }
+    std::string pagestorepath = savestateprefix + ".pagestore";
+    unlink(pagestorepath.c_str());
 }
 
 int extractBinaryType(std::string path)
@@ -32,6 +32,9 @@ std::string realpath_nonexist(const std::string& path);
 /* Create a directory if it does not exist already */
 int create_dir(const std::string& path);
 
+/* Remove a directory and all its content */
+int remove_dir(const std::string& path);
+
 /* Remove savestate files */
 void remove_savestates(Context* context);
 
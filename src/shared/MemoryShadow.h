@@ -0,0 +1,52 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MEMORYSHADOW_H_INCLUDED
+#define LIBTAS_MEMORYSHADOW_H_INCLUDED
+
+#include <stdint.h>
+
+/*
+ * Layout of the memory shadow, a memfd mapped by both the game and the
+ * program. The program writes the addresses of the game pages it reads the
+ * most, and the game copies these pages into the shadow each time it enters
+ * a frame boundary. While the game is stopped, the program can then read them
+ * without any system call. It only uses fixed-size fields, so that it is
+ * identical for 32-bit and 64-bit games.
+ */
+struct MemoryShadowMapping {
+    static const int PAGES_MAX = 256;
+
+    /* Number of pages to copy, written by the program */
+    uint64_t page_count;
+
+    /* Incremented by the game each time the pages are copied */
+    uint64_t generation;
+
+    /* Address of each page to copy, sorted, written by the program */
+    uint64_t page_addr[PAGES_MAX];
+
+    /* Whether each page could be copied, written by the game */
+    uint8_t page_valid[PAGES_MAX];
+
+    /* Copied pages, aligned on a page boundary */
+    alignas(4096) char pages[PAGES_MAX][4096];
+};
+
+#endif
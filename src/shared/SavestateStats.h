@@ -0,0 +1,86 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SAVESTATESTATS_H_INCLUDED
+#define LIBTAS_SAVESTATESTATS_H_INCLUDED
+
+#include <stdint.h>
+
+/*
+ * Statistics of the last savestate that was saved or loaded, collected by the
+ * game for each memory area and displayed in the UI. Both structures are sent
+ * as is through the socket, so they only use fixed-size fields which are
+ * aligned the same way on 32-bit and 64-bit games.
+ */
+struct SavestateStats {
+    /* Slot of the savestate, or -1 if no savestate was processed yet */
+    int32_t slot = -1;
+
+    /* Was the savestate loaded (1) or saved (0) */
+    int32_t loading = 0;
+
+    /* Total time spent in the savestate, in nanoseconds */
+    uint64_t total_ns = 0;
+
+    /* Number of areas that follow */
+    uint64_t area_count = 0;
+};
+
+struct SavestateAreaStats {
+    uint64_t addr;
+    uint64_t size;
+
+    /* Number of pages of the area, and how many are mapped in memory */
+    uint64_t pages;
+    uint64_t pages_present;
+
+    /* Pages that were written to the savestate when saving, or read from a
+     * savestate file when loading */
+    uint64_t pages_dirty;
+
+    /* Pages by savestate flag */
+    uint64_t pages_skipped; // not mapped and not saved
+    uint64_t pages_zero;
+    uint64_t pages_full;
+    uint64_t pages_compressed; // alone or inside a compressed block
+    uint64_t pages_base; // identical to the base savestate
+    uint64_t pages_shared; // in the page store
+
+    /* Bytes written to the savestate files when saving, or bytes of page
+     * content read when loading */
+    uint64_t bytes;
+
+    /* Time spent in reading /proc/self/pagemap and classifying pages,
+     * in compressing or deduplicating pages (decompressing when loading),
+     * and in reading or writing savestate files, in nanoseconds */
+    uint64_t scan_ns;
+    uint64_t compress_ns;
+    uint64_t io_ns;
+
+    /* The area was not saved */
+    int32_t skip;
+
+    /* Flags of the area, see Area::AreaFlag */
+    int32_t flags;
+
+    /* Truncated name of the area */
+    char name[64];
+};
+
+#endif
@@ -232,11 +232,29 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
         SS_COMPRESSED = 0x08, /* Compress savestates */
         SS_PRESENT = 0x10, /* Skip unmapped pages */
         SS_FORK = 0x20, /* Use a forked process to save the state */
+        SS_BLOCKS = 0x40, /* Compress stored pages in blocks instead of individually */
+        SS_DEDUP = 0x80, /* Share identical pages between all savestates */
+        SS_LAZY = 0x100, /* Load savestate pages when they are first accessed */
+        SS_SNAPSHOT = 0x200, /* Keep savestates in stopped forked processes */
+        SS_ASYNC = 0x400, /* Write savestates to disk in a background thread */
     };
 
     /* Savestate settings */
     int savestate_settings = SS_COMPRESSED;
 
+    /* Number of threads used to compress savestates. Values below 2 disable
+     * parallel compression */
+    int savestate_threads = 1;
+
+    /* Number of savestate slots, including the base slot 0 and the
+     * backtrack slot 10. Slots above 10 are only used by lua scripts */
+    int savestate_slots = 11;
+
+    /* Maximum memory used by savestates stored in RAM or in processes, in
+     * bytes. The least recently used states that are not pinned are removed
+     * above it. 0 disables the limit */
+    int64_t savestate_budget = 0;
+
     /* Stacktrace hash to advance time */
     uint64_t busy_loop_hash = 0;
 
@@ -299,6 +317,10 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
 
     /* Call raise(SIGINT) in libtas::init */
     bool sigint_upon_launch = false;
+
+    /* Copy the memory pages read by the program into a shadow shared with
+     * the program at each frame. The shadow is only created at startup. */
+    bool memory_shadow = false;
 };
 
 #endif
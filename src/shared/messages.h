@@ -204,7 +204,7 @@ enum {
     MSGB_FPS,
 
     /*
-     * Send ramwatch string to display on OSD
+     * Send all ramwatch strings to display on OSD, separated by newlines
      * Argument: size_t (string length) then char[len]
      */
     MSGN_RAMWATCH,
@@ -299,6 +299,65 @@ enum {
      */
     MSGB_LUA_RESOLUTION,
 
+    /*
+     * Send to the game the path of the page store shared by all savestates
+     * Argument: size_t (string length) then char[len]
+     */
+    MSGN_PAGESTORE_PATH,
+
+    /*
+     * Ask the game for the memory used by the savestates stored in RAM or in
+     * processes
+     * Argument: none
+     */
+    MSGN_SAVESTATE_SIZES,
+
+    /*
+     * Send the memory used by the savestate of each slot
+     * Argument: int (slot count) then uint64_t[count]
+     */
+    MSGB_SAVESTATE_SIZES,
+
+    /*
+     * Ask the game to remove the savestate of a slot
+     * Argument: int (slot), then string (savestate path)
+     */
+    MSGN_FREE_SAVESTATE,
+
+    /*
+     * Ask the game for the statistics of the last savestate that was saved
+     * or loaded
+     * Argument: none
+     */
+    MSGN_SAVESTATE_STATS,
+
+    /*
+     * Send the statistics of the last savestate
+     * Argument: SavestateStats then SavestateAreaStats[area_count]
+     */
+    MSGB_SAVESTATE_STATS,
+
+    /*
+     * Clear the soft-dirty bits of the game memory, so that the ram search
+     * only reads the pages modified since then
+     * Argument: none
+     */
+    MSGN_CLEAR_SOFT_DIRTY,
+
+    /*
+     * Send if the soft-dirty bits were cleared. This is refused when
+     * incremental savestates rely on them
+     * Argument: bool
+     */
+    MSGB_CLEAR_SOFT_DIRTY,
+
+    /*
+     * Send the file descriptor of the memory shadow, so that the program can
+     * map it from /proc/pid/fd
+     * Argument: int
+     */
+    MSGB_MEMORY_SHADOW,
+
 };
 
 #endif
@@ -0,0 +1,206 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringtransport.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstring>
+#include <ctime>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/* Number of checks of the ring before sleeping, which lasts for some tens
+ * of microseconds. Frame boundary messages are usually answered within this
+ * delay, which avoids the cost of a futex sleep and wake. */
+#define RING_SPIN_COUNT 2000
+
+/* Interval at which a writer waiting for free space checks the other side */
+#define RING_ALIVE_CHECK_US 100000
+
+static inline void cpuRelax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+size_t ringsMappingSize(void)
+{
+    return (sizeof(RingPair) + 4095) & ~static_cast<size_t>(4095);
+}
+
+RingPair* createRings(int* fd)
+{
+#ifdef __linux__
+    int ring_fd = syscall(SYS_memfd_create, "libtasrings", 0);
+    if (ring_fd < 0)
+        return nullptr;
+
+    if (ftruncate(ring_fd, ringsMappingSize()) != 0) {
+        close(ring_fd);
+        return nullptr;
+    }
+
+    RingPair* rings = mapRings(ring_fd);
+    if (!rings) {
+        close(ring_fd);
+        return nullptr;
+    }
+
+    /* The memfd is zero-filled, which is the empty state of both rings */
+    *fd = ring_fd;
+    return rings;
+#else
+    return nullptr;
+#endif
+}
+
+RingPair* mapRings(int fd)
+{
+    void* addr = mmap(nullptr, ringsMappingSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    return static_cast<RingPair*>(addr);
+}
+
+void unmapRings(RingPair* rings)
+{
+    munmap(rings, ringsMappingSize());
+}
+
+#ifdef __linux__
+/* Futex calls are not private, because the words are shared between
+ * processes */
+static void futexWait(std::atomic<uint32_t>* word, uint32_t value, int timeout_us)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, value, (timeout_us < 0) ? nullptr : &ts, nullptr, 0);
+}
+
+static void futexWake(std::atomic<uint32_t>* word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+#endif
+
+/* Wait until `word` is different from `value`, for at most timeout_us
+ * microseconds. Returns if the value changed. */
+static bool waitChange(std::atomic<uint32_t>* word, uint32_t value, std::atomic<uint32_t>* waiting, int timeout_us)
+{
+    if (timeout_us == 0)
+        return word->load(std::memory_order_acquire) != value;
+
+    /* Spinning only prevents the other side from running on a single CPU */
+    static const int spin_count = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? RING_SPIN_COUNT : 0;
+
+    for (int i = 0; i < spin_count; i++) {
+        if (word->load(std::memory_order_acquire) != value)
+            return true;
+        cpuRelax();
+    }
+
+#ifdef __linux__
+    /* The other side checks our flag after updating the word, so either it
+     * sees the flag and wakes us, or we see the updated word here */
+    waiting->store(1);
+    if (word->load() == value)
+        futexWait(word, value, timeout_us);
+    waiting->store(0);
+#else
+    usleep(timeout_us);
+#endif
+
+    return word->load(std::memory_order_acquire) != value;
+}
+
+/* Signal the other side that `word` was updated, if it sleeps on it */
+static void signalChange(std::atomic<uint32_t>* word, std::atomic<uint32_t>* waiting)
+{
+#ifdef __linux__
+    if (waiting->load())
+        futexWake(word);
+#endif
+}
+
+bool ringWrite(Ring* ring, const void* data, unsigned int size, bool (*alive)(void))
+{
+    const char* in = static_cast<const char*>(data);
+
+    while (size > 0) {
+        uint32_t head = ring->head.load(std::memory_order_relaxed);
+        uint32_t tail = ring->tail.load(std::memory_order_acquire);
+        uint32_t space = RING_SIZE - (head - tail);
+
+        if (space == 0) {
+            if (!waitChange(&ring->tail, tail, &ring->writer_waiting, RING_ALIVE_CHECK_US) && !alive())
+                return false;
+            continue;
+        }
+
+        unsigned int len = (size < space) ? size : space;
+        uint32_t offset = head & (RING_SIZE - 1);
+        unsigned int first = (len < RING_SIZE - offset) ? len : RING_SIZE - offset;
+        memcpy(ring->data + offset, in, first);
+        memcpy(ring->data, in + first, len - first);
+
+        /* Sequentially consistent store, to be ordered with the read of the
+         * waiting flag */
+        ring->head.store(head + len);
+        signalChange(&ring->head, &ring->reader_waiting);
+
+        in += len;
+        size -= len;
+    }
+    return true;
+}
+
+unsigned int ringRead(Ring* ring, void* data, unsigned int size, int timeout_us)
+{
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t head = ring->head.load(std::memory_order_acquire);
+
+    if (head == tail) {
+        if (!waitChange(&ring->head, tail, &ring->reader_waiting, timeout_us))
+            return 0;
+        head = ring->head.load(std::memory_order_acquire);
+    }
+
+    uint32_t available = head - tail;
+    unsigned int len = (size < available) ? size : available;
+    uint32_t offset = tail & (RING_SIZE - 1);
+    unsigned int first = (len < RING_SIZE - offset) ? len : RING_SIZE - offset;
+    char* out = static_cast<char*>(data);
+    memcpy(out, ring->data + offset, first);
+    memcpy(out + first, ring->data, len - first);
+
+    ring->tail.store(tail + len);
+    signalChange(&ring->tail, &ring->writer_waiting);
+
+    return len;
+}
+
+bool ringWait(Ring* ring, int timeout_us)
+{
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    return waitChange(&ring->head, tail, &ring->reader_waiting, timeout_us);
+}
@@ -0,0 +1,75 @@
+/*
+    Copyright 2015-2020 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_RINGTRANSPORT_H_INCL
+#define LIBTAS_RINGTRANSPORT_H_INCL
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* Size of each ring in bytes, must be a power of two */
+#define RING_SIZE (256*1024)
+
+/* Single-producer single-consumer byte ring, located in memory shared by the
+ * game and the program. Positions are byte counters that wrap around, and
+ * are also used as futex words to sleep while waiting for data or space. */
+struct Ring {
+    alignas(64) std::atomic<uint32_t> head; // bytes written by the producer
+    std::atomic<uint32_t> reader_waiting; // the consumer sleeps on head
+    alignas(64) std::atomic<uint32_t> tail; // bytes read by the consumer
+    std::atomic<uint32_t> writer_waiting; // the producer sleeps on tail
+    alignas(64) char data[RING_SIZE];
+};
+
+/* Both directions of the connection */
+struct RingPair {
+    Ring to_program;
+    Ring to_game;
+};
+
+/* Create the shared memory holding both rings. Returns the rings and stores
+ * the file descriptor of the shared memory in fd, or returns nullptr if
+ * rings are not supported. */
+RingPair* createRings(int* fd);
+
+/* Map the rings created by the other side from the file descriptor */
+RingPair* mapRings(int fd);
+
+/* Unmap the rings */
+void unmapRings(RingPair* rings);
+
+/* Size of the mapping holding the rings */
+size_t ringsMappingSize(void);
+
+/* Write data to the ring, waiting for free space if needed. While waiting,
+ * `alive` is called regularly, and the write is aborted if it returns false.
+ * Returns false if the write was aborted. */
+bool ringWrite(Ring* ring, const void* data, unsigned int size, bool (*alive)(void));
+
+/* Read at most size bytes from the ring. If the ring is empty, wait at most
+ * timeout_us microseconds for data, by spinning shortly then sleeping.
+ * Returns the number of bytes read. */
+unsigned int ringRead(Ring* ring, void* data, unsigned int size, int timeout_us);
+
+/* Wait at most timeout_us microseconds for data to read in the ring.
+ * Returns if data is available. */
+bool ringWait(Ring* ring, int timeout_us);
+
+#endif
@@ -18,6 +18,7 @@
  */
 
 #include "sockethelpers.h"
+#include "ringtransport.h"
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <cstdlib>
@@ -27,6 +28,10 @@
 #include <vector>
 #include <mutex>
 #include <errno.h>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <poll.h>
 
 #ifdef SOCKET_LOG
 #include "lcf.h"
@@ -37,6 +42,9 @@
 
 #define SOCKET_FILENAME "/tmp/libTAS.socket"
 
+/* Environment variable used to pass the socket file to the game */
+#define SOCKET_ENV "LIBTAS_SOCKET_PATH"
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
@@ -46,23 +54,267 @@
 /* Socket to communicate between the program and the game */
 static int socket_fd = 0;
 
+/* Socket file of this instance */
+static char socket_filename[sizeof(sockaddr_un::sun_path)] = SOCKET_FILENAME;
+
 static std::mutex mutex;
 
+/* Sizes of the buffers of the connection */
+#define SEND_BUFFER_SIZE (64*1024)
+#define RECV_BUFFER_SIZE (64*1024)
+
+/* Data is sent when the buffer is full, when the other side must be waited
+ * for, or on explicit flush, and received by as large chunks as available.
+ * The buffers are located in a dedicated mapping that the game excludes
+ * from savestates: like the socket, they must not be restored to a
+ * previous state when loading a savestate. */
+struct SocketBuffers {
+    unsigned int send_size; // pending bytes to send
+    unsigned int recv_pos; // position of the next byte to receive
+    unsigned int recv_size; // received bytes in the buffer
+    bool send_failed; // an error occurred on the connection
+    uint64_t send_calls; // number of send() calls
+    uint64_t recv_calls; // number of recv() calls
+    char send_buf[SEND_BUFFER_SIZE];
+    char recv_buf[RECV_BUFFER_SIZE];
+};
+
+static SocketBuffers* buffers = nullptr;
+
+/* Transports negotiated after the connection. With rings, data goes through
+ * a pair of rings in memory shared by the game and the program, and the
+ * socket is only kept to detect when the other side is gone. */
+enum {
+    TRANSPORT_SOCKET = 0,
+    TRANSPORT_RINGS = 1,
+};
+
+static RingPair* rings = nullptr;
+static Ring* send_ring = nullptr;
+static Ring* recv_ring = nullptr;
+
+/* Interval at which a blocking receive on the rings checks the other side */
+#define PEER_CHECK_US 100000
+
+/* The receive lock may flush pending data, so it must be taken first */
+static std::mutex send_mutex;
+static std::mutex recv_mutex;
+
+static void initBuffers(void)
+{
+    if (buffers)
+        return;
+
+    /* Surround the mapping with guard pages, so that it never gets merged
+     * with a neighbour mapping and can be skipped when saving a state. */
+    size_t size = (sizeof(SocketBuffers) + 4095) & ~static_cast<size_t>(4095);
+    void* addr = mmap(nullptr, size + (2 * 4096), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Couldn't allocate socket buffers." << std::endl;
+        exit(-1);
+    }
+    addr = static_cast<char*>(addr) + 4096;
+    if (mprotect(addr, size, PROT_READ | PROT_WRITE) != 0) {
+        std::cerr << "Couldn't allocate socket buffers." << std::endl;
+        exit(-1);
+    }
+    buffers = static_cast<SocketBuffers*>(addr);
+}
+
+static void resetBuffers(void)
+{
+    buffers->send_size = 0;
+    buffers->recv_pos = 0;
+    buffers->recv_size = 0;
+    buffers->send_failed = false;
+}
+
+/* Game side of the transport negotiation: offer the rings to the program by
+ * sending the file descriptor of their shared memory */
+static void offerTransport(void)
+{
+    int ring_fd = -1;
+    RingPair* new_rings = createRings(&ring_fd);
+    int transport = new_rings ? TRANSPORT_RINGS : TRANSPORT_SOCKET;
+
+    struct iovec iov = {&transport, sizeof(int)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    if (new_rings) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &ring_fd, sizeof(int));
+    }
+
+    if (sendmsg(socket_fd, &msg, MSG_NOSIGNAL) != sizeof(int)) {
+        std::cerr << "Couldn't send the transport to the program." << std::endl;
+        exit(-1);
+    }
+
+    if (!new_rings)
+        return;
+
+    /* The mapping stays valid after closing the file descriptor */
+    close(ring_fd);
+
+    int accepted = 0;
+    if ((recv(socket_fd, &accepted, sizeof(int), MSG_WAITALL) == sizeof(int)) && accepted) {
+        rings = new_rings;
+        send_ring = &rings->to_program;
+        recv_ring = &rings->to_game;
+#ifdef SOCKET_LOG
+        libtas::debuglogstdio(LCF_SOCKET, "Using shared memory rings for the connection");
+#endif
+    }
+    else {
+        unmapRings(new_rings);
+    }
+}
+
+/* Program side of the transport negotiation */
+static void acceptTransport(bool allow_rings)
+{
+    int transport = TRANSPORT_SOCKET;
+    struct iovec iov = {&transport, sizeof(int)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(socket_fd, &msg, MSG_WAITALL) != sizeof(int)) {
+        std::cerr << "Couldn't receive the transport from the game." << std::endl;
+        return;
+    }
+
+    int ring_fd = -1;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+        memcpy(&ring_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    if (transport != TRANSPORT_RINGS)
+        return;
+
+    if (allow_rings && (ring_fd >= 0)) {
+        rings = mapRings(ring_fd);
+        if (rings) {
+            send_ring = &rings->to_game;
+            recv_ring = &rings->to_program;
+        }
+    }
+
+    if (ring_fd >= 0)
+        close(ring_fd);
+
+    int accepted = rings ? 1 : 0;
+    send(socket_fd, &accepted, sizeof(int), MSG_NOSIGNAL);
+}
+
+/* Check if the other side closed the connection. After the negotiation,
+ * nothing is sent over the socket when using rings, so any event means that
+ * the socket was closed */
+static bool peerAlive(void)
+{
+    struct pollfd pfd = {socket_fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+/* Send data using the negotiated transport, with the same return value as
+ * send() */
+static ssize_t transportSend(const void* buf, size_t len)
+{
+    if (rings) {
+        if (ringWrite(send_ring, buf, len, peerAlive))
+            return len;
+        errno = EPIPE;
+        return -1;
+    }
+
+    return send(socket_fd, buf, len, MSG_NOSIGNAL);
+}
+
+/* Receive data using the negotiated transport, with the same return value
+ * as recv() */
+static ssize_t transportRecv(void* buf, size_t len, bool blocking)
+{
+    if (rings) {
+        while (true) {
+            unsigned int ret = ringRead(recv_ring, buf, len, blocking ? PEER_CHECK_US : 0);
+            if (ret > 0)
+                return ret;
+
+            /* Non-blocking reads don't check the other side, so that they
+             * don't need any system call. A blocking read will notice. */
+            if (!blocking) {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            /* Data may have been written just before the other side left */
+            if (!peerAlive())
+                return ringRead(recv_ring, buf, len, 0);
+        }
+    }
+
+    return recv(socket_fd, buf, len, blocking ? 0 : MSG_DONTWAIT);
+}
+
+bool setSocketFilename(const char* filename)
+{
+    /* The file must fit in the address of the socket with its terminator */
+    size_t len = strlen(filename);
+    if (len >= sizeof(socket_filename))
+        return false;
+
+    memcpy(socket_filename, filename, len + 1);
+    return true;
+}
+
+const char* getSocketFilename(void)
+{
+    return socket_filename;
+}
+
+static struct sockaddr_un socketAddress(void)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+#if defined(__APPLE__) && defined(__MACH__)
+    addr.sun_len = sizeof(struct sockaddr_un);
+#endif
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_filename, strlen(socket_filename) + 1);
+    return addr;
+}
+
 int removeSocket(void) {
-    int ret = unlink(SOCKET_FILENAME);
+    int ret = unlink(socket_filename);
     if ((ret == -1) && (errno != ENOENT))
         return errno;
     return 0;
 }
 
-bool initSocketProgram(void)
+bool initSocketProgram(bool allow_rings)
 {
-#ifdef __unix__
-    const struct sockaddr_un addr = { AF_UNIX, SOCKET_FILENAME };
-#elif defined(__APPLE__) && defined(__MACH__)
-    const struct sockaddr_un addr = { sizeof(struct sockaddr_un), AF_UNIX, SOCKET_FILENAME };
-#endif
+    const struct sockaddr_un addr = socketAddress();
     socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    initBuffers();
 
     struct timespec tim = {0, 500L*1000L*1000L};
 
@@ -87,6 +339,8 @@ bool initSocketProgram(void)
     }
     std::cout << "Attempt " << retry + 1 << ": Connected." << std::endl;
 
+    resetBuffers();
+    acceptTransport(allow_rings);
     return true;
 }
 
@@ -96,16 +350,18 @@ bool initSocketGame(void)
      * the link is already done in another process of the game.
      * In this case, we just return immediately.
      */
+    const char* filename = getenv(SOCKET_ENV);
+    if (filename && !setSocketFilename(filename)) {
+        std::cerr << "Socket file " << filename << " is too long." << std::endl;
+        exit(-1);
+    }
+
     struct stat st;
-    int result = stat(SOCKET_FILENAME, &st);
+    int result = stat(socket_filename, &st);
     if (result == 0)
         return false;
 
-#ifdef __unix__
-    const struct sockaddr_un addr = { AF_UNIX, SOCKET_FILENAME };
-#elif defined(__APPLE__) && defined(__MACH__)
-    const struct sockaddr_un addr = { sizeof(struct sockaddr_un), AF_UNIX, SOCKET_FILENAME };
-#endif
+    const struct sockaddr_un addr = socketAddress();
     const int tmp_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (bind(tmp_fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(struct sockaddr_un)))
     {
@@ -136,12 +392,71 @@ bool initSocketGame(void)
 #endif
     
     close(tmp_fd);
+    initBuffers();
+    resetBuffers();
+    offerTransport();
     return true;
 }
 
+/* Send all pending data. Must be called with send_mutex locked */
+static int flushLocked(void)
+{
+    unsigned int pos = 0;
+    while (pos < buffers->send_size) {
+        ssize_t ret = transportSend(buffers->send_buf + pos, buffers->send_size - pos);
+        buffers->send_calls++;
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+#ifdef SOCKET_LOG
+            libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "send() returns -1 with error %s", strerror(errno));
+#else
+            std::cerr << "send() returns -1 with error " << strerror(errno) << std::endl;
+#endif
+            buffers->send_failed = true;
+            break;
+        }
+        pos += ret;
+    }
+
+    buffers->send_size = 0;
+    return buffers->send_failed ? -1 : 0;
+}
+
+int flushSocket(void)
+{
+    if (!buffers)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(send_mutex);
+    return flushLocked();
+}
+
+void getSocketStats(uint64_t* send_calls, uint64_t* recv_calls)
+{
+    *send_calls = buffers ? buffers->send_calls : 0;
+    *recv_calls = buffers ? buffers->recv_calls : 0;
+}
+
+bool isSocketBuffersArea(const void* addr, size_t size)
+{
+    if (rings && (addr == static_cast<void*>(rings)) && (size == ringsMappingSize()))
+        return true;
+
+    return buffers && (addr == static_cast<void*>(buffers)) && (size == ((sizeof(SocketBuffers) + 4095) & ~static_cast<size_t>(4095)));
+}
+
 void closeSocket(void)
 {
+    flushSocket();
     close(socket_fd);
+
+    if (rings) {
+        unmapRings(rings);
+        rings = nullptr;
+        send_ring = nullptr;
+        recv_ring = nullptr;
+    }
 }
 
 void lockSocket(void)
@@ -151,6 +466,9 @@ void lockSocket(void)
 
 void unlockSocket(void)
 {
+    /* Messages sent by other threads are not followed by a receive, so they
+     * are sent right away */
+    flushSocket();
     mutex.unlock();
 }
 
@@ -160,27 +478,37 @@ int sendData(const void* elem, unsigned int size)
     libtas::debuglogstdio(LCF_SOCKET, "Send socket data of size %u", size);
 #endif
 
-    ssize_t ret = 0;
-    do {
-        ret = send(socket_fd, elem, size, MSG_NOSIGNAL);
-    } while ((ret == -1) && (errno == EINTR));
+    std::lock_guard<std::mutex> lock(send_mutex);
 
-    if (ret == -1) {
-#ifdef SOCKET_LOG
-        libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "send() returns -1 with error %s", strerror(errno));
-#else
-        std::cerr << "send() returns -1 with error " << strerror(errno) << std::endl;
-#endif
+    if (buffers->send_size + size > SEND_BUFFER_SIZE)
+        flushLocked();
+
+    if (size <= SEND_BUFFER_SIZE) {
+        memcpy(buffers->send_buf + buffers->send_size, elem, size);
+        buffers->send_size += size;
     }
-    else if (ret != static_cast<ssize_t>(size)) {
+    else {
+        /* Too large for the buffer, send it directly */
+        unsigned int pos = 0;
+        while (pos < size) {
+            ssize_t ret = transportSend(static_cast<const char*>(elem) + pos, size - pos);
+            buffers->send_calls++;
+            if (ret == -1) {
+                if (errno == EINTR)
+                    continue;
 #ifdef SOCKET_LOG
-        libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "send() %u bytes instead of %u", ret, size);
+                libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "send() returns -1 with error %s", strerror(errno));
 #else
-        std::cerr << "send() " << ret << " bytes instead of " << size << std::endl;
+                std::cerr << "send() returns -1 with error " << strerror(errno) << std::endl;
 #endif
+                buffers->send_failed = true;
+                break;
+            }
+            pos += ret;
+        }
     }
-    
-    return ret;
+
+    return buffers->send_failed ? -1 : static_cast<int>(size);
 }
 
 int sendMessage(int message)
@@ -201,39 +529,97 @@ void sendString(const std::string& str)
     sendData(str.c_str(), str_size);
 }
 
+/* Move the received bytes to the beginning of the buffer. Must be called
+ * with recv_mutex locked */
+static void compactRecvBuffer(void)
+{
+    unsigned int available = buffers->recv_size - buffers->recv_pos;
+    if (available && buffers->recv_pos)
+        memmove(buffers->recv_buf, buffers->recv_buf + buffers->recv_pos, available);
+    buffers->recv_pos = 0;
+    buffers->recv_size = available;
+}
+
 int receiveData(void* elem, unsigned int size)
 {
 #ifdef SOCKET_LOG
     libtas::debuglogstdio(LCF_SOCKET, "Receive socket data of size %u", size);
 #endif
 
-    ssize_t ret = 0;
-    do {
-        ret = recv(socket_fd, elem, size, MSG_WAITALL);
-    } while ((ret == -1) && (errno == EINTR));
+    std::lock_guard<std::mutex> lock(recv_mutex);
+
+    char* out = static_cast<char*>(elem);
+    unsigned int received = 0;
+
+    /* Take what was already received */
+    unsigned int available = buffers->recv_size - buffers->recv_pos;
+    unsigned int len = (available < size) ? available : size;
+    memcpy(out, buffers->recv_buf + buffers->recv_pos, len);
+    buffers->recv_pos += len;
+    received += len;
+
+    if (received == size)
+        return size;
+
+    /* We are going to wait for the other side, which may be waiting for our
+     * pending data */
+    flushSocket();
+    buffers->recv_pos = 0;
+    buffers->recv_size = 0;
+
+    while (received < size) {
+        ssize_t ret;
+        unsigned int remaining = size - received;
+        if (remaining >= RECV_BUFFER_SIZE) {
+            /* Large data is received directly */
+            ret = transportRecv(out + received, remaining, true);
+            buffers->recv_calls++;
+            if (ret > 0)
+                received += ret;
+        }
+        else {
+            /* Get everything that is available */
+            ret = transportRecv(buffers->recv_buf, RECV_BUFFER_SIZE, true);
+            buffers->recv_calls++;
+            if (ret > 0) {
+                buffers->recv_size = ret;
+                len = (static_cast<unsigned int>(ret) < remaining) ? ret : remaining;
+                memcpy(out + received, buffers->recv_buf, len);
+                buffers->recv_pos = len;
+                received += len;
+            }
+        }
 
-    if (ret == -1) {
+        if ((ret == -1) && (errno == EINTR))
+            continue;
+
+        if (ret == -1) {
 #ifdef SOCKET_LOG
-        libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() returns -1 with error %s", strerror(errno));
+            libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() returns -1 with error %s", strerror(errno));
 #else
-        std::cerr << "recv() returns -1 with error " << strerror(errno) << std::endl;
+            std::cerr << "recv() returns -1 with error " << strerror(errno) << std::endl;
 #endif
-    }
-    else if (ret == 0) { // socket has been closed
+            return -1;
+        }
+
+        if (ret == 0) { // socket has been closed
 #ifdef SOCKET_LOG
-        libtas::debuglogstdio(LCF_SOCKET | LCF_WARNING, "recv() returns 0 -> socket closed");
+            libtas::debuglogstdio(LCF_SOCKET | LCF_WARNING, "recv() returns 0 -> socket closed");
 #else
-        std::cerr << "recv() returns 0 -> socket closed" << std::endl;
+            std::cerr << "recv() returns 0 -> socket closed" << std::endl;
 #endif
-    }
-    else if (ret != static_cast<ssize_t>(size)) {
+            if (received) {
 #ifdef SOCKET_LOG
-        libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() %u bytes instead of %u", ret, size);
+                libtas::debuglogstdio(LCF_SOCKET | LCF_ERROR, "recv() %u bytes instead of %u", received, size);
 #else
-        std::cerr << "recv() " << ret << " bytes instead of " << size << std::endl;
+                std::cerr << "recv() " << received << " bytes instead of " << size << std::endl;
 #endif
+            }
+            return received;
+        }
     }
-    return ret;
+
+    return size;
 }
 
 int receiveMessage()
@@ -255,20 +641,57 @@ int receiveMessage()
 int receiveMessageNonBlocking()
 {
     int msg;
-    int ret = recv(socket_fd, &msg, sizeof(int), MSG_WAITALL | MSG_DONTWAIT);
-    if (ret < 0)
-        return ret;
+    {
+        std::lock_guard<std::mutex> lock(recv_mutex);
+
+        if (buffers->recv_size - buffers->recv_pos < sizeof(int)) {
+            /* Nothing to process, so the other side must get our data */
+            flushSocket();
+
+            compactRecvBuffer();
+            ssize_t ret = transportRecv(buffers->recv_buf + buffers->recv_size, RECV_BUFFER_SIZE - buffers->recv_size, false);
+            buffers->recv_calls++;
+            if (ret < 0)
+                return ret;
+
+            /* Handle special case for closed socket */
+            if (ret == 0)
+                return -2;
+
+            buffers->recv_size += ret;
+            if (buffers->recv_size < sizeof(int))
+                return -1;
+        }
+
+        memcpy(&msg, buffers->recv_buf + buffers->recv_pos, sizeof(int));
+        buffers->recv_pos += sizeof(int);
+    }
+
 #ifdef SOCKET_LOG
     libtas::debuglogstdio(LCF_SOCKET, "Receive non-blocking socket message %d", msg);
 #endif
 
-    /* Handle special case for closed socket */
-    if (ret == 0)
-        return -2;
-
     return msg;
 }
 
+bool waitSocketData(int timeout_us)
+{
+    {
+        std::lock_guard<std::mutex> lock(recv_mutex);
+        if (buffers->recv_size > buffers->recv_pos)
+            return true;
+    }
+
+    /* The other side may be waiting for our pending data */
+    flushSocket();
+
+    if (rings)
+        return ringWait(recv_ring, timeout_us);
+
+    struct pollfd pfd = {socket_fd, POLLIN, 0};
+    return poll(&pfd, 1, (timeout_us + 999) / 1000) > 0;
+}
+
 std::string receiveString()
 {
     unsigned int str_size;
@@ -21,15 +21,29 @@
 #define LIBTAS_SOCKETHELPERS_H_INCL
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 
+/* Set the socket file of this instance, so that several instances can run
+ * concurrently. The program passes it to the game using the
+ * LIBTAS_SOCKET_PATH environment variable. Returns false if the path does
+ * not fit in a socket address. */
+bool setSocketFilename(const char* filename);
+
+/* Get the socket file of this instance */
+const char* getSocketFilename(void);
+
 /* Remove the socket file and return error */
 int removeSocket();
 
-/* Initiate a socket connection with the game */
-bool initSocketProgram(void);
+/* Initiate a socket connection with the game. The game may offer to
+ * exchange data through rings in shared memory instead of the socket, which
+ * is accepted if allow_rings is true. */
+bool initSocketProgram(bool allow_rings);
 
-/* Initiate a socket connection with libTAS */
+/* Initiate a socket connection with libTAS, and offer the rings transport
+ * when available. The socket file is taken from the LIBTAS_SOCKET_PATH
+ * environment variable if set. */
 bool initSocketGame(void);
 
 /* Close the socket connection */
@@ -38,11 +52,24 @@ void closeSocket(void);
 /* Lock access to socket */
 void lockSocket(void);
 
-/* Unlock access to socket */
+/* Unlock access to socket, and send pending data */
 void unlockSocket(void);
 
+/* Send all pending data. Data is buffered by the send functions, and only
+ * sent when the buffer is full, before waiting on a receive, or by this
+ * function. Returns -1 if the connection failed. */
+int flushSocket(void);
+
+/* Number of send and receive operations on the transport (send() and
+ * recv() calls, or ring accesses) since the connection started */
+void getSocketStats(uint64_t* send_calls, uint64_t* recv_calls);
+
+/* Is this memory area holding the socket buffers or the rings? */
+bool isSocketBuffersArea(const void* addr, size_t size);
+
 /* Send data over the socket. Data is stored at the beginning of
- * pointer elem, and has the specified size in bytes.
+ * pointer elem, and has the specified size in bytes. Returns -1 if the
+ * connection failed.
  */
 int sendData(const void* elem, unsigned int size);
 
@@ -63,6 +90,10 @@ int receiveMessage();
 /* Receive a message or returns -1 if no message available */
 int receiveMessageNonBlocking();
 
+/* Wait at most timeout_us microseconds for data to receive, while sending
+ * pending data. Returns if data is available. */
+bool waitSocketData(int timeout_us);
+
 /* Receive a string object from the socket. */
 std::string receiveString();
 
@@ -0,0 +1,114 @@
+#!/bin/bash
+# Run libTAS in batch mode with batchinstance.sh as instances, and check the
+# scheduling of the instances and the gathered report. Then verify a movie of
+# batchgame with the real libTAS, and check that it runs at maximum speed.
+#
+# Usage: ./batch.sh [path/to/libTAS]
+# An X display is needed, for example with xvfb-run.
+
+LIBTAS=${1:-../src/program/libTAS}
+if [ ! -x "$LIBTAS" ]; then
+    echo "libTAS not found at $LIBTAS"
+    exit 1
+fi
+
+export LIBTAS_REAL=$(realpath "$LIBTAS")
+export BATCH_TEST_DIR=$(mktemp -d)
+export BATCH_TEST_JOBS=2
+export XDG_DATA_HOME=$BATCH_TEST_DIR/data
+export XDG_CONFIG_HOME=$BATCH_TEST_DIR/config
+INSTANCE=$(pwd)/batchinstance.sh
+TMP=$BATCH_TEST_DIR
+
+status=0
+fail() {
+    echo "FAIL: $*"
+    status=1
+}
+
+for movie in ok1 desync1 crash1 ok2 hang1 ok3; do
+    touch "$TMP/$movie.ltm"
+    echo "$TMP/$movie.ltm" >> "$TMP/list"
+done
+
+"$INSTANCE" --batch "$TMP/list" --report "$TMP/report.json" --jobs $BATCH_TEST_JOBS --timeout 3 /bin/true
+
+[ -f "$TMP/collisions" ] && fail "instances ran in the same slot: $(cat "$TMP/collisions")"
+[ -f "$TMP/overflows" ] && fail "more than $BATCH_TEST_JOBS instances ran at once"
+
+python3 - "$TMP/report.json" <<'END' || status=1
+import json, os, sys
+report = json.load(open(sys.argv[1]))
+runs = {os.path.basename(run["movie"]): run for run in report["runs"]}
+errors = []
+def check(cond, msg):
+    if not cond:
+        errors.append(msg)
+
+summary = report["summary"]
+check(summary["runs"] == 6, "summary has %d runs" % summary["runs"])
+check(summary["completed"] == 4, "summary has %d completed runs" % summary["completed"])
+check(summary["desynced"] == 3, "summary has %d desynced runs" % summary["desynced"])
+check(summary["jobs"] == 2, "summary has %d jobs" % summary["jobs"])
+check(list(runs) == ["ok1.ltm", "desync1.ltm", "crash1.ltm", "ok2.ltm", "hang1.ltm", "ok3.ltm"], "runs are not in the order of the list")
+
+for name in ["ok1.ltm", "ok2.ltm", "ok3.ltm"]:
+    check(runs[name]["completed"] and not runs[name]["desync"], name + " should complete without desync")
+    check(runs[name]["exit_status"] == 0, name + " has exit status %d" % runs[name]["exit_status"])
+check(runs["desync1.ltm"]["desyncs"] == ["Desync at frame 10"], "desync1 does not report its desync")
+check(runs["crash1.ltm"]["desyncs"] == ["The game exited before the end of the movie"], "crash1 is not reported as exited")
+check(runs["hang1.ltm"]["desyncs"] == ["The instance was killed after 3 seconds"], "hang1 is not reported as killed")
+
+for error in errors:
+    print("FAIL: " + error)
+sys.exit(1 if errors else 0)
+END
+
+# Hashes are compared against a reference report
+echo "$TMP/ok1.ltm" > "$TMP/list2"
+echo "$TMP/ok2.ltm" >> "$TMP/list2"
+BATCH_TEST_SALT=changed "$INSTANCE" --batch "$TMP/list2" --report "$TMP/report2.json" --reference "$TMP/report.json" --jobs $BATCH_TEST_JOBS /bin/true
+[ $? -ne 0 ] || fail "runs with different hashes are not reported as desynced"
+python3 - "$TMP/report2.json" <<'END' || status=1
+import json, sys
+runs = json.load(open(sys.argv[1]))["runs"]
+if any(run["desyncs"] != ["The memory hash differs from the reference"] for run in runs):
+    print("FAIL: hash differences are not reported")
+    sys.exit(1)
+END
+
+"$INSTANCE" --batch "$TMP/list2" --report "$TMP/report3.json" --reference "$TMP/report.json" --jobs $BATCH_TEST_JOBS /bin/true
+[ $? -eq 0 ] || fail "runs with the same hashes are reported as desynced"
+
+# A movie verified by the real libTAS runs at maximum speed: 600 frames at
+# 60 fps last 10 seconds in real time, and must complete in much less
+GAME=$(pwd)/batchgame
+if [ -x "$GAME" ]; then
+    mkdir "$TMP/speed"
+    cat > "$TMP/speed/config.ini" <<END
+[General]
+frame_count=600
+framerate_num=60
+framerate_den=1
+mouse_support=false
+nb_controllers=0
+END
+    for i in $(seq 600); do echo "|K|"; done > "$TMP/speed/inputs"
+    tar -czf "$TMP/speed.ltm" -C "$TMP/speed" config.ini inputs
+
+    start=$(date +%s%N)
+    timeout 60 "$LIBTAS_REAL" --instance batchspeed --report "$TMP/speed.json" -r "$TMP/speed.ltm" "$GAME" > "$TMP/speed.log" 2>&1
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+
+    python3 -c 'import json, sys; sys.exit(0 if json.load(open(sys.argv[1]))["completed"] else 1)' "$TMP/speed.json" 2>/dev/null || fail "the movie was not verified: $(cat "$TMP/speed.log")"
+    [ $elapsed -lt 5000 ] || fail "verifying 10 seconds of movie took $elapsed ms"
+else
+    fail "batchgame not found, run make batchgame first"
+fi
+
+if [ $status -eq 0 ]; then
+    echo "Batch runs were scheduled and reported correctly"
+fi
+
+rm -rf "$TMP"
+exit $status
@@ -0,0 +1,53 @@
+#!/bin/bash
+# Stand-in for libTAS used by batch.sh. The batch runner is started through
+# this script, so that it starts this script for each instance instead of
+# libTAS. Instances write a report depending on the name of their movie:
+#   ok*: the movie completes
+#   desync*: the movie completes with a desync
+#   crash*: the instance exits without a report
+#   hang*: the instance never finishes
+
+if [[ " $* " == *" --batch "* ]]; then
+    exec -a "$0" "$LIBTAS_REAL" "$@"
+fi
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --instance) instance=$2; shift ;;
+        --report) report=$2; shift ;;
+        --read) movie=$2; shift ;;
+    esac
+    shift
+done
+
+# Check that no other instance runs in the same slot, and that no more than
+# the requested number of instances run at once
+if ! mkdir "$BATCH_TEST_DIR/running-$instance" 2>/dev/null; then
+    echo "$instance" >> "$BATCH_TEST_DIR/collisions"
+fi
+if [ $(ls -d "$BATCH_TEST_DIR"/running-* | wc -l) -gt $BATCH_TEST_JOBS ]; then
+    echo "$instance" >> "$BATCH_TEST_DIR/overflows"
+fi
+
+name=$(basename "$movie" .ltm)
+hash=$(printf '%016x' $(echo "$name$BATCH_TEST_SALT" | cksum | cut -d' ' -f1))
+
+case "$name" in
+    ok*)
+        desyncs='[]' ;;
+    desync*)
+        desyncs='["Desync at frame 10"]' ;;
+    crash*)
+        rmdir "$BATCH_TEST_DIR/running-$instance"
+        exit 1 ;;
+    hang*)
+        rmdir "$BATCH_TEST_DIR/running-$instance"
+        sleep 1000 ;;
+esac
+
+sleep 0.5
+cat > "$report" <<END
+{"movie": "$movie", "frames": 100, "movie_frames": 100, "completed": true, "ram_hash": "$hash", "desyncs": $desyncs}
+END
+rmdir "$BATCH_TEST_DIR/running-$instance"
+exit 0
@@ -0,0 +1,19 @@
+// Game started by instances.sh with: instancegame NAME GOFILE
+// It waits until GOFILE exists, so that all instances run at the same time
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+        return 1;
+
+    /* Sleeps of the game are handled by libTAS, so call the kernel directly */
+    struct timespec ts = {0, 10000000};
+    while (access(argv[2], F_OK) != 0)
+        syscall(SYS_nanosleep, &ts, NULL);
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#!/bin/sh
+# Start several libTAS instances at once with --instance, each running
+# instancegame, and check that their sockets and working directories don't
+# collide.
+#
+# Usage: ./instances.sh [path/to/libTAS] [count]
+# libtas.so is found like when running libTAS (next to it, or with
+# LIBTAS_SO_PATH). An X display is needed, for example with xvfb-run.
+
+LIBTAS=${1:-../src/program/libTAS}
+COUNT=${2:-4}
+GAME=$(pwd)/instancegame
+
+if [ ! -x "$LIBTAS" ]; then
+    echo "libTAS not found at $LIBTAS"
+    exit 1
+fi
+if [ ! -x "$GAME" ]; then
+    echo "instancegame not found, run make first"
+    exit 1
+fi
+
+TMP=$(mktemp -d)
+GO=$TMP/go
+export XDG_DATA_HOME=$TMP/data
+export XDG_CONFIG_HOME=$TMP/config
+
+status=0
+fail() {
+    echo "FAIL: $*"
+    status=1
+}
+
+pids=""
+for i in $(seq $COUNT); do
+    "$LIBTAS" -n --instance test$i "$GAME" test$i "$GO" > "$TMP/test$i.log" 2>&1 &
+    pids="$pids $!"
+done
+
+# Every game creates the socket of its instance
+for i in $(seq $COUNT); do
+    n=0
+    while [ ! -S /tmp/libTAS-test$i.socket ] && [ $n -lt 300 ]; do
+        sleep 0.1
+        n=$((n+1))
+    done
+    [ -S /tmp/libTAS-test$i.socket ] || fail "instance test$i did not create its socket"
+done
+
+# Each game was given the socket of its own instance
+games=0
+for pid in $(pgrep -x instancegame); do
+    name=$(tr '\0' '\n' < /proc/$pid/cmdline | sed -n 2p)
+    socket=$(tr '\0' '\n' < /proc/$pid/environ | sed -n 's/^LIBTAS_SOCKET_PATH=//p')
+    case "$name" in
+        test*)
+            games=$((games+1))
+            [ "$socket" = "/tmp/libTAS-$name.socket" ] || fail "instance $name uses socket $socket"
+            ;;
+    esac
+done
+[ $games -eq $COUNT ] || fail "$games games are running instead of $COUNT"
+
+# Each instance has its own working directories
+for i in $(seq $COUNT); do
+    for dir in movie states ramsearch; do
+        [ -d "$XDG_DATA_HOME/libTAS/instances/test$i/$dir" ] || fail "instance test$i has no $dir directory"
+    done
+done
+
+# Let the games quit, and don't wait more than 30 seconds for the instances
+touch "$GO"
+n=0
+while [ $n -lt 300 ]; do
+    running=0
+    for pid in $pids; do
+        kill -0 $pid 2>/dev/null && running=1
+    done
+    [ $running -eq 0 ] && break
+    sleep 0.1
+    n=$((n+1))
+done
+for pid in $pids; do
+    if kill -0 $pid 2>/dev/null; then
+        fail "instance with pid $pid did not quit"
+        kill $pid
+    fi
+done
+
+if [ $status -ne 0 ]; then
+    for i in $(seq $COUNT); do
+        echo "--- log of instance test$i"
+        cat "$TMP/test$i.log"
+    done
+else
+    echo "$COUNT instances ran concurrently without collision"
+fi
+
+rm -rf "$TMP"
+exit $status
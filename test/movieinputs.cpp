@@ -0,0 +1,189 @@
+// Round-trip test of the movie inputs between the binary and the text formats
+// Build with make movieinputs, and run ./movieinputs
+
+#include "../src/program/movie/MovieFileInputs.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#define FRAMES 5000
+
+static int failures = 0;
+
+static void check(bool cond, const char* msg)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", msg);
+        failures++;
+    }
+}
+
+/* Inputs that the text format can represent with the config of the test */
+static void generateInputs(std::vector<AllInputs>& inputs)
+{
+    static const uint32_t text_flags[] = {SingleInput::FLAG_RESTART,
+        SingleInput::FLAG_CONTROLLER1_ADDED, SingleInput::FLAG_CONTROLLER2_REMOVED};
+
+    srand(0);
+    AllInputs ai;
+    ai.emptyInputs();
+    for (int f = 0; f < FRAMES; f++) {
+        /* Inputs are held for a few frames, like in real movies */
+        if (rand() % 4 == 0) {
+            ai.emptyInputs();
+
+            /* Pressed keys are stored first */
+            int keys = rand() % 4;
+            for (int k = 0; k < keys; k++)
+                ai.keyboard[k] = 0x61 + rand() % 26;
+
+            ai.pointer_x = rand() % 640 - 100;
+            ai.pointer_y = rand() % 480;
+            ai.pointer_mode = (rand() % 2) ? SingleInput::POINTER_MODE_RELATIVE : SingleInput::POINTER_MODE_ABSOLUTE;
+            ai.pointer_mask = (rand() % 32) << SingleInput::POINTER_B1;
+
+            for (int joy = 0; joy < AllInputs::MAXJOYS; joy++) {
+                if (rand() % 2)
+                    continue;
+                for (int axis = 0; axis < AllInputs::MAXAXES; axis++)
+                    ai.controller_axes[joy][axis] = rand() % 65536 - 32768;
+                ai.controller_buttons[joy] = rand() % (1 << (SingleInput::BUTTON_DPAD_RIGHT + 1));
+            }
+
+            if (rand() % 8 == 0)
+                ai.flags = 1 << text_flags[rand() % 3];
+
+            /* The text format only stores a framerate that differs from the
+             * initial one */
+            if (rand() % 8 == 0) {
+                ai.framerate_num = 30;
+                ai.framerate_den = 1;
+            }
+        }
+        inputs.push_back(ai);
+    }
+}
+
+static bool sameInputs(const std::vector<AllInputs>& a, const std::vector<AllInputs>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t f = 0; f < a.size(); f++)
+        if (!(a[f] == b[f]) || (a[f].pointer_mode != b[f].pointer_mode))
+            return false;
+    return true;
+}
+
+static std::vector<AllInputs> loadInputs(Context* context)
+{
+    MovieFileInputs movie(context);
+    movie.framerate_num = 60;
+    movie.framerate_den = 1;
+    movie.load();
+    return movie.input_list;
+}
+
+static bool exists(const std::string& path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+int main()
+{
+    char dir[] = "/tmp/movieinputs.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    Context context;
+    context.config.tempmoviedir = dir;
+    context.config.sc.mouse_support = true;
+    context.config.sc.nb_controllers = AllInputs::MAXJOYS;
+    context.config.sc.variable_framerate = true;
+    std::string binary_file = context.config.tempmoviedir + "/inputs.bin";
+    std::string text_file = context.config.tempmoviedir + "/inputs";
+
+    std::vector<AllInputs> inputs;
+    generateInputs(inputs);
+
+    MovieFileInputs movie(&context);
+    movie.framerate_num = 60;
+    movie.framerate_den = 1;
+    movie.input_list = inputs;
+
+    /* Both formats are saved, and the binary inputs are read */
+    context.config.movie_text_inputs = true;
+    movie.save();
+    check(exists(binary_file) && exists(text_file), "binary and text inputs are not both saved");
+    check(sameInputs(loadInputs(&context), inputs), "binary inputs differ after saving with text inputs");
+
+    /* Text inputs alone */
+    unlink(binary_file.c_str());
+    check(sameInputs(loadInputs(&context), inputs), "text inputs differ");
+
+    /* Binary inputs alone */
+    context.config.movie_text_inputs = false;
+    movie.save();
+    check(exists(binary_file) && !exists(text_file), "text inputs are saved while disabled");
+    check(sameInputs(loadInputs(&context), inputs), "binary inputs differ");
+
+    /* Text inputs are saved when exporting, even if disabled */
+    movie.save(true);
+    check(exists(binary_file) && exists(text_file), "text inputs are not saved when exporting");
+    check(sameInputs(loadInputs(&context), inputs), "binary inputs differ after exporting");
+
+    /* Text inputs edited by hand are read instead of the binary inputs, when
+     * a frame is removed or when a frame is changed */
+    context.config.movie_text_inputs = true;
+    movie.save();
+    std::ifstream text_in(text_file);
+    std::stringstream text;
+    text << text_in.rdbuf();
+    text_in.close();
+    std::string content = text.str();
+
+    std::ofstream text_out(text_file, std::ofstream::trunc);
+    text_out << content.substr(0, content.rfind('\n', content.size() - 2) + 1);
+    text_out.close();
+    std::vector<AllInputs> edited = loadInputs(&context);
+    check(edited.size() == FRAMES - 1, "text inputs with a removed frame are not read");
+
+    text_out.open(text_file, std::ofstream::trunc);
+    text_out << "|K7a|" << content.substr(content.find('\n'));
+    text_out.close();
+    edited = loadInputs(&context);
+    check((edited.size() == FRAMES) && (edited[0].keyboard[0] == 0x7a) && (edited[1] == inputs[1]),
+        "text inputs with a changed frame are not read");
+
+    /* The number of frames of the binary inputs is bounded, even without
+     * any record */
+    movie.save();
+    unlink(text_file.c_str());
+    FILE* f = fopen(binary_file.c_str(), "r+b");
+    uint64_t frames = UINT32_MAX + 2ull;
+    check(f && (fseek(f, 16, SEEK_SET) == 0) && (fwrite(&frames, sizeof(frames), 1, f) == 1), "could not modify the binary inputs");
+    if (f)
+        fclose(f);
+    check(loadInputs(&context).empty(), "binary inputs with too many frames are read");
+
+    f = fopen(binary_file.c_str(), "r+b");
+    uint64_t header_counts[2] = {UINT32_MAX, 0};
+    check(f && (fseek(f, 16, SEEK_SET) == 0) && (fwrite(header_counts, sizeof(header_counts), 1, f) == 1), "could not modify the binary inputs");
+    if (f)
+        fclose(f);
+    check(loadInputs(&context).empty(), "binary inputs without records and with too many frames are read");
+
+    unlink(binary_file.c_str());
+    unlink(text_file.c_str());
+    rmdir(dir);
+
+    if (failures == 0)
+        printf("Binary and text inputs are consistent\n");
+    return failures ? 1 : 0;
+}
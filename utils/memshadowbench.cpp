@@ -0,0 +1,178 @@
+/* This code compares reading game memory with process_vm_readv and reading
+ * it from the memory shadow, using the memory access code of the program. A
+ * game process updates values spread over several pages at each frame, then
+ * stops at a frame boundary, where the program reads all values as RAM
+ * watches would. With the shadow, the game copies the pages read by the
+ * program into the shadow before stopping, as MemoryShadow::sync() does in
+ * the library. The time per read and the number of wrong values read are
+ * printed.
+ *
+ * The number of frames in thousands can be given as argument (20 by
+ * default).
+ *
+ * Can be compiled with: g++ -O2 -o memshadowbench memshadowbench.cpp ../src/program/ramsearch/MemAccess.cpp ../src/program/ramsearch/MemShadow.cpp -lpthread
+ */
+
+#include "../src/program/ramsearch/MemAccess.h"
+#include "../src/program/ramsearch/MemShadow.h"
+#include "../src/shared/MemoryShadow.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define VALUES 50
+#define VALUE_PAGES 16
+
+/* Values of the game, spread over several pages */
+static uint32_t* values[VALUES];
+
+static void initValues()
+{
+    void* addr = mmap(nullptr, VALUE_PAGES * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        exit(1);
+
+    for (int i = 0; i < VALUES; i++)
+        values[i] = reinterpret_cast<uint32_t*>(static_cast<char*>(addr) + ((i * 7) % VALUE_PAGES) * 4096 + (i * 68) % 4096);
+}
+
+/* Copy the pages requested by the program into the shadow */
+static void syncShadow(MemoryShadowMapping* shadow)
+{
+    uint64_t count = shadow->page_count;
+    if (count > MemoryShadowMapping::PAGES_MAX)
+        count = MemoryShadowMapping::PAGES_MAX;
+
+    struct iovec local[MemoryShadowMapping::PAGES_MAX], remote[MemoryShadowMapping::PAGES_MAX];
+    for (uint64_t i = 0; i < count; i++) {
+        local[i].iov_base = shadow->pages[i];
+        local[i].iov_len = 4096;
+        remote[i].iov_base = reinterpret_cast<void*>(static_cast<uintptr_t>(shadow->page_addr[i]));
+        remote[i].iov_len = 4096;
+    }
+
+    memset(shadow->page_valid, 0, count);
+    if (count && (process_vm_readv(getpid(), local, count, remote, count, 0) == static_cast<ssize_t>(count * 4096)))
+        memset(shadow->page_valid, 1, count);
+
+    shadow->generation++;
+}
+
+/* Game loop: update the values and stop at each frame boundary until the
+ * program resumes us */
+static void runGame(int shadow_fd, int stopped_fd, int resume_fd)
+{
+    MemoryShadowMapping* shadow = nullptr;
+    if (shadow_fd >= 0) {
+        void* addr = mmap(nullptr, sizeof(MemoryShadowMapping), PROT_READ | PROT_WRITE, MAP_SHARED, shadow_fd, 0);
+        if (addr == MAP_FAILED)
+            exit(1);
+        shadow = static_cast<MemoryShadowMapping*>(addr);
+    }
+
+    char c = 0;
+    for (uint32_t frame = 0; ; frame++) {
+        for (int i = 0; i < VALUES; i++)
+            *values[i] = frame * VALUES + i;
+
+        if (shadow)
+            syncShadow(shadow);
+
+        if ((write(stopped_fd, &c, 1) != 1) || (read(resume_fd, &c, 1) != 1))
+            return;
+    }
+}
+
+static void runBench(uint64_t frames, bool use_shadow)
+{
+    int shadow_fd = -1;
+    if (use_shadow) {
+        shadow_fd = syscall(SYS_memfd_create, "memoryshadow", 0);
+        if ((shadow_fd < 0) || (ftruncate(shadow_fd, sizeof(MemoryShadowMapping)) != 0)) {
+            printf("Could not create the memory shadow\n");
+            return;
+        }
+    }
+
+    int stopped[2], resume[2];
+    if ((pipe(stopped) != 0) || (pipe(resume) != 0))
+        exit(1);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(stopped[0]);
+        close(resume[1]);
+        runGame(shadow_fd, stopped[1], resume[0]);
+        exit(0);
+    }
+    close(stopped[1]);
+    close(resume[0]);
+
+    MemAccess::init(pid);
+    if (use_shadow)
+        MemShadow::init(pid, shadow_fd);
+
+    std::chrono::duration<double> elapsed(0);
+    uint64_t errors = 0;
+    char c = 0;
+
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        if (read(stopped[0], &c, 1) != 1)
+            break;
+
+        MemShadow::setValid(true);
+
+        uint32_t read_values[VALUES];
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < VALUES; i++)
+            MemAccess::read(&read_values[i], values[i], sizeof(uint32_t));
+        elapsed += std::chrono::steady_clock::now() - start;
+
+        for (int i = 0; i < VALUES; i++)
+            if (read_values[i] != frame * VALUES + i)
+                errors++;
+
+        MemShadow::update();
+        MemShadow::setValid(false);
+
+        if (write(resume[1], &c, 1) != 1)
+            break;
+    }
+
+    close(resume[1]);
+    close(stopped[0]);
+    waitpid(pid, nullptr, 0);
+
+    if (use_shadow) {
+        MemShadow::init(0, -1);
+        close(shadow_fd);
+    }
+
+    printf("%-18s %10.1f %12llu\n", use_shadow ? "memory shadow" : "process_vm_readv",
+        elapsed.count() * 1000000000 / (frames * VALUES), static_cast<unsigned long long>(errors));
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t frames = 20000;
+    if (argc > 1)
+        frames = strtoull(argv[1], nullptr, 10) * 1000;
+
+    /* Values are allocated before forking, so that they have the same
+     * addresses in the game */
+    initValues();
+
+    printf("%llu frames, %d values over %d pages\n", static_cast<unsigned long long>(frames), VALUES, VALUE_PAGES);
+    printf("%-18s %10s %12s\n", "read", "ns/read", "wrong values");
+    runBench(frames, false);
+    runBench(frames, true);
+    return 0;
+}
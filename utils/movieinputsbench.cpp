@@ -0,0 +1,124 @@
+/* This code compares the time to save and load the movie inputs in the text
+ * format and in the binary format, using the movie code of libTAS. Synthetic
+ * inputs with keys, mouse and controllers held for a few frames are saved
+ * with and without the text inputs, then loaded from the binary inputs
+ * (which checks that the text inputs were not edited), and from the text
+ * inputs alone. The timings and the size of the files are printed.
+ *
+ * The number of frames in thousands can be given as argument (1000 by
+ * default).
+ *
+ * Can be compiled with: g++ -O2 -std=c++17 -fPIC -o movieinputsbench movieinputsbench.cpp ../src/program/movie/MovieFileInputs.cpp ../src/shared/AllInputs.cpp ../src/shared/SingleInput.cpp -I../src/program $(pkg-config --cflags --libs Qt5Core sdl2) $(pkg-config --cflags lua54 || pkg-config --cflags lua53)
+ */
+
+#include "../src/program/movie/MovieFileInputs.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static double fileSize(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return 0;
+    return st.st_size / (1024.0 * 1024.0);
+}
+
+/* Inputs change every few frames, with a few keys, the mouse and sometimes
+ * a controller */
+static void generateInputs(std::vector<AllInputs>& inputs, size_t frames)
+{
+    srand(0);
+    AllInputs ai;
+    ai.emptyInputs();
+    for (size_t f = 0; f < frames; f++) {
+        if (rand() % 4 == 0) {
+            ai.emptyInputs();
+            int keys = rand() % 3;
+            for (int k = 0; k < keys; k++)
+                ai.keyboard[k] = 0x61 + rand() % 26;
+            ai.pointer_x = rand() % 640;
+            ai.pointer_y = rand() % 480;
+            ai.pointer_mask = (rand() % 4) << SingleInput::POINTER_B1;
+            if (rand() % 4 == 0) {
+                ai.controller_axes[0][0] = rand() % 65536 - 32768;
+                ai.controller_axes[0][1] = rand() % 65536 - 32768;
+                ai.controller_buttons[0] = rand() % (1 << (SingleInput::BUTTON_DPAD_RIGHT + 1));
+            }
+        }
+        inputs.push_back(ai);
+    }
+}
+
+static double loadTime(Context* context, size_t frames)
+{
+    MovieFileInputs movie(context);
+    auto start = std::chrono::steady_clock::now();
+    movie.load();
+    double time = seconds(start);
+    if (movie.nbFrames() != frames) {
+        fprintf(stderr, "Loaded %llu frames instead of %zu\n", static_cast<unsigned long long>(movie.nbFrames()), frames);
+        exit(1);
+    }
+    return time;
+}
+
+int main(int argc, char** argv)
+{
+    size_t frames = 1000 * 1000;
+    if (argc > 1)
+        frames = strtoull(argv[1], nullptr, 10) * 1000;
+
+    char dir[] = "/tmp/movieinputsbench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    Context context;
+    context.config.tempmoviedir = dir;
+    context.config.sc.mouse_support = true;
+    context.config.sc.nb_controllers = 1;
+    std::string binary_file = context.config.tempmoviedir + "/inputs.bin";
+    std::string text_file = context.config.tempmoviedir + "/inputs";
+
+    MovieFileInputs movie(&context);
+    generateInputs(movie.input_list, frames);
+
+    printf("%-8s %10s %10s %10s %10s\n", "inputs", "save s", "load s", "text MB", "binary MB");
+
+    /* Binary inputs only */
+    context.config.movie_text_inputs = false;
+    auto start = std::chrono::steady_clock::now();
+    movie.save();
+    double save_time = seconds(start);
+    double load_time = loadTime(&context, frames);
+    printf("%-8s %10.3f %10.3f %10.1f %10.1f\n", "binary", save_time, load_time, fileSize(text_file), fileSize(binary_file));
+
+    /* Both inputs, the binary ones are read after checking the text ones */
+    context.config.movie_text_inputs = true;
+    start = std::chrono::steady_clock::now();
+    movie.save();
+    save_time = seconds(start);
+    load_time = loadTime(&context, frames);
+    printf("%-8s %10.3f %10.3f %10.1f %10.1f\n", "both", save_time, load_time, fileSize(text_file), fileSize(binary_file));
+
+    /* Text inputs only, as read by previous versions */
+    unlink(binary_file.c_str());
+    load_time = loadTime(&context, frames);
+    printf("%-8s %10s %10.3f %10.1f %10.1f\n", "text", "-", load_time, fileSize(text_file), fileSize(binary_file));
+
+    unlink(text_file.c_str());
+    rmdir(dir);
+    return 0;
+}
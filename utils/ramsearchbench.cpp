@@ -0,0 +1,71 @@
+/* This code measures the throughput of the RAM search compare kernels, by
+ * scanning a synthetic buffer for each value type and compare operator.
+ * The buffer is scanned repeatedly until 4 GB were processed (or the number
+ * of GB given as argument), both against a constant value and against
+ * previous values.
+ *
+ * Can be compiled with: g++ -O2 -o ramsearchbench ramsearchbench.cpp ../src/program/ramsearch/CompareOperations.cpp
+ */
+
+#include "../src/program/ramsearch/CompareOperations.h"
+#include "../src/program/ramsearch/TypeIndex.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+#define BUFFER_SIZE 64*1024*1024
+#define CHUNK_SIZE 1024*1024
+
+static const char* typeNames[] = {"unsigned char", "char", "unsigned short", "short",
+    "unsigned int", "int", "unsigned long", "long", "float", "double"};
+static const int typeSizes[] = {1, 1, 2, 2, 4, 4, 8, 8, 4, 8};
+
+static const char* operatorNames[] = {"==", "!=", "<", ">", "<=", ">=", "different"};
+
+int main(int argc, char** argv)
+{
+    uint64_t total_size = 4ull * 1024 * 1024 * 1024;
+    if (argc > 1)
+        total_size = strtoull(argv[1], nullptr, 10) * 1024 * 1024 * 1024;
+
+    /* Memory with small values, so that every operator has some matches */
+    std::vector<uint8_t> memory(BUFFER_SIZE);
+    std::vector<uint8_t> old_memory(BUFFER_SIZE);
+    srand(0);
+    for (int i = 0; i < BUFFER_SIZE; i++) {
+        memory[i] = rand() % 4;
+        old_memory[i] = rand() % 4;
+    }
+
+    std::vector<uint64_t> mask(CHUNK_SIZE / 64);
+
+    printf("%-16s %-10s %12s %12s\n", "type", "operator", "value GB/s", "prev GB/s");
+
+    for (int type = RamUnsignedChar; type <= RamDouble; type++) {
+        int count = CHUNK_SIZE / typeSizes[type];
+        for (int op = 0; op <= static_cast<int>(CompareOperator::Different); op++) {
+            CompareOperations::init(type, static_cast<CompareOperator>(op), 1, 1);
+
+            double seconds[2];
+            for (int previous = 0; previous < 2; previous++) {
+                auto start = std::chrono::steady_clock::now();
+                for (uint64_t done = 0; done < total_size; done += CHUNK_SIZE) {
+                    uint64_t offset = done % BUFFER_SIZE;
+                    if (previous)
+                        CompareOperations::check_previous_chunk(&memory[offset], &old_memory[offset], count, mask.data());
+                    else
+                        CompareOperations::check_value_chunk(&memory[offset], count, mask.data());
+                }
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                seconds[previous] = elapsed.count();
+            }
+
+            printf("%-16s %-10s %12.2f %12.2f\n", typeNames[type], operatorNames[op],
+                total_size / seconds[0] / (1024*1024*1024), total_size / seconds[1] / (1024*1024*1024));
+        }
+    }
+
+    return 0;
+}
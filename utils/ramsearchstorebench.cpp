@@ -0,0 +1,135 @@
+/* This code compares the memory footprint of the RAM search result store
+ * against the previous storage in files, which wrote the address and the
+ * value of every result. Synthetic memory is scanned with an unknown value
+ * first scan, then with narrowing scans, and the size of both storages is
+ * printed after each scan, along with the time spent storing the results.
+ *
+ * The size of the memory in MB can be given as argument (256 by default).
+ *
+ * Can be compiled with: g++ -O2 -o ramsearchstorebench ramsearchstorebench.cpp ../src/program/ramsearch/ScanStore.cpp ../src/external/lz4.cpp
+ */
+
+#include "../src/program/ramsearch/ScanStore.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#define PAGE_SIZE 4096
+#define VALUE_SIZE 4
+#define VALUE_COUNT (PAGE_SIZE / VALUE_SIZE)
+
+/* Fill memory with small integers, with some zero pages and some repeated
+ * structures, and modify a part of it between scans */
+static void fillMemory(std::vector<int32_t>& memory, int seed)
+{
+    srand(seed);
+    size_t nb_pages = memory.size() / VALUE_COUNT;
+    for (size_t p = 0; p < nb_pages; p++) {
+        int32_t* page = &memory[p * VALUE_COUNT];
+        switch ((p * 7919) % 4) {
+            case 0:
+                memset(page, 0, PAGE_SIZE);
+                break;
+            case 1:
+                for (int i = 0; i < VALUE_COUNT; i++)
+                    page[i] = (i % 8) + (p % 16);
+                break;
+            default:
+                /* Only some of these values change between scans */
+                for (int i = 0; i < VALUE_COUNT; i++)
+                    if ((seed == 0) || (rand() % 8 == 0))
+                        page[i] = rand() % 256;
+                break;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t memory_size = 256ull * 1024 * 1024;
+    if (argc > 1)
+        memory_size = strtoull(argv[1], nullptr, 10) * 1024 * 1024;
+    size_t nb_pages = memory_size / PAGE_SIZE;
+
+    std::vector<int32_t> memory(nb_pages * VALUE_COUNT);
+    fillMemory(memory, 0);
+
+    printf("%-14s %14s %14s %14s %10s\n", "scan", "results", "files MB", "store MB", "store s");
+
+    std::vector<PageResults> results;
+    std::unique_ptr<ScanArena> arena;
+
+    static const char* scanNames[] = {"unknown", "unchanged", "unchanged", "equal to 42"};
+    for (int scan = 0; scan < 4; scan++) {
+        if (scan > 0)
+            fillMemory(memory, scan);
+
+        /* The store keeps every arena in memory, as with no budget */
+        std::unique_ptr<ScanArena> new_arena(new ScanArena("/tmp", 0));
+        std::vector<PageResults> new_results;
+        uint64_t count = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        size_t scan_pages = (scan == 0) ? nb_pages : results.size();
+        for (size_t r = 0; r < scan_pages; r++) {
+            const PageResults* old_page = (scan == 0) ? nullptr : &results[r];
+            size_t p = old_page ? (old_page->addr / PAGE_SIZE) : r;
+            const int32_t* page = &memory[p * VALUE_COUNT];
+
+            uint64_t matches[VALUE_COUNT / 64];
+            uint32_t page_count = 0;
+            if (scan == 0) {
+                page_count = VALUE_COUNT;
+            }
+            else {
+                int32_t old_values[VALUE_COUNT];
+                if (!loadPage(*old_page, reinterpret_cast<char*>(old_values)))
+                    return 1;
+
+                uint64_t old_matches[VALUE_COUNT / 64];
+                loadMatches(*old_page, VALUE_COUNT, old_matches);
+
+                memset(matches, 0, sizeof(matches));
+                for (int i = 0; i < VALUE_COUNT; i++) {
+                    bool match = (scan == 3) ? (page[i] == 42) : (page[i] == old_values[i]);
+                    if (!(old_matches[i / 64] & (1ull << (i % 64))))
+                        match = false;
+                    if (match) {
+                        matches[i / 64] |= 1ull << (i % 64);
+                        page_count++;
+                    }
+                }
+            }
+
+            if (page_count == 0)
+                continue;
+
+            PageResults page_results = storePage(*new_arena, p * PAGE_SIZE, reinterpret_cast<const char*>(page), matches, VALUE_COUNT, page_count);
+            if (page_results.count == 0) {
+                fprintf(stderr, "Could not store the results\n");
+                return 1;
+            }
+            new_results.push_back(page_results);
+            count += page_count;
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        results.swap(new_results);
+        arena.swap(new_arena);
+
+        /* The previous storage wrote the address and the value of each result */
+        uint64_t files_size = count * (sizeof(uintptr_t) + VALUE_SIZE);
+        uint64_t store_size = results.capacity() * sizeof(PageResults) + arena->memorySize() + arena->fileSize();
+
+        printf("%-14s %14llu %14.1f %14.1f %10.3f\n", scanNames[scan], static_cast<unsigned long long>(count),
+            files_size / (1024.0 * 1024.0), store_size / (1024.0 * 1024.0), elapsed.count());
+    }
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/* This code compares the two savestate formats for stored pages: each page
+ * compressed individually with a length prefix (STATEVERSION_PAGE), and pages
+ * compressed by blocks of STATEBLOCKPAGES pages with a block index
+ * (STATEVERSION_BLOCK). Synthetic game memory is saved in both formats into
+ * temporary files, then fully loaded back and accessed at random pages, and
+ * the compression ratio and timings are printed.
+ *
+ * The size of the memory in MB can be given as argument (256 by default).
+ *
+ * Can be compiled with: g++ -O2 -o savestatebench savestatebench.cpp ../src/external/lz4.cpp
+ */
+
+#include "../src/external/lz4.h"
+#include "../src/library/checkpoint/StateHeader.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace libtas;
+
+#define PAGE_SIZE 4096
+#define BLOCK_SIZE (STATEBLOCKPAGES * PAGE_SIZE)
+#define RANDOM_ACCESSES 10000
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/* Fill memory with pages looking like game data: arrays of small integers,
+ * floats, repeated structs, text and a few random pages */
+static void fillMemory(std::vector<char>& memory)
+{
+    srand(0);
+    size_t nb_pages = memory.size() / PAGE_SIZE;
+    for (size_t p = 0; p < nb_pages; p++) {
+        char* page = &memory[p * PAGE_SIZE];
+        switch (rand() % 6) {
+            case 0: {
+                int32_t* ints = reinterpret_cast<int32_t*>(page);
+                for (int i = 0; i < PAGE_SIZE / 4; i++)
+                    ints[i] = rand() % 100;
+                break;
+            }
+            case 1: {
+                float* floats = reinterpret_cast<float*>(page);
+                float f = static_cast<float>(rand() % 1000);
+                for (int i = 0; i < PAGE_SIZE / 4; i++)
+                    floats[i] = f + (i % 16) * 0.5f;
+                break;
+            }
+            case 2: {
+                char object[48];
+                for (int i = 0; i < 48; i++)
+                    object[i] = rand() % 4;
+                for (int i = 0; i < PAGE_SIZE; i++)
+                    page[i] = object[i % 48] + ((i / 48) % 3);
+                break;
+            }
+            case 3: {
+                static const char* text = "The quick brown fox jumps over the lazy dog. ";
+                size_t len = strlen(text);
+                for (int i = 0; i < PAGE_SIZE; i++)
+                    page[i] = text[(i + p) % len];
+                break;
+            }
+            case 4: {
+                memset(page, 0, PAGE_SIZE);
+                for (int i = 0; i < 64; i++)
+                    page[rand() % PAGE_SIZE] = rand();
+                break;
+            }
+            default:
+                for (int i = 0; i < PAGE_SIZE; i++)
+                    page[i] = rand();
+                break;
+        }
+    }
+}
+
+/* Per-page format: each page is stored as an int length followed by the
+ * compressed page, or as a full page if it does not compress. Flags are kept
+ * in memory, like the pagemap file. */
+static size_t savePages(const std::vector<char>& memory, int pfd, std::vector<char>& flags)
+{
+    size_t nb_pages = memory.size() / PAGE_SIZE;
+    char compressed[LZ4_COMPRESSBOUND(PAGE_SIZE)];
+    size_t size = 0;
+
+    for (size_t p = 0; p < nb_pages; p++) {
+        int compressed_size = LZ4_compress_default(&memory[p * PAGE_SIZE], compressed, PAGE_SIZE, LZ4_COMPRESSBOUND(PAGE_SIZE));
+        if (compressed_size != 0) {
+            flags[p] = 1;
+            if ((write(pfd, &compressed_size, sizeof(int)) != sizeof(int)) ||
+                (write(pfd, compressed, compressed_size) != compressed_size))
+                exit(1);
+            size += sizeof(int) + compressed_size;
+        }
+        else {
+            flags[p] = 0;
+            if (write(pfd, &memory[p * PAGE_SIZE], PAGE_SIZE) != PAGE_SIZE)
+                exit(1);
+            size += PAGE_SIZE;
+        }
+    }
+    return size;
+}
+
+/* Reach page `page` by reading the length prefixes of all previous pages,
+ * then load it. `offset` and `current` keep the position of the sequential
+ * walk between calls. */
+static void loadPage(int pfd, const std::vector<char>& flags, size_t page, size_t& current, off_t& offset, char* out)
+{
+    if (page < current) {
+        current = 0;
+        offset = 0;
+    }
+
+    int length = PAGE_SIZE;
+    while (true) {
+        if (flags[current]) {
+            if (pread(pfd, &length, sizeof(int), offset) != sizeof(int))
+                exit(1);
+            offset += sizeof(int);
+        }
+        else
+            length = PAGE_SIZE;
+
+        if (current == page)
+            break;
+        offset += length;
+        current++;
+    }
+
+    char compressed[LZ4_COMPRESSBOUND(PAGE_SIZE)];
+    if (flags[current]) {
+        if (pread(pfd, compressed, length, offset) != length)
+            exit(1);
+        if (LZ4_decompress_safe(compressed, out, length, PAGE_SIZE) != PAGE_SIZE)
+            exit(1);
+    }
+    else {
+        if (pread(pfd, out, PAGE_SIZE, offset) != PAGE_SIZE)
+            exit(1);
+    }
+    offset += length;
+    current++;
+}
+
+/* Block format: pages are compressed by blocks, and the block index is
+ * written in the pagemap file */
+static size_t saveBlocks(const std::vector<char>& memory, int pfd, int pmfd)
+{
+    size_t nb_pages = memory.size() / PAGE_SIZE;
+    std::vector<char> compressed(LZ4_COMPRESSBOUND(BLOCK_SIZE));
+    size_t size = 0;
+    off_t offset = 0;
+
+    for (size_t first = 0; first < nb_pages; first += STATEBLOCKPAGES) {
+        StateBlock entry;
+        entry.page_count = std::min<size_t>(STATEBLOCKPAGES, nb_pages - first);
+        entry.offset = offset;
+        entry.compressed_size = LZ4_compress_default(&memory[first * PAGE_SIZE], compressed.data(),
+            entry.page_count * PAGE_SIZE, compressed.size());
+        if ((write(pfd, compressed.data(), entry.compressed_size) != entry.compressed_size) ||
+            (write(pmfd, &entry, sizeof(StateBlock)) != sizeof(StateBlock)))
+            exit(1);
+        offset += entry.compressed_size;
+        size += entry.compressed_size + sizeof(StateBlock);
+    }
+    return size;
+}
+
+/* Load page `page` by reading its block index entry, and decompress its
+ * block unless it is the cached one */
+static void loadBlockPage(int pfd, int pmfd, size_t page, int& cached_block, char* cache, char* out)
+{
+    int block = page / STATEBLOCKPAGES;
+    if (block != cached_block) {
+        StateBlock entry;
+        if (pread(pmfd, &entry, sizeof(StateBlock), block * sizeof(StateBlock)) != sizeof(StateBlock))
+            exit(1);
+        static std::vector<char> compressed(LZ4_COMPRESSBOUND(BLOCK_SIZE));
+        if (pread(pfd, compressed.data(), entry.compressed_size, entry.offset) != entry.compressed_size)
+            exit(1);
+        if (LZ4_decompress_safe(compressed.data(), cache, entry.compressed_size, BLOCK_SIZE) != entry.page_count * PAGE_SIZE)
+            exit(1);
+        cached_block = block;
+    }
+    memcpy(out, cache + (page % STATEBLOCKPAGES) * PAGE_SIZE, PAGE_SIZE);
+}
+
+int main(int argc, char** argv)
+{
+    size_t memory_size = 256ull * 1024 * 1024;
+    if (argc > 1)
+        memory_size = strtoull(argv[1], nullptr, 10) * 1024 * 1024;
+    size_t nb_pages = memory_size / PAGE_SIZE;
+
+    std::vector<char> memory(nb_pages * PAGE_SIZE);
+    fillMemory(memory);
+    std::vector<char> loaded(memory.size());
+
+    std::vector<size_t> random_pages(RANDOM_ACCESSES);
+    for (int i = 0; i < RANDOM_ACCESSES; i++)
+        random_pages[i] = (static_cast<size_t>(rand()) * RAND_MAX + rand()) % nb_pages;
+
+    char pagespath[] = "/tmp/savestatebench.p.XXXXXX";
+    char pagemappath[] = "/tmp/savestatebench.pm.XXXXXX";
+    int pfd = mkstemp(pagespath);
+    int pmfd = mkstemp(pagemappath);
+    if ((pfd < 0) || (pmfd < 0)) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(pagespath);
+    unlink(pagemappath);
+
+    printf("%-8s %10s %10s %10s %14s\n", "format", "ratio", "save s", "load s", "random us");
+
+    /* Per-page format */
+    std::vector<char> flags(nb_pages);
+    auto start = std::chrono::steady_clock::now();
+    size_t size = savePages(memory, pfd, flags);
+    double save_time = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t current = 0;
+    off_t offset = 0;
+    for (size_t p = 0; p < nb_pages; p++)
+        loadPage(pfd, flags, p, current, offset, &loaded[p * PAGE_SIZE]);
+    double load_time = seconds(start);
+    if (memcmp(memory.data(), loaded.data(), memory.size()) != 0) {
+        fprintf(stderr, "Pages were not restored correctly\n");
+        return 1;
+    }
+
+    char page[PAGE_SIZE];
+    start = std::chrono::steady_clock::now();
+    for (size_t p : random_pages)
+        loadPage(pfd, flags, p, current, offset, page);
+    double random_time = seconds(start);
+
+    printf("%-8s %10.2f %10.3f %10.3f %14.1f\n", "page", static_cast<double>(memory.size()) / size,
+        save_time, load_time, random_time * 1000000 / RANDOM_ACCESSES);
+
+    /* Block format */
+    if ((ftruncate(pfd, 0) != 0) || (lseek(pfd, 0, SEEK_SET) != 0))
+        return 1;
+    memset(loaded.data(), 0, loaded.size());
+
+    start = std::chrono::steady_clock::now();
+    size = saveBlocks(memory, pfd, pmfd);
+    save_time = seconds(start);
+
+    std::vector<char> cache(BLOCK_SIZE);
+    int cached_block = -1;
+    start = std::chrono::steady_clock::now();
+    for (size_t p = 0; p < nb_pages; p++)
+        loadBlockPage(pfd, pmfd, p, cached_block, cache.data(), &loaded[p * PAGE_SIZE]);
+    load_time = seconds(start);
+    if (memcmp(memory.data(), loaded.data(), memory.size()) != 0) {
+        fprintf(stderr, "Blocks were not restored correctly\n");
+        return 1;
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (size_t p : random_pages)
+        loadBlockPage(pfd, pmfd, p, cached_block, cache.data(), page);
+    random_time = seconds(start);
+
+    printf("%-8s %10.2f %10.3f %10.3f %14.1f\n", "block", static_cast<double>(memory.size()) / size,
+        save_time, load_time, random_time * 1000000 / RANDOM_ACCESSES);
+
+    close(pfd);
+    close(pmfd);
+    return 0;
+}
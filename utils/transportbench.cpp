@@ -0,0 +1,206 @@
+/* This code measures the transport between the program and the game, using
+ * the socket code of libTAS. A game process and a program process exchange
+ * the messages of a typical frame boundary (framecount and time, fps, then
+ * inputs from the program) for a number of frames. Each transport is run
+ * with fresh processes, and the number of send() and recv() calls per frame
+ * of each side and the frame rate are printed.
+ *
+ * The transports are:
+ * - per-field sends: the socket is flushed after each message and field,
+ *   which emulates the send() per field used before the socket buffers,
+ * - buffered socket: all messages of a frame boundary are sent at once,
+ * - shared rings: the buffered messages go through the rings in shared
+ *   memory instead of the socket.
+ *
+ * With several CPUs, the game and the program are pinned to two different
+ * CPUs, and a ring reader spins shortly before sleeping on a futex. With a
+ * single CPU, spinning is disabled and readers sleep right away, so the
+ * rings must be measured on a machine with several CPUs to cover the spin
+ * path. The path in use is printed.
+ *
+ * The number of frames in thousands can be given as argument (20 by
+ * default).
+ *
+ * Can be compiled with: g++ -O2 -o transportbench transportbench.cpp ../src/shared/sockethelpers.cpp ../src/shared/ringtransport.cpp -lpthread
+ */
+
+#include "../src/shared/sockethelpers.h"
+#include "../src/shared/messages.h"
+#include "../src/shared/AllInputs.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+enum Transport {
+    PER_FIELD_SENDS,
+    BUFFERED_SOCKET,
+    SHARED_RINGS,
+    TRANSPORT_COUNT,
+};
+
+static const char* transportNames[] = {"per-field sends", "buffered socket", "shared rings"};
+
+static bool per_field = false;
+
+/* Run the calling process on a single CPU, if there are enough CPUs */
+static void pinToCpu(int cpu)
+{
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= cpu)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Send data, and send it right away when emulating per-field sends */
+static void sendField(const void* elem, unsigned int size)
+{
+    sendData(elem, size);
+    if (per_field)
+        flushSocket();
+}
+
+static void sendMessageField(int message)
+{
+    sendMessage(message);
+    if (per_field)
+        flushSocket();
+}
+
+static void runGame(uint64_t frames)
+{
+    if (!initSocketGame())
+        exit(1);
+
+    char inputs[sizeof(AllInputs)];
+    float fps = 60.0f, lfps = 59.9f;
+
+    for (uint64_t framecount = 0; framecount < frames; framecount++) {
+        sendMessageField(MSGB_FRAMECOUNT_TIME);
+        sendField(&framecount, sizeof(uint64_t));
+        uint64_t ticks_sec = framecount / 60;
+        sendField(&ticks_sec, sizeof(uint64_t));
+        uint64_t ticks_nsec = (framecount % 60) * 16666666;
+        sendField(&ticks_nsec, sizeof(uint64_t));
+
+        sendMessageField(MSGB_FPS);
+        sendField(&fps, sizeof(float));
+        sendField(&lfps, sizeof(float));
+
+        sendMessage(MSGB_START_FRAMEBOUNDARY);
+        flushSocket();
+
+        int message = receiveMessage();
+        while (message != MSGN_START_FRAMEBOUNDARY) {
+            if (message == MSGN_ALL_INPUTS)
+                receiveData(inputs, sizeof(inputs));
+            message = receiveMessage();
+        }
+    }
+
+    /* Print before quitting, so that the program prints after us */
+    uint64_t send_calls, recv_calls;
+    getSocketStats(&send_calls, &recv_calls);
+    printf("  game:    %5.2f send, %5.2f recv per frame\n",
+        static_cast<double>(send_calls) / frames, static_cast<double>(recv_calls) / frames);
+    fflush(stdout);
+
+    sendMessage(MSGB_QUIT);
+    closeSocket();
+}
+
+static void runProgram(uint64_t frames, bool allow_rings)
+{
+    if (!initSocketProgram(allow_rings))
+        exit(1);
+
+    char inputs[sizeof(AllInputs)] = {};
+    uint64_t framecount, ticks_sec, ticks_nsec;
+    float fps, lfps;
+
+    auto start = std::chrono::steady_clock::now();
+
+    int message = receiveMessage();
+    while ((message != MSGB_QUIT) && (message != -1)) {
+        switch (message) {
+            case MSGB_FRAMECOUNT_TIME:
+                receiveData(&framecount, sizeof(uint64_t));
+                receiveData(&ticks_sec, sizeof(uint64_t));
+                receiveData(&ticks_nsec, sizeof(uint64_t));
+                break;
+            case MSGB_FPS:
+                receiveData(&fps, sizeof(float));
+                receiveData(&lfps, sizeof(float));
+                break;
+            case MSGB_START_FRAMEBOUNDARY:
+                sendMessageField(MSGN_ALL_INPUTS);
+                sendField(inputs, sizeof(inputs));
+                sendMessage(MSGN_START_FRAMEBOUNDARY);
+                flushSocket();
+                break;
+        }
+        message = receiveMessage();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t send_calls, recv_calls;
+    getSocketStats(&send_calls, &recv_calls);
+    printf("  program: %5.2f send, %5.2f recv per frame\n",
+        static_cast<double>(send_calls) / frames, static_cast<double>(recv_calls) / frames);
+    printf("  %.1fk frames/s\n", frames / elapsed.count() / 1000);
+    fflush(stdout);
+    closeSocket();
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t frames = 20000;
+    if (argc > 1)
+        frames = strtoull(argv[1], nullptr, 10) * 1000;
+
+    std::string socket_file = "/tmp/libTAS-transportbench-" + std::to_string(getpid()) + ".socket";
+    setSocketFilename(socket_file.c_str());
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%llu frames, %ld CPUs: ring readers %s\n", static_cast<unsigned long long>(frames),
+        cpus, (cpus > 1) ? "spin then sleep, sides on CPUs 0 and 1" : "sleep without spinning");
+    fflush(stdout);
+
+    for (int transport = 0; transport < TRANSPORT_COUNT; transport++) {
+        per_field = (transport == PER_FIELD_SENDS);
+        printf("%s\n", transportNames[transport]);
+        fflush(stdout);
+
+        removeSocket();
+
+        /* Each side runs in a fresh process, so that the connection state
+         * and the call counters start from zero */
+        pid_t game = fork();
+        if (game == 0) {
+            pinToCpu(1);
+            runGame(frames);
+            exit(0);
+        }
+
+        pid_t program = fork();
+        if (program == 0) {
+            pinToCpu(0);
+            runProgram(frames, transport == SHARED_RINGS);
+            exit(0);
+        }
+
+        waitpid(game, nullptr, 0);
+        waitpid(program, nullptr, 0);
+    }
+
+    removeSocket();
+    return 0;
+}